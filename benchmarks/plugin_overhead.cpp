@@ -0,0 +1,340 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+// Measures the overhead added by the plugin layer on top of the solvers, running snopt7::evolve() and
+// worhp::evolve() against the fake snopt7_c and worhp libraries (so that the solver itself costs
+// next to nothing) on problems of increasing size, with dense or sparse gradients and with or without Hessians.
+//
+// Usage: plugin_overhead [max_nx] [repeats]
+//
+// The results are written to the standard output in the JSON Lines format, one object per line:
+//
+// - {"benchmark": "library_load", "solver": ..., "us": ...} is the latency of the first (cold) loading of
+//   the solver library, which is then cached by the library registry.
+// - {"benchmark": "evolve", "solver": ..., "nx": ..., ...} describes one problem configuration, with the
+//   median over the repetitions of:
+//   - "setup_us" and "setup_allocs", the time and the heap allocations from the call to evolve() to
+//     the first call to the UDP (library lookup, options, sparsity conversion, solver memory),
+//   - "overhead_us" and "allocs", the time and the heap allocations per fitness evaluation spent outside
+//     the UDP (callbacks, caches, the fake solver and the final reinsertion),
+//   - "fevals", "gevals" and "hevals", the number of UDP evaluations per evolve.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <pagmo/population.hpp>
+#include <pagmo/problem.hpp>
+#include <pagmo/types.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pagmo_plugins_nonfree/snopt7.hpp>
+#include <pagmo_plugins_nonfree/worhp.hpp>
+
+#include "alloc_counter.hpp"
+
+#if defined(_WIN32)
+#define SNOPT7C_LIB ".\\snopt7_c.dll"
+#define WORHP_LIB ".\\libworhp_c.dll"
+#elif defined(__APPLE__)
+#define SNOPT7C_LIB "./libsnopt7_c.dylib"
+#define WORHP_LIB "./libworhp_c.dylib"
+#else
+#define SNOPT7C_LIB "./libsnopt7_c.so"
+#define WORHP_LIB "./libworhp_c.so"
+#endif
+
+using namespace pagmo;
+using bench_clock = std::chrono::steady_clock;
+
+// Number of (inequality) constraints of the benchmark problem.
+constexpr vector_double::size_type nc = 5u;
+
+// Records what happens inside the UDP during one evolve.
+struct probe {
+    bool m_armed = false;
+    bool m_called = false;
+    bench_clock::time_point m_first_call;
+    unsigned long long m_first_call_allocs = 0u;
+    bench_clock::duration m_udp_time{0};
+    unsigned long long m_udp_allocs = 0u;
+    unsigned long long m_fevals = 0u;
+    unsigned long long m_gevals = 0u;
+    unsigned long long m_hevals = 0u;
+};
+static probe the_probe;
+
+// Scope of a UDP method: its time and allocations are not accounted to the plugin.
+class udp_scope
+{
+public:
+    explicit udp_scope(unsigned long long &n_evals)
+        : m_start(bench_clock::now()), m_allocs(ppnf_bench::n_allocs().load())
+    {
+        if (the_probe.m_armed) {
+            if (!the_probe.m_called) {
+                the_probe.m_called = true;
+                the_probe.m_first_call = m_start;
+                the_probe.m_first_call_allocs = m_allocs;
+            }
+            ++n_evals;
+        }
+    }
+    ~udp_scope()
+    {
+        if (the_probe.m_armed) {
+            the_probe.m_udp_time += bench_clock::now() - m_start;
+            the_probe.m_udp_allocs += ppnf_bench::n_allocs().load() - m_allocs;
+        }
+    }
+
+private:
+    bench_clock::time_point m_start;
+    unsigned long long m_allocs;
+};
+
+// The benchmark problem: minimise sum x_j^2 subject to nc linear constraints. With dense gradients each
+// constraint depends on all the variables, otherwise the i-th constraint depends on x_2i and x_2i+1 only.
+// The Hessian of the objective is diagonal, the ones of the (linear) constraints are empty.
+struct bench_udp {
+    vector_double::size_type m_nx = 10u;
+    bool m_dense = false;
+    bool m_hessians = false;
+
+    vector_double fitness(const vector_double &x) const
+    {
+        udp_scope scope(the_probe.m_fevals);
+        vector_double retval(1u + nc, 0.);
+        for (auto xj : x) {
+            retval[0] += xj * xj;
+        }
+        for (vector_double::size_type i = 0u; i < nc; ++i) {
+            if (m_dense) {
+                for (auto xj : x) {
+                    retval[i + 1u] += static_cast<double>(i + 1u) * xj;
+                }
+            } else {
+                retval[i + 1u] = x[2u * i] + x[2u * i + 1u];
+            }
+            retval[i + 1u] -= 1.;
+        }
+        return retval;
+    }
+    std::pair<vector_double, vector_double> get_bounds() const
+    {
+        return {vector_double(m_nx, -1.), vector_double(m_nx, 1.)};
+    }
+    vector_double::size_type get_nic() const
+    {
+        return nc;
+    }
+    bool has_gradient() const
+    {
+        return true;
+    }
+    sparsity_pattern gradient_sparsity() const
+    {
+        sparsity_pattern retval;
+        for (vector_double::size_type j = 0u; j < m_nx; ++j) {
+            retval.emplace_back(0u, j);
+        }
+        for (vector_double::size_type i = 0u; i < nc; ++i) {
+            if (m_dense) {
+                for (vector_double::size_type j = 0u; j < m_nx; ++j) {
+                    retval.emplace_back(i + 1u, j);
+                }
+            } else {
+                retval.emplace_back(i + 1u, 2u * i);
+                retval.emplace_back(i + 1u, 2u * i + 1u);
+            }
+        }
+        return retval;
+    }
+    vector_double gradient(const vector_double &x) const
+    {
+        udp_scope scope(the_probe.m_gevals);
+        vector_double retval;
+        retval.reserve(m_nx * (m_dense ? 1u + nc : 1u) + (m_dense ? 0u : 2u * nc));
+        for (auto xj : x) {
+            retval.push_back(2. * xj);
+        }
+        for (vector_double::size_type i = 0u; i < nc; ++i) {
+            retval.insert(retval.end(), m_dense ? m_nx : 2u, m_dense ? static_cast<double>(i + 1u) : 1.);
+        }
+        return retval;
+    }
+    bool has_hessians() const
+    {
+        return m_hessians;
+    }
+    std::vector<sparsity_pattern> hessians_sparsity() const
+    {
+        std::vector<sparsity_pattern> retval(1u + nc);
+        for (vector_double::size_type j = 0u; j < m_nx; ++j) {
+            retval[0].emplace_back(j, j);
+        }
+        return retval;
+    }
+    std::vector<vector_double> hessians(const vector_double &) const
+    {
+        udp_scope scope(the_probe.m_hevals);
+        std::vector<vector_double> retval(1u + nc);
+        retval[0].assign(m_nx, 2.);
+        return retval;
+    }
+};
+
+// One line of the results.
+struct evolve_result {
+    double m_setup_us = 0.;
+    double m_setup_allocs = 0.;
+    double m_overhead_us = 0.;
+    double m_allocs = 0.;
+    unsigned long long m_fevals = 0u;
+    unsigned long long m_gevals = 0u;
+    unsigned long long m_hevals = 0u;
+};
+
+double median(std::vector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2u];
+}
+
+double to_us(bench_clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+template <typename UDA>
+evolve_result run_evolves(const UDA &uda, const bench_udp &udp, unsigned repeats)
+{
+    population pop{udp, 1u, 42u};
+    std::vector<double> setup_us, setup_allocs, overhead_us, allocs;
+    evolve_result retval;
+    for (unsigned r = 0u; r < repeats; ++r) {
+        the_probe = probe{};
+        the_probe.m_armed = true;
+        const auto allocs0 = ppnf_bench::n_allocs().load();
+        const auto start = bench_clock::now();
+        pop = uda.evolve(std::move(pop));
+        const auto stop = bench_clock::now();
+        const auto allocs1 = ppnf_bench::n_allocs().load();
+        the_probe.m_armed = false;
+        if (!the_probe.m_called || !the_probe.m_fevals) {
+            continue;
+        }
+        const auto n = static_cast<double>(the_probe.m_fevals);
+        setup_us.push_back(to_us(the_probe.m_first_call - start));
+        setup_allocs.push_back(static_cast<double>(the_probe.m_first_call_allocs - allocs0));
+        overhead_us.push_back(to_us(stop - the_probe.m_first_call - the_probe.m_udp_time) / n);
+        allocs.push_back(static_cast<double>(allocs1 - the_probe.m_first_call_allocs - the_probe.m_udp_allocs) / n);
+        retval.m_fevals = the_probe.m_fevals;
+        retval.m_gevals = the_probe.m_gevals;
+        retval.m_hevals = the_probe.m_hevals;
+    }
+    if (!setup_us.empty()) {
+        retval.m_setup_us = median(setup_us);
+        retval.m_setup_allocs = median(setup_allocs);
+        retval.m_overhead_us = median(overhead_us);
+        retval.m_allocs = median(allocs);
+    }
+    return retval;
+}
+
+template <typename UDA>
+void print_library_load(const std::string &solver, const UDA &uda)
+{
+    const auto start = bench_clock::now();
+    uda.preload();
+    const auto stop = bench_clock::now();
+    std::cout << R"({"benchmark": "library_load", "solver": ")" << solver << R"(", "us": )" << to_us(stop - start)
+              << "}" << std::endl;
+}
+
+void print_evolve(const std::string &solver, const bench_udp &udp, unsigned repeats, const evolve_result &res)
+{
+    std::cout << R"({"benchmark": "evolve", "solver": ")" << solver << R"(", "nx": )" << udp.m_nx
+              << R"(, "nc": )" << nc << R"(, "gradient": ")" << (udp.m_dense ? "dense" : "sparse")
+              << R"(", "hessians": )" << (udp.m_hessians ? "true" : "false") << R"(, "repeats": )" << repeats
+              << R"(, "setup_us": )" << res.m_setup_us << R"(, "setup_allocs": )" << res.m_setup_allocs
+              << R"(, "overhead_us": )" << res.m_overhead_us << R"(, "allocs": )" << res.m_allocs
+              << R"(, "fevals": )" << res.m_fevals << R"(, "gevals": )" << res.m_gevals << R"(, "hevals": )"
+              << res.m_hevals << "}" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    const vector_double::size_type max_nx = argc > 1 ? std::stoul(argv[1]) : 100000u;
+    const unsigned repeats = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : 5u;
+
+    ppnf::snopt7 snopt7_uda{false, SNOPT7C_LIB};
+    snopt7_uda.set_integer_option("Major iterations limit", 100);
+    snopt7_uda.set_numeric_option("Major optimality tolerance", 1e-6);
+    ppnf::worhp worhp_uda{false, WORHP_LIB};
+    worhp_uda.set_integer_option("MaxIter", 100);
+    worhp_uda.set_numeric_option("TolOpti", 1e-6);
+
+    print_library_load("snopt7", snopt7_uda);
+    print_library_load("worhp", worhp_uda);
+
+    for (vector_double::size_type nx = 10u; nx <= max_nx; nx *= 10u) {
+        for (auto dense : {false, true}) {
+            for (auto hessians : {false, true}) {
+                const bench_udp udp{nx, dense, hessians};
+                // snopt7 does not use the Hessians.
+                if (!hessians) {
+                    print_evolve("snopt7", udp, repeats, run_evolves(snopt7_uda, udp, repeats));
+                }
+                print_evolve("worhp", udp, repeats, run_evolves(worhp_uda, udp, repeats));
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
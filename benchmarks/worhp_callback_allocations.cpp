@@ -0,0 +1,220 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+// Measures the overhead of the worhp user callbacks (UserF, UserG, UserDF, UserDG), and checks that no heap
+// allocation is performed per reverse communication iteration when the UDP provides the in-place methods (see
+// ppnf::register_inplace_udp()). The fake worhp library runs 10 iterations per evolve, each moving the decision
+// vector and asking for all the actions (fitness, constraints, gradients and hessians). The hessians of a pagmo
+// problem are always returned by value: the allocations made by the UDP to build them are not counted.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <pagmo/population.hpp>
+#include <pagmo/types.hpp>
+#include <utility>
+#include <vector>
+
+#include <pagmo_plugins_nonfree/inplace.hpp>
+#include <pagmo_plugins_nonfree/worhp.hpp>
+
+#include "alloc_counter.hpp"
+
+#if defined(_WIN32)
+#define WORHP_LIB ".\\libworhp_c.dll"
+#elif defined(__APPLE__)
+#define WORHP_LIB "./libworhp_c.dylib"
+#else
+#define WORHP_LIB "./libworhp_c.so"
+#endif
+
+using namespace pagmo;
+
+// Problem dimension and number of (inequality) constraints: the dense gradient has
+// (1 + nc) * nx = 10100 components.
+constexpr vector_double::size_type nx = 100u;
+constexpr vector_double::size_type nc = 100u;
+// The number of iterations of the fake worhp library per evolve.
+constexpr unsigned n_iter = 10u;
+
+// The number of allocations made by the UDPs to build their hessians.
+unsigned long long hessians_allocs = 0u;
+
+// Records the largest number of allocations observed between two consecutive fitness calls
+// (i.e., during one iteration of the reverse communication loop) within an evolve, ignoring the first
+// two calls (warm-up) and the allocations made to build the hessians.
+struct alloc_tracker {
+    unsigned long long m_last = 0u;
+    unsigned long long m_max = 0u;
+    unsigned long long m_calls = 0u;
+    void operator()()
+    {
+        const auto cur = ppnf_bench::n_allocs().load() - hessians_allocs;
+        if (m_calls > 1u) {
+            m_max = std::max(m_max, cur - m_last);
+        }
+        ++m_calls;
+        m_last = cur;
+    }
+};
+
+struct generic_udp {
+    static alloc_tracker tracker;
+    vector_double fitness(const vector_double &x) const
+    {
+        tracker();
+        vector_double retval(1u + nc);
+        fill_fitness(x, retval.data());
+        return retval;
+    }
+    vector_double gradient(const vector_double &x) const
+    {
+        vector_double retval((1u + nc) * nx);
+        fill_gradient(x, retval.data());
+        return retval;
+    }
+    bool has_gradient() const
+    {
+        return true;
+    }
+    // The objective has a constant diagonal hessian, the constraints are linear.
+    std::vector<vector_double> hessians(const vector_double &) const
+    {
+        const auto start = ppnf_bench::n_allocs().load();
+        std::vector<vector_double> retval(1u + nc);
+        retval[0].assign(nx, 2.);
+        hessians_allocs += ppnf_bench::n_allocs().load() - start;
+        return retval;
+    }
+    std::vector<sparsity_pattern> hessians_sparsity() const
+    {
+        std::vector<sparsity_pattern> retval(1u + nc);
+        for (vector_double::size_type j = 0u; j < nx; ++j) {
+            retval[0].emplace_back(j, j);
+        }
+        return retval;
+    }
+    vector_double::size_type get_nic() const
+    {
+        return nc;
+    }
+    std::pair<vector_double, vector_double> get_bounds() const
+    {
+        return {vector_double(nx, -1.), vector_double(nx, 1.)};
+    }
+    static void fill_fitness(const vector_double &x, double *f)
+    {
+        f[0] = 0.;
+        for (auto xi : x) {
+            f[0] += xi * xi;
+        }
+        for (vector_double::size_type i = 0u; i < nc; ++i) {
+            f[i + 1u] = x[i % nx] - 0.5;
+        }
+    }
+    static void fill_gradient(const vector_double &x, double *g)
+    {
+        std::fill(g, g + (1u + nc) * nx, 0.);
+        for (vector_double::size_type j = 0u; j < nx; ++j) {
+            g[j] = 2. * x[j];
+        }
+        for (vector_double::size_type i = 0u; i < nc; ++i) {
+            g[(i + 1u) * nx + i % nx] = 1.;
+        }
+    }
+};
+alloc_tracker generic_udp::tracker;
+
+struct inplace_udp : generic_udp {
+    static alloc_tracker tracker;
+    vector_double fitness(const vector_double &x) const
+    {
+        vector_double retval(1u + nc);
+        fill_fitness(x, retval.data());
+        return retval;
+    }
+    void fitness_inplace(const vector_double &x, double *f) const
+    {
+        tracker();
+        fill_fitness(x, f);
+    }
+    void gradient_inplace(const vector_double &x, double *g) const
+    {
+        fill_gradient(x, g);
+    }
+};
+alloc_tracker inplace_udp::tracker;
+
+template <typename UDP>
+double run(unsigned n_evolves)
+{
+    ppnf::worhp uda{false, WORHP_LIB};
+    population pop{UDP{}, 1u, 42u};
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0u; i < n_evolves; ++i) {
+        UDP::tracker.m_calls = 0u;
+        pop = uda.evolve(pop);
+    }
+    const auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(stop - start).count() / (n_evolves * n_iter);
+}
+
+int main()
+{
+    const unsigned n_evolves = 100u;
+    ppnf::register_inplace_udp<inplace_udp>();
+
+    const auto t_generic = run<generic_udp>(n_evolves);
+    const auto t_inplace = run<inplace_udp>(n_evolves);
+
+    std::cout << "iteration time (us), generic path:  " << t_generic << '\n';
+    std::cout << "iteration time (us), in-place path: " << t_inplace << '\n';
+    std::cout << "max allocations per iteration, generic path:  " << generic_udp::tracker.m_max << '\n';
+    std::cout << "max allocations per iteration, in-place path: " << inplace_udp::tracker.m_max << '\n';
+
+    // The in-place path must not allocate after warm-up.
+    return inplace_udp::tracker.m_max == 0u ? EXIT_SUCCESS : EXIT_FAILURE;
+}
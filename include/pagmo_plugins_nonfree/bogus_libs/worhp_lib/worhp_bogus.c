@@ -5,12 +5,16 @@
 
 #include "worhp_bogus.h"
 
+// The print function set by SetWorhpPrint.
+static worhp_print_t worhp_print = NULL;
+
 inline double closed_interval_rand(double x0, double x1)
 {
     return x0 + (x1 - x0) * rand() / ((double)RAND_MAX);
 }
 
 void ReadParams(int *a, const char b[], Params *c) {}
+void InitParams(int *a, Params *c) {}
 void WorhpPreInit(OptVar *o, Workspace *w, Params *p, Control *c) {}
 void WorhpInit(OptVar *o, Workspace *w, Params *p, Control *c)
 {
@@ -33,6 +37,7 @@ void WorhpInit(OptVar *o, Workspace *w, Params *p, Control *c)
     w->DF.NeedStructure = false;
     w->DG.NeedStructure = false;
     w->HM.NeedStructure = false;
+    w->NLP_X = NULL; // set by WorhpRestart
     w->ScaleObj = 1;
     c->status = 0; // to ensure it will enter the main loop in worhp.hpp
     srand((unsigned int)(time(NULL)));
@@ -45,9 +50,22 @@ void DoneUserAction(Control *a, int b) {}
 void IterationOutput(OptVar *o, Workspace *w, Params *p, Control *c) {}
 void Worhp(OptVar *o, Workspace *w, Params *p, Control *c)
 {
+    int j;
+    if (c->status == 0) {
+        // The first iterate is the starting point (the one WorhpRestart was given, on restart).
+        c->status = 100;
+        if (w->NLP_X) {
+            for (j = 0; j < o->n; ++j) {
+                o->X[j] = w->NLP_X[j];
+            }
+        }
+        return;
+    }
     c->status = c->status + 100; // this will make it so after ten calls it concludes.
+    if (worhp_print) {
+        worhp_print(1, "Bogus WORHP iteration.");
+    }
     // Random vector
-    int j;
     for (j = 0; j < o->n; ++j) {
         o->X[j] = closed_interval_rand(o->XL[j], o->XU[j]);
     }
@@ -90,8 +108,21 @@ void WorhpFree(OptVar *o, Workspace *w, Params *p, Control *c)
     free(w->HM.row);
     free(w->HM.col);
     free(w->HM.val);
+    free(w->NLP_X);
 }
 void WorhpFidif(OptVar *o, Workspace *w, Params *p, Control *c) {}
+void WorhpRestart(OptVar *o, Workspace *w, Params *p, Control *c)
+{
+    int j;
+    // The starting point is taken from X, projected within the bounds.
+    if (!w->NLP_X) {
+        w->NLP_X = calloc(o->n, sizeof(double));
+    }
+    for (j = 0; j < o->n; ++j) {
+        w->NLP_X[j] = o->X[j] < o->XL[j] ? o->XL[j] : (o->X[j] > o->XU[j] ? o->XU[j] : o->X[j]);
+    }
+    c->status = 0; // to ensure it will enter the main loop again
+}
 bool WorhpSetBoolParam(Params *p, const char *stropt, bool b)
 {
     char *invalid;
@@ -108,9 +139,12 @@ bool WorhpSetIntParam(Params *p, const char *stropt, int b)
     invalid = "invalid_integer_option";
     if (strcmp(stropt, invalid) == 0) {
         return 0;
-    } else {
-        return 1;
     }
+    // The BFGS method is stored, so that the value used by a run can be checked.
+    if (strcmp(stropt, "BFGSmethod") == 0) {
+        p->BFGSmethod = b;
+    }
+    return 1;
 }
 bool WorhpSetDoubleParam(Params *p, const char *stropt, double b)
 {
@@ -122,7 +156,14 @@ bool WorhpSetDoubleParam(Params *p, const char *stropt, double b)
         return 1;
     }
 }
-void SetWorhpPrint(worhp_print_t l1) {}
+void SetWorhpPrint(worhp_print_t l1)
+{
+    worhp_print = l1;
+}
+void WorhpDefaultPrintFunction(int mode, const char *message)
+{
+    printf("%s\n", message);
+}
 
 void WorhpVersion(int *major, int *minor, char patch[PATCH_STRING_LENGTH])
 {
@@ -0,0 +1,190 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_BATCH_HPP
+#define PPNF_DETAIL_BATCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <boost/any.hpp>
+#include <cstddef>
+#include <exception>
+#include <numeric>
+#include <pagmo/exceptions.hpp>
+#include <pagmo/population.hpp>
+#include <pagmo/problem.hpp>
+#include <pagmo/threading.hpp>
+#include <pagmo/types.hpp>
+#include <pagmo/utils/constrained.hpp>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ppnf
+{
+namespace detail
+{
+// Selects the (at most) k individuals optimised by a batch evolve, according to the selection policy sel of
+// pagmo::not_population_based: the k best, the k worst, k random ones (without repetitions) or the k consecutive
+// ones starting from the index sel.
+template <typename RandomEngine>
+inline std::vector<pagmo::population::size_type> select_batch(const pagmo::population &pop, const boost::any &sel,
+                                                              unsigned k, RandomEngine &e)
+{
+    using size_type = pagmo::population::size_type;
+    const auto n = std::min(static_cast<size_type>(k), pop.size());
+    std::vector<size_type> retval;
+    if (const auto idx = boost::any_cast<size_type>(&sel)) {
+        if (*idx >= pop.size()) {
+            pagmo_throw(std::invalid_argument, "Cannot select the individual at index " + std::to_string(*idx)
+                                                   + " for evolution: the population has a size of only "
+                                                   + std::to_string(pop.size()));
+        }
+        for (size_type i = *idx; i < std::min(*idx + n, pop.size()); ++i) {
+            retval.push_back(i);
+        }
+        return retval;
+    }
+    const auto &policy = boost::any_cast<const std::string &>(sel);
+    if (policy == "random") {
+        retval.resize(pop.size());
+        std::iota(retval.begin(), retval.end(), size_type(0));
+        std::shuffle(retval.begin(), retval.end(), e);
+    } else {
+        const auto &prob = pop.get_problem();
+        retval = pagmo::sort_population_con(pop.get_f(), prob.get_nec(), prob.get_c_tol());
+        if (policy == "worst") {
+            std::reverse(retval.begin(), retval.end());
+        }
+    }
+    retval.resize(n);
+    return retval;
+}
+
+// Runs f(i, t) for i in [0, n), on n_threads threads (or sequentially if n_threads is one), t being the index in
+// [0, n_threads) of the thread running f. The calling thread takes part in the work as thread 0, so that
+// n_threads - 1 threads are started. The exceptions thrown by f are captured and the first one is rethrown once all
+// the threads have been joined.
+template <typename F>
+inline void parallel_for(std::size_t n, std::size_t n_threads, const F &f)
+{
+    std::vector<std::exception_ptr> eptrs(n);
+    std::atomic<std::size_t> next{0u};
+    auto worker = [&](std::size_t t) {
+        for (auto i = next++; i < n; i = next++) {
+            try {
+                f(i, t);
+            } catch (...) {
+                eptrs[i] = std::current_exception();
+            }
+        }
+    };
+    if (n_threads <= 1u) {
+        worker(0u);
+    } else {
+        std::vector<std::thread> threads;
+        threads.reserve(n_threads - 1u);
+        for (std::size_t t = 1u; t < n_threads; ++t) {
+            threads.emplace_back(worker, t);
+        }
+        worker(0u);
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+    for (const auto &eptr : eptrs) {
+        if (eptr) {
+            std::rethrow_exception(eptr);
+        }
+    }
+}
+
+// Number of threads used by a batch evolve of n instances on prob, according to its thread safety level: at most
+// one per instance and one per hardware thread.
+inline std::size_t batch_threads(const pagmo::problem &prob, std::size_t n)
+{
+    if (prob.get_thread_safety() == pagmo::thread_safety::none) {
+        return 1u;
+    }
+    const auto hw_threads = static_cast<std::size_t>(std::max(std::thread::hardware_concurrency(), 1u));
+    return std::max(std::min(hw_threads, n), std::size_t(1));
+}
+
+// The problems the threads of a batch evolve (see parallel_for()) work on. If the problem provides the constant
+// thread safety level, all threads share it. Otherwise (basic thread safety level) each thread works on its own
+// copy, used by all the instances it runs, and merge_fevals() reports back to the original problem the fitness
+// evaluations made on the copies.
+class batch_problems
+{
+public:
+    batch_problems(pagmo::problem &prob, std::size_t n_threads) : m_prob(prob), m_fevals0(prob.get_fevals())
+    {
+        if (prob.get_thread_safety() != pagmo::thread_safety::constant && n_threads > 1u) {
+            m_copies.assign(n_threads, prob);
+        }
+    }
+    pagmo::problem &operator[](std::size_t t)
+    {
+        return m_copies.empty() ? m_prob : m_copies[t];
+    }
+    void merge_fevals() const
+    {
+        for (const auto &p : m_copies) {
+            m_prob.increment_fevals(p.get_fevals() - m_fevals0);
+        }
+    }
+
+private:
+    pagmo::problem &m_prob;
+    unsigned long long m_fevals0;
+    std::vector<pagmo::problem> m_copies;
+};
+} // namespace detail
+} // namespace ppnf
+
+#endif
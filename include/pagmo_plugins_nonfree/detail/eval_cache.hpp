@@ -0,0 +1,354 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_EVAL_CACHE_HPP
+#define PPNF_DETAIL_EVAL_CACHE_HPP
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <pagmo/s11n.hpp>
+#include <pagmo/types.hpp>
+#include <thread>
+#include <vector>
+
+#include <pagmo_plugins_nonfree/inplace.hpp>
+
+namespace ppnf
+{
+namespace detail
+{
+// Hit/miss counters of an eval_cache.
+struct eval_cache_stats {
+    unsigned long long m_f_hits = 0u;
+    unsigned long long m_f_misses = 0u;
+    unsigned long long m_g_hits = 0u;
+    unsigned long long m_g_misses = 0u;
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, m_f_hits, m_f_misses, m_g_hits, m_g_misses);
+    }
+};
+
+// A helper thread evaluating one gradient at a time, so that it runs concurrently with the fitness evaluations of
+// the calling thread (see eval_cache::prefetch()). Starting and waiting for an evaluation does not allocate.
+class gradient_worker
+{
+public:
+    explicit gradient_worker(const inplace_evaluator &eval) : m_eval(eval), m_thread([this]() { run(); }) {}
+    gradient_worker(const gradient_worker &) = delete;
+    gradient_worker &operator=(const gradient_worker &) = delete;
+    // The pending evaluation (if any) is completed before the thread exits.
+    ~gradient_worker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+    // Starts the evaluation of the gradient of x into g. x and g must not be touched until wait() returns.
+    void start(const pagmo::vector_double &x, double *g)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_x = &x;
+            m_g = g;
+            m_ok = false;
+            m_pending = true;
+        }
+        m_cv.notify_all();
+    }
+    // Waits for the evaluation started last, returns false if it threw.
+    bool wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this]() { return !m_pending; });
+        return m_ok;
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [this]() { return m_stop || m_pending; });
+            if (!m_pending) {
+                return;
+            }
+            lock.unlock();
+            bool ok = true;
+            try {
+                m_eval.gradient(*m_x, m_g);
+            } catch (...) {
+                // The error is reported when the gradient is evaluated again by the thread requesting it.
+                ok = false;
+            }
+            lock.lock();
+            m_ok = ok;
+            m_pending = false;
+            m_cv.notify_all();
+        }
+    }
+
+    const inplace_evaluator &m_eval;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    const pagmo::vector_double *m_x = nullptr;
+    double *m_g = nullptr;
+    bool m_pending = false;
+    bool m_ok = false;
+    bool m_stop = false;
+    // Started last, as it uses all the other members.
+    std::thread m_thread;
+};
+
+// Bounded LRU cache of fitness and gradient evaluations, keyed by the decision vector. It is meant to live for the
+// duration of a single evolve() (the problem is fixed). The number of entries is small, so lookups are linear scans
+// over the stored hashes. All the entries' buffers are allocated on construction and then recycled: no memory is
+// allocated by the cache afterwards. A capacity of zero disables caching (every request is evaluated).
+// The callers can announce that both the fitness and the gradient of a point will be requested (see prefetch()): if
+// the UDP implements the combined in-place method, both are then evaluated in one pass, otherwise, in concurrent
+// mode, the gradient is evaluated by a helper thread while the caller evaluates the fitness. The results are
+// published into the cache (a capacity of zero then behaves as a capacity of one).
+class eval_cache
+{
+    struct entry {
+        std::size_t m_hash = 0u;
+        unsigned long long m_stamp = 0u;
+        bool m_has_f = false;
+        bool m_has_g = false;
+        // The fitness (gradient) was (being) evaluated ahead of time and not yet requested.
+        bool m_f_prefetched = false;
+        bool m_g_prefetched = false;
+        // Empty until the entry is first used (its capacity is reserved), so that it never matches a lookup.
+        pagmo::vector_double m_x;
+        pagmo::vector_double m_f;
+        pagmo::vector_double m_g;
+    };
+
+public:
+    // nx, nf and ng are the sizes of the decision vector, of the fitness and of the gradient (ng = 0 if gradients
+    // are not used). concurrent activates the concurrent mode (the evaluator must then be usable concurrently).
+    eval_cache(const inplace_evaluator &eval, pagmo::vector_double::size_type nx, pagmo::vector_double::size_type nf,
+               pagmo::vector_double::size_type ng, std::size_t capacity, bool concurrent = false)
+        : m_eval(eval), m_capacity(capacity), m_combined(ng && eval.has_fitness_and_gradient()),
+          m_entries(std::max(capacity, std::size_t(1)))
+    {
+        for (auto &e : m_entries) {
+            e.m_x.reserve(nx);
+            e.m_f.resize(nf);
+            e.m_g.resize(ng);
+        }
+        if (concurrent && ng && !m_combined) {
+            m_worker = std::make_unique<gradient_worker>(eval);
+        }
+    }
+    eval_cache(const eval_cache &) = delete;
+    eval_cache &operator=(const eval_cache &) = delete;
+    // Announces that the fitness and the gradient of the nx doubles starting at x will be requested. If the combined
+    // method is available, both are evaluated (unless one of them is cached). Otherwise, in concurrent mode, starts
+    // the evaluation of the gradient (unless it is cached or already started), waiting first for the one started
+    // previously. It does nothing otherwise.
+    void prefetch(const double *x, pagmo::vector_double::size_type nx)
+    {
+        if (m_combined) {
+            auto &e = lookup(x, x + nx);
+            if (!e.m_has_f && !e.m_has_g) {
+                m_eval.fitness_and_gradient(e.m_x, e.m_f.data(), e.m_g.data());
+                e.m_has_f = e.m_has_g = true;
+                e.m_f_prefetched = e.m_g_prefetched = true;
+            }
+            return;
+        }
+        if (!m_worker) {
+            return;
+        }
+        auto &e = lookup(x, x + nx);
+        if (e.m_has_g || &e == m_pending) {
+            return;
+        }
+        if (m_pending) {
+            finish();
+        }
+        e.m_g_prefetched = true;
+        m_pending = &e;
+        m_worker->start(e.m_x, e.m_g.data());
+    }
+    // The (cached) fitness of the nx doubles starting at x.
+    const pagmo::vector_double &fitness(const double *x, pagmo::vector_double::size_type nx)
+    {
+        auto &e = lookup(x, x + nx);
+        if (e.m_has_f && !e.m_f_prefetched) {
+            ++m_stats.m_f_hits;
+        } else {
+            // The first request of a fitness evaluated ahead of time is accounted as a miss.
+            ++m_stats.m_f_misses;
+            if (!e.m_has_f) {
+                m_eval.fitness(e.m_x, e.m_f.data());
+                e.m_has_f = true;
+            }
+            e.m_f_prefetched = false;
+        }
+        return e.m_f;
+    }
+    // The (cached) fitness of x.
+    const pagmo::vector_double &fitness(const pagmo::vector_double &x)
+    {
+        return fitness(x.data(), x.size());
+    }
+    // Writes the fitness of x in out. If caching is disabled, this writes directly into out.
+    void fitness(const pagmo::vector_double &x, double *out)
+    {
+        if (m_capacity || m_combined || m_worker) {
+            const auto &f = fitness(x);
+            std::copy(f.begin(), f.end(), out);
+        } else {
+            ++m_stats.m_f_misses;
+            m_eval.fitness(x, out);
+        }
+    }
+    // The (cached) gradient of the nx doubles starting at x.
+    const pagmo::vector_double &gradient(const double *x, pagmo::vector_double::size_type nx)
+    {
+        auto &e = lookup(x, x + nx);
+        if (&e == m_pending) {
+            finish();
+        }
+        if (e.m_has_g && !e.m_g_prefetched) {
+            ++m_stats.m_g_hits;
+        } else {
+            // The first request of a gradient evaluated ahead of time is accounted as a miss.
+            ++m_stats.m_g_misses;
+            if (!e.m_has_g) {
+                m_eval.gradient(e.m_x, e.m_g.data());
+                e.m_has_g = true;
+            }
+            e.m_g_prefetched = false;
+        }
+        return e.m_g;
+    }
+    // The (cached) gradient of x.
+    const pagmo::vector_double &gradient(const pagmo::vector_double &x)
+    {
+        return gradient(x.data(), x.size());
+    }
+    // Writes the gradient of x in out. If caching is disabled, this writes directly into out.
+    void gradient(const pagmo::vector_double &x, double *out)
+    {
+        if (m_capacity || m_combined || m_worker) {
+            const auto &g = gradient(x);
+            std::copy(g.begin(), g.end(), out);
+        } else {
+            ++m_stats.m_g_misses;
+            m_eval.gradient(x, out);
+        }
+    }
+    const eval_cache_stats &get_stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    // Returns the entry for [first, last), recycling the least recently used one if it is not found.
+    entry &lookup(const double *first, const double *last)
+    {
+        const auto h = boost::hash_range(first, last);
+        ++m_clock;
+        if (m_capacity || m_combined || m_worker) {
+            for (auto &e : m_entries) {
+                if (e.m_hash == h && std::equal(e.m_x.begin(), e.m_x.end(), first, last)) {
+                    e.m_stamp = m_clock;
+                    return e;
+                }
+            }
+        }
+        auto &e = *std::min_element(m_entries.begin(), m_entries.end(),
+                                    [](const entry &a, const entry &b) { return a.m_stamp < b.m_stamp; });
+        if (&e == m_pending) {
+            finish();
+        }
+        e.m_hash = h;
+        e.m_stamp = m_clock;
+        e.m_has_f = false;
+        e.m_has_g = false;
+        e.m_f_prefetched = false;
+        e.m_g_prefetched = false;
+        e.m_x.assign(first, last);
+        return e;
+    }
+    // Waits for the gradient evaluated ahead of time and publishes it (it is dropped if its evaluation threw).
+    void finish()
+    {
+        if (m_worker->wait()) {
+            m_pending->m_has_g = true;
+        } else {
+            m_pending->m_g_prefetched = false;
+        }
+        m_pending = nullptr;
+    }
+
+    const inplace_evaluator &m_eval;
+    std::size_t m_capacity;
+    // Whether the fitness and the gradient are evaluated in one pass by the combined method.
+    bool m_combined;
+    unsigned long long m_clock = 0u;
+    std::vector<entry> m_entries;
+    eval_cache_stats m_stats;
+    // The helper thread of the concurrent mode and the entry whose gradient it is evaluating. The thread is
+    // destroyed (completing the pending evaluation) before the entries.
+    entry *m_pending = nullptr;
+    std::unique_ptr<gradient_worker> m_worker;
+};
+} // namespace detail
+} // namespace ppnf
+
+#endif
@@ -0,0 +1,185 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_EVOLVE_STATE_HPP
+#define PPNF_DETAIL_EVOLVE_STATE_HPP
+
+#include <boost/serialization/split_member.hpp>
+#include <memory>
+#include <mutex>
+#include <pagmo/s11n.hpp>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <pagmo_plugins_nonfree/detail/eval_cache.hpp>
+#include <pagmo_plugins_nonfree/evolve_stats.hpp>
+#include <pagmo_plugins_nonfree/log_columns.hpp>
+
+namespace ppnf
+{
+namespace detail
+{
+// A mutex which can be a member of a copyable class: copies and assignments leave each object with its own mutex.
+class member_mutex
+{
+public:
+    member_mutex() = default;
+    member_mutex(const member_mutex &) {}
+    member_mutex &operator=(const member_mutex &)
+    {
+        return *this;
+    }
+    void lock()
+    {
+        m_mutex.lock();
+    }
+    void unlock()
+    {
+        m_mutex.unlock();
+    }
+
+private:
+    std::mutex m_mutex;
+};
+
+// A value of an algorithm shared by its concurrent evolve() calls (e.g., the warm start states). It is accessed
+// only under its mutex, also when the algorithm is copied or serialized.
+template <typename T>
+class guarded
+{
+public:
+    guarded() = default;
+    explicit guarded(T value) : m_value(std::move(value)) {}
+    guarded(const guarded &other) : m_value(other.get()) {}
+    guarded &operator=(const guarded &other)
+    {
+        if (this != &other) {
+            set(other.get());
+        }
+        return *this;
+    }
+    // A copy of the value.
+    T get() const
+    {
+        std::lock_guard<member_mutex> lock(m_mutex);
+        return m_value;
+    }
+    void set(T value) const
+    {
+        std::lock_guard<member_mutex> lock(m_mutex);
+        m_value = std::move(value);
+    }
+    // Calls f on the value while holding the lock, and returns its result.
+    template <typename F>
+    auto apply(F &&f) const -> decltype(std::forward<F>(f)(std::declval<T &>()))
+    {
+        std::lock_guard<member_mutex> lock(m_mutex);
+        return std::forward<F>(f)(m_value);
+    }
+    template <typename Archive>
+    void save(Archive &ar, unsigned) const
+    {
+        const T value = get();
+        ar << value;
+    }
+    template <typename Archive>
+    void load(Archive &ar, unsigned)
+    {
+        T value;
+        ar >> value;
+        set(std::move(value));
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+private:
+    mutable member_mutex m_mutex;
+    mutable T m_value;
+};
+
+// The results of an evolve(), published together once it is complete, so that concurrent readers see either
+// those of the previous evolve() or those of the new one. Res is the type of the solver status. The log is never
+// modified once published, and is shared with the copies of the results.
+template <typename Res>
+struct evolve_results {
+    Res m_opt_res;
+    std::shared_ptr<const log_columns> m_log = std::make_shared<const log_columns>();
+    eval_cache_stats m_cache_stats;
+    evolve_stats m_stats;
+    // The error raised writing the log file of the logged run (empty if none).
+    std::string m_log_error;
+    template <typename Archive>
+    void save(Archive &ar, unsigned) const
+    {
+        pagmo::detail::archive(ar, m_opt_res, *m_log, m_cache_stats, m_stats, m_log_error);
+    }
+    template <typename Archive>
+    void load(Archive &ar, unsigned)
+    {
+        log_columns log;
+        pagmo::detail::archive(ar, m_opt_res, log, m_cache_stats, m_stats, m_log_error);
+        m_log = std::make_shared<const log_columns>(std::move(log));
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+};
+
+// The columnar log holding the log lines (used to load the archives storing the log as lines).
+inline std::shared_ptr<const log_columns> log_from_lines(const std::vector<log_columns::line_type> &lines)
+{
+    log_columns retval;
+    retval.reserve(lines.size());
+    for (const auto &line : lines) {
+        retval.push_back(std::get<0>(line), std::get<1>(line), std::get<2>(line), std::get<3>(line),
+                         std::get<4>(line));
+    }
+    return std::make_shared<const log_columns>(std::move(retval));
+}
+
+} // namespace detail
+} // namespace ppnf
+
+#endif
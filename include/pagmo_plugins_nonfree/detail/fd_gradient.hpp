@@ -0,0 +1,242 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_FD_GRADIENT_HPP
+#define PPNF_DETAIL_FD_GRADIENT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <pagmo/bfe.hpp>
+#include <pagmo/problem.hpp>
+#include <pagmo/types.hpp>
+#include <utility>
+#include <vector>
+
+namespace ppnf
+{
+namespace detail
+{
+// Default relative steps of the forward (sqrt of the machine epsilon) and central (cbrt of the machine
+// epsilon) finite-difference schemes.
+inline double fd_default_step(bool central)
+{
+    return central ? std::cbrt(std::numeric_limits<double>::epsilon())
+                   : std::sqrt(std::numeric_limits<double>::epsilon());
+}
+
+// A colouring of the variables appearing in a gradient sparsity pattern, such that no two variables of the same
+// colour appear in the same row (i.e., affect the same fitness component). The variables of a colour can then be
+// perturbed together, as in the Curtis-Powell-Reid method.
+struct fd_colouring {
+    // The colour of each variable (fd_colouring::none if the variable does not appear in the pattern).
+    std::vector<pagmo::vector_double::size_type> m_colour;
+    pagmo::vector_double::size_type m_n_colours = 0u;
+    static constexpr pagmo::vector_double::size_type none = std::numeric_limits<pagmo::vector_double::size_type>::max();
+};
+
+// Greedy colouring of the variables of a pattern, visited in order of decreasing number of nonzeros (largest
+// first). Each variable gets the smallest colour not used by the variables sharing a row with it. The cost
+// is linear in the sum, over the rows, of the squared number of nonzeros of the row.
+inline fd_colouring colour_gradient_sparsity(const pagmo::sparsity_pattern &pattern,
+                                             pagmo::vector_double::size_type nx, pagmo::vector_double::size_type nf)
+{
+    using size_type = pagmo::vector_double::size_type;
+    constexpr auto none = fd_colouring::none;
+    std::vector<std::vector<size_type>> col_rows(nx), row_cols(nf);
+    for (const auto &p : pattern) {
+        col_rows[p.second].push_back(p.first);
+        row_cols[p.first].push_back(p.second);
+    }
+    std::vector<size_type> order;
+    for (size_type j = 0u; j < nx; ++j) {
+        if (!col_rows[j].empty()) {
+            order.push_back(j);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&col_rows](size_type a, size_type b) { return col_rows[a].size() > col_rows[b].size(); });
+    fd_colouring retval;
+    retval.m_colour.assign(nx, none);
+    // The colours forbidden to the variable j are marked with j.
+    std::vector<size_type> mark;
+    for (const auto j : order) {
+        for (const auto i : col_rows[j]) {
+            for (const auto k : row_cols[i]) {
+                if (retval.m_colour[k] != none) {
+                    mark[retval.m_colour[k]] = j;
+                }
+            }
+        }
+        size_type c = 0u;
+        while (c < retval.m_n_colours && mark[c] == j) {
+            ++c;
+        }
+        if (c == retval.m_n_colours) {
+            mark.push_back(none);
+            ++retval.m_n_colours;
+        }
+        retval.m_colour[j] = c;
+    }
+    return retval;
+}
+
+// Finite-difference approximation of the entries of a fitness gradient in a given sparsity pattern. The variables
+// are perturbed by colours (see colour_gradient_sparsity()): the forward scheme costs one evaluation per colour plus
+// one (the unperturbed point), the central scheme two per colour. All the perturbed decision vectors needed by one
+// gradient are evaluated with a single call to a batch fitness evaluator, if given, so that they can be computed in
+// parallel, and sequentially otherwise. The step of the variable j is step * max(1, |x_j|). A perturbation that would
+// leave the bounds is reversed by the forward scheme, while the central scheme falls back to a (forward-sized)
+// one-sided difference for that variable.
+// The object is meant to live for the duration of a single run: the problem, the pattern and the colouring must
+// outlive it, and its buffers are reused between calls. The problem is held by mutable reference, as required by
+// pagmo::bfe (which updates its fitness evaluations counter).
+class fd_gradient
+{
+public:
+    using size_type = pagmo::vector_double::size_type;
+    fd_gradient(pagmo::problem &prob, const pagmo::bfe *b, const pagmo::sparsity_pattern &pattern,
+                const fd_colouring &colouring, bool central, double step)
+        : m_prob(prob), m_bfe(b ? std::make_unique<const pagmo::bfe>(*b) : nullptr), m_pattern(pattern),
+          m_colour(colouring.m_colour), m_n_colours(colouring.m_n_colours), m_central(central),
+          m_step(step > 0. ? step : fd_default_step(central)), m_bounds(prob.get_bounds()), m_nf(prob.get_nf()),
+          m_den(prob.get_nx())
+    {
+        for (size_type j = 0u; j < m_colour.size(); ++j) {
+            if (m_colour[j] != fd_colouring::none) {
+                m_cols.push_back(j);
+            }
+        }
+    }
+    // Number of decision vectors evaluated per gradient.
+    size_type n_points() const
+    {
+        return m_central ? 2u * m_n_colours : m_n_colours + 1u;
+    }
+    // Writes the m_pattern.size() entries of the gradient at x in g.
+    void gradient(const pagmo::vector_double &x, double *g)
+    {
+        const auto nx = x.size();
+        const auto np = n_points();
+        m_dvs.resize(nx * np);
+        for (size_type p = 0u; p < np; ++p) {
+            std::copy(x.begin(), x.end(), m_dvs.begin() + static_cast<std::ptrdiff_t>(p * nx));
+        }
+        const auto &lb = m_bounds.first;
+        const auto &ub = m_bounds.second;
+        for (const auto j : m_cols) {
+            const auto xj = x[j];
+            const auto h = m_step * std::max(1., std::abs(xj));
+            const auto plus = plus_point(m_colour[j]) * nx + j;
+            if (m_central && xj + h <= ub[j] && xj - h >= lb[j]) {
+                const auto minus = minus_point(m_colour[j]) * nx + j;
+                m_dvs[plus] = xj + h;
+                m_dvs[minus] = xj - h;
+                // NOTE: the actual steps are used, as xj + h and xj - h are rounded.
+                m_den[j] = m_dvs[plus] - m_dvs[minus];
+            } else {
+                // NOTE: the one-sided fallback of the central scheme uses at most the default forward step.
+                const auto hf = m_central ? std::min(h, fd_default_step(false) * std::max(1., std::abs(xj))) : h;
+                m_dvs[plus] = (xj + hf > ub[j] && xj - hf >= lb[j]) ? xj - hf : xj + hf;
+                m_den[j] = m_dvs[plus] - xj;
+            }
+        }
+        if (m_bfe) {
+            m_fvs = (*m_bfe)(m_prob, m_dvs);
+        } else {
+            m_fvs.resize(m_nf * np);
+            for (size_type p = 0u; p < np; ++p) {
+                m_x.assign(m_dvs.begin() + static_cast<std::ptrdiff_t>(p * nx),
+                           m_dvs.begin() + static_cast<std::ptrdiff_t>((p + 1u) * nx));
+                const auto f = m_prob.fitness(m_x);
+                std::copy(f.begin(), f.end(), m_fvs.begin() + static_cast<std::ptrdiff_t>(p * m_nf));
+            }
+        }
+        // NOTE: the other variables of the colour of j do not affect the component i.
+        for (size_type k = 0u; k < m_pattern.size(); ++k) {
+            const auto i = m_pattern[k].first;
+            const auto j = m_pattern[k].second;
+            g[k] = (m_fvs[plus_point(m_colour[j]) * m_nf + i] - m_fvs[minus_point(m_colour[j]) * m_nf + i])
+                   / m_den[j];
+        }
+    }
+
+private:
+    // Index of the decision vector perturbed forward (backward) for the colour c.
+    size_type plus_point(size_type c) const
+    {
+        return m_central ? 2u * c : c;
+    }
+    // NOTE: in the forward scheme, the last decision vector is the unperturbed one.
+    size_type minus_point(size_type c) const
+    {
+        return m_central ? 2u * c + 1u : m_n_colours;
+    }
+    pagmo::problem &m_prob;
+    // NOTE: each run owns a copy of the evaluator, as bfes are not required to be callable concurrently.
+    const std::unique_ptr<const pagmo::bfe> m_bfe;
+    const pagmo::sparsity_pattern &m_pattern;
+    const std::vector<size_type> &m_colour;
+    const size_type m_n_colours;
+    const bool m_central;
+    const double m_step;
+    const std::pair<pagmo::vector_double, pagmo::vector_double> m_bounds;
+    const size_type m_nf;
+    // The variables appearing in the pattern.
+    std::vector<size_type> m_cols;
+    // Reused buffers: the batch of decision vectors and their fitnesses, a single decision vector (sequential
+    // evaluation) and the denominator of each difference.
+    pagmo::vector_double m_dvs;
+    pagmo::vector_double m_fvs;
+    pagmo::vector_double m_x;
+    pagmo::vector_double m_den;
+};
+} // namespace detail
+} // namespace ppnf
+
+#endif
@@ -0,0 +1,114 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_LIBRARY_REGISTRY_HPP
+#define PPNF_DETAIL_LIBRARY_REGISTRY_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+
+namespace ppnf
+{
+namespace detail
+{
+// Process-wide cache of run-time loaded solver libraries. Lib is the table of resolved symbols (it must
+// also own the boost::dll::shared_library so that the symbols stay valid for as long as the table is alive),
+// Key identifies the library (e.g. its path). Handles are handed out as shared pointers: erasing an entry from the
+// registry does not invalidate the handles still held by running evolves, the library is unloaded
+// when the last of them is destroyed.
+template <typename Key, typename Lib>
+class library_registry
+{
+public:
+    using handle_type = std::shared_ptr<const Lib>;
+    // Returns the cached handle for key, or calls loader() to create it. The loader is called at most once per key
+    // (unless it throws, in which case nothing is stored and the exception is propagated).
+    template <typename Loader>
+    handle_type get(const Key &key, Loader &&loader)
+    {
+        // Fast path: concurrent lookups only need a shared lock.
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            const auto it = m_libs.find(key);
+            if (it != m_libs.end()) {
+                return it->second;
+            }
+        }
+        // Slow path: we need to load the library. We check again as another thread may have
+        // loaded it in the meantime.
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        const auto it = m_libs.find(key);
+        if (it != m_libs.end()) {
+            return it->second;
+        }
+        handle_type retval(loader());
+        m_libs.emplace(key, retval);
+        return retval;
+    }
+    // Removes key from the registry. Returns true if an entry was removed.
+    bool erase(const Key &key)
+    {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        return m_libs.erase(key) > 0u;
+    }
+    // Checks if key is in the registry.
+    bool contains(const Key &key) const
+    {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return m_libs.count(key) > 0u;
+    }
+
+private:
+    mutable std::shared_mutex m_mutex;
+    std::map<Key, handle_type> m_libs;
+};
+
+} // namespace detail
+} // namespace ppnf
+
+#endif
@@ -0,0 +1,172 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_LOG_SINK_HPP
+#define PPNF_DETAIL_LOG_SINK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <pagmo/s11n.hpp>
+#include <pagmo/types.hpp>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <pagmo_plugins_nonfree/detail/visibility.hpp>
+#include <pagmo_plugins_nonfree/log_columns.hpp>
+
+namespace ppnf
+{
+namespace detail
+{
+// The log settings of a UDA: the policy of the in-memory log ("unbounded", "ring" keeping the last m_capacity
+// lines, or "decimate" keeping at most m_capacity lines evenly spread over the run) and the file the log lines are
+// streamed to (none if empty), in "csv" or "binary" format.
+struct PPNF_DLL_PUBLIC log_settings {
+    std::string m_buffer = "unbounded";
+    unsigned m_capacity = 0u;
+    std::string m_file;
+    std::string m_format = "csv";
+    // Validating setters.
+    void set_buffer(const std::string &, unsigned);
+    void set_file(const std::string &, const std::string &);
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, m_buffer, m_capacity, m_file, m_format);
+    }
+};
+
+// A log line, as pushed by the solver callbacks: objevals, objval, n of unsatisfied constraints, constraints
+// violation, feasibility, and the seconds elapsed since the start of the run.
+struct log_record {
+    unsigned long m_fevals;
+    double m_objval;
+    pagmo::vector_double::size_type m_violated;
+    double m_viol_norm;
+    bool m_feasible;
+    double m_time;
+};
+
+// Asynchronous sink of the log lines of a single run. The solver callback (the only producer) pushes fixed-size
+// records into a bounded lock-free queue, while a background thread (the only consumer) prints them to screen,
+// streams them to the log file and stores them in the in-memory log according to the buffer policy. The consumer
+// sleeps on a condition variable while the queue is empty, and push() wakes it up only if it is sleeping. If the
+// queue is full, push() waits for the consumer. finish() processes the remaining records, joins the thread and
+// returns the in-memory log, in columnar form. The errors of the consumer do not interrupt the run: after an error
+// writing the log file, the records are only stored in memory, and the first error is reported by get_error().
+class PPNF_DLL_PUBLIC async_log_sink
+{
+public:
+    using log_line_type = std::tuple<unsigned long, double, pagmo::vector_double::size_type, double, bool>;
+    using log_type = std::vector<log_line_type>;
+    // Opens the log file (if any) and starts the consumer thread.
+    async_log_sink(const log_settings &, bool screen);
+    async_log_sink(const async_log_sink &) = delete;
+    async_log_sink &operator=(const async_log_sink &) = delete;
+    ~async_log_sink();
+    void push(unsigned long fevals, double objval, pagmo::vector_double::size_type violated, double viol_norm,
+              bool feasible)
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        while (tail - m_head.load(std::memory_order_acquire) == queue_size) {
+            std::this_thread::yield();
+        }
+        m_queue[tail % queue_size] = log_record{
+            fevals, objval, violated, viol_norm, feasible,
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count()};
+        // NOTE: the tail is published and the sleeping flag read with sequentially consistent operations, pairing
+        // with those of the consumer going to sleep, so that either the consumer sees the record or it is woken up.
+        m_tail.store(tail + 1u);
+        if (m_sleeping.load()) {
+            wake();
+        }
+    }
+    log_columns finish();
+    // The first error of the consumer (empty if none). Meaningful after finish().
+    const std::string &get_error() const
+    {
+        return m_error;
+    }
+
+private:
+    void consume();
+    void process(const log_record &);
+    void wait();
+    void wake();
+    void stop();
+
+    static constexpr std::size_t queue_size = 1024u;
+    const log_settings m_settings;
+    const bool m_screen;
+    const std::chrono::steady_clock::time_point m_start;
+    std::vector<log_record> m_queue;
+    // NOTE: the producer and consumer positions live on separate cache lines.
+    alignas(64) std::atomic<std::size_t> m_head{0u};
+    alignas(64) std::atomic<std::size_t> m_tail{0u};
+    alignas(64) std::atomic<bool> m_done{false};
+    std::atomic<bool> m_sleeping{false};
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    // The state of the consumer: the log file, the number of records processed, the in-memory log, the
+    // oldest line of the (full) ring buffer and the stride of the decimating buffer.
+    std::ofstream m_file;
+    unsigned long long m_n_records = 0u;
+    log_type m_lines;
+    std::size_t m_ring_pos = 0u;
+    unsigned long long m_stride = 1u;
+    std::string m_error;
+    std::thread m_thread;
+};
+} // namespace detail
+} // namespace ppnf
+
+#endif
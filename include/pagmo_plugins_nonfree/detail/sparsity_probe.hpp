@@ -0,0 +1,261 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PPNF_DETAIL_SPARSITY_PROBE_HPP
+#define PPNF_DETAIL_SPARSITY_PROBE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <pagmo/problem.hpp>
+#include <pagmo/types.hpp>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ppnf
+{
+namespace detail
+{
+// A gradient sparsity pattern discovered by probing, together with the position of each of its entries
+// in the (dense) gradient returned by the problem.
+struct probed_sparsity {
+    pagmo::sparsity_pattern m_pattern;
+    std::vector<pagmo::vector_double::size_type> m_dense_idx;
+};
+
+// Identifies a problem for the purpose of reusing a probed or prepared sparsity pattern: UDP type and name,
+// dimensions, bounds and availability of the derivatives and of their sparsities. Two problems with the same
+// fingerprint are assumed to share the same gradient and hessians structure.
+struct sparsity_fingerprint {
+    std::string m_type;
+    std::string m_name;
+    pagmo::vector_double::size_type m_nx = 0u;
+    pagmo::vector_double::size_type m_nf = 0u;
+    bool m_has_gradient = false;
+    bool m_has_gradient_sparsity = false;
+    bool m_has_hessians = false;
+    bool m_has_hessians_sparsity = false;
+    std::pair<pagmo::vector_double, pagmo::vector_double> m_bounds;
+    explicit sparsity_fingerprint(const pagmo::problem &prob)
+        : m_type(prob.get_type_index().name()), m_name(prob.get_name()), m_nx(prob.get_nx()), m_nf(prob.get_nf()),
+          m_has_gradient(prob.has_gradient()), m_has_gradient_sparsity(prob.has_gradient_sparsity()),
+          m_has_hessians(prob.has_hessians()), m_has_hessians_sparsity(prob.has_hessians_sparsity()),
+          m_bounds(prob.get_bounds())
+    {
+    }
+    bool operator==(const sparsity_fingerprint &other) const
+    {
+        return m_type == other.m_type && m_name == other.m_name && m_nx == other.m_nx && m_nf == other.m_nf
+               && m_has_gradient == other.m_has_gradient && m_has_gradient_sparsity == other.m_has_gradient_sparsity
+               && m_has_hessians == other.m_has_hessians && m_has_hessians_sparsity == other.m_has_hessians_sparsity
+               && m_bounds == other.m_bounds;
+    }
+};
+
+// Writes into x a random point within the bounds (for each coordinate, close to the finite bound if the other is not).
+template <typename RandomEngine>
+inline void random_probe_point(const std::pair<pagmo::vector_double, pagmo::vector_double> &bounds,
+                               pagmo::vector_double &x, RandomEngine &e)
+{
+    const auto &lb = bounds.first;
+    const auto &ub = bounds.second;
+    std::uniform_real_distribution<double> unif(0., 1.);
+    for (decltype(x.size()) j = 0u; j < x.size(); ++j) {
+        const auto r = unif(e);
+        if (std::isfinite(lb[j]) && std::isfinite(ub[j])) {
+            x[j] = lb[j] + r * (ub[j] - lb[j]);
+        } else if (std::isfinite(lb[j])) {
+            x[j] = lb[j] + r;
+        } else if (std::isfinite(ub[j])) {
+            x[j] = ub[j] - r;
+        } else {
+            x[j] = 2. * r - 1.;
+        }
+    }
+}
+
+// Discovers the structural nonzeros of the fitness gradient of a problem which does not provide its gradient
+// sparsity, by looking at n_probes random points within the bounds. If the problem provides the gradient, the
+// nonzero entries of the (dense) gradient are recorded. Otherwise each variable is perturbed in turn, and the fitness
+// components that change are recorded (this costs nx + 1 fitness evaluations per probe). An entry is structurally zero
+// if it is zero at all the probes. The pattern is never empty, as SNOPT7 requires at least one entry.
+template <typename RandomEngine>
+inline probed_sparsity probe_gradient_sparsity(const pagmo::problem &prob, unsigned n_probes, RandomEngine &e)
+{
+    using size_type = pagmo::vector_double::size_type;
+    const auto nx = prob.get_nx();
+    const auto nf = prob.get_nf();
+    const auto bounds = prob.get_bounds();
+    const auto &ub = bounds.second;
+    // NOTE: the nonzero flags are stored row-major, as the dense gradient.
+    std::vector<char> nonzero(nf * nx, 0);
+    pagmo::vector_double x(nx);
+    for (unsigned p = 0u; p < n_probes; ++p) {
+        random_probe_point(bounds, x, e);
+        if (prob.has_gradient()) {
+            const auto g = prob.gradient(x);
+            for (size_type k = 0u; k < g.size(); ++k) {
+                // NOTE: a NaN counts as a nonzero.
+                nonzero[k] |= static_cast<char>(!(g[k] == 0.));
+            }
+        } else {
+            const auto f0 = prob.fitness(x);
+            for (size_type j = 0u; j < nx; ++j) {
+                const auto xj = x[j];
+                auto h = 1e-6 * std::max(1., std::abs(xj));
+                if (xj + h > ub[j]) {
+                    h = -h;
+                }
+                x[j] = xj + h;
+                const auto f1 = prob.fitness(x);
+                x[j] = xj;
+                for (size_type i = 0u; i < nf; ++i) {
+                    nonzero[i * nx + j] |= static_cast<char>(!(f1[i] == f0[i]));
+                }
+            }
+        }
+    }
+    probed_sparsity retval;
+    for (size_type i = 0u; i < nf; ++i) {
+        for (size_type j = 0u; j < nx; ++j) {
+            if (nonzero[i * nx + j]) {
+                retval.m_pattern.emplace_back(i, j);
+                retval.m_dense_idx.push_back(i * nx + j);
+            }
+        }
+    }
+    if (retval.m_pattern.empty()) {
+        retval.m_pattern.emplace_back(0u, 0u);
+        retval.m_dense_idx.push_back(0u);
+    }
+    return retval;
+}
+
+// The linear part of the fitness of a problem providing its gradient, detected by probing: the entries of the
+// gradient sparsity having the same value at all the probes are constant, and the others are nonlinear. The
+// fitness components with no nonlinear entries are linear, up to a constant term.
+struct linear_structure {
+    // The nonzero constant entries: rows, columns and values (as the iAfun, jAvar and A arrays of SNOPT7).
+    std::vector<int> m_iAfun;
+    std::vector<int> m_jAvar;
+    pagmo::vector_double m_A;
+    // The nonlinear entries, and their position in the gradient returned by the problem.
+    pagmo::sparsity_pattern m_pattern;
+    std::vector<pagmo::vector_double::size_type> m_gradient_idx;
+    // For each fitness component, the linearity flag and the constant term (zero for the nonlinear components).
+    std::vector<char> m_linear_row;
+    pagmo::vector_double m_constant;
+};
+
+// Detects the linear part of the fitness at n_probes (at least two) random points within the bounds. The problem
+// returns the gradient of the given sparsity pattern, in the same order or, if dense_idx is not null, as a dense
+// gradient where the k-th entry of the pattern is at position (*dense_idx)[k]. This costs n_probes gradient
+// evaluations and one fitness evaluation. An entry is constant if it has exactly the same value at all the probes
+// (a NaN counts as nonlinear), and the zero constant entries are dropped.
+template <typename RandomEngine>
+inline linear_structure detect_linear_structure(const pagmo::problem &prob, const pagmo::sparsity_pattern &pattern,
+                                                const std::vector<pagmo::vector_double::size_type> *dense_idx,
+                                                unsigned n_probes, RandomEngine &e)
+{
+    using size_type = pagmo::vector_double::size_type;
+    const auto nf = prob.get_nf();
+    const auto bounds = prob.get_bounds();
+    const auto position = [dense_idx](size_type k) { return dense_idx ? (*dense_idx)[k] : k; };
+    pagmo::vector_double x(prob.get_nx()), x0, value(pattern.size());
+    std::vector<char> constant(pattern.size(), 1);
+    for (unsigned p = 0u; p < n_probes; ++p) {
+        random_probe_point(bounds, x, e);
+        const auto g = prob.gradient(x);
+        for (size_type k = 0u; k < pattern.size(); ++k) {
+            const auto v = g[position(k)];
+            if (p == 0u) {
+                value[k] = v;
+            } else {
+                constant[k] &= static_cast<char>(v == value[k]);
+            }
+        }
+        if (p == 0u) {
+            x0 = x;
+        }
+    }
+    linear_structure retval;
+    retval.m_linear_row.assign(nf, 1);
+    for (size_type k = 0u; k < pattern.size(); ++k) {
+        const auto i = pattern[k].first, j = pattern[k].second;
+        if (constant[k] && !std::isnan(value[k])) {
+            if (value[k] != 0.) {
+                retval.m_iAfun.push_back(static_cast<int>(i));
+                retval.m_jAvar.push_back(static_cast<int>(j));
+                retval.m_A.push_back(value[k]);
+            }
+        } else {
+            retval.m_pattern.emplace_back(i, j);
+            retval.m_gradient_idx.push_back(position(k));
+            retval.m_linear_row[i] = 0;
+        }
+    }
+    // The constant terms of the linear components, from the fitness at the first probe.
+    const auto f0 = prob.fitness(x0);
+    retval.m_constant.assign(nf, 0.);
+    for (size_type i = 0u; i < nf; ++i) {
+        if (retval.m_linear_row[i]) {
+            retval.m_constant[i] = f0[i];
+        }
+    }
+    for (size_type k = 0u; k < retval.m_A.size(); ++k) {
+        const auto i = static_cast<size_type>(retval.m_iAfun[k]);
+        if (retval.m_linear_row[i]) {
+            retval.m_constant[i] -= retval.m_A[k] * x0[static_cast<size_type>(retval.m_jAvar[k])];
+        }
+    }
+    return retval;
+}
+} // namespace detail
+} // namespace ppnf
+
+#endif
@@ -0,0 +1,179 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PAGMO_PLUGINS_NONFREE_EVOLVE_STATS_HPP
+#define PAGMO_PLUGINS_NONFREE_EVOLVE_STATS_HPP
+
+#include <chrono>
+#include <ostream>
+#include <pagmo/s11n.hpp>
+
+#include <pagmo_plugins_nonfree/detail/visibility.hpp>
+
+namespace ppnf
+{
+/// Statistics of a call to evolve().
+/**
+ * The statistics are collected, if requested (see, e.g., ppnf::snopt7::set_collect_stats()), during each call to
+ * evolve(). Times are wall-clock times in seconds. In batch mode the times and counters of the solver instances are
+ * summed, so that the time spent in the various phases may exceed the total time.
+ */
+struct evolve_stats {
+    /// Time spent fetching the solver library (i.e. loading it from disk, the first time it is used).
+    double m_load_time = 0.;
+    /// Time spent initialising the solver data structures.
+    double m_init_time = 0.;
+    /// Time spent setting the solver options.
+    double m_options_time = 0.;
+    /// Time spent preparing the problem for the solver (bounds, sparsity patterns, starting point).
+    double m_setup_time = 0.;
+    /// Time spent in the solver, excluding the callbacks.
+    double m_solver_time = 0.;
+    /// Time spent in the callbacks (evaluations of the problem, caching and logging).
+    double m_callback_time = 0.;
+    /// Total time of the call to evolve().
+    double m_total_time = 0.;
+    /// Number of requests of the objective function (for SNOPT7, of the objective and the constraints).
+    unsigned long long m_f_calls = 0u;
+    /// Number of requests of the constraints.
+    unsigned long long m_g_calls = 0u;
+    /// Number of requests of the gradient of the objective (for SNOPT7, of the whole fitness gradient).
+    unsigned long long m_df_calls = 0u;
+    /// Number of requests of the jacobian of the constraints.
+    unsigned long long m_dg_calls = 0u;
+    /// Number of requests of the hessian of the lagrangian.
+    unsigned long long m_hm_calls = 0u;
+    /// Number of finite differences steps performed by the solver.
+    unsigned long long m_fidif_calls = 0u;
+    /// Number of fitness and gradient requests served by the evaluation cache.
+    unsigned long long m_cache_hits = 0u;
+    /// Number of fitness and gradient requests evaluated on the problem.
+    unsigned long long m_cache_misses = 0u;
+    /// Estimated bytes of the solver arrays (bounds, sparsity structures, workspaces and caches), computed from their
+    /// sizes (not measured on the allocator).
+    unsigned long long m_bytes_estimated = 0u;
+
+    /// Accumulate the statistics of another run.
+    /**
+     * @param other the statistics to be added to \p this.
+     *
+     * @return a reference to \p this.
+     */
+    evolve_stats &operator+=(const evolve_stats &other)
+    {
+        m_load_time += other.m_load_time;
+        m_init_time += other.m_init_time;
+        m_options_time += other.m_options_time;
+        m_setup_time += other.m_setup_time;
+        m_solver_time += other.m_solver_time;
+        m_callback_time += other.m_callback_time;
+        m_total_time += other.m_total_time;
+        m_f_calls += other.m_f_calls;
+        m_g_calls += other.m_g_calls;
+        m_df_calls += other.m_df_calls;
+        m_dg_calls += other.m_dg_calls;
+        m_hm_calls += other.m_hm_calls;
+        m_fidif_calls += other.m_fidif_calls;
+        m_cache_hits += other.m_cache_hits;
+        m_cache_misses += other.m_cache_misses;
+        m_bytes_estimated += other.m_bytes_estimated;
+        return *this;
+    }
+    /// Object serialization
+    /**
+     * @param ar target archive.
+     *
+     * @throws unspecified any exception thrown by the serialization of primitive types.
+     */
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, m_load_time, m_init_time, m_options_time, m_setup_time, m_solver_time,
+                               m_callback_time, m_total_time, m_f_calls, m_g_calls, m_df_calls, m_dg_calls,
+                               m_hm_calls, m_fidif_calls, m_cache_hits, m_cache_misses, m_bytes_estimated);
+    }
+};
+
+PPNF_DLL_PUBLIC std::ostream &operator<<(std::ostream &, const evolve_stats &);
+
+namespace detail
+{
+// Adds to *target the wall-clock time (in seconds) elapsed between its construction and its destruction
+// (or the call to stop()). A null target disables the timer, so that no clock is read.
+class phase_timer
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    explicit phase_timer(double *target) : m_target(target)
+    {
+        if (m_target) {
+            m_start = clock::now();
+        }
+    }
+    phase_timer(const phase_timer &) = delete;
+    phase_timer &operator=(const phase_timer &) = delete;
+    ~phase_timer()
+    {
+        stop();
+    }
+    void stop()
+    {
+        if (m_target) {
+            *m_target += std::chrono::duration<double>(clock::now() - m_start).count();
+            m_target = nullptr;
+        }
+    }
+
+private:
+    double *m_target;
+    clock::time_point m_start;
+};
+} // namespace detail
+
+} // namespace ppnf
+
+#endif
@@ -0,0 +1,245 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PAGMO_PLUGINS_NONFREE_INPLACE_HPP
+#define PAGMO_PLUGINS_NONFREE_INPLACE_HPP
+
+#include <algorithm> // std::copy
+#include <pagmo/problem.hpp>
+#include <pagmo/types.hpp>
+#include <type_traits>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
+
+#include <pagmo_plugins_nonfree/detail/fd_gradient.hpp>
+#include <pagmo_plugins_nonfree/detail/visibility.hpp>
+
+namespace ppnf
+{
+namespace detail
+{
+// Detects the optional UDP method void fitness_inplace(const vector_double &, double *) const.
+template <typename T, typename = void>
+struct has_fitness_inplace : std::false_type {
+};
+template <typename T>
+struct has_fitness_inplace<T, std::void_t<decltype(std::declval<const T &>().fitness_inplace(
+                                  std::declval<const pagmo::vector_double &>(), std::declval<double *>()))>>
+    : std::true_type {
+};
+
+// Detects the optional UDP method void gradient_inplace(const vector_double &, double *) const.
+template <typename T, typename = void>
+struct has_gradient_inplace : std::false_type {
+};
+template <typename T>
+struct has_gradient_inplace<T, std::void_t<decltype(std::declval<const T &>().gradient_inplace(
+                                   std::declval<const pagmo::vector_double &>(), std::declval<double *>()))>>
+    : std::true_type {
+};
+
+// Detects the optional UDP method void fitness_and_gradient_inplace(const vector_double &, double *, double *) const.
+template <typename T, typename = void>
+struct has_fitness_and_gradient_inplace : std::false_type {
+};
+template <typename T>
+struct has_fitness_and_gradient_inplace<
+    T, std::void_t<decltype(std::declval<const T &>().fitness_and_gradient_inplace(
+           std::declval<const pagmo::vector_double &>(), std::declval<double *>(), std::declval<double *>()))>>
+    : std::true_type {
+};
+
+// Type-erased in-place methods of a registered UDP. The first argument is the
+// pointer to the UDP as returned by pagmo::problem::get_ptr(). Null members
+// signal that the corresponding method is not available.
+struct inplace_hooks {
+    using function_type = void (*)(const void *, const pagmo::vector_double &, double *);
+    using fg_function_type = void (*)(const void *, const pagmo::vector_double &, double *, double *);
+    function_type m_fitness = nullptr;
+    function_type m_gradient = nullptr;
+    fg_function_type m_fitness_and_gradient = nullptr;
+};
+
+PPNF_DLL_PUBLIC void register_inplace_hooks(const std::type_index &, const inplace_hooks &);
+PPNF_DLL_PUBLIC inplace_hooks get_inplace_hooks(const std::type_index &);
+
+// Evaluation front-end used by the plugins' callbacks: it writes the fitness (gradient) of x directly into
+// the output array, going through the in-place methods of the UDP when they are registered,
+// and through the pagmo::problem interface otherwise. If a finite-difference engine is set, it replaces
+// the gradient of the problem.
+class inplace_evaluator
+{
+public:
+    explicit inplace_evaluator(const pagmo::problem &p)
+        : m_prob(&p), m_udp(p.get_ptr()), m_hooks(get_inplace_hooks(p.get_type_index()))
+    {
+    }
+    bool has_fitness_inplace() const
+    {
+        return m_hooks.m_fitness != nullptr;
+    }
+    bool has_gradient_inplace() const
+    {
+        return m_hooks.m_gradient != nullptr;
+    }
+    // The combined method is not used if the gradient is computed by finite differences.
+    bool has_fitness_and_gradient() const
+    {
+        return m_hooks.m_fitness_and_gradient != nullptr && m_fd == nullptr;
+    }
+    // Writes get_nf() values in f.
+    void fitness(const pagmo::vector_double &x, double *f) const
+    {
+        if (m_hooks.m_fitness) {
+            m_hooks.m_fitness(m_udp, x, f);
+            // NOTE: the pagmo counters are bypassed by the in-place call.
+            m_prob->increment_fevals(1u);
+        } else {
+            const auto fit = m_prob->fitness(x);
+            std::copy(fit.begin(), fit.end(), f);
+        }
+    }
+    // Sets the finite-difference engine computing the gradient (null to use the gradient of the problem).
+    void set_fd_gradient(fd_gradient *fd)
+    {
+        m_fd = fd;
+    }
+    // Writes as many values as the size of the gradient sparsity (or of the pattern of the
+    // finite-difference engine) in g.
+    void gradient(const pagmo::vector_double &x, double *g) const
+    {
+        if (m_fd) {
+            m_fd->gradient(x, g);
+        } else if (m_hooks.m_gradient) {
+            m_hooks.m_gradient(m_udp, x, g);
+        } else {
+            const auto grad = m_prob->gradient(x);
+            std::copy(grad.begin(), grad.end(), g);
+        }
+    }
+    // Writes the fitness and the gradient of x in f and g in one pass (only if has_fitness_and_gradient()).
+    void fitness_and_gradient(const pagmo::vector_double &x, double *f, double *g) const
+    {
+        m_hooks.m_fitness_and_gradient(m_udp, x, f, g);
+        m_prob->increment_fevals(1u);
+    }
+
+private:
+    const pagmo::problem *m_prob;
+    const void *m_udp;
+    inplace_hooks m_hooks;
+    fd_gradient *m_fd = nullptr;
+};
+} // namespace detail
+
+/// Register the in-place methods of a UDP.
+/**
+ * The solvers' callbacks need to write the fitness and the gradient into arrays owned by the solver. Going through
+ * pagmo::problem::fitness() and pagmo::problem::gradient() allocates a new pagmo::vector_double at each call,
+ * which is then copied into the solver's array. A UDP of type \p T can avoid both by implementing one or both
+ * of the optional methods
+ *
+ * @code{.unparsed}
+ * void fitness_inplace(const vector_double &x, double *f) const;
+ * void gradient_inplace(const vector_double &x, double *g) const;
+ * @endcode
+ *
+ * which must write, respectively, the get_nf() fitness components and the gradient components
+ * (in the order given by the gradient sparsity) of \p x into the preallocated output array, and
+ * must return the same values as the corresponding fitness() and gradient() methods.
+ *
+ * A UDP computing its gradient as a by-product of the fitness (e.g., by an adjoint or a forward-mode pass) can
+ * also implement the optional method
+ *
+ * @code{.unparsed}
+ * void fitness_and_gradient_inplace(const vector_double &x, double *f, double *g) const;
+ * @endcode
+ *
+ * which must write both in one pass. The plugins then use it whenever the solver needs the fitness and the
+ * gradient at the same point (SNOPT7 requesting both in one call, WORHP requesting the objective, as its gradient
+ * usually follows), and the evaluation cache serves the subsequent requests. The combined method is not used when
+ * the gradient is computed by finite differences in the plugin.
+ * Since pagmo::problem type-erases the UDP, these methods can be discovered only after a call to this function.
+ * The plugins will then use them whenever the UDP stored in the evolved population is a \p T.
+ *
+ * The fitness evaluations counter of the pagmo::problem is incremented also by the in-place
+ * (and combined) calls, while the gradient evaluations counter is not (pagmo offers no way to do it).
+ * No consistency check on the output dimensions is performed for the in-place calls.
+ *
+ * This function is thread-safe.
+ *
+ * @tparam T the UDP type.
+ */
+template <typename T>
+inline void register_inplace_udp()
+{
+    static_assert(detail::has_fitness_inplace<T>::value || detail::has_gradient_inplace<T>::value
+                      || detail::has_fitness_and_gradient_inplace<T>::value,
+                  "A UDP registered for in-place evaluation must implement fitness_inplace(), gradient_inplace() "
+                  "and/or fitness_and_gradient_inplace().");
+    detail::inplace_hooks hooks;
+    if constexpr (detail::has_fitness_inplace<T>::value) {
+        hooks.m_fitness = [](const void *udp, const pagmo::vector_double &x, double *f) {
+            static_cast<const T *>(udp)->fitness_inplace(x, f);
+        };
+    }
+    if constexpr (detail::has_gradient_inplace<T>::value) {
+        hooks.m_gradient = [](const void *udp, const pagmo::vector_double &x, double *g) {
+            static_cast<const T *>(udp)->gradient_inplace(x, g);
+        };
+    }
+    if constexpr (detail::has_fitness_and_gradient_inplace<T>::value) {
+        hooks.m_fitness_and_gradient = [](const void *udp, const pagmo::vector_double &x, double *f, double *g) {
+            static_cast<const T *>(udp)->fitness_and_gradient_inplace(x, f, g);
+        };
+    }
+    detail::register_inplace_hooks(std::type_index(typeid(T)), hooks);
+}
+
+} // namespace ppnf
+
+#endif
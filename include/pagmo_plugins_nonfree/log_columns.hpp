@@ -0,0 +1,228 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#ifndef PAGMO_PLUGINS_NONFREE_LOG_COLUMNS_HPP
+#define PAGMO_PLUGINS_NONFREE_LOG_COLUMNS_HPP
+
+#include <cstddef>
+#include <pagmo/s11n.hpp>
+#include <pagmo/types.hpp>
+#include <tuple>
+#include <vector>
+
+namespace ppnf
+{
+/// Read-only view of a contiguous sequence.
+/**
+ * A minimal replacement of the C++20 ``std::span``, used to access the columns of ppnf::log_columns without
+ * copies. The view is invalidated by the destruction of the object owning the sequence.
+ */
+template <typename T>
+class log_span
+{
+public:
+    /// Constructor.
+    /**
+     * @param data pointer to the first element.
+     * @param size number of elements.
+     */
+    log_span(const T *data, std::size_t size) : m_data(data), m_size(size) {}
+    /// Pointer to the first element.
+    const T *data() const
+    {
+        return m_data;
+    }
+    /// Number of elements.
+    std::size_t size() const
+    {
+        return m_size;
+    }
+    /// Empty check.
+    bool empty() const
+    {
+        return m_size == 0u;
+    }
+    /// Element access (unchecked).
+    const T &operator[](std::size_t i) const
+    {
+        return m_data[i];
+    }
+    /// First element (unchecked).
+    const T &front() const
+    {
+        return m_data[0];
+    }
+    /// Last element (unchecked).
+    const T &back() const
+    {
+        return m_data[m_size - 1u];
+    }
+    /// Begin iterator.
+    const T *begin() const
+    {
+        return m_data;
+    }
+    /// End iterator.
+    const T *end() const
+    {
+        return m_data + m_size;
+    }
+
+private:
+    const T *m_data;
+    std::size_t m_size;
+};
+
+/// Columnar optimisation log.
+/**
+ * The log lines of a run (see, e.g., ppnf::snopt7::set_verbosity()) stored as a struct of arrays: the number of
+ * objective function evaluations, the objective function value, the number of constraints violated, the
+ * constraints violation norm and the feasibility flag (one byte per line, zero if infeasible). Each column is
+ * contiguous in memory, and can be accessed without copies via the span accessors.
+ */
+class log_columns
+{
+public:
+    /// The type of the counters of the violated constraints.
+    using size_type = pagmo::vector_double::size_type;
+    /// A single log line, as returned by, e.g., ppnf::snopt7::get_log().
+    using line_type = std::tuple<unsigned long, double, size_type, double, bool>;
+
+    /// Append a log line.
+    /**
+     * @param fevals the number of objective function evaluations.
+     * @param objval the objective function value.
+     * @param violated the number of constraints violated.
+     * @param viol_norm the constraints violation norm.
+     * @param feasible the feasibility flag.
+     */
+    void push_back(unsigned long fevals, double objval, size_type violated, double viol_norm, bool feasible)
+    {
+        m_fevals.push_back(fevals);
+        m_objval.push_back(objval);
+        m_violated.push_back(violated);
+        m_viol_norm.push_back(viol_norm);
+        m_feasible.push_back(static_cast<unsigned char>(feasible));
+    }
+    /// Reserve memory for \p n lines.
+    void reserve(std::size_t n)
+    {
+        m_fevals.reserve(n);
+        m_objval.reserve(n);
+        m_violated.reserve(n);
+        m_viol_norm.reserve(n);
+        m_feasible.reserve(n);
+    }
+    /// Number of log lines.
+    std::size_t size() const
+    {
+        return m_fevals.size();
+    }
+    /// Empty check.
+    bool empty() const
+    {
+        return m_fevals.empty();
+    }
+    /// Number of objective function evaluations.
+    log_span<unsigned long> fevals() const
+    {
+        return {m_fevals.data(), m_fevals.size()};
+    }
+    /// Objective function values.
+    log_span<double> objval() const
+    {
+        return {m_objval.data(), m_objval.size()};
+    }
+    /// Numbers of constraints violated.
+    log_span<size_type> violated() const
+    {
+        return {m_violated.data(), m_violated.size()};
+    }
+    /// Constraints violation norms.
+    log_span<double> viol_norm() const
+    {
+        return {m_viol_norm.data(), m_viol_norm.size()};
+    }
+    /// Feasibility flags (zero if infeasible).
+    log_span<unsigned char> feasible() const
+    {
+        return {m_feasible.data(), m_feasible.size()};
+    }
+    /// Conversion to log lines.
+    /**
+     * @return the log as a vector of log lines.
+     */
+    std::vector<line_type> lines() const
+    {
+        std::vector<line_type> retval;
+        retval.reserve(size());
+        for (std::size_t i = 0u; i < size(); ++i) {
+            retval.emplace_back(m_fevals[i], m_objval[i], m_violated[i], m_viol_norm[i], m_feasible[i] != 0u);
+        }
+        return retval;
+    }
+    /// Object serialization
+    /**
+     * @param ar target archive.
+     *
+     * @throws unspecified any exception thrown by the serialization of primitive types and vectors.
+     */
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, m_fevals, m_objval, m_violated, m_viol_norm, m_feasible);
+    }
+
+private:
+    std::vector<unsigned long> m_fevals;
+    std::vector<double> m_objval;
+    std::vector<size_type> m_violated;
+    std::vector<double> m_viol_norm;
+    std::vector<unsigned char> m_feasible;
+};
+} // namespace ppnf
+
+#endif
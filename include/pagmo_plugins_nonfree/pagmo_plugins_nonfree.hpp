@@ -48,6 +48,7 @@ see https://www.gnu.org/licenses/. */
 #define PAGMO_PAGMO_PLUGINS_NONFREE_HPP
 
 #include <pagmo_plugins_nonfree/config.hpp>
+#include <pagmo_plugins_nonfree/inplace.hpp>
 #include <pagmo_plugins_nonfree/snopt7.hpp>
 #include <pagmo_plugins_nonfree/worhp.hpp>
 
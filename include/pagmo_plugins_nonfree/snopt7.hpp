@@ -47,19 +47,36 @@ see https://www.gnu.org/licenses/. */
 #ifndef PAGMO_SNOPT7_HPP
 #define PAGMO_SNOPT7_HPP
 
+#include <boost/optional.hpp>
 #include <boost/serialization/map.hpp>
+#include <boost/serialization/optional.hpp>
+#include <boost/serialization/shared_ptr.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/type_traits/is_object.hpp>
+#include <cstddef>
 #include <limits> // std::numeric_limits
 #include <map>
+#include <memory>
 #include <mutex>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/not_population_based.hpp>
+#include <pagmo/bfe.hpp>
 #include <pagmo/population.hpp>
 #include <pagmo/s11n.hpp>
+#include <pagmo/threading.hpp>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include <pagmo_plugins_nonfree/detail/eval_cache.hpp>
+#include <pagmo_plugins_nonfree/detail/evolve_state.hpp>
+#include <pagmo_plugins_nonfree/detail/log_sink.hpp>
+#include <pagmo_plugins_nonfree/detail/sparsity_probe.hpp>
 #include <pagmo_plugins_nonfree/detail/visibility.hpp>
+#include <pagmo_plugins_nonfree/evolve_stats.hpp>
+#include <pagmo_plugins_nonfree/inplace.hpp>
 extern "C" {
 #include "bogus_libs/snopt7_c_lib/snopt7_c.h"
 }
@@ -93,12 +110,27 @@ struct user_data {
     using log_type = std::vector<log_line_type>;
     // The problem stored in the evolve() population
     const pagmo::problem *m_prob;
+    // The (cached) evaluator writing fitness and gradient into the snOptA arrays
+    eval_cache *m_cache;
     // A preallocated decision vector
     pagmo::vector_double m_dv;
+    // If the entries passed to snOptA are not the gradient returned by the problem (a dense gradient, if the
+    // sparsity was detected by probing, or a gradient including the linear part), their position in that
+    // gradient, and a preallocated gradient (otherwise null and empty)
+    const std::vector<pagmo::vector_double::size_type> *m_gather_idx = nullptr;
+    pagmo::vector_double m_full_g;
+    // The linear part of the fitness, subtracted from the values passed to snOptA (null if not used)
+    const linear_structure *m_linear = nullptr;
+    // Cached problem properties, so that the callback does not need to query (and copy) them
+    pagmo::vector_double m_c_tol;
+    pagmo::vector_double::size_type m_nec;
+    bool m_has_gradient;
     // The verbosity
     unsigned m_verbosity;
-    // The log
-    log_type m_log;
+    // The statistics of the run (null if not collected)
+    evolve_stats *m_stats = nullptr;
+    // The sink of the log lines (null if the run is not logged)
+    async_log_sink *m_log_sink = nullptr;
     // A counter
     unsigned long m_objfun_counter = 0;
     // This exception pointer will be null, unless
@@ -108,6 +140,45 @@ struct user_data {
     std::exception_ptr m_eptr;
 };
 
+// The pool of persistent SNOPT7 sessions of a snopt7 instance (see snopt7::set_persistent_session()).
+struct snopt7_session_pool;
+
+// Owns the pool of persistent SNOPT7 sessions of a snopt7 instance. The sessions are bound to the object which created
+// them: copies and moved-to objects start with an empty pool.
+class PPNF_DLL_PUBLIC snopt7_session_holder
+{
+public:
+    snopt7_session_holder();
+    snopt7_session_holder(const snopt7_session_holder &);
+    snopt7_session_holder(snopt7_session_holder &&);
+    snopt7_session_holder &operator=(const snopt7_session_holder &);
+    snopt7_session_holder &operator=(snopt7_session_holder &&);
+    ~snopt7_session_holder();
+    snopt7_session_pool &get() const;
+    void clear() const;
+
+private:
+    std::shared_ptr<snopt7_session_pool> m_pool;
+};
+
+// The final state of a SNOPT7 run, stored to warm start later runs from a nearby decision vector.
+struct snopt7_warm_start {
+    // The problem name (used as a sanity check).
+    std::string m_prob_name;
+    // The final decision vector (the key of the entry).
+    pagmo::vector_double m_x;
+    // The states and multipliers of the variables and of the fitness components.
+    std::vector<int> m_xstate;
+    pagmo::vector_double m_xmul;
+    std::vector<int> m_Fstate;
+    pagmo::vector_double m_Fmul;
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, m_prob_name, m_x, m_xstate, m_xmul, m_Fstate, m_Fmul);
+    }
+};
+
 // Wrapper to connect pagmo's fitness calculation machinery to SNOPT7's.
 // NOTE: this function needs to be passed to the SNOPT7 C API, and as such it needs to be
 // declared within an 'extern "C"' block (otherwise, it might be UB to pass C++ function pointers
@@ -168,15 +239,30 @@ inline void snopt_fitness_wrapper(int *Status, int *n, double x[], int *needF, i
  *
  *    Constructing this class with an inconsistent \p minor_version parameter results in undefined behaviour.
  *
+ * .. note::
+ *
+ *    The SNOPT7 workspaces kept by the persistent session mode (see snopt7::set_persistent_session()) belong to the
+ *    object which created them: copies, moved-to and deserialised objects start cold.
+ *
  * .. warning::
  *
  *    A moved-from :cpp:class:`ppnf::snopt7` is destructible and assignable. Any other operation will result
  *    in undefined behaviour.
  *
+ * .. note::
+ *
+ *    SNOPT7 can exploit the linear part of the problem fitness, :math:`F(x) = f(x) + A x`. As pagmo problems do not
+ *    declare it, this is off by default, and can be activated with :cpp:func:`ppnf::snopt7::set_linear_detection()`.
+ *    The gradient of a problem providing it is then evaluated at a few random points within the bounds, and the
+ *    entries of its sparsity pattern having the same value at all of them are passed to SNOPT7 as :math:`A`. A
+ *    fitness component with only such entries is linear: its constant term, computed from the fitness at the first
+ *    probe, is folded into its bounds (``Flow`` and ``Fupp``), or into ``ObjAdd`` for the objective.
+ *
  * .. warning::
  *
- *    The possibility to exploit the linear part of the problem fitness, part of the original SNOPT7 library,
- *    is deactivated in this plugin for pagmo.
+ *    The linear detection is a heuristic. An entry is classed as constant from the few probe points only, so an
+ *    entry that is equal at all of them, but not elsewhere, makes SNOPT7 optimise a different problem. An entry
+ *    evaluating to NaN at the probes is always treated as nonlinear.
  *
  * .. seealso::
  *
@@ -230,25 +316,50 @@ public:
     snopt7(bool screen_output = false, std::string snopt7_c_library = "/usr/local/lib/libsnopt7_c.so",
            unsigned minor_version = 6u);
     pagmo::population evolve(pagmo::population) const;
+    void preload() const;
+    bool unload() const;
     void set_verbosity(unsigned);
-    const log_type &get_log() const;
+    log_type get_log() const;
+    std::shared_ptr<const log_columns> get_log_columns() const;
     unsigned int get_verbosity() const;
     std::string get_name() const;
     std::string get_extra_info() const;
+    pagmo::thread_safety get_thread_safety() const;
     /// Object serialization
     /**
      * This method will save/load \p this into the archive \p ar.
      *
+     * Archives written before the class version 1 (pagmo_plugins_nonfree 0.27 and earlier) can be loaded: their
+     * solver status and log become those of the last evolve(), and the settings they do not contain keep their
+     * default values.
+     *
      * @param ar target archive.
+     * @param version the version of the class in the archive.
      *
      * @throws unspecified any exception thrown by the serialization of the UDA and of primitive types.
      */
     template <typename Archive>
-    void serialize(Archive &ar, unsigned)
+    void serialize(Archive &ar, unsigned version)
     {
+        if (version == 0u) {
+            // NOTE: only reached on loading, as the current version is saved.
+            int last_opt_res;
+            log_type log;
+            pagmo::detail::archive(ar, boost::serialization::base_object<not_population_based>(*this),
+                                   m_snopt7_c_library, m_minor_version, m_integer_opts, m_numeric_opts, last_opt_res,
+                                   m_screen_output, m_verbosity, log);
+            detail::evolve_results<int> results;
+            results.m_opt_res = last_opt_res;
+            results.m_log = detail::log_from_lines(log);
+            m_results.set(std::move(results));
+            return;
+        }
         pagmo::detail::archive(ar, boost::serialization::base_object<not_population_based>(*this), m_snopt7_c_library,
-                               m_minor_version, m_integer_opts, m_numeric_opts, m_last_opt_res, m_screen_output,
-                               m_verbosity, m_log);
+                               m_minor_version, m_integer_opts, m_numeric_opts, m_results, m_screen_output,
+                               m_verbosity, m_warm_start, m_ws_tol, m_ws_capacity, m_ws_states, m_cache_capacity,
+                               m_batch_size, m_collect_stats, m_sparsity_probes, m_persistent_session, m_fd,
+                               m_fd_bfe, m_fd_central, m_fd_step, m_log_settings, m_linear_probes,
+                               m_concurrent_gradient);
     }
     void set_integer_option(const std::string &, int);
     void set_integer_options(const std::map<std::string, int> &);
@@ -259,6 +370,34 @@ public:
     void reset_integer_options();
     void reset_numeric_options();
     int get_last_opt_result() const;
+    void set_warm_start(bool, double = 0., unsigned = 16u);
+    bool get_warm_start() const;
+    void clear_warm_start();
+    void set_cache_capacity(unsigned);
+    unsigned get_cache_capacity() const;
+    void set_concurrent_gradient(bool);
+    bool get_concurrent_gradient() const;
+    void set_batch_size(unsigned);
+    unsigned get_batch_size() const;
+    void set_persistent_session(bool);
+    bool get_persistent_session() const;
+    void set_sparsity_detection(unsigned);
+    unsigned get_sparsity_detection() const;
+    void set_linear_detection(unsigned);
+    unsigned get_linear_detection() const;
+    void set_fd_gradient(const std::string & = "forward", double = 0.);
+    void set_fd_gradient(const pagmo::bfe &, const std::string & = "forward", double = 0.);
+    void unset_fd_gradient();
+    bool has_fd_gradient() const;
+    std::string get_fd_scheme() const;
+    double get_fd_step() const;
+    void set_log_buffer(const std::string &, unsigned = 0u);
+    std::pair<std::string, unsigned> get_log_buffer() const;
+    void set_log_file(const std::string &, const std::string & = "csv");
+    std::pair<std::string, std::string> get_log_file() const;
+    void set_collect_stats(bool);
+    bool get_collect_stats() const;
+    evolve_stats get_stats() const;
 
 private:
     template <typename snProblem>
@@ -271,12 +410,48 @@ private:
     // Options maps.
     std::map<std::string, int> m_integer_opts;
     std::map<std::string, double> m_numeric_opts;
-    // Solver return status.
-    mutable int m_last_opt_res = 0;
+    // The results of the last evolve(): solver return status, columnar log (shared with the copies of the
+    // algorithm), cache counters and statistics.
+    detail::guarded<detail::evolve_results<int>> m_results;
     // Activates the original snopt screen output
     bool m_screen_output;
     unsigned int m_verbosity;
-    mutable log_type m_log;
+    // Warm start: activation flag, matching tolerance, maximum number of stored states
+    // and the stored states (least recently used first).
+    bool m_warm_start = false;
+    double m_ws_tol = 0.;
+    unsigned m_ws_capacity = 16u;
+    detail::guarded<std::vector<detail::snopt7_warm_start>> m_ws_states;
+    // Capacity of the fitness/gradient cache used during evolve().
+    unsigned m_cache_capacity = 0u;
+    // Evaluation of the gradient concurrently with the fitness (activation flag).
+    bool m_concurrent_gradient = false;
+    // Number of individuals optimised concurrently by each evolve().
+    unsigned m_batch_size = 1u;
+    // Collection of the evolve() statistics (activation flag).
+    bool m_collect_stats = false;
+    // Gradient sparsity detection: number of probes (zero if disabled) and the patterns detected for the
+    // problems seen by evolve() (least recently used first, not serialized).
+    using sparsity_cache_entry
+        = std::pair<detail::sparsity_fingerprint, std::shared_ptr<const detail::probed_sparsity>>;
+    static constexpr std::size_t sparsity_cache_capacity = 8u;
+    unsigned m_sparsity_probes = 0u;
+    detail::guarded<std::vector<sparsity_cache_entry>> m_sparsity_cache;
+    // Linear structure detection: number of probes (zero if disabled).
+    unsigned m_linear_probes = 0u;
+    // Persistent session mode: activation flag and the idle SNOPT7 workspaces (not serialized).
+    bool m_persistent_session = false;
+    detail::snopt7_session_holder m_sessions;
+    // Finite-difference gradients computed by the plugin: activation flag, the batch fitness evaluator (none for
+    // sequential evaluations), the scheme (central or forward) and the relative step.
+    bool m_fd = false;
+    boost::optional<pagmo::bfe> m_fd_bfe;
+    bool m_fd_central = false;
+    double m_fd_step = 0.;
+    // The policy of the in-memory log and the log file.
+    detail::log_settings m_log_settings;
+    // Serialises the uses of the random engine inherited from not_population_based by concurrent evolve() calls.
+    mutable detail::member_mutex m_e_mutex;
 
     // Deleting the methods load save public inherited from not_population_based as to avoid conflict with serialize
     // implemented by snopt7
@@ -290,4 +465,7 @@ private:
 
 PAGMO_S11N_ALGORITHM_EXPORT_KEY(ppnf::snopt7)
 
+// NOTE: version 1 added the settings and results of the evolve() redesign (see snopt7::serialize()).
+BOOST_CLASS_VERSION(ppnf::snopt7, 1)
+
 #endif // PAGMO_SNOPT7
\ No newline at end of file
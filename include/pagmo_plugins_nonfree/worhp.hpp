@@ -52,17 +52,27 @@ see https://www.gnu.org/licenses/. */
 #include <boost/dll/shared_library.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/functional/hash.hpp>
+#include <boost/optional.hpp>
 #include <boost/serialization/map.hpp>
+#include <boost/serialization/optional.hpp>
+#include <boost/serialization/shared_ptr.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/version.hpp>
 #include <iomanip>
+#include <memory>
 #include <mutex>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/not_population_based.hpp>
+#include <pagmo/bfe.hpp>
 #include <pagmo/config.hpp>
 #include <pagmo/exceptions.hpp>
 #include <pagmo/io.hpp>
 #include <pagmo/population.hpp>
 #include <pagmo/problem.hpp>
 #include <pagmo/s11n.hpp>
+#include <pagmo/threading.hpp>
 #include <pagmo/utils/constrained.hpp>
 #include <random>
 #include <stdexcept>
@@ -73,11 +83,73 @@ see https://www.gnu.org/licenses/. */
 #include <vector>
 
 #include "bogus_libs/worhp_lib/worhp_bogus.h"
+#include <pagmo_plugins_nonfree/detail/eval_cache.hpp>
+#include <pagmo_plugins_nonfree/detail/evolve_state.hpp>
+#include <pagmo_plugins_nonfree/detail/log_sink.hpp>
+#include <pagmo_plugins_nonfree/detail/sparsity_probe.hpp>
 #include <pagmo_plugins_nonfree/detail/visibility.hpp>
+#include <pagmo_plugins_nonfree/evolve_stats.hpp>
 
 namespace ppnf
 {
 
+namespace detail
+{
+// Precomputed scatter plan for the assembly of the Hessian of the Lagrangian in the WORHP format.
+// The j-th entry of the i-th pagmo hessian (objective first, then the constraints) is accumulated
+// into HM.val[m_slot[m_offset[i] + j]].
+struct hm_scatter_plan {
+    std::vector<pagmo::vector_double::size_type> m_offset;
+    std::vector<pagmo::vector_double::size_type> m_slot;
+};
+
+// The sparsity structures of a problem in the WORHP representation.
+struct worhp_sparsity;
+
+// The in-memory snapshot of the WORHP parameters of a worhp instance (see worhp::set_params_caching()).
+struct worhp_params_cache;
+
+// The pool of persistent WORHP sessions of a worhp instance (see worhp::set_persistent_session()).
+struct worhp_session_pool;
+
+// Owns the pool of persistent WORHP sessions of a worhp instance. The sessions are bound to the object which created
+// them: copies and moved-to objects start with an empty pool.
+class PPNF_DLL_PUBLIC worhp_session_holder
+{
+public:
+    worhp_session_holder();
+    worhp_session_holder(const worhp_session_holder &);
+    worhp_session_holder(worhp_session_holder &&);
+    worhp_session_holder &operator=(const worhp_session_holder &);
+    worhp_session_holder &operator=(worhp_session_holder &&);
+    ~worhp_session_holder();
+    worhp_session_pool &get() const;
+    void clear() const;
+
+private:
+    std::shared_ptr<worhp_session_pool> m_pool;
+};
+
+// The final state of a WORHP run, stored to warm start later runs from a nearby decision vector.
+struct worhp_warm_start {
+    // The problem name (used as a sanity check).
+    std::string m_prob_name;
+    // The final decision vector (the key of the entry).
+    pagmo::vector_double m_x;
+    // The multipliers of the box constraints and of the constraints.
+    pagmo::vector_double m_lambda;
+    pagmo::vector_double m_mu;
+    // The scaling of the objective and the penalties of the merit function.
+    double m_scale_obj = 1.;
+    pagmo::vector_double m_penalty;
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, m_prob_name, m_x, m_lambda, m_mu, m_scale_obj, m_penalty);
+    }
+};
+} // namespace detail
+
 /// WORHP - (We Optimize Really Huge Problems)
 /**
  * \image html worhp.png
@@ -127,6 +199,11 @@ namespace ppnf
  *    This plugin for the WORHP was developed around version 1.12.1 of the worhp library and will not work with
  *    any other version.
  *
+ * .. note::
+ *
+ *    The WORHP instances kept by the persistent session mode (see worhp::set_persistent_session()) belong to the
+ *    object which created them: copies, moved-to and deserialised objects start cold.
+ *
  * .. warning::
  *
  *    A moved-from :cpp:class:`ppnf::worhp` is destructible and assignable. Any other operation will result
@@ -173,11 +250,15 @@ public:
      */
     worhp(bool screen_output = false, std::string worhp_library = "/usr/local/lib/libworhp.so");
     pagmo::population evolve(pagmo::population pop) const;
+    void preload() const;
+    bool unload() const;
     void set_verbosity(unsigned n);
-    const log_type &get_log() const;
+    log_type get_log() const;
+    std::shared_ptr<const log_columns> get_log_columns() const;
     unsigned int get_verbosity() const;
     std::string get_name() const;
     std::string get_extra_info() const;
+    pagmo::thread_safety get_thread_safety() const;
     void set_integer_option(const std::string &name, int value);
     void set_integer_options(const std::map<std::string, int> &m);
     std::map<std::string, int> get_integer_options() const;
@@ -191,58 +272,98 @@ public:
     void reset_numeric_options();
     void reset_bool_options();
     std::string get_last_opt_result() const;
+    void set_cache_capacity(unsigned capacity);
+    unsigned get_cache_capacity() const;
+    void set_concurrent_gradient(bool flag);
+    bool get_concurrent_gradient() const;
+    void set_warm_start(bool flag, double tol = 0., unsigned capacity = 16u);
+    bool get_warm_start() const;
+    void clear_warm_start();
+    void set_batch_size(unsigned k);
+    unsigned get_batch_size() const;
+    void set_collect_stats(bool flag);
+    bool get_collect_stats() const;
+    evolve_stats get_stats() const;
+    void set_params_caching(bool flag);
+    bool get_params_caching() const;
+    void load_params(const std::string &file = "");
+    const std::string &get_params_file() const;
+    void set_xml_params(bool flag);
+    bool get_xml_params() const;
+    void set_persistent_session(bool flag);
+    bool get_persistent_session() const;
+    void set_fd_gradient(const std::string &scheme = "forward", double step = 0.);
+    void set_fd_gradient(const pagmo::bfe &b, const std::string &scheme = "forward", double step = 0.);
+    void unset_fd_gradient();
+    bool has_fd_gradient() const;
+    std::string get_fd_scheme() const;
+    double get_fd_step() const;
+    void set_hessian_structure(const std::string &strategy);
+    const std::string &get_hessian_structure() const;
+    void set_log_buffer(const std::string &policy, unsigned capacity = 0u);
+    std::pair<std::string, unsigned> get_log_buffer() const;
+    void set_log_file(const std::string &file, const std::string &format = "csv");
+    std::pair<std::string, std::string> get_log_file() const;
     /// Object serialization
     /**
      * This method will save/load \p this into the archive \p ar.
      *
+     * Archives written before the class version 1 (pagmo_plugins_nonfree 0.27 and earlier) can be loaded: their
+     * solver status becomes that of the last evolve(), and the settings they do not contain keep their default
+     * values.
+     *
      * @param ar target archive.
+     * @param version the version of the class in the archive.
      *
      * @throws unspecified any exception thrown by the serialization of the UDA and of primitive types.
      */
     template <typename Archive>
-    void serialize(Archive &ar, unsigned)
+    void serialize(Archive &ar, unsigned version)
     {
+        if (version == 0u) {
+            // NOTE: only reached on loading, as the current version is saved. The evaluation caches of the
+            // earlier versions are discarded.
+            detail::evolve_results<std::string> results;
+            std::pair<pagmo::vector_double, pagmo::vector_double> f_cache, g_cache;
+            pagmo::detail::archive(ar, boost::serialization::base_object<not_population_based>(*this),
+                                   m_worhp_library, results.m_opt_res, m_integer_opts, m_numeric_opts, m_bool_opts,
+                                   m_screen_output, m_verbosity, f_cache, g_cache);
+            m_results.set(std::move(results));
+            return;
+        }
         pagmo::detail::archive(ar, boost::serialization::base_object<not_population_based>(*this), m_worhp_library,
-                               m_last_opt_res, m_integer_opts, m_numeric_opts, m_bool_opts, m_screen_output,
-                               m_verbosity, m_f_cache, m_g_cache);
+                               m_results, m_integer_opts, m_numeric_opts, m_bool_opts, m_screen_output, m_verbosity,
+                               m_cache_capacity, m_batch_size, m_collect_stats, m_persistent_session, m_params_file,
+                               m_params_caching, m_xml_params, m_fd, m_fd_bfe, m_fd_central, m_fd_step,
+                               m_log_settings, m_warm_start, m_ws_tol, m_ws_capacity, m_ws_states,
+                               m_hessian_structure, m_concurrent_gradient);
     }
 
 private:
-    struct pair_hash {
-        template <class T1, class T2>
-        std::size_t operator()(const std::pair<T1, T2> &p) const
-        {
-            std::size_t seed = 0;
-            boost::hash_combine(seed, p.first);
-            boost::hash_combine(seed, p.second);
-            return seed;
-        }
-    };
     // Log update and print to screen
-    void update_log(const pagmo::problem &prob, const pagmo::vector_double &fit, long long unsigned fevals0) const;
+    void update_log(const pagmo::problem &prob, const pagmo::vector_double &fit, const pagmo::vector_double &c_tol,
+                    detail::async_log_sink *sink, unsigned long f_count) const;
     // Objective function
-    void UserF(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::population &pop,
-               long long unsigned fevals0) const;
+    void UserF(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::problem &prob,
+               detail::eval_cache &cache, const pagmo::vector_double &c_tol, detail::async_log_sink *sink,
+               unsigned long &f_count) const;
     // Constraints
-    void UserG(OptVar *opt, Workspace *, Params *, Control *, const pagmo::population &pop) const;
+    void UserG(OptVar *opt, Workspace *, Params *, Control *, const pagmo::problem &prob,
+               detail::eval_cache &cache) const;
     // Gradient for the objective function
-    void UserDF(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::population &pop) const;
+    void UserDF(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::problem &prob,
+                detail::eval_cache &cache) const;
     // Gradient for the constraints
-    void UserDG(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::population &pop,
-                const std::vector<pagmo::vector_double::size_type> &gs_idx_map) const;
+    void UserDG(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::problem &prob,
+                detail::eval_cache &cache, const std::vector<pagmo::vector_double::size_type> &dg_gather) const;
     // The Hessian of the Lagrangian L = f + mu * g
-    void UserHM(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::population &pop,
-                const std::vector<pagmo::sparsity_pattern> &pagmo_hsp, const pagmo::sparsity_pattern &pagmo_merged_hsp,
-                const std::vector<pagmo::vector_double::size_type> &hs_idx_map) const;
-    // We cache the last call to fitness as it will be repeated by worhp
-    pagmo::vector_double fitness_with_cache(const pagmo::vector_double &x, const pagmo::problem &prob) const;
-    // We cache the last call to gradient as it will be repeated by worhp
-    pagmo::vector_double gradient_with_cache(const pagmo::vector_double &x, const pagmo::problem &prob) const;
+    void UserHM(OptVar *opt, Workspace *wsp, Params *, Control *, const pagmo::problem &prob,
+                const detail::hm_scatter_plan &plan, pagmo::vector_double &x) const;
     // The absolute path to the worhp library
     std::string m_worhp_library;
-    // Solver return status.
-    mutable std::string m_last_opt_res
-        = "\tThere still is no last optimisation result as WORHP evolve was never successfully called yet.";
+    // The results of the last evolve(): solver return status, columnar log (shared with the copies of the
+    // algorithm), cache counters and statistics.
+    detail::guarded<detail::evolve_results<std::string>> m_results;
 
     // Options maps.
     std::map<std::string, int> m_integer_opts;
@@ -252,11 +373,47 @@ private:
     // Activates the original worhp screen output
     bool m_screen_output;
     unsigned int m_verbosity;
-    mutable log_type m_log;
 
-    // The caches
-    mutable std::pair<pagmo::vector_double, pagmo::vector_double> m_f_cache = {{}, {}};
-    mutable std::pair<pagmo::vector_double, pagmo::vector_double> m_g_cache = {{}, {}};
+    // Capacity of the fitness/gradient cache used during evolve().
+    unsigned m_cache_capacity = 8u;
+    // Speculative evaluation of the gradient concurrently with the fitness (activation flag).
+    bool m_concurrent_gradient = false;
+    // Number of individuals optimised concurrently by each evolve().
+    unsigned m_batch_size = 1u;
+    // Collection of the evolve() statistics (activation flag).
+    bool m_collect_stats = false;
+    // The sparsity structures prepared for the problems seen by evolve() (least recently used first, not serialized).
+    using sparsity_cache_entry
+        = std::pair<detail::sparsity_fingerprint, std::shared_ptr<const detail::worhp_sparsity>>;
+    static constexpr std::size_t sparsity_cache_capacity = 8u;
+    detail::guarded<std::vector<sparsity_cache_entry>> m_sparsity_cache;
+    // The parameter file, the caching flag, the XML lookup flag and the snapshot of the parameters (not serialized,
+    // shared by the copies).
+    std::string m_params_file;
+    bool m_params_caching = false;
+    bool m_xml_params = true;
+    std::shared_ptr<detail::worhp_params_cache> m_params_cache;
+    // Persistent session mode: activation flag and the idle WORHP instances (not serialized).
+    bool m_persistent_session = false;
+    detail::worhp_session_holder m_sessions;
+    // Finite-difference gradients computed by the plugin: activation flag, the batch fitness evaluator (none for
+    // sequential evaluations), the scheme (central or forward) and the relative step.
+    bool m_fd = false;
+    boost::optional<pagmo::bfe> m_fd_bfe;
+    bool m_fd_central = false;
+    double m_fd_step = 0.;
+    // The policy of the in-memory log and the log file.
+    detail::log_settings m_log_settings;
+    // Warm start: activation flag, matching tolerance, maximum number of stored states
+    // and the stored states (least recently used first).
+    bool m_warm_start = false;
+    double m_ws_tol = 0.;
+    unsigned m_ws_capacity = 16u;
+    detail::guarded<std::vector<detail::worhp_warm_start>> m_ws_states;
+    // The strategy for the structure of the hessian of the lagrangian of the problems not providing the hessians.
+    std::string m_hessian_structure = "auto";
+    // Serialises the uses of the random engine inherited from not_population_based by concurrent evolve() calls.
+    mutable detail::member_mutex m_e_mutex;
 
     // Deleting the methods load save public in base as to avoid conflict with serialize
     template <typename Archive>
@@ -268,4 +425,7 @@ private:
 } // namespace ppnf
 
 PAGMO_S11N_ALGORITHM_EXPORT_KEY(ppnf::worhp)
+
+// NOTE: version 1 added the settings and results of the evolve() redesign (see worhp::serialize()).
+BOOST_CLASS_VERSION(ppnf::worhp, 1)
 #endif // PAGMO_WORHP
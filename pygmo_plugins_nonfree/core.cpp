@@ -1,6 +1,9 @@
 #include <boost/numeric/conversion/cast.hpp>
 #include <iostream>
+#include <memory>
+#include <pagmo/population.hpp>
 #include <pagmo/s11n.hpp>
+#include <pagmo/threading.hpp>
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <sstream>
@@ -59,6 +62,89 @@ UDA uda_pickle_setstate(py::tuple state)
     return uda;
 }
 
+// Finite-difference gradients computed by the plugin: the batch fitness evaluator is optional.
+template <typename UDA>
+void expose_fd_gradient(py::class_<UDA> &c, const std::string &algo)
+{
+    c.def(
+        "set_fd_gradient",
+        [](UDA &uda, const py::object &b, const std::string &scheme, double step) {
+            if (b.is_none()) {
+                uda.set_fd_gradient(scheme, step);
+            } else {
+                uda.set_fd_gradient(py::cast<pagmo::bfe>(b), scheme, step);
+            }
+        },
+        ppnf::fd_gradient_docstring(algo).c_str(), py::arg("b") = py::none(), py::arg("scheme") = "forward",
+        py::arg("step") = 0.);
+    c.def("unset_fd_gradient", &UDA::unset_fd_gradient);
+    c.def("has_fd_gradient", &UDA::has_fd_gradient);
+    c.def("get_fd_scheme", &UDA::get_fd_scheme);
+    c.def("get_fd_step", &UDA::get_fd_step);
+}
+
+// A read-only NumPy view of a column of the log. The capsule owns a reference to the columnar log, so that the
+// memory stays valid for the lifetime of the array.
+template <typename T>
+py::array log_column_array(const ppnf::log_span<T> &s, const py::dtype &dt, const py::capsule &owner)
+{
+    py::array retval(dt, {s.size()}, {sizeof(T)}, s.data(), owner);
+    retval.attr("flags").attr("writeable") = false;
+    return retval;
+}
+
+// Columnar log, exported as NumPy arrays without copies.
+template <typename UDA>
+void expose_log_columns(py::class_<UDA> &c)
+{
+    c.def(
+        "get_log_columns",
+        [](const UDA &uda) {
+            auto cols = new std::shared_ptr<const ppnf::log_columns>(uda.get_log_columns());
+            const py::capsule owner(
+                cols, [](void *p) { delete static_cast<std::shared_ptr<const ppnf::log_columns> *>(p); });
+            py::dict retval;
+            retval["fevals"] = log_column_array((*cols)->fevals(), py::dtype::of<unsigned long>(), owner);
+            retval["objval"] = log_column_array((*cols)->objval(), py::dtype::of<double>(), owner);
+            retval["violated"]
+                = log_column_array((*cols)->violated(), py::dtype::of<ppnf::log_columns::size_type>(), owner);
+            retval["viol_norm"] = log_column_array((*cols)->viol_norm(), py::dtype::of<double>(), owner);
+            // NOTE: the flags are stored as one byte per line, zero or one.
+            retval["feasible"] = log_column_array((*cols)->feasible(), py::dtype::of<bool>(), owner);
+            return retval;
+        },
+        ppnf::log_columns_docstring().c_str());
+}
+
+// Bounded in-memory log and log file.
+template <typename UDA>
+void expose_log_sink(py::class_<UDA> &c)
+{
+    c.def("set_log_buffer", &UDA::set_log_buffer, ppnf::log_buffer_docstring().c_str(), py::arg("policy"),
+          py::arg("capacity") = 0u);
+    c.def("get_log_buffer", &UDA::get_log_buffer);
+    c.def("set_log_file", &UDA::set_log_file, ppnf::log_file_docstring().c_str(), py::arg("file"),
+          py::arg("format") = "csv");
+    c.def("get_log_file", &UDA::get_log_file);
+}
+
+// evolve(), releasing the GIL while the solver runs only if no Python code can be called by it: the problem and the
+// batch fitness evaluator of the finite differences (if any) are then C++ objects (pygmo reports the thread safety
+// level of the Python ones, which are evaluated, copied and destroyed without taking the GIL, as none). This way,
+// UDAs evolving C++ UDPs in different Python threads run concurrently.
+template <typename UDA>
+void expose_evolve(py::class_<UDA> &c)
+{
+    c.def("evolve", [](const UDA &uda, const pagmo::population &pop) {
+        if (pop.get_problem().get_thread_safety() == pagmo::thread_safety::none
+            || uda.get_thread_safety() == pagmo::thread_safety::none) {
+            return uda.evolve(pop);
+        }
+        py::gil_scoped_release release;
+        return uda.evolve(pop);
+    });
+}
+
 pagmo::population test_intermodule(const pagmo::population &pop) {
     return pop;
 }
@@ -74,13 +160,41 @@ PYBIND11_MODULE(core, m)
     // expose a trivial function to test the intermodule operability
     m.def("_test_intermodule", &test_intermodule);
 
+    // The statistics of evolve()
+    py::class_<ppnf::evolve_stats> evolve_stats_(m, "evolve_stats", ppnf::evolve_stats_docstring().c_str());
+    evolve_stats_.def(py::init<>());
+    evolve_stats_.def_readonly("load_time", &ppnf::evolve_stats::m_load_time);
+    evolve_stats_.def_readonly("init_time", &ppnf::evolve_stats::m_init_time);
+    evolve_stats_.def_readonly("options_time", &ppnf::evolve_stats::m_options_time);
+    evolve_stats_.def_readonly("setup_time", &ppnf::evolve_stats::m_setup_time);
+    evolve_stats_.def_readonly("solver_time", &ppnf::evolve_stats::m_solver_time);
+    evolve_stats_.def_readonly("callback_time", &ppnf::evolve_stats::m_callback_time);
+    evolve_stats_.def_readonly("total_time", &ppnf::evolve_stats::m_total_time);
+    evolve_stats_.def_readonly("f_calls", &ppnf::evolve_stats::m_f_calls);
+    evolve_stats_.def_readonly("g_calls", &ppnf::evolve_stats::m_g_calls);
+    evolve_stats_.def_readonly("df_calls", &ppnf::evolve_stats::m_df_calls);
+    evolve_stats_.def_readonly("dg_calls", &ppnf::evolve_stats::m_dg_calls);
+    evolve_stats_.def_readonly("hm_calls", &ppnf::evolve_stats::m_hm_calls);
+    evolve_stats_.def_readonly("fidif_calls", &ppnf::evolve_stats::m_fidif_calls);
+    evolve_stats_.def_readonly("cache_hits", &ppnf::evolve_stats::m_cache_hits);
+    evolve_stats_.def_readonly("cache_misses", &ppnf::evolve_stats::m_cache_misses);
+    evolve_stats_.def_readonly("bytes_estimated", &ppnf::evolve_stats::m_bytes_estimated);
+    evolve_stats_.def("__repr__", [](const ppnf::evolve_stats &s) {
+        std::ostringstream oss;
+        oss << s;
+        return oss.str();
+    });
+    evolve_stats_.def(py::pickle(&uda_pickle_getstate<ppnf::evolve_stats>, &uda_pickle_setstate<ppnf::evolve_stats>));
+
     // snopt7
     py::class_<ppnf::snopt7> snopt7_(m, "snopt7", ppnf::snopt7_docstring().c_str());
     snopt7_.def(py::init<>());
     // We expose the additional constructor
     snopt7_.def(py::init<bool, std::string, unsigned>(), py::arg("screen_output") = false,
                 py::arg("library") = "/usr/local/lib/", py::arg("minor_version") = 6);
-    snopt7_.def("evolve", &ppnf::snopt7::evolve);
+    expose_evolve(snopt7_);
+    snopt7_.def("preload", &ppnf::snopt7::preload, ppnf::library_preload_docstring("snopt7_c").c_str());
+    snopt7_.def("unload", &ppnf::snopt7::unload, ppnf::library_unload_docstring("snopt7_c").c_str());
     snopt7_.def("set_verbosity", &ppnf::snopt7::set_verbosity);
     snopt7_.def("get_name", &ppnf::snopt7::get_name);
     snopt7_.def("get_extra_info", &ppnf::snopt7::get_extra_info);
@@ -88,6 +202,35 @@ PYBIND11_MODULE(core, m)
                 ppnf::snopt7_set_integer_option_docstring().c_str(), py::arg("name"), py::arg("value"));
     snopt7_.def("set_numeric_option", &ppnf::snopt7::set_numeric_option,
                 ppnf::snopt7_set_numeric_option_docstring().c_str(), py::arg("name"), py::arg("value"));
+    snopt7_.def("set_warm_start", &ppnf::snopt7::set_warm_start, ppnf::snopt7_set_warm_start_docstring().c_str(),
+                py::arg("flag"), py::arg("tol") = 0., py::arg("capacity") = 16u);
+    snopt7_.def("get_warm_start", &ppnf::snopt7::get_warm_start);
+    snopt7_.def("clear_warm_start", &ppnf::snopt7::clear_warm_start);
+    snopt7_.def("set_cache_capacity", &ppnf::snopt7::set_cache_capacity,
+                ppnf::eval_cache_capacity_docstring(0u).c_str(), py::arg("capacity"));
+    snopt7_.def("get_cache_capacity", &ppnf::snopt7::get_cache_capacity);
+    snopt7_.def("set_concurrent_gradient", &ppnf::snopt7::set_concurrent_gradient,
+                ppnf::concurrent_gradient_docstring("SNOPT7").c_str(), py::arg("flag"));
+    snopt7_.def("get_concurrent_gradient", &ppnf::snopt7::get_concurrent_gradient);
+    snopt7_.def("set_batch_size", &ppnf::snopt7::set_batch_size, ppnf::batch_size_docstring("SNOPT7").c_str(),
+                py::arg("k"));
+    snopt7_.def("get_batch_size", &ppnf::snopt7::get_batch_size);
+    snopt7_.def("set_sparsity_detection", &ppnf::snopt7::set_sparsity_detection,
+                ppnf::snopt7_set_sparsity_detection_docstring().c_str(), py::arg("n_probes"));
+    snopt7_.def("get_sparsity_detection", &ppnf::snopt7::get_sparsity_detection);
+    snopt7_.def("set_linear_detection", &ppnf::snopt7::set_linear_detection,
+                ppnf::snopt7_set_linear_detection_docstring().c_str(), py::arg("n_probes"));
+    snopt7_.def("get_linear_detection", &ppnf::snopt7::get_linear_detection);
+    snopt7_.def("set_persistent_session", &ppnf::snopt7::set_persistent_session,
+                ppnf::snopt7_set_persistent_session_docstring().c_str(), py::arg("flag"));
+    snopt7_.def("get_persistent_session", &ppnf::snopt7::get_persistent_session);
+    expose_fd_gradient(snopt7_, "SNOPT7");
+    expose_log_sink(snopt7_);
+    expose_log_columns(snopt7_);
+    snopt7_.def("set_collect_stats", &ppnf::snopt7::set_collect_stats, ppnf::set_collect_stats_docstring().c_str(),
+                py::arg("flag"));
+    snopt7_.def("get_collect_stats", &ppnf::snopt7::get_collect_stats);
+    snopt7_.def("get_stats", &ppnf::snopt7::get_stats);
     snopt7_.def(py::pickle(&uda_pickle_getstate<ppnf::snopt7>, &uda_pickle_setstate<ppnf::snopt7>));
     expose_algo_log(snopt7_, ppnf::snopt7_get_log_docstring().c_str());
     expose_not_population_based(snopt7_, "snopt7");
@@ -96,7 +239,9 @@ PYBIND11_MODULE(core, m)
     worhp_.def(py::init<>());
     // We expose the additional constructor
     worhp_.def(py::init<bool, std::string>(), py::arg("screen_output") = false, py::arg("library") = "/usr/local/lib/");
-    worhp_.def("evolve", &ppnf::worhp::evolve);
+    expose_evolve(worhp_);
+    worhp_.def("preload", &ppnf::worhp::preload, ppnf::library_preload_docstring("worhp").c_str());
+    worhp_.def("unload", &ppnf::worhp::unload, ppnf::library_unload_docstring("worhp").c_str());
     worhp_.def("set_verbosity", &ppnf::worhp::set_verbosity);
     worhp_.def("get_name", &ppnf::worhp::get_name);
     worhp_.def("get_extra_info", &ppnf::worhp::get_extra_info);
@@ -106,6 +251,41 @@ PYBIND11_MODULE(core, m)
                ppnf::worhp_set_numeric_option_docstring().c_str(), py::arg("name"), py::arg("value"));
     worhp_.def("set_bool_option", &ppnf::worhp::set_bool_option, ppnf::worhp_set_bool_option_docstring().c_str(),
                py::arg("name"), py::arg("value"));
+    worhp_.def("set_cache_capacity", &ppnf::worhp::set_cache_capacity, ppnf::eval_cache_capacity_docstring(8u).c_str(),
+               py::arg("capacity"));
+    worhp_.def("get_cache_capacity", &ppnf::worhp::get_cache_capacity);
+    worhp_.def("set_concurrent_gradient", &ppnf::worhp::set_concurrent_gradient,
+               ppnf::concurrent_gradient_docstring("WORHP").c_str(), py::arg("flag"));
+    worhp_.def("get_concurrent_gradient", &ppnf::worhp::get_concurrent_gradient);
+    worhp_.def("set_warm_start", &ppnf::worhp::set_warm_start, ppnf::worhp_set_warm_start_docstring().c_str(),
+               py::arg("flag"), py::arg("tol") = 0., py::arg("capacity") = 16u);
+    worhp_.def("get_warm_start", &ppnf::worhp::get_warm_start);
+    worhp_.def("clear_warm_start", &ppnf::worhp::clear_warm_start);
+    worhp_.def("set_batch_size", &ppnf::worhp::set_batch_size, ppnf::batch_size_docstring("WORHP").c_str(),
+               py::arg("k"));
+    worhp_.def("get_batch_size", &ppnf::worhp::get_batch_size);
+    worhp_.def("set_collect_stats", &ppnf::worhp::set_collect_stats, ppnf::set_collect_stats_docstring().c_str(),
+               py::arg("flag"));
+    worhp_.def("get_collect_stats", &ppnf::worhp::get_collect_stats);
+    worhp_.def("get_stats", &ppnf::worhp::get_stats);
+    worhp_.def("set_params_caching", &ppnf::worhp::set_params_caching,
+               ppnf::worhp_set_params_caching_docstring().c_str(), py::arg("flag"));
+    worhp_.def("get_params_caching", &ppnf::worhp::get_params_caching);
+    worhp_.def("load_params", &ppnf::worhp::load_params, ppnf::worhp_load_params_docstring().c_str(),
+               py::arg("file") = "");
+    worhp_.def("get_params_file", &ppnf::worhp::get_params_file);
+    worhp_.def("set_xml_params", &ppnf::worhp::set_xml_params, ppnf::worhp_set_xml_params_docstring().c_str(),
+               py::arg("flag"));
+    worhp_.def("get_xml_params", &ppnf::worhp::get_xml_params);
+    worhp_.def("set_persistent_session", &ppnf::worhp::set_persistent_session,
+               ppnf::worhp_set_persistent_session_docstring().c_str(), py::arg("flag"));
+    worhp_.def("get_persistent_session", &ppnf::worhp::get_persistent_session);
+    expose_fd_gradient(worhp_, "WORHP");
+    worhp_.def("set_hessian_structure", &ppnf::worhp::set_hessian_structure,
+               ppnf::worhp_set_hessian_structure_docstring().c_str(), py::arg("strategy"));
+    worhp_.def("get_hessian_structure", &ppnf::worhp::get_hessian_structure);
+    expose_log_sink(worhp_);
+    expose_log_columns(worhp_);
     worhp_.def(py::pickle(&uda_pickle_getstate<ppnf::worhp>, &uda_pickle_setstate<ppnf::worhp>));
     expose_algo_log(worhp_, ppnf::worhp_get_log_docstring().c_str());
     expose_not_population_based(worhp_, "worhp");
@@ -55,6 +55,14 @@ Raises:
    This plugin was tested with snopt version 7.2 as well as with the compiled evaluation libraries (7.7)
    made available via the snopt7 official web site (C/Fortran library).
 
+.. note::
+
+   The Python interpreter lock (GIL) is released while SNOPT7 runs, unless the problem (or the batch evaluator of the
+   finite-difference gradient) is implemented in Python: several instances of this UDA optimising C++ UDPs from
+   different Python threads run concurrently. A single instance can also be evolved from several threads at the same
+   time (its thread safety level is ``constant`` unless a log file, or a finite-difference batch evaluator which is
+   not thread safe, is set): the getters of the results then return those of the last completed evolution.
+
 .. warning::
 
    Constructing this class with an inconsistent *minor_version* parameter results in undefined behaviour.
@@ -64,10 +72,20 @@ Raises:
    A moved-from :cpp:class:`ppnf::snopt7` is destructible and assignable. Any other operation will result
    in undefined behaviour.
 
+.. note::
+
+   SNOPT7 can exploit the linear part of the problem fitness, :math:`F(x) = f(x) + A x`. As pygmo problems do not
+   declare it, this is off by default, and can be activated with :func:`set_linear_detection()`. The gradient of a
+   problem providing it is then evaluated at a few random points within the bounds, and the entries of its sparsity
+   pattern having the same value at all of them are passed to SNOPT7 as :math:`A`. A fitness component with only
+   such entries is linear: its constant term, computed from the fitness at the first probe, is folded into its
+   bounds (``Flow`` and ``Fupp``), or into ``ObjAdd`` for the objective.
+
 .. warning::
 
-   The possibility to exploit the linear part of the problem fitness, part of the original SNOPT7 library,
-   is deactivated in this plugin for pagmo.
+   The linear detection is a heuristic. An entry is classed as constant from the few probe points only, so an
+   entry that is equal at all of them, but not elsewhere, makes SNOPT7 optimise a different problem. An entry
+   evaluating to NaN at the probes is always treated as nonlinear.
 
 .. seealso::
 
@@ -315,6 +333,102 @@ Examples:
 )";
 }
 
+std::string snopt7_set_warm_start_docstring()
+{
+    return R"(set_warm_start(flag, tol = 0., capacity = 16)
+
+Set the warm start mode.
+
+When the warm start mode is active, the final states and multipliers computed by SNOPT7 are stored after each call
+to evolve(), together with the final decision vector. When the individual selected by a later call to evolve() is
+within *tol* (infinity norm) from one of the stored decision vectors, snOptA is called with a warm start using the
+stored states and multipliers. At most *capacity* states are stored, the least recently used ones being discarded first.
+
+Args:
+   flag (``bool``): ``True`` activates the warm start mode, ``False`` deactivates it
+   tol (``float``): the matching tolerance on the decision vector
+   capacity (``int``): the maximum number of stored states
+
+Raises:
+    ValueError: if *tol* is negative or NaN
+    unspecified: any exception thrown by failures at the intersection between C++ and Python (e.g.,
+      type conversion errors, mismatched function signatures, etc.)
+
+)";
+}
+
+std::string snopt7_set_sparsity_detection_docstring()
+{
+    return R"(set_sparsity_detection(n_probes)
+
+Set the gradient sparsity detection.
+
+When a problem does not declare its gradient sparsity, it is assumed dense, which may be wasteful for large
+problems that are implicitly sparse. With *n_probes* larger than zero, the structural nonzeros of the gradient
+of such problems are detected at *n_probes* random points within the bounds (from the gradient if the problem
+provides it, otherwise perturbing each variable, at the cost of *n_probes* * (nx + 1) fitness evaluations), and
+SNOPT7 is given the detected pattern. The detected patterns are cached and reused for problems with the same
+type, name, dimensions and bounds.
+
+.. warning::
+
+   The detection is a heuristic: a gradient entry vanishing at all the probes is taken as a structural zero.
+
+Args:
+   n_probes (``int``): the number of random points used for the detection (zero, the default, disables it)
+
+)";
+}
+
+std::string snopt7_set_linear_detection_docstring()
+{
+    return R"(set_linear_detection(n_probes)
+
+Set the linear structure detection.
+
+SNOPT7 treats separately the linear part of the problem, :math:`F(x) = f(x) + Ax`: the constant entries of the
+jacobian are not evaluated by the callbacks, and the linear constraints are satisfied exactly by the QP subproblems.
+As pygmo problems do not declare their linear part, it is switched off by default. With *n_probes* larger than zero,
+the gradient of a problem providing it is evaluated at *n_probes* random points within the bounds, and the entries
+of the gradient sparsity (declared, or detected as per ``set_sparsity_detection()``) having the same value at all
+the probes are passed to SNOPT7 as the matrix :math:`A`. The fitness components having only constant entries are
+linear, and their constant term is moved into the bounds. The detection is repeated by each call to ``evolve()``,
+at the cost of *n_probes* gradient evaluations and one fitness evaluation, and it is skipped for problems not
+providing the gradient.
+
+.. warning::
+
+   The detection is a heuristic: a gradient entry having the same value at all the probes is taken as constant.
+
+Args:
+   n_probes (``int``): the number of random points used for the detection (zero, the default, disables it)
+
+Raises:
+   ValueError: if *n_probes* is one
+
+)";
+}
+
+std::string snopt7_set_persistent_session_docstring()
+{
+    return R"(set_persistent_session(flag)
+
+Set the persistent session mode.
+
+By default, each call to ``evolve()`` initialises a SNOPT7 workspace, sets all the options and frees the workspace
+at the end. With the persistent session mode active, the initialised workspaces are kept by the algorithm and reused
+by later calls to ``evolve()`` on problems with the same name, and only the options which changed since the previous
+run are set again. This may save a noticeable share of the runtime of short runs on small problems.
+
+Each workspace is used by one run at a time. The workspaces are not copied, pickled or deep-copied along with the
+algorithm, and deactivating the mode frees them.
+
+Args:
+   flag (``bool``): ``True`` to activate the persistent session mode, ``False`` (the default) to deactivate it
+
+)";
+}
+
 std::string worhp_docstring()
 {
     return R"(__init__(screen_output = false, library = '\usr\local\lib\libworhp.so')
@@ -369,6 +483,14 @@ Raises:
    This plugin for the WORHP was developed around version 1.12.1 of the worhp library. It will not 
    work with versions having a different amajor or minor version.
 
+.. note::
+
+   The Python interpreter lock (GIL) is released while WORHP runs, unless the problem (or the batch evaluator of the
+   finite-difference gradient) is implemented in Python: several instances of this UDA optimising C++ UDPs from
+   different Python threads run concurrently. A single instance can also be evolved from several threads at the same
+   time (its thread safety level is ``constant`` unless a log file, or a finite-difference batch evaluator which is
+   not thread safe, is set): the getters of the results then return those of the last completed evolution.
+
 .. warning::
 
    A moved-from :cpp:class:`ppnf::worhp` is destructible and assignable. Any other operation will result
@@ -427,7 +549,7 @@ Examples:
     WORHP plugin for pagmo/pygmo: 
         The gradient sparsity is assumed dense: 130 components detected.
         The gradient is computed numerically by WORHP.
-        The hessian of the lagrangian sparsity has: 91 components.
+        The hessian of the lagrangian sparsity has: 91 components (dense).
         The hessian of the lagrangian is computed numerically by WORHP.
     <BLANKLINE>
     The following parameters have been set by pagmo to values other than their xml provided ones (or their default ones): 
@@ -530,6 +652,375 @@ Args:
 )";
 }
 
+std::string worhp_set_params_caching_docstring()
+{
+    return R"(set_params_caching(flag)
+
+Set the parameter file caching.
+
+By default, each call to ``evolve()`` reads the WORHP parameters from the XML parameter file (see
+:func:`load_params()`). With the caching active, the file is read once into an in-memory snapshot, which is used by
+later calls to ``evolve()`` as long as the modification time and the size of the file do not change (the file is then
+read again). The snapshot is shared by the copies of the algorithm.
+
+Args:
+   flag (``bool``): ``True`` to activate the parameter file caching, ``False`` (the default) to deactivate it
+
+)";
+}
+
+std::string worhp_load_params_docstring()
+{
+    return R"(load_params(file = "")
+
+Load the parameter file.
+
+Reads the WORHP parameters from the XML file *file* into the in-memory snapshot and activates the parameter file
+caching (see :func:`set_params_caching()`). With an empty *file*, the WORHP default is used: the file named by the
+environment variable ``WORHP_PARAM_FILE``, if set, otherwise ``param.xml`` in the current directory.
+
+Args:
+   file (``str``): the XML parameter file
+
+Raises:
+   ValueError: if *file* is not empty and it is not a file
+   unspecified: any exception thrown by the loading of the WORHP library
+
+)";
+}
+
+std::string worhp_set_xml_params_docstring()
+{
+    return R"(set_xml_params(flag)
+
+Set the XML parameter file lookup.
+
+When deactivated, ``evolve()`` does not look up (nor read) the XML parameter file: the parameters take the WORHP default
+values, except those set by pygmo and the options set by the user.
+
+Args:
+   flag (``bool``): ``True`` (the default) to activate the XML parameter file lookup, ``False`` to deactivate it
+
+)";
+}
+
+std::string worhp_set_warm_start_docstring()
+{
+    return R"(set_warm_start(flag, tol = 0., capacity = 16)
+
+Set the warm start mode.
+
+When the warm start mode is active, the final multipliers (``Lambda`` and ``Mu``), the scaling of the objective and
+the penalties of the merit function computed by WORHP are stored after each successful call to evolve(), together
+with the final decision vector. When the individual selected by a later call to evolve() is within *tol* (infinity
+norm) from one of the stored decision vectors, WORHP starts from the stored multipliers, scaling and penalties. At most
+*capacity* states are stored, the least recently used ones being discarded first. The stored states are pickled
+with the UDA.
+
+Args:
+   flag (``bool``): ``True`` activates the warm start mode, ``False`` deactivates it
+   tol (``float``): the matching tolerance on the decision vector
+   capacity (``int``): the maximum number of stored states
+
+Raises:
+    ValueError: if *tol* is negative or NaN
+    unspecified: any exception thrown by failures at the intersection between C++ and Python (e.g.,
+      type conversion errors, mismatched function signatures, etc.)
+
+)";
+}
+
+std::string worhp_set_hessian_structure_docstring()
+{
+    return R"(set_hessian_structure(strategy)
+
+Set the strategy for the structure of the hessian of the lagrangian.
+
+When a problem does not provide its hessians, WORHP approximates the hessian of the lagrangian by BFGS updates on the
+structure passed by pygmo, whose size determines the memory used by WORHP. The allowed strategies are:
+
+* ``"dense"``: the lower triangular part of the hessian, that is :math:`n_x (n_x + 1) / 2` entries,
+* ``"gradient"``: the structure derived from the gradient sparsity, as the hessian of each fitness component can only be
+  non-zero between the variables the component depends upon, WORHP then using block BFGS with intersecting blocks (the
+  ``BFGSmethod`` integer option is set to 2, unless set by the user),
+* ``"diagonal"``: the diagonal alone, WORHP then using limited-memory BFGS (the ``BFGSmethod`` integer option is set to
+  100, unless set by the user),
+* ``"auto"`` (the default): the hessians sparsity of the problem, if provided, otherwise the dense structure for small
+  problems (up to about 1.4k variables), otherwise the structure derived from the gradient sparsity if its size is at
+  most 16 times that of the gradient sparsity (plus :math:`n_x`), otherwise the diagonal structure.
+
+The hessians provided by a problem always use the structure given by its hessians sparsity.
+
+Args:
+   strategy (``str``): the strategy, ``"auto"``, ``"dense"``, ``"gradient"`` or ``"diagonal"``
+
+Raises:
+    ValueError: if *strategy* is not one of the allowed values
+
+)";
+}
+
+std::string worhp_set_persistent_session_docstring()
+{
+    return R"(set_persistent_session(flag)
+
+Set the persistent session mode.
+
+By default, each call to ``evolve()`` initialises the WORHP data structures, sets the parameters, fills the
+sparsity structures and frees everything at the end. With the persistent session mode active, the initialised WORHP
+instances are kept by the algorithm: a later call to ``evolve()`` on a problem with the same dimensions, sparsity
+patterns, constraint tolerances and options only restarts an instance, resetting its iterate and control state,
+while anything else triggers a full initialisation.
+
+Each instance is used by one run at a time. The instances are not copied, pickled or deep-copied along with the
+algorithm, and deactivating the mode frees them. If the WORHP library does not export ``WorhpRestart``, the mode has
+no effect.
+
+Args:
+   flag (``bool``): ``True`` to activate the persistent session mode, ``False`` (the default) to deactivate it
+
+)";
+}
+
+// Utilities for implementing the exposition of the run-time loaded libraries.
+std::string library_preload_docstring(const std::string &lib)
+{
+    return R"(preload()
+
+Preload the )" + lib + R"( library.
+
+The )" + lib + R"( library is loaded at run-time, and its symbols resolved, the first time it is needed. The loaded
+library is then kept in a process-wide registry and shared by all subsequent calls to evolve() of all the instances
+using the same library, from any thread. This method forces the loading to happen immediately (e.g., at start-up)
+rather than during the first call to evolve(). Calling it on an already loaded library has no effect.
+
+Raises:
+   ValueError: if the library cannot be loaded or does not contain the expected symbols
+
+)";
+}
+
+std::string library_unload_docstring(const std::string &lib)
+{
+    return R"(unload()
+
+Unload the )" + lib + R"( library.
+
+This method removes the )" + lib + R"( library used by this object from the process-wide registry (see preload()).
+Evolves that are already running keep their own reference to the library, which is effectively unloaded when the last
+of them ends. The next call to evolve() or preload() will load the library again.
+
+Returns:
+   ``bool``: ``True`` if the library was in the registry, ``False`` otherwise
+
+)";
+}
+
+std::string eval_cache_capacity_docstring(unsigned default_capacity)
+{
+    return R"(set_cache_capacity(capacity)
+
+Set the capacity of the evaluation cache.
+
+During evolve(), the fitness and gradient evaluations requested by the solver are stored in a least recently used
+cache holding at most *capacity* decision vectors, so that revisited points are not evaluated again. The number of
+cache hits and misses of the last call to evolve() is reported by get_extra_info(). A capacity of zero disables
+the cache. The default capacity is )" + std::to_string(default_capacity) + R"(.
+
+Args:
+   capacity (``int``): the maximum number of decision vectors stored in the cache
+
+)";
+}
+
+std::string batch_size_docstring(const std::string &algo)
+{
+    return R"(set_batch_size(k)
+
+Set the batch size.
+
+By default, evolve() optimises the single individual selected by the selection policy. With a batch size *k* larger
+than one, evolve() selects instead *k* individuals with the same policy (the *k* best, the *k* worst, *k* random
+individuals or, if the selection policy is an index, the *k* individuals starting from that index) and optimises them
+concurrently, each with its own )" + algo + R"( instance. Each improved individual then replaces the one it originates
+from, and the replacement policy is not used. The problem is shared among the instances if its thread safety level
+is ``constant``, copied if it is ``basic``, and the instances run sequentially if it is ``none``. Only the first of
+the selected individuals is logged.
+
+Args:
+   k (``int``): the number of individuals optimised by each call to evolve()
+
+Raises:
+   ValueError: if *k* is zero
+
+)";
+}
+
+std::string concurrent_gradient_docstring(const std::string &algo)
+{
+    return R"(set_concurrent_gradient(flag)
+
+Set the concurrent evaluation of fitness and gradient.
+
+By default, when )" + algo + R"( needs both the fitness and the gradient at a point, they are evaluated one after the
+other. If this mode is active and the thread safety level of the problem is ``constant``, the gradient is instead
+evaluated by a helper thread (one per )" + algo + R"( instance) while the fitness is evaluated by the calling thread,
+and stored in the evaluation cache (which then holds at least one decision vector). This pays off for problems whose
+fitness and gradient are computed independently (e.g., an adjoint gradient). WORHP requests the objective and the
+gradients in separate calls: the gradient is then evaluated speculatively as soon as the objective is requested at a
+new point, also at points (e.g., in the line search) where it is not needed. The mode is off by default.
+
+Args:
+   flag (``bool``): ``True`` to evaluate fitness and gradient concurrently, ``False`` otherwise
+
+)";
+}
+
+std::string fd_gradient_docstring(const std::string &algo)
+{
+    return R"(set_fd_gradient(b = None, scheme = "forward", step = 0.)
+
+Set the finite-difference gradient computed by the plugin.
+
+When a problem does not provide its gradient, )" + algo + R"( approximates it by finite differences, perturbing one
+variable per fitness evaluation. After a call to this method, the plugin computes instead the finite differences
+itself, and )" + algo + R"( is given the result as if the problem provided its gradient. The variables are perturbed in
+groups (Curtis-Powell-Reid method): a greedy colouring of the gradient sparsity, computed once per call to evolve(),
+puts in the same group variables which do not affect the same fitness components. The forward scheme then costs one
+fitness evaluation per group plus one per gradient, the central scheme two per group and is more accurate. The number
+of groups is reported in the verbose output.
+
+The evaluations are performed sequentially or, if *b* is given, all the perturbed decision vectors needed by a
+gradient are evaluated with a single call to the batch fitness evaluator *b* (e.g., a :class:`pygmo.thread_bfe` or a
+:class:`pygmo.member_bfe`). They are counted as fitness evaluations of the problem. Problems providing their gradient
+are not affected.
+
+The variable :math:`x_j` is perturbed by :math:`h \max(1, |x_j|)`, where :math:`h` is the relative step. A perturbation
+leaving the bounds is reversed (forward scheme), or replaced by a one-sided difference (central scheme).
+
+The plugin-side finite differences are disabled by ``unset_fd_gradient()``, and the settings are returned by
+``has_fd_gradient()``, ``get_fd_scheme()`` and ``get_fd_step()``.
+
+Args:
+   b (:class:`pygmo.bfe` or ``None``): the batch fitness evaluator (``None`` for sequential evaluations)
+   scheme (``str``): the finite-difference scheme, ``"forward"`` or ``"central"``
+   step (``float``): the relative step (zero selects the default, the square root of the machine epsilon for the
+     forward scheme and its cube root for the central scheme)
+
+Raises:
+   ValueError: if *scheme* is not one of the allowed values, or if *step* is negative or not finite
+
+)";
+}
+
+std::string log_columns_docstring()
+{
+    return R"(get_log_columns()
+
+Returns:
+    ``dict``: the optimisation log of the last call to evolve(), with the same content as ``get_log()``, as a
+    dictionary of one-dimensional NumPy arrays:
+
+    * ``fevals`` (unsigned integers), the number of objective function evaluations made so far
+    * ``objval`` (``float64``), the objective function value for the current decision vector
+    * ``violated`` (unsigned integers), the number of constraints violated by the current decision vector
+    * ``viol_norm`` (``float64``), the constraints violation norm for the current decision vector
+    * ``feasible`` (``bool``), the feasibility flag of the current decision vector (as determined by pagmo)
+
+The arrays are read-only views of the log stored by the algorithm, so that no conversion is performed, and they
+remain valid (and unchanged) after further calls to evolve(), which store a new log.
+
+)";
+}
+
+std::string log_buffer_docstring()
+{
+    return R"(set_log_buffer(policy, capacity = 0)
+
+Set the policy of the in-memory log.
+
+By default, all the log lines of a run are kept in memory and returned by ``get_log()``. The ``"ring"`` policy keeps
+the last *capacity* lines, the ``"decimate"`` policy keeps at most *capacity* lines evenly spread over the run (once
+the buffer is full, every other line is dropped and only half of the following lines are recorded), and the
+``"unbounded"`` policy (the default) keeps all the lines. The current policy is returned by ``get_log_buffer()``.
+
+The log lines are printed, written to the log file (see ``set_log_file()``) and recorded by a background thread, so
+that the fitness callbacks of the solver are not slowed down by the logging.
+
+Args:
+   policy (``str``): the policy of the in-memory log, ``"unbounded"``, ``"ring"`` or ``"decimate"``
+   capacity (``int``): the maximum number of lines kept in memory (ignored by the ``"unbounded"`` policy)
+
+Raises:
+   ValueError: if *policy* is not one of the allowed values, or if *capacity* is zero for the ``"ring"`` and
+     ``"decimate"`` policies
+
+)";
+}
+
+std::string log_file_docstring()
+{
+    return R"(set_log_file(file, format = "csv")
+
+Set the log file.
+
+If *file* is not empty, the log lines of each run are also appended to *file*, together with the seconds elapsed
+since the start of the run. In the ``"csv"`` format each line contains the number of objective evaluations, the
+objective value, the number of violated constraints, the constraints violation norm, the feasibility flag and the
+time, and a header line is written to new files. In the ``"binary"`` format each line is a record of 41 bytes, in the
+native byte order, with the same fields (as ``uint64``, ``double``, ``uint64``, ``double``, ``uint8`` and ``double``).
+The current file is returned by ``get_log_file()``. An error writing the file does not interrupt the run: the log
+lines are still kept in memory, and the error is reported by ``get_extra_info()``.
+
+Args:
+   file (``str``): the path of the log file (empty to disable it)
+   format (``str``): the format of the log file, ``"csv"`` or ``"binary"``
+
+Raises:
+   ValueError: if *format* is not one of the allowed values
+
+)";
+}
+
+std::string evolve_stats_docstring()
+{
+    return R"(Statistics of a call to evolve().
+
+The statistics are collected, if requested via ``set_collect_stats()``, during each call to evolve(). Times are
+wall-clock times in seconds. In batch mode the times and counters of the solver instances are summed.
+
+The following read-only attributes are available:
+
+* ``load_time``, ``init_time``, ``options_time``, ``setup_time``, ``solver_time``, ``callback_time`` and
+  ``total_time``: the time spent fetching the solver library, initialising the solver, setting its options,
+  preparing the problem, in the solver itself (excluding the callbacks), in the callbacks and in the whole evolve(),
+* ``f_calls``, ``g_calls``, ``df_calls``, ``dg_calls``, ``hm_calls`` and ``fidif_calls``: the number of requests of
+  the objective, the constraints, their gradients, the hessian of the lagrangian and of finite differences steps
+  (for SNOPT7, ``f_calls`` and ``df_calls`` count the requests of the whole fitness and of its gradient),
+* ``cache_hits`` and ``cache_misses``: the fitness and gradient requests served by the evaluation cache
+  and evaluated on the problem,
+* ``bytes_estimated``: the bytes of the solver arrays, estimated from their sizes.
+
+)";
+}
+
+std::string set_collect_stats_docstring()
+{
+    return R"(set_collect_stats(flag)
+
+Activate the collection of statistics.
+
+If active, each call to evolve() records the time spent in its phases, the number of callbacks of each kind, the
+evaluation cache hits and misses and the estimated bytes of the solver arrays. The statistics of the last call to
+evolve() are returned by ``get_stats()`` (as an :class:`~pygmo_plugins_nonfree.evolve_stats`) and reported by
+``get_extra_info()``. The collection is off by default.
+
+Args:
+   flag (``bool``): ``True`` to collect the statistics, ``False`` otherwise
+
+)";
+}
+
 // Utilities for implementing the exposition of algorithms
 // which inherit from not_population_based.
 std::string bls_selection_docstring(const std::string &algo)
@@ -9,17 +9,41 @@ namespace ppnf
 std::string bls_selection_docstring(const std::string &);
 std::string bls_replacement_docstring(const std::string &);
 std::string bls_set_random_sr_seed_docstring(const std::string &);
+// run-time loaded libraries.
+std::string library_preload_docstring(const std::string &);
+std::string library_unload_docstring(const std::string &);
+std::string eval_cache_capacity_docstring(unsigned default_capacity);
+std::string batch_size_docstring(const std::string &);
+std::string concurrent_gradient_docstring(const std::string &);
+std::string fd_gradient_docstring(const std::string &);
+// Log buffer and log file.
+std::string log_buffer_docstring();
+std::string log_file_docstring();
+std::string log_columns_docstring();
+// evolve() statistics.
+std::string evolve_stats_docstring();
+std::string set_collect_stats_docstring();
 // snopt7
 std::string snopt7_docstring();
 std::string snopt7_get_log_docstring();
 std::string snopt7_set_integer_option_docstring();
 std::string snopt7_set_numeric_option_docstring();
+std::string snopt7_set_warm_start_docstring();
+std::string snopt7_set_sparsity_detection_docstring();
+std::string snopt7_set_linear_detection_docstring();
+std::string snopt7_set_persistent_session_docstring();
 // worhp
 std::string worhp_docstring();
 std::string worhp_get_log_docstring();
 std::string worhp_set_integer_option_docstring();
 std::string worhp_set_numeric_option_docstring();
 std::string worhp_set_bool_option_docstring();
+std::string worhp_set_params_caching_docstring();
+std::string worhp_load_params_docstring();
+std::string worhp_set_xml_params_docstring();
+std::string worhp_set_persistent_session_docstring();
+std::string worhp_set_warm_start_docstring();
+std::string worhp_set_hessian_structure_docstring();
 }
 
 #endif
@@ -55,6 +55,84 @@ class worhp_test_case(_ut.TestCase):
         self.assertEqual(pop.get_f()[0], pop2.get_f()[0])
 
 
+class gil_release_test_case(_ut.TestCase):
+    """Test case for the release of the GIL during evolve().
+    """
+
+    def runTest(self):
+        from .core import snopt7, worhp
+        for uda_type, library in [(snopt7, "/usr/local/lib/libsnopt7.so"), (worhp, "/usr/local/lib/libworhp.so")]:
+            udas = [uda_type(screen_output=False, library=library) for _ in range(2)]
+            try:
+                udas[0].preload()
+            except ValueError:
+                # The solver library is not available.
+                continue
+            self.run_test_concurrency(udas)
+            self.run_test_python_udp(udas[0])
+
+    def run_test_concurrency(self, udas):
+        import pygmo as pg
+        import threading
+        import time
+        # Two threads evolve C++ UDPs, while a third one counts in Python.
+        pops = [pg.population(pg.rosenbrock(100), 1, seed=i) for i in range(2)]
+        ticks = [0]
+        done = threading.Event()
+
+        def ticker():
+            while not done.is_set():
+                ticks[0] += 1
+                time.sleep(1e-3)
+
+        intervals = [None, None]
+
+        def solve(i):
+            start = time.perf_counter()
+            pops[i] = udas[i].evolve(pops[i])
+            intervals[i] = (start, time.perf_counter())
+
+        tick_thread = threading.Thread(target=ticker)
+        tick_thread.start()
+        solvers = [threading.Thread(target=solve, args=(i,)) for i in range(2)]
+        start = time.perf_counter()
+        for t in solvers:
+            t.start()
+        for t in solvers:
+            t.join()
+        elapsed = time.perf_counter() - start
+        done.set()
+        tick_thread.join()
+        for pop in pops:
+            self.assertEqual(pop.get_problem().get_nx(), 100)
+        # If the GIL was held by evolve(), the counter could only advance before and after the two calls, and the
+        # two evolutions could not overlap in time.
+        if elapsed > 0.1:
+            self.assertGreater(ticks[0], elapsed * 100)
+            self.assertLess(max(iv[0] for iv in intervals), min(iv[1] for iv in intervals))
+
+    def run_test_python_udp(self, uda):
+        import pygmo as pg
+
+        # A Python UDP is evaluated with the GIL held.
+        class sphere:
+            def fitness(self, x):
+                return [sum(xi * xi for xi in x)]
+
+            def gradient(self, x):
+                return [2. * xi for xi in x]
+
+            def get_bounds(self):
+                return ([-5.] * 3, [5.] * 3)
+
+        prob = pg.problem(sphere())
+        self.assertEqual(prob.get_thread_safety(), pg.thread_safety.none)
+        pop = pg.population(prob, 1, seed=3)
+        pop = uda.evolve(pop)
+        self.assertGreater(pop.get_problem().get_fevals(), 1)
+        self.assertTrue(pop.get_problem().is_(sphere))
+
+
 def run_test_suite(level=0):
     """Run the full test suite.
     This function will raise an exception if at least one test fails.
@@ -71,6 +149,7 @@ def run_test_suite(level=0):
     retval = 0
     suite = _ut.TestLoader().loadTestsFromTestCase(snopt7_test_case)
     suite.addTest(worhp_test_case())
+    suite.addTest(gil_release_test_case())
 
     test_result = _ut.TextTestRunner(verbosity=2).run(suite)
 
@@ -0,0 +1,73 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#include <ostream>
+
+#include <pagmo_plugins_nonfree/evolve_stats.hpp>
+
+namespace ppnf
+{
+
+/// Stream operator for ppnf::evolve_stats.
+/**
+ * @param os the target stream.
+ * @param s the statistics to be streamed.
+ *
+ * @return a reference to \p os.
+ */
+std::ostream &operator<<(std::ostream &os, const evolve_stats &s)
+{
+    os << "\tTimes (s), total: " << s.m_total_time << ", library: " << s.m_load_time << ", init: " << s.m_init_time
+       << ", options: " << s.m_options_time << ", setup: " << s.m_setup_time << ", solver: " << s.m_solver_time
+       << ", callbacks: " << s.m_callback_time;
+    os << "\n\tCallbacks, F: " << s.m_f_calls << ", G: " << s.m_g_calls << ", DF: " << s.m_df_calls
+       << ", DG: " << s.m_dg_calls << ", HM: " << s.m_hm_calls << ", fidif: " << s.m_fidif_calls;
+    os << "\n\tCache hits/misses: " << s.m_cache_hits << "/" << s.m_cache_misses
+       << ", bytes (estimated): " << s.m_bytes_estimated;
+    return os;
+}
+
+} // namespace ppnf
@@ -0,0 +1,88 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#include <mutex>
+#include <shared_mutex>
+#include <typeindex>
+#include <unordered_map>
+
+#include <pagmo_plugins_nonfree/inplace.hpp>
+
+namespace ppnf
+{
+namespace detail
+{
+namespace
+{
+// The process-wide table of the registered in-place UDPs.
+struct inplace_registry {
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::type_index, inplace_hooks> m_hooks;
+};
+
+inplace_registry &get_inplace_registry()
+{
+    static inplace_registry reg;
+    return reg;
+}
+} // namespace
+
+void register_inplace_hooks(const std::type_index &t, const inplace_hooks &hooks)
+{
+    auto &reg = get_inplace_registry();
+    std::unique_lock<std::shared_mutex> lock(reg.m_mutex);
+    reg.m_hooks[t] = hooks;
+}
+
+inplace_hooks get_inplace_hooks(const std::type_index &t)
+{
+    auto &reg = get_inplace_registry();
+    std::shared_lock<std::shared_mutex> lock(reg.m_mutex);
+    const auto it = reg.m_hooks.find(t);
+    return it == reg.m_hooks.end() ? inplace_hooks{} : it->second;
+}
+} // namespace detail
+} // namespace ppnf
@@ -0,0 +1,262 @@
+/* Copyright 2018 PaGMO development team
+This file is part of "pagmo plugins nonfree", a PaGMO affiliated library.
+The "pagmo plugins nonfree" library, is free software;
+you can redistribute it and/or modify it under the terms of either:
+  * the GNU Lesser General Public License as published by the Free
+    Software Foundation; either version 3 of the License, or (at your
+    option) any later version.
+or
+  * the GNU General Public License as published by the Free Software
+    Foundation; either version 3 of the License, or (at your option) any
+    later version.
+or both in parallel, as here.
+
+Linking "pagmo plugins nonfree" statically or dynamically with other modules is
+making a combined work based on "pagmo plugins nonfree". Thus, the terms and conditions
+of the GNU General Public License cover the whole combination.
+
+As a special exception, the copyright holders of "pagmo plugins nonfree" give you
+permission to combine ABC program with free software programs or libraries that are
+released under the GNU LGPL and with independent modules that communicate with
+"pagmo plugins nonfree" solely through the interface defined by the headers included in
+"pagmo plugins nonfree" bogus_libs folder.
+You may copy and distribute such a system following the terms of the licence
+for "pagmo plugins nonfree" and the licenses of the other code concerned, provided that
+you include the source code of that other code when and as the "pagmo plugins nonfree" licence
+requires distribution of source code and provided that you do not modify the interface defined in the bogus_libs folder
+
+Note that people who make modified versions of "pagmo plugins nonfree" are not obligated to grant this special
+exception for their modified versions; it is their choice whether to do so.
+The GNU General Public License gives permission to release a modified version without this exception;
+this exception also makes it possible to release a modified version which carries forward this exception.
+If you modify the interface defined in the bogus_libs folder, this exception does not apply to your
+modified version of "pagmo plugins nonfree", and you must remove this exception when you distribute your modified
+version.
+
+This exception is an additional permission under section 7 of the GNU General Public License, version 3 (“GPLv3”)
+
+The "pagmo plugins nonfree" library, and its affiliated librares are distributed in the hope
+that they will be useful, but WITHOUT ANY WARRANTY;
+without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+for more details.
+You should have received copies of the GNU General Public License and the
+GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
+see https://www.gnu.org/licenses/. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <pagmo/exceptions.hpp>
+#include <pagmo/io.hpp>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <pagmo_plugins_nonfree/detail/log_sink.hpp>
+
+namespace ppnf
+{
+namespace detail
+{
+void log_settings::set_buffer(const std::string &policy, unsigned capacity)
+{
+    if (policy != "unbounded" && policy != "ring" && policy != "decimate") {
+        pagmo_throw(std::invalid_argument,
+                    "The log buffer policy must be one of 'unbounded', 'ring' or 'decimate', while '" + policy
+                        + "' was detected");
+    }
+    if (policy != "unbounded" && !capacity) {
+        pagmo_throw(std::invalid_argument, "The capacity of a '" + policy + "' log buffer must be nonzero");
+    }
+    m_buffer = policy;
+    m_capacity = policy == "unbounded" ? 0u : capacity;
+}
+
+void log_settings::set_file(const std::string &file, const std::string &format)
+{
+    if (format != "csv" && format != "binary") {
+        pagmo_throw(std::invalid_argument,
+                    "The log file format must be either 'csv' or 'binary', while '" + format + "' was detected");
+    }
+    m_file = file;
+    m_format = format;
+}
+
+async_log_sink::async_log_sink(const log_settings &settings, bool screen)
+    : m_settings(settings), m_screen(screen), m_start(std::chrono::steady_clock::now()), m_queue(queue_size)
+{
+    if (!m_settings.m_file.empty()) {
+        // NOTE: the log lines are appended, and the CSV header is written only to a new (or empty) file.
+        m_file.open(m_settings.m_file, m_settings.m_format == "csv" ? std::ios::app : std::ios::app | std::ios::binary);
+        if (!m_file) {
+            pagmo_throw(std::invalid_argument, "Could not open the log file " + m_settings.m_file);
+        }
+        if (m_settings.m_format == "csv") {
+            m_file.seekp(0, std::ios::end);
+            if (m_file.tellp() == std::streampos(0)) {
+                m_file << "fevals,objval,violated,viol_norm,feasible,time\n";
+            }
+            m_file << std::setprecision(std::numeric_limits<double>::max_digits10);
+        }
+    }
+    if (m_settings.m_buffer == "ring") {
+        m_lines.reserve(m_settings.m_capacity);
+    }
+    m_thread = std::thread([this]() { consume(); });
+}
+
+async_log_sink::~async_log_sink()
+{
+    stop();
+}
+
+void async_log_sink::stop()
+{
+    if (m_thread.joinable()) {
+        m_done.store(true);
+        wake();
+        m_thread.join();
+    }
+}
+
+void async_log_sink::wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_sleeping.store(true);
+    m_cv.wait(lock, [this]() {
+        return m_done.load() || m_tail.load() != m_head.load(std::memory_order_relaxed);
+    });
+    m_sleeping.store(false);
+}
+
+void async_log_sink::wake()
+{
+    // NOTE: the mutex is taken so that the notification cannot fall between the check of the predicate and the
+    // wait of the consumer.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_cv.notify_one();
+}
+
+void async_log_sink::consume()
+{
+    while (true) {
+        // NOTE: the done flag is read before the queue, so that no record pushed before it was set is lost.
+        const auto done = m_done.load();
+        const auto head = m_head.load(std::memory_order_relaxed);
+        const auto tail = m_tail.load();
+        if (head == tail) {
+            if (done) {
+                break;
+            }
+            wait();
+            continue;
+        }
+        for (auto i = head; i != tail; ++i) {
+            // NOTE: a record which cannot be processed (e.g., for lack of memory) is dropped, so that the producer
+            // is never blocked.
+            try {
+                process(m_queue[i % queue_size]);
+            } catch (const std::exception &e) {
+                if (m_error.empty()) {
+                    m_error = e.what();
+                }
+            }
+        }
+        m_head.store(tail, std::memory_order_release);
+    }
+    if (m_file.is_open() && !m_file.flush()) {
+        m_error = "Could not write to the log file " + m_settings.m_file;
+    }
+}
+
+void async_log_sink::process(const log_record &r)
+{
+    if (m_screen) {
+        if (!(m_n_records % 50u)) {
+            // Every 50 lines print the column names.
+            pagmo::print("\n", std::setw(10), "objevals:", std::setw(15), "objval:", std::setw(15), "violated:",
+                         std::setw(15), "viol. norm:", '\n');
+        }
+        pagmo::print(std::setw(10), r.m_fevals, std::setw(15), r.m_objval, std::setw(15), r.m_violated,
+                     std::setw(15), r.m_viol_norm, r.m_feasible ? "" : " i", '\n');
+    }
+    // NOTE: after a write error, the log file is closed and the records are only stored in memory.
+    if (m_file.is_open()) {
+        if (m_settings.m_format == "csv") {
+            m_file << r.m_fevals << ',' << r.m_objval << ',' << r.m_violated << ',' << r.m_viol_norm << ','
+                   << r.m_feasible << ',' << r.m_time << '\n';
+        } else {
+            // Fixed-size binary records, in the native byte order: uint64 fevals, double objval, uint64 violated,
+            // double viol_norm, uint8 feasible, double time.
+            const auto fevals = static_cast<std::uint64_t>(r.m_fevals);
+            const auto violated = static_cast<std::uint64_t>(r.m_violated);
+            const auto feasible = static_cast<std::uint8_t>(r.m_feasible);
+            m_file.write(reinterpret_cast<const char *>(&fevals), sizeof(fevals));
+            m_file.write(reinterpret_cast<const char *>(&r.m_objval), sizeof(r.m_objval));
+            m_file.write(reinterpret_cast<const char *>(&violated), sizeof(violated));
+            m_file.write(reinterpret_cast<const char *>(&r.m_viol_norm), sizeof(r.m_viol_norm));
+            m_file.write(reinterpret_cast<const char *>(&feasible), sizeof(feasible));
+            m_file.write(reinterpret_cast<const char *>(&r.m_time), sizeof(r.m_time));
+        }
+        if (!m_file) {
+            m_error = "Could not write to the log file " + m_settings.m_file;
+            m_file.close();
+        }
+    }
+    const log_line_type line(r.m_fevals, r.m_objval, r.m_violated, r.m_viol_norm, r.m_feasible);
+    const auto capacity = static_cast<std::size_t>(m_settings.m_capacity);
+    if (m_settings.m_buffer == "ring") {
+        // Once full, the oldest line is overwritten.
+        if (m_lines.size() < capacity) {
+            m_lines.push_back(line);
+        } else {
+            m_lines[m_ring_pos] = line;
+            m_ring_pos = (m_ring_pos + 1u) % capacity;
+        }
+    } else if (m_settings.m_buffer == "decimate") {
+        // The stored lines are those of the records 0, m_stride, 2 * m_stride, ... Once full, every other line is
+        // dropped and the stride doubles.
+        if (!(m_n_records % m_stride)) {
+            if (m_lines.size() == capacity) {
+                std::size_t w = 0u;
+                for (std::size_t j = 0u; j < m_lines.size(); j += 2u) {
+                    m_lines[w++] = m_lines[j];
+                }
+                m_lines.resize(w);
+                m_stride *= 2u;
+            }
+            if (!(m_n_records % m_stride) && m_lines.size() < capacity) {
+                m_lines.push_back(line);
+            }
+        }
+    } else {
+        m_lines.push_back(line);
+    }
+    ++m_n_records;
+}
+
+log_columns async_log_sink::finish()
+{
+    stop();
+    // The ring buffer is returned in chronological order.
+    std::rotate(m_lines.begin(), m_lines.begin() + static_cast<std::ptrdiff_t>(m_ring_pos), m_lines.end());
+    m_ring_pos = 0u;
+    log_columns retval;
+    retval.reserve(m_lines.size());
+    for (const auto &line : m_lines) {
+        retval.push_back(std::get<0>(line), std::get<1>(line), std::get<2>(line), std::get<3>(line),
+                         std::get<4>(line));
+    }
+    m_lines.clear();
+    return retval;
+}
+} // namespace detail
+} // namespace ppnf
@@ -44,15 +44,16 @@ You should have received copies of the GNU General Public License and the
 GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
 see https://www.gnu.org/licenses/. */
 
-#include <algorithm> // std::min_element
+#include <algorithm> // std::min_element, std::find_if, std::rotate
 #include <boost/dll/import.hpp>
 #include <boost/dll/shared_library.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/serialization/map.hpp>
+#include <cmath>
 #include <exception>
-#include <iomanip>
+#include <functional>
 #include <limits> // std::numeric_limits
-#include <mutex>
+#include <memory>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/not_population_based.hpp>
 #include <pagmo/config.hpp>
@@ -70,6 +71,8 @@ see https://www.gnu.org/licenses/. */
 #include <unordered_map>
 #include <vector>
 
+#include <pagmo_plugins_nonfree/detail/batch.hpp>
+#include <pagmo_plugins_nonfree/detail/library_registry.hpp>
 #include <pagmo_plugins_nonfree/snopt7.hpp>
 
 extern "C" {
@@ -87,29 +90,69 @@ namespace ppnf
 {
 namespace detail
 {
-// We use this to ensure deleteSNOPT is called also if exceptions occur.
-template <typename snProblem>
-struct sn_problem_raii {
-    sn_problem_raii(snProblem *p, char *a, char *b, int n,
-                    std::function<void(snProblem *, char *, char *, int)> &snInit,
-                    std::function<void(snProblem *)> &deleteSNOPT)
-        : m_prob(p), m_deleteSNOPT(deleteSNOPT)
+// A SNOPT7 workspace initialised by snInit, see snopt7_session. The base class identifies the library,
+// the screen output flag and the problem name the workspace was initialised with.
+struct snopt7_session_base {
+    snopt7_session_base(const void *lib, bool screen_output, const std::string &name)
+        : m_lib_id(lib), m_screen_output(screen_output), m_name(name)
     {
-        snInit(p, a, b, n);
     }
-    ~sn_problem_raii()
+    snopt7_session_base(const snopt7_session_base &) = delete;
+    snopt7_session_base &operator=(const snopt7_session_base &) = delete;
+    virtual ~snopt7_session_base() = default;
+    bool matches(const void *lib, bool screen_output, const std::string &name) const
     {
-        m_deleteSNOPT(m_prob);
+        return m_lib_id == lib && m_screen_output == screen_output && m_name == name;
     }
-    snProblem *m_prob;
-    std::function<void(snProblem *)> &m_deleteSNOPT;
+    const void *m_lib_id;
+    bool m_screen_output;
+    std::string m_name;
+};
+
+// The idle persistent sessions of a snopt7 instance.
+struct snopt7_session_pool {
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<snopt7_session_base>> m_idle;
 };
 
+snopt7_session_holder::snopt7_session_holder() : m_pool(std::make_shared<snopt7_session_pool>()) {}
+
+snopt7_session_holder::snopt7_session_holder(const snopt7_session_holder &) : snopt7_session_holder() {}
+
+snopt7_session_holder::snopt7_session_holder(snopt7_session_holder &&) : snopt7_session_holder() {}
+
+// NOTE: the target keeps its own sessions, which are only used if they match the library, screen output and
+// problem of later runs (the options are re-applied as needed).
+snopt7_session_holder &snopt7_session_holder::operator=(const snopt7_session_holder &)
+{
+    return *this;
+}
+
+snopt7_session_holder &snopt7_session_holder::operator=(snopt7_session_holder &&)
+{
+    return *this;
+}
+
+snopt7_session_holder::~snopt7_session_holder() = default;
+
+snopt7_session_pool &snopt7_session_holder::get() const
+{
+    return *m_pool;
+}
+
+void snopt7_session_holder::clear() const
+{
+    std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+    m_pool->m_idle.clear();
+}
+
+
 inline void snopt_fitness_wrapper(int *Status, int *n, double x[], int *needF, int *nF, double F[], int *needG,
                                   int *neG, double G[], char cu[], int *lencu, int iu[], int *leniu, double ru[],
                                   int *lenru)
 {
     (void)n;
+    (void)neG;
     (void)cu;
     (void)lencu;
     (void)ru;
@@ -118,54 +161,74 @@ inline void snopt_fitness_wrapper(int *Status, int *n, double x[], int *needF, i
     // First we recover the info we have hidden in the workspace
     auto &info = *(static_cast<detail::user_data *>(static_cast<void *>(iu)));
     auto &verb = info.m_verbosity;
-    auto &log = info.m_log;
     auto &f_count = info.m_objfun_counter;
     auto &p = info.m_prob;
     auto &dv = info.m_dv;
-    // We copy the decision vector into the vector_double
-    std::copy(x, x + p->get_nx(), dv.begin());
-    // We try to call the UDP fitness and gradient
+    // The time spent here is accounted to the callbacks (if the statistics are collected).
+    phase_timer timer(info.m_stats ? &info.m_stats->m_callback_time : nullptr);
+    if (info.m_stats) {
+        info.m_stats->m_f_calls += (*needF > 0);
+        info.m_stats->m_df_calls += (*needG > 0);
+    }
+    // We copy the decision vector into the (preallocated) vector_double
+    std::copy(x, x + dv.size(), dv.begin());
+    // We try to call the UDP fitness and gradient. Their values are written directly into F and G,
+    // so that no memory is allocated here if the UDP implements the in-place methods.
     try {
         if (*needF > 0) {
-            auto fit = p->fitness(dv);
-            for (size_t i = 0u; i < static_cast<size_t>(*nF); ++i) {
-                F[i] = fit[i];
+            // Both are evaluated in one pass if the UDP implements the combined method, otherwise, in concurrent
+            // mode, the gradient is evaluated by a helper thread while the fitness is evaluated here.
+            if (*needG > 0 && info.m_has_gradient) {
+                info.m_cache->prefetch(dv.data(), dv.size());
             }
+            info.m_cache->fitness(dv, F);
 
-            if (verb && !(f_count % verb)) {
+            if (info.m_log_sink && !(f_count % verb)) {
+                const auto nf = static_cast<pagmo::vector_double::size_type>(*nF);
+                const auto &ctol = info.m_c_tol;
                 // Constraints bits.
-                const auto ctol = p->get_c_tol();
-                const auto c1eq
-                    = pagmo::detail::test_eq_constraints(fit.data() + 1, fit.data() + 1 + p->get_nec(), ctol.data());
-                const auto c1ineq = pagmo::detail::test_ineq_constraints(
-                    fit.data() + 1 + p->get_nec(), fit.data() + fit.size(), ctol.data() + p->get_nec());
+                const auto c1eq = pagmo::detail::test_eq_constraints(F + 1, F + 1 + info.m_nec, ctol.data());
+                const auto c1ineq
+                    = pagmo::detail::test_ineq_constraints(F + 1 + info.m_nec, F + nf, ctol.data() + info.m_nec);
                 // This will be the total number of violated constraints.
                 const auto nv = p->get_nc() - c1eq.first - c1ineq.first;
                 // This will be the norm of the violation.
                 const auto l = c1eq.second + c1ineq.second;
-                // Test feasibility.
-                const auto feas = p->feasibility_f(fit);
-
-                if (!(f_count / verb % 50u)) {
-                    // Every 50 lines print the column names.
-                    pagmo::print("\n", std::setw(10), "objevals:", std::setw(15), "objval:", std::setw(15),
-                                 "violated:", std::setw(15), "viol. norm:", '\n');
-                }
-                // Print to screen the log line.
-                pagmo::print(std::setw(10), f_count + 1u, std::setw(15), fit[0], std::setw(15), nv, std::setw(15), l,
-                             feas ? "" : " i", '\n');
-                // Record the log.
-                log.emplace_back(f_count + 1u, fit[0], nv, l, feas);
+                // Test feasibility (same as p->feasibility_f(), without constructing the fitness vector).
+                const auto feas = (nv == 0u);
+                // The line is printed and recorded by the background thread of the sink.
+                info.m_log_sink->push(f_count + 1u, F[0], nv, l, feas);
             }
 
             // Update the counter.
             ++f_count;
+
+            if (info.m_linear) {
+                // snOptA adds the linear part A x to the values returned here: we return the nonlinear remainder,
+                // and zero for the linear components (whose constant term is in the bounds).
+                const auto &lin = *info.m_linear;
+                for (decltype(lin.m_A.size()) k = 0u; k < lin.m_A.size(); ++k) {
+                    F[lin.m_iAfun[k]] -= lin.m_A[k] * x[lin.m_jAvar[k]];
+                }
+                for (decltype(lin.m_linear_row.size()) i = 0u; i < lin.m_linear_row.size(); ++i) {
+                    if (lin.m_linear_row[i]) {
+                        F[i] = 0.;
+                    }
+                }
+            }
         }
 
-        if (*needG > 0 && p->has_gradient()) {
-            auto grad = p->gradient(dv);
-            for (size_t i = 0u; i < static_cast<size_t>(*neG); ++i) {
-                G[i] = grad[i];
+        if (*needG > 0 && info.m_has_gradient) {
+            if (info.m_gather_idx) {
+                // The sparsity was detected by probing (the UDP gradient is dense) or the linear part is passed
+                // separately: we gather the entries of G from the UDP gradient.
+                info.m_cache->gradient(dv, info.m_full_g.data());
+                const auto &idx = *info.m_gather_idx;
+                for (decltype(idx.size()) k = 0u; k < idx.size(); ++k) {
+                    G[k] = info.m_full_g[idx[k]];
+                }
+            } else {
+                info.m_cache->gradient(dv, G);
             }
         }
     } catch (...) {
@@ -223,13 +286,541 @@ const std::unordered_map<int, std::string> results
        {141, "System error - wrong number of basic variables"},
        {142, "System error - error in basis package"}};
 
-std::mutex library_load_mutex;
+// The SNOPT7 C interface symbols used by the plugin. The table owns the shared library, so the
+// symbols remain valid for as long as the table is alive.
+template <typename snProblem>
+struct snopt7_lib {
+    boost::dll::shared_library m_lib;
+    std::function<void(snProblem *, char *, char *, int)> snInit;
+    std::function<int(snProblem *, char[], int)> setIntParameter;
+    std::function<int(snProblem *, char[], double)> setRealParameter;
+    std::function<void(snProblem *)> deleteSNOPT;
+    std::function<int(snProblem *, int, int, int, double, int, snFunA, int, int *, int *, double *, int, int *, int *,
+                      double *, double *, double *, double *, double *, int *, double *, double *, int *, double *,
+                      int *, int *, double *)>
+        solveA;
+};
+
+// A SNOPT7 workspace, initialised by snInit on construction and freed by deleteSNOPT on destruction,
+// together with the options applied to it.
+template <typename snProblem>
+struct snopt7_session final : snopt7_session_base {
+    snopt7_session(std::shared_ptr<const snopt7_lib<snProblem>> lib, const std::string &name, bool screen_output)
+        : snopt7_session_base(lib.get(), screen_output, name), m_lib(std::move(lib)), m_c_name(s_to_C(name))
+    {
+        init();
+    }
+    ~snopt7_session()
+    {
+        m_lib->deleteSNOPT(&m_problem);
+    }
+    void init()
+    {
+        m_lib->snInit(&m_problem, m_c_name.data(), m_print_file, m_screen_output);
+        m_integer_opts.clear();
+        m_numeric_opts.clear();
+    }
+    // Brings the options of the workspace to the requested ones, setting only those which changed since the last
+    // call. As options cannot be unset, the workspace is initialised again if an option previously set is not
+    // requested anymore.
+    void apply_options(const std::map<std::string, int> &integer_opts,
+                       const std::map<std::string, double> &numeric_opts)
+    {
+        const auto stale_integer = std::any_of(m_integer_opts.begin(), m_integer_opts.end(),
+                                               [&integer_opts](const auto &p) { return !integer_opts.count(p.first); });
+        const auto stale_numeric = std::any_of(m_numeric_opts.begin(), m_numeric_opts.end(),
+                                               [&numeric_opts](const auto &p) { return !numeric_opts.count(p.first); });
+        if (stale_integer || stale_numeric) {
+            m_lib->deleteSNOPT(&m_problem);
+            init();
+        }
+        for (const auto &p : numeric_opts) {
+            const auto it = m_numeric_opts.find(p.first);
+            if (it != m_numeric_opts.end() && it->second == p.second) {
+                continue;
+            }
+            auto option_name = s_to_C(p.first);
+            if (m_lib->setRealParameter(&m_problem, option_name.data(), p.second) > 0) {
+                pagmo_throw(std::invalid_argument,
+                            "The option '" + p.first + "' was requested by the user to be set to the float value "
+                                + std::to_string(p.second)
+                                + ", but SNOPT7 interface returned an error. Did you mispell the option name?");
+            }
+            m_numeric_opts[p.first] = p.second;
+        }
+        for (const auto &p : integer_opts) {
+            const auto it = m_integer_opts.find(p.first);
+            if (it != m_integer_opts.end() && it->second == p.second) {
+                continue;
+            }
+            auto option_name = s_to_C(p.first);
+            if (m_lib->setIntParameter(&m_problem, option_name.data(), p.second) > 0) {
+                pagmo_throw(std::invalid_argument,
+                            "The option '" + p.first + "' was requested by the user to be set to the int value "
+                                + std::to_string(p.second)
+                                + ", but SNOPT7 interface returned an error. Did you mispell the option name?");
+            }
+            m_integer_opts[p.first] = p.second;
+        }
+    }
+    // NOTE: the library is kept alive for as long as the workspace exists.
+    std::shared_ptr<const snopt7_lib<snProblem>> m_lib;
+    snProblem m_problem;
+    // The strings passed to snInit.
+    std::vector<char> m_c_name;
+    char m_print_file[1] = {'\0'};
+    // The options applied to the workspace.
+    std::map<std::string, int> m_integer_opts;
+    std::map<std::string, double> m_numeric_opts;
+};
+
+// Exclusive use of a SNOPT7 session for the duration of a run. If a pool is given, a matching idle session is taken
+// from it (or a new one is created) and is given back to it on destruction. Otherwise the session is created for
+// the run only.
+template <typename snProblem>
+class snopt7_session_lease
+{
+public:
+    snopt7_session_lease(snopt7_session_pool *pool, const std::shared_ptr<const snopt7_lib<snProblem>> &lib,
+                         const std::string &name, bool screen_output)
+        : m_pool(pool)
+    {
+        if (m_pool) {
+            std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+            auto &idle = m_pool->m_idle;
+            const auto it = std::find_if(idle.begin(), idle.end(), [&](const auto &s) {
+                return s->matches(lib.get(), screen_output, name);
+            });
+            if (it != idle.end()) {
+                m_session.reset(static_cast<snopt7_session<snProblem> *>(it->release()));
+                idle.erase(it);
+            }
+        }
+        if (!m_session) {
+            m_session = std::make_unique<snopt7_session<snProblem>>(lib, name, screen_output);
+        }
+    }
+    snopt7_session_lease(const snopt7_session_lease &) = delete;
+    snopt7_session_lease &operator=(const snopt7_session_lease &) = delete;
+    ~snopt7_session_lease()
+    {
+        if (m_pool) {
+            try {
+                std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+                m_pool->m_idle.push_back(std::move(m_session));
+            } catch (...) {
+                // The session could not be given back: it is simply freed.
+            }
+        }
+    }
+    snopt7_session<snProblem> *operator->() const
+    {
+        return m_session.get();
+    }
+
+private:
+    snopt7_session_pool *m_pool;
+    std::unique_ptr<snopt7_session<snProblem>> m_session;
+};
+
+// Loads the snopt7_c library at run time and locates the symbols used.
+template <typename snProblem>
+std::shared_ptr<const snopt7_lib<snProblem>> load_snopt7_lib(const std::string &snopt7_c_library)
+{
+    auto retval = std::make_shared<snopt7_lib<snProblem>>();
+    try {
+        boost::filesystem::path path_to_lib(snopt7_c_library);
+        if (!boost::filesystem::is_regular_file(path_to_lib)) {
+            pagmo_throw(std::invalid_argument, "The snopt7_c library path was constructed to be: "
+                                                   + path_to_lib.string() + " and it does not appear to be a file");
+        }
+        retval->m_lib.load(path_to_lib);
+        auto &libsnopt7_c = retval->m_lib;
+        // We then load the symbols we need for the SNOPT7 plugin
+        retval->snInit = boost::dll::import_symbol<void(snProblem *, char *, char *,
+                                                        int)>( // type of the function to import
+            libsnopt7_c,                                       // the library
+            "snInit"                                           // name of the function to import
+        );
+
+        retval->setIntParameter
+            = boost::dll::import_symbol<int(snProblem *, char[], int)>( // type of the function to import
+                libsnopt7_c,                                            // the library
+                "setIntParameter"                                       // name of the function to import
+            );
+
+        retval->setRealParameter
+            = boost::dll::import_symbol<int(snProblem *, char[], double)>( // type of the function to import
+                libsnopt7_c,                                               // the library
+                "setRealParameter"                                         // name of the function to import
+            );
+
+        retval->deleteSNOPT = boost::dll::import_symbol<void(snProblem *)>( // type of the function to import
+            libsnopt7_c,                                                    // the library
+            "deleteSNOPT"                                                   // name of the function to import
+        );
+
+        retval->solveA
+            = boost::dll::import_symbol<int(snProblem *, int, int, int, double, int, snFunA, int, int *, int *,
+                                            double *, int, int *, int *, double *, double *, double *, double *,
+                                            double *, int *, double *, double *, int *, double *, int *, int *,
+                                            double *)>( // type of the function to import
+                libsnopt7_c,                            // the library
+                "solveA"                                // name of the function to import
+            );
+    } catch (const std::exception &e) {
+        std::string message(
+            R"(
+An error occurred while loading the snopt7_c library at run-time. This is typically caused by one of the following
+reasons:
+
+- The file declared to be the snopt7_c library, i.e. )"
+            + snopt7_c_library
+            + R"(, is not a shared library containing the necessary C interface symbols (is the file path really pointing to
+a valid shared library?)
+ - The library is found and it does contain the C interface symbols, but it needs linking to some additional libraries that are not found
+at run-time.
+
+We report the exact text of the original exception thrown:
+
+ )" + std::string(e.what()));
+        pagmo_throw(std::invalid_argument, message);
+    }
+    return retval;
+}
+
+// Looks for a stored warm start state matching the decision vector x (i.e. with the same problem name and sizes,
+// and with a decision vector within tol from x in the infinity norm). Returns states.end() if none is found.
+std::vector<snopt7_warm_start>::iterator find_warm_start(std::vector<snopt7_warm_start> &states,
+                                                         const std::string &prob_name, const pagmo::vector_double &x,
+                                                         pagmo::vector_double::size_type nF, double tol)
+{
+    return std::find_if(states.begin(), states.end(), [&](const snopt7_warm_start &ws) {
+        if (ws.m_prob_name != prob_name || ws.m_x.size() != x.size() || ws.m_Fstate.size() != nF) {
+            return false;
+        }
+        for (decltype(x.size()) i = 0u; i < x.size(); ++i) {
+            if (!(std::abs(ws.m_x[i] - x[i]) <= tol)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+// The registry of the loaded snopt7_c libraries (one per snProblem version), keyed by path and minor version.
+template <typename snProblem>
+library_registry<std::pair<std::string, unsigned>, snopt7_lib<snProblem>> &snopt7_registry()
+{
+    static library_registry<std::pair<std::string, unsigned>, snopt7_lib<snProblem>> registry;
+    return registry;
+}
+
+template <typename snProblem>
+std::shared_ptr<const snopt7_lib<snProblem>> get_snopt7_lib(const std::string &snopt7_c_library,
+                                                             unsigned minor_version)
+{
+    return snopt7_registry<snProblem>().get({snopt7_c_library, minor_version}, [&snopt7_c_library]() {
+        return load_snopt7_lib<snProblem>(snopt7_c_library);
+    });
+}
+
+// The settings of a snopt7 instance used by a single call to snOptA.
+struct snopt7_settings {
+    const std::map<std::string, int> &m_integer_opts;
+    const std::map<std::string, double> &m_numeric_opts;
+    bool m_screen_output;
+    unsigned m_cache_capacity;
+    bool m_concurrent_gradient;
+    bool m_collect_stats;
+    // The gradient sparsity detected by probing (null if the sparsity declared by the problem is used).
+    const probed_sparsity *m_probed;
+    // The linear part of the fitness (null if not detected).
+    const linear_structure *m_linear;
+    // The pool of persistent sessions (null if the session is not persistent).
+    snopt7_session_pool *m_sessions;
+    // The colouring of the gradient sparsity used by the finite-difference gradients (null if they are not computed
+    // by the plugin), their batch fitness evaluator (null for sequential evaluations), scheme and relative step.
+    const fd_colouring *m_fd_colouring;
+    const pagmo::bfe *m_fd_bfe;
+    bool m_fd_central;
+    double m_fd_step;
+    // The log settings.
+    const log_settings &m_log;
+};
+
+// The input and the outcome of a single call to snOptA.
+struct snopt7_run {
+    // The starting point and its fitness.
+    pagmo::vector_double m_x0;
+    pagmo::vector_double m_f0;
+    // Start parameter of snOptA (0 cold, 2 warm) and the states and multipliers,
+    // initial on input and final on output.
+    int m_start = 0;
+    std::vector<int> m_xstate;
+    pagmo::vector_double m_xmul;
+    std::vector<int> m_Fstate;
+    pagmo::vector_double m_Fmul;
+    // The final decision vector and fitness.
+    pagmo::vector_double m_x;
+    pagmo::vector_double m_F;
+    // snOptA return value, log (and the error writing its file, if any), evaluation cache counters and statistics.
+    int m_res = 0;
+    log_columns m_log;
+    std::string m_log_error;
+    eval_cache_stats m_cache_stats;
+    evolve_stats m_stats;
+    // This exception pointer will be null, unless an error is raised during the
+    // computation of the objfun or constraints.
+    std::exception_ptr m_eptr;
+};
+
+// Optimises, with its own snOptA workspace, the starting point of run.
+template <typename snProblem>
+void snopt7_solve(const std::shared_ptr<const snopt7_lib<snProblem>> &lib, const snopt7_settings &settings,
+                  pagmo::problem &prob, snopt7_run &run, unsigned verbosity)
+{
+    auto dim = prob.get_nx();
+    const auto bounds = prob.get_bounds();
+    const auto &lb = bounds.first;
+    const auto &ub = bounds.second;
+    const auto &solveA = lib->solveA;
+    // The statistics of the run, if collected.
+    evolve_stats *stats = settings.m_collect_stats ? &run.m_stats : nullptr;
+
+    // The gradient is computed by finite differences in the plugin if the problem does not provide it and
+    // this was requested. SNOPT7 then sees the problem as one providing its gradient.
+    const bool plugin_fd = settings.m_fd_colouring != nullptr;
+    const bool has_gradient = prob.has_gradient() || plugin_fd;
+
+    // ------- The options passed to SNOPT7: those set by the user, plus "Derivative option", set according
+    // to has_gradient, and "Major feasibility tolerance", for which the logic is as follows:
+    // - if the user provides the "Major feasibility tolerance" option, use that *unconditionally*. Otherwise,
+    // - compute the minimum tolerance min_tol among those returned by  problem.c_tol(). If zero, ignore
+    //   it and use the SNOPT7 default value for "Major feasibility tolerance" (1e-6). Otherwise, use min_tol as
+    //   the value for "Major feasibility tolerance".
+    auto integer_opts = settings.m_integer_opts;
+    auto numeric_opts = settings.m_numeric_opts;
+    integer_opts["Derivative option"] = has_gradient ? 3 : 0;
+    if (prob.get_nc() && !settings.m_numeric_opts.count("Major feasibility tolerance")) {
+        const auto c_tol = prob.get_c_tol();
+        assert(!c_tol.empty());
+        const double min_tol = *std::min_element(c_tol.begin(), c_tol.end());
+        if (min_tol > 0.) {
+            numeric_opts["Major feasibility tolerance"] = min_tol;
+        }
+    }
+
+    // ------- We init the SNOPT workspace (suppressing the file output. TODO: should we allow the file output?)
+    // The workspace is taken from the pool of persistent sessions, if any, otherwise it is created here (calling
+    // snInit) and destroyed (calling deleteSNOPT) at the end of the run.
+    phase_timer init_timer(stats ? &stats->m_init_time : nullptr);
+    snopt7_session_lease<snProblem> session(settings.m_sessions, lib, prob.get_name(), settings.m_screen_output);
+    init_timer.stop();
+    auto &snopt7_problem = session->m_problem;
+
+    // ------- We set the options (only those changed since the last run, for a persistent session)
+    phase_timer options_timer(stats ? &stats->m_options_time : nullptr);
+    session->apply_options(integer_opts, numeric_opts);
+    options_timer.stop();
+
+    // ------- We define various inputs to call the snOptA interface
+    phase_timer setup_timer(stats ? &stats->m_setup_time : nullptr);
+    auto nF = prob.get_nf(); // Fitness dimension
+    auto n = prob.get_nx();  // Decision vector dimension
+
+    // ------- Setting the bounds. -----------------------------------------------------------------------------
+    pagmo::vector_double xlow(n), xupp(n);
+    pagmo::vector_double Flow(nF), Fupp(nF);
+    // decision vector.
+    for (decltype(dim) i = 0u; i < dim; ++i) {
+        xlow[i] = lb[i];
+        xupp[i] = ub[i];
+    }
+    // fitness vector.
+    Flow[0] = -std::numeric_limits<double>::max(); // obj
+    Fupp[0] = std::numeric_limits<double>::max();
+    for (decltype(prob.get_nec()) i = 0u; i < prob.get_nec(); ++i) { // ec
+        Flow[i + 1] = 0.;
+        Fupp[i + 1] = 0.;
+    }
+    for (decltype(prob.get_nic()) i = 0u; i < prob.get_nic(); ++i) { // ic
+        Flow[i + 1 + prob.get_nec()] = -std::numeric_limits<double>::max();
+        Fupp[i + 1 + prob.get_nec()] = 0.;
+    }
+
+    // ------- Setting the initial point ---------------------------------------------------------------------
+    // The states and multipliers have been initialised by the caller (possibly from a stored warm start state).
+    run.m_x = run.m_x0;
+    run.m_F = run.m_f0;
+
+    // ------- Some inits for quantities needed by the snOptA interface
+    int ObjRow = 0;
+    double ObjAdd = 0;
+    int nS, nInf;
+    double sInf;
+    // We use the user workspace (iu variable) to hide a pointer to user_data,
+    // so that it may be accessed in the user-defined function.
+    user_data info;
+    inplace_evaluator eval(prob);
+    info.m_prob = &prob;
+    info.m_verbosity = verbosity;
+    info.m_dv = pagmo::vector_double(dim);
+    info.m_c_tol = prob.get_c_tol();
+    info.m_nec = prob.get_nec();
+    info.m_has_gradient = has_gradient;
+    info.m_stats = stats;
+    snopt7_problem.iu = reinterpret_cast<int *>(&info);
+
+    // -------- Linear Part Of the Problem. -------------------------------------------------------------------
+    // As pagmo does not support linear problems, the linear part is switched off unless it was detected. Its
+    // constant terms are moved into the bounds (into ObjAdd, for the objective).
+    const auto *linear = settings.m_linear;
+    int neA = linear ? static_cast<int>(linear->m_A.size()) : 0;
+    const auto lenA = std::max<std::size_t>(static_cast<std::size_t>(neA), 1u); // Thats the minimum length allowed
+    std::vector<int> iAfun(lenA);
+    std::vector<int> jAvar(lenA);
+    pagmo::vector_double A(lenA);
+    if (linear) {
+        std::copy(linear->m_iAfun.begin(), linear->m_iAfun.end(), iAfun.begin());
+        std::copy(linear->m_jAvar.begin(), linear->m_jAvar.end(), jAvar.begin());
+        std::copy(linear->m_A.begin(), linear->m_A.end(), A.begin());
+        ObjAdd = linear->m_constant[0];
+        for (decltype(nF) i = 1u; i < nF; ++i) {
+            if (std::abs(Flow[i]) != std::numeric_limits<double>::max()) {
+                Flow[i] -= linear->m_constant[i];
+            }
+            if (std::abs(Fupp[i]) != std::numeric_limits<double>::max()) {
+                Fupp[i] -= linear->m_constant[i];
+            }
+        }
+        info.m_linear = linear;
+    }
+
+    // -------- Non Linear Part Of the Problem. ----------------------------------------------------------------
+    // The gradient sparsity is either the one declared by the problem or the one detected by probing. In the
+    // latter case the problem returns a dense gradient, whose structural nonzeros are gathered by the callback.
+    // If the linear part was detected, only the nonlinear entries are passed to snOptA.
+    pagmo::sparsity_pattern declared_sparsity;
+    if (!settings.m_probed) {
+        declared_sparsity = prob.gradient_sparsity();
+    }
+    const auto &sparsity = settings.m_probed ? settings.m_probed->m_pattern : declared_sparsity;
+    const auto &nl_sparsity = linear ? linear->m_pattern : sparsity;
+    int neG = static_cast<int>(nl_sparsity.size());
+    const auto lenG = std::max<std::size_t>(nl_sparsity.size(), 1u);
+    auto ng = sparsity.size();
+    if (settings.m_probed && prob.has_gradient()) {
+        ng = nF * n;
+        info.m_gather_idx = &settings.m_probed->m_dense_idx;
+    }
+    if (linear) {
+        info.m_gather_idx = &linear->m_gradient_idx;
+    }
+    if (info.m_gather_idx) {
+        info.m_full_g.resize(ng);
+    }
+    // The finite differences are computed directly in the structure passed to snOptA.
+    std::unique_ptr<fd_gradient> fd;
+    if (plugin_fd) {
+        fd = std::make_unique<fd_gradient>(prob, settings.m_fd_bfe, sparsity, *settings.m_fd_colouring,
+                                           settings.m_fd_central, settings.m_fd_step);
+        eval.set_fd_gradient(fd.get());
+    }
+    // All the evaluations requested by snOptA go through the (optional) evaluation cache.
+    // If requested and the problem allows it, the gradient is evaluated concurrently with the fitness.
+    const bool concurrent
+        = settings.m_concurrent_gradient && prob.get_thread_safety() == pagmo::thread_safety::constant;
+    eval_cache cache(eval, n, nF, has_gradient ? ng : 0u, settings.m_cache_capacity, concurrent);
+    info.m_cache = &cache;
+    std::vector<int> iGfun(lenG);
+    std::vector<int> jGvar(lenG);
+    for (decltype(nl_sparsity.size()) i = 0u; i < nl_sparsity.size(); ++i) {
+        iGfun[i] = static_cast<int>(nl_sparsity[i].first);
+        jGvar[i] = static_cast<int>(nl_sparsity[i].second);
+    }
+    setup_timer.stop();
+
+    // ------- We call the snOptA interface.
+    if (verbosity > 0u) {
+        pagmo::print("SNOPT7 plugin for pagmo/pygmo: \n");
+        if (prob.has_gradient_sparsity()) {
+            pagmo::print("The gradient sparsity is provided by the user: ", neG, " components detected.\n");
+        } else if (settings.m_probed) {
+            pagmo::print("The gradient sparsity is detected by probing: ", neG, " components detected.\n");
+        } else {
+            pagmo::print("The gradient sparsity is assumed dense: ", neG, " components detected.\n");
+        }
+        if (linear) {
+            pagmo::print("The linear part of the fitness is detected: ", neA, " constant components, ",
+                         std::count(linear->m_linear_row.begin(), linear->m_linear_row.end(), 1),
+                         " linear fitness components.\n");
+        }
+        if (prob.has_gradient()) {
+            pagmo::print("The gradient is provided by the user.\n");
+        } else if (plugin_fd) {
+            pagmo::print("The gradient is computed by ", settings.m_fd_central ? "central" : "forward",
+                         " finite differences in the plugin: ", settings.m_fd_colouring->m_n_colours,
+                         " colours detected, ", fd->n_points(), " evaluations per gradient.\n");
+        } else {
+            pagmo::print("The gradient is computed numerically by SNOPT7.\n");
+        }
+        if (run.m_start == 2) {
+            pagmo::print("Warm start from a previously stored state.\n");
+        }
+    }
+    // The log lines are printed and recorded by an asynchronous sink, if the run is logged.
+    std::unique_ptr<async_log_sink> log_sink;
+    if (verbosity > 0u) {
+        log_sink = std::make_unique<async_log_sink>(settings.m_log, true);
+        info.m_log_sink = log_sink.get();
+    }
+    // The time spent in solveA, minus the time spent in the callbacks, is the time spent by the solver.
+    double solve_time = 0.;
+    const double callback_time0 = stats ? stats->m_callback_time : 0.;
+    phase_timer solve_timer(stats ? &solve_time : nullptr);
+    run.m_res = solveA(&snopt7_problem, run.m_start, static_cast<int>(nF), static_cast<int>(n), ObjAdd, ObjRow,
+                       snopt_fitness_wrapper, neA, iAfun.data(), jAvar.data(), A.data(), neG, iGfun.data(),
+                       jGvar.data(), xlow.data(), xupp.data(), Flow.data(), Fupp.data(), run.m_x.data(),
+                       run.m_xstate.data(), run.m_xmul.data(), run.m_F.data(), run.m_Fstate.data(),
+                       run.m_Fmul.data(), &nS, &nInf, &sInf);
+    solve_timer.stop();
+    // ------- Store the log and the outcome -----------------------------------------------------------------
+    if (log_sink) {
+        run.m_log = log_sink->finish();
+        run.m_log_error = log_sink->get_error();
+    }
+    if (linear && !info.m_eptr) {
+        // The final fitness is evaluated in full, as the linear components returned by snOptA lack their
+        // constant terms.
+        cache.fitness(run.m_x, run.m_F.data());
+    }
+    if (verbosity > 0u) {
+        pagmo::print("\n", results.at(run.m_res), "\n");
+        if (!run.m_log_error.empty()) {
+            pagmo::print(run.m_log_error, "\n");
+        }
+    }
+    run.m_cache_stats = cache.get_stats();
+    run.m_eptr = info.m_eptr;
+    if (stats) {
+        stats->m_solver_time += solve_time - (stats->m_callback_time - callback_time0);
+        stats->m_cache_hits += run.m_cache_stats.m_f_hits + run.m_cache_stats.m_g_hits;
+        stats->m_cache_misses += run.m_cache_stats.m_f_misses + run.m_cache_stats.m_g_misses;
+        // Bounds, starting point, states and multipliers, linear and nonlinear structures, the decision
+        // vector in user_data and the entries of the evaluation cache.
+        const auto n_doubles
+            = 5u * (n + nF) + lenA + n + info.m_full_g.size() + settings.m_cache_capacity * (n + nF + ng);
+        const auto n_ints = n + nF + 2u * (lenA + lenG);
+        stats->m_bytes_estimated += n_doubles * sizeof(double) + n_ints * sizeof(int);
+    }
+}
 } // namespace
 } // namespace detail
 
 snopt7::snopt7(bool screen_output, std::string snopt7_c_library, unsigned minor_version)
     : m_snopt7_c_library(snopt7_c_library), m_minor_version(minor_version), m_integer_opts(), m_numeric_opts(),
-      m_screen_output(screen_output), m_verbosity(0), m_log()
+      m_screen_output(screen_output), m_verbosity(0)
 {
 }
 
@@ -286,6 +877,42 @@ pagmo::population snopt7::evolve(pagmo::population pop) const
     }
 }
 
+/// Preload the snopt7_c library.
+/**
+ * The snopt7_c library is loaded at run-time, and its symbols resolved, the first time it is needed. The loaded
+ * library is then kept in a process-wide registry (keyed by library path and minor version) and shared by all
+ * subsequent calls to evolve() of all ppnf::snopt7 instances, from any thread. This method forces the loading to
+ * happen immediately (e.g., at program start-up) rather than during the first call to evolve().
+ * Calling it on an already loaded library has no effect.
+ *
+ * @throws std::invalid_argument if the library cannot be loaded or does not contain the expected symbols.
+ */
+void snopt7::preload() const
+{
+    if (m_minor_version > 6) {
+        detail::get_snopt7_lib<snProblem_77>(m_snopt7_c_library, m_minor_version);
+    } else {
+        detail::get_snopt7_lib<snProblem_76>(m_snopt7_c_library, m_minor_version);
+    }
+}
+
+/// Unload the snopt7_c library.
+/**
+ * This method removes the snopt7_c library used by \p this from the process-wide registry (see preload()).
+ * Evolves that are already running keep their own reference to the library, which is effectively
+ * unloaded when the last of them ends. The next call to evolve() or preload() will load the library again.
+ *
+ * @return ``true`` if the library was in the registry, ``false`` otherwise.
+ */
+bool snopt7::unload() const
+{
+    if (m_minor_version > 6) {
+        return detail::snopt7_registry<snProblem_77>().erase({m_snopt7_c_library, m_minor_version});
+    } else {
+        return detail::snopt7_registry<snProblem_76>().erase({m_snopt7_c_library, m_minor_version});
+    }
+}
+
 /// Set verbosity.
 /**
  * This method will set the algorithm's verbosity. If \p n is zero, no output is produced during the
@@ -347,17 +974,36 @@ void snopt7::set_verbosity(unsigned n)
  * See snopt7::log_type for a description of the optimisation log. Logging is turned on/off via
  * set_verbosity().
  *
- * @return a const reference to the log.
+ * \verbatim embed:rst:leading-asterisk
+ * .. versionchanged:: 0.28
+ *
+ *    The log is returned by value, rather than by const reference (see :ref:`changelog`).
+ *
+ * \endverbatim
+ *
+ * @return a copy of the log, built from the columnar log of the last run (see get_log_columns()).
  */
-const snopt7::log_type &snopt7::get_log() const
+snopt7::log_type snopt7::get_log() const
 {
-    return m_log;
+    return get_log_columns()->lines();
 }
-/// Gets the verbosity level
+/// Get the columnar optimisation log.
 /**
- * @return the verbosity level
+ * The log of the last call to evolve(), with the same content as get_log(), stored as one contiguous array per
+ * field (see ppnf::log_columns). The columns can be accessed without copies, and are not modified by further calls
+ * to evolve(), which store a new log.
+ *
+ * @return a pointer sharing the ownership of the columnar log.
  */
-unsigned int snopt7::get_verbosity() const
+std::shared_ptr<const log_columns> snopt7::get_log_columns() const
+{
+    return m_results.apply([](const detail::evolve_results<int> &res) { return res.m_log; });
+}
+/// Gets the verbosity level
+/**
+ * @return the verbosity level
+ */
+unsigned int snopt7::get_verbosity() const
 {
     return m_verbosity;
 }
@@ -378,6 +1024,7 @@ std::string snopt7::get_name() const
  */
 std::string snopt7::get_extra_info() const
 {
+    const auto results = m_results.get();
     std::ostringstream ss;
     pagmo::stream(ss, "\tName of the snopt7_c library: ", m_snopt7_c_library);
     pagmo::stream(ss, "\n\tLibrary version declared: 7.", m_minor_version);
@@ -387,7 +1034,7 @@ std::string snopt7::get_extra_info() const
     } else {
         pagmo::stream(ss, "\n\tScreen output: (snopt7)");
     }
-    pagmo::stream(ss, "\n\tLast optimisation return code: ", detail::results.at(m_last_opt_res));
+    pagmo::stream(ss, "\n\tLast optimisation return code: ", detail::results.at(results.m_opt_res));
     pagmo::stream(ss, "\n\tIndividual selection ");
     if (boost::any_cast<pagmo::population::size_type>(&m_select)) {
         pagmo::stream(ss, "idx: ", std::to_string(boost::any_cast<pagmo::population::size_type>(m_select)));
@@ -406,9 +1053,75 @@ std::string snopt7::get_extra_info() const
     if (m_numeric_opts.size()) {
         pagmo::stream(ss, "\n\tNumeric options: ", pagmo::detail::to_string(m_numeric_opts));
     }
+    if (m_cache_capacity) {
+        pagmo::stream(ss, "\n\tEvaluation cache capacity: ", m_cache_capacity);
+    }
+    const auto &cache_stats = results.m_cache_stats;
+    pagmo::stream(ss, "\n\tEvaluation cache (last evolve), fitness hits/misses: ", cache_stats.m_f_hits, "/",
+                  cache_stats.m_f_misses, ", gradient hits/misses: ", cache_stats.m_g_hits, "/",
+                  cache_stats.m_g_misses);
+    if (m_concurrent_gradient) {
+        pagmo::stream(ss, "\n\tConcurrent gradient: active");
+    }
+    if (m_batch_size > 1u) {
+        pagmo::stream(ss, "\n\tBatch size: ", m_batch_size);
+    }
+    if (m_warm_start) {
+        pagmo::stream(ss, "\n\tWarm start: active (tolerance ", m_ws_tol, ", ", m_ws_states.get().size(), "/",
+                      m_ws_capacity, " stored states)");
+    }
+    if (m_sparsity_probes) {
+        pagmo::stream(ss, "\n\tSparsity detection: ", m_sparsity_probes, " probes");
+    }
+    if (m_linear_probes) {
+        pagmo::stream(ss, "\n\tLinear structure detection: ", m_linear_probes, " probes");
+    }
+    if (m_persistent_session) {
+        pagmo::stream(ss, "\n\tPersistent session: active");
+    }
+    if (m_log_settings.m_buffer != "unbounded") {
+        pagmo::stream(ss, "\n\tLog buffer: ", m_log_settings.m_buffer, " (capacity ", m_log_settings.m_capacity, ")");
+    }
+    if (!m_log_settings.m_file.empty()) {
+        pagmo::stream(ss, "\n\tLog file: ", m_log_settings.m_file, " (", m_log_settings.m_format, ")");
+    }
+    if (!results.m_log_error.empty()) {
+        pagmo::stream(ss, "\n\tLog error (last evolve): ", results.m_log_error);
+    }
+    if (m_fd) {
+        pagmo::stream(ss, "\n\tFinite-difference gradient: ", get_fd_scheme(), " (step ", m_fd_step, ", ",
+                      m_fd_bfe ? m_fd_bfe->get_name() : std::string("sequential"), ")");
+    }
+    if (m_collect_stats) {
+        ss << "\n\tStatistics (last evolve):\n" << results.m_stats;
+    }
     pagmo::stream(ss, "\n");
     return ss.str();
 }
+/// Thread safety level.
+/**
+ * One of the optional methods of any user-defined algorithm (UDA). The state of a call to evolve() is private to
+ * the call, while the state shared by the calls (the random engine of the selection and replacement policies, the
+ * warm start states and the detected sparsity patterns) is accessed under a lock. The results of an evolve() (see,
+ * e.g., get_log() and get_stats()) are published together once it is complete, so that evolve() and the getters
+ * can be called concurrently on the same instance.
+ *
+ * @return pagmo::thread_safety::constant, or pagmo::thread_safety::basic if a log file is set (concurrent calls
+ * would write to the same file) or if the finite-difference gradient uses a batch fitness evaluator which cannot
+ * be called concurrently, or pagmo::thread_safety::none if that batch fitness evaluator provides no thread safety
+ * guarantee (e.g., a Python one).
+ */
+pagmo::thread_safety snopt7::get_thread_safety() const
+{
+    if (m_fd_bfe && m_fd_bfe->get_thread_safety() == pagmo::thread_safety::none) {
+        return pagmo::thread_safety::none;
+    }
+    if (!m_log_settings.m_file.empty()
+        || (m_fd_bfe && m_fd_bfe->get_thread_safety() != pagmo::thread_safety::constant)) {
+        return pagmo::thread_safety::basic;
+    }
+    return pagmo::thread_safety::constant;
+}
 
 /// Set integer option.
 /**
@@ -503,7 +1216,439 @@ void snopt7::reset_numeric_options()
  */
 int snopt7::get_last_opt_result() const
 {
-    return m_last_opt_res;
+    return m_results.apply([](const detail::evolve_results<int> &res) { return res.m_opt_res; });
+}
+
+/// Set the warm start mode.
+/**
+ * When the warm start mode is active, the final states and multipliers of the variables and of the fitness
+ * components computed by SNOPT7 are stored, after each call to evolve(), together with the final decision vector.
+ * When the individual selected by a later call to evolve() is close enough to one of the stored decision vectors
+ * (i.e., their difference is not larger than \p tol in the infinity norm), snOptA is called with a warm start
+ * (``Start = 2``) using the stored states and multipliers. This is typically useful when the same individual, or a
+ * slightly perturbed one, is repeatedly optimised (e.g., after migration).
+ *
+ * At most \p capacity states are stored, the least recently used ones being discarded first.
+ * The stored states are part of the serialized representation of \p this.
+ *
+ * @param flag ``true`` activates the warm start mode, ``false`` deactivates it (the stored states are kept, see
+ * clear_warm_start()).
+ * @param tol the matching tolerance on the decision vector.
+ * @param capacity the maximum number of stored states.
+ *
+ * @throws std::invalid_argument if \p tol is negative or NaN.
+ */
+void snopt7::set_warm_start(bool flag, double tol, unsigned capacity)
+{
+    if (!(tol >= 0.)) {
+        pagmo_throw(std::invalid_argument,
+                    "The warm start tolerance must be non negative, while a value of " + std::to_string(tol)
+                        + " was detected");
+    }
+    m_warm_start = flag;
+    m_ws_tol = tol;
+    m_ws_capacity = capacity;
+    m_ws_states.apply([capacity](std::vector<detail::snopt7_warm_start> &states) {
+        if (states.size() > capacity) {
+            states.erase(states.begin(), states.begin() + static_cast<std::ptrdiff_t>(states.size() - capacity));
+        }
+    });
+}
+/// Get the warm start mode.
+/**
+ * @return ``true`` if the warm start mode is active, ``false`` otherwise.
+ */
+bool snopt7::get_warm_start() const
+{
+    return m_warm_start;
+}
+/// Clear the stored warm start states.
+void snopt7::clear_warm_start()
+{
+    m_ws_states.set({});
+}
+
+/// Set the capacity of the evaluation cache.
+/**
+ * During evolve(), the fitness and gradient evaluations requested by SNOPT7 can be stored in a least
+ * recently used cache holding at most \p capacity decision vectors, so that points revisited by the solver
+ * are not evaluated again. The number of cache hits and misses of the last call to evolve() is reported by
+ * get_extra_info(). As snOptA rarely requests twice the same point, the cache is disabled by default
+ * (capacity zero): fitness and gradient are then written directly into the snOptA arrays.
+ *
+ * @param capacity the maximum number of decision vectors stored in the cache.
+ */
+void snopt7::set_cache_capacity(unsigned capacity)
+{
+    m_cache_capacity = capacity;
+}
+/// Get the capacity of the evaluation cache.
+/**
+ * @return the maximum number of decision vectors stored in the evaluation cache.
+ */
+unsigned snopt7::get_cache_capacity() const
+{
+    return m_cache_capacity;
+}
+
+/// Set the concurrent evaluation of fitness and gradient.
+/**
+ * When snOptA requests both the fitness and the gradient at a point, they are by default evaluated one after the
+ * other. If this mode is active and the problem is thread safe (pagmo::thread_safety::constant), the gradient is
+ * instead evaluated by a helper thread (one per snOptA instance) while the fitness is evaluated by the calling
+ * thread. This pays off for problems whose fitness and gradient are computed independently (e.g., an adjoint
+ * gradient). The gradient is stored in the evaluation cache (see set_cache_capacity()), which then holds at least one
+ * decision vector. The mode is off by default, and has no effect on problems which are not thread safe or whose UDP
+ * evaluates fitness and gradient in one pass (see ppnf::register_inplace_udp()).
+ *
+ * @param flag ``true`` to evaluate fitness and gradient concurrently, ``false`` otherwise.
+ */
+void snopt7::set_concurrent_gradient(bool flag)
+{
+    m_concurrent_gradient = flag;
+}
+/// Get the activation flag of the concurrent evaluation of fitness and gradient.
+/**
+ * @return ``true`` if fitness and gradient are evaluated concurrently (see set_concurrent_gradient()).
+ */
+bool snopt7::get_concurrent_gradient() const
+{
+    return m_concurrent_gradient;
+}
+
+/// Set the batch size.
+/**
+ * By default, evolve() optimises the single individual selected by the selection policy, and reinserts the result
+ * according to the replacement policy (see pagmo::not_population_based). With a batch size \p k larger than one,
+ * evolve() selects instead \p k individuals with the same policy (the \p k best, the \p k worst, \p k random
+ * individuals or, if the selection policy is an index, the \p k individuals starting from that index), and
+ * optimises them concurrently, each with its own SNOPT7 workspace. Each improved individual then replaces the one it
+ * originates from, and the replacement policy is not used. This is useful to multi-start SNOPT7 from a population.
+ *
+ * The concurrency respects the thread safety level of the problem: the SNOPT7 instances share the problem if
+ * it is pagmo::thread_safety::constant, work on their own copy of it if it is pagmo::thread_safety::basic (only the
+ * fitness evaluations made on the copies are then added to the counters of the original problem) and
+ * run sequentially if it is pagmo::thread_safety::none. Only the first of the selected individuals is
+ * logged and printed to screen, and the result returned by get_last_opt_result() refers to it.
+ *
+ * @param k the number of individuals optimised by each call to evolve().
+ *
+ * @throws std::invalid_argument if \p k is zero.
+ */
+void snopt7::set_batch_size(unsigned k)
+{
+    if (!k) {
+        pagmo_throw(std::invalid_argument, "The batch size must be at least one");
+    }
+    m_batch_size = k;
+}
+/// Get the batch size.
+/**
+ * @return the number of individuals optimised by each call to evolve().
+ */
+unsigned snopt7::get_batch_size() const
+{
+    return m_batch_size;
+}
+
+/// Set the persistent session mode.
+/**
+ * By default, each call to evolve() initialises a SNOPT7 workspace (snInit), sets all the options and frees the
+ * workspace (deleteSNOPT) at the end. For short runs on small problems this setup may be a noticeable share of the
+ * runtime. With the persistent session mode active, the initialised workspaces are kept by the algorithm and reused
+ * by later calls to evolve() on problems with the same name, and only the options which changed since the
+ * previous run are set again (the workspace is initialised again if an option is removed).
+ *
+ * Each workspace is used by one run at a time: concurrent calls to evolve() (or the runs of a batch, see
+ * set_batch_size()) each take their own workspace. The workspaces belong to the algorithm object: copies (as well as
+ * moved-to and deserialised objects) start without workspaces, and deactivating the mode frees them.
+ *
+ * @param flag ``true`` to activate the persistent session mode, ``false`` to deactivate it.
+ */
+void snopt7::set_persistent_session(bool flag)
+{
+    m_persistent_session = flag;
+    if (!flag) {
+        m_sessions.clear();
+    }
+}
+/// Get the persistent session mode.
+/**
+ * @return ``true`` if the persistent session mode is active.
+ */
+bool snopt7::get_persistent_session() const
+{
+    return m_persistent_session;
+}
+
+/// Set the gradient sparsity detection.
+/**
+ * When a problem does not declare its gradient sparsity, pagmo assumes it dense, and so would SNOPT7, which
+ * may be wasteful (in memory, and in finite differences if the gradient is not provided) for large problems
+ * that are implicitly sparse. With \p n_probes larger than zero, the structural nonzeros of the gradient of
+ * such problems are detected at \p n_probes random points within the bounds: the nonzero entries of the gradient,
+ * if the problem provides it, or otherwise the fitness components changed by a perturbation of each variable
+ * (costing \p n_probes * (nx + 1) fitness evaluations). SNOPT7 is then given the detected pattern.
+ *
+ * The detected patterns are cached by the algorithm, and reused by later calls to evolve() on problems with the
+ * same UDP type, name, dimensions and bounds.
+ *
+ * \verbatim embed:rst:leading-asterisk
+ *
+ * .. warning::
+ *
+ *    The detection is a heuristic: an entry of the gradient that vanishes at all the probes (but not elsewhere)
+ *    is taken as a structural zero. Problems with a known structure should declare their gradient sparsity.
+ *
+ * \endverbatim
+ *
+ * @param n_probes the number of random points used for the detection (zero, the default, disables it).
+ */
+void snopt7::set_sparsity_detection(unsigned n_probes)
+{
+    m_sparsity_probes = n_probes;
+}
+/// Get the gradient sparsity detection.
+/**
+ * @return the number of random points used for the detection of the gradient sparsity (zero if disabled).
+ */
+unsigned snopt7::get_sparsity_detection() const
+{
+    return m_sparsity_probes;
+}
+
+/// Set the linear structure detection.
+/**
+ * SNOPT7 treats separately the linear part of the problem, \f$ F(x) = f(x) + A x\f$: the constant entries of
+ * the jacobian are not evaluated by the callbacks, and the linear constraints are satisfied exactly by the QP
+ * subproblems. As pagmo problems do not declare their linear part, it is by default switched off. With
+ * \p n_probes larger than zero, the gradient of a problem providing it is evaluated at \p n_probes random points
+ * within the bounds, and the entries of the gradient sparsity (declared or detected, see
+ * set_sparsity_detection()) having the same value at all the probes are passed to SNOPT7 as the matrix \f$ A \f$.
+ * The fitness components having only constant entries are linear, and their constant term is moved into the
+ * bounds. The detection is repeated by each call to evolve(), at the cost of \p n_probes gradient evaluations and
+ * one fitness evaluation, and it is skipped for problems not providing the gradient.
+ *
+ * \verbatim embed:rst:leading-asterisk
+ *
+ * .. warning::
+ *
+ *    The detection is a heuristic: an entry of the gradient having the same value at all the probes (but not
+ *    elsewhere) is taken as constant, and SNOPT7 then optimises a different problem.
+ *
+ * \endverbatim
+ *
+ * @param n_probes the number of random points used for the detection (zero, the default, disables it).
+ *
+ * @throws std::invalid_argument if \p n_probes is one.
+ */
+void snopt7::set_linear_detection(unsigned n_probes)
+{
+    if (n_probes == 1u) {
+        pagmo_throw(std::invalid_argument, "The detection of the linear structure needs at least two probes");
+    }
+    m_linear_probes = n_probes;
+}
+/// Get the linear structure detection.
+/**
+ * @return the number of random points used for the detection of the linear structure (zero if disabled).
+ */
+unsigned snopt7::get_linear_detection() const
+{
+    return m_linear_probes;
+}
+
+/// Set the finite-difference gradient computed by the plugin.
+/**
+ * When a problem does not provide its gradient, SNOPT7 approximates it by finite differences, perturbing one variable
+ * per fitness evaluation. After a call to this method, the plugin computes instead the finite differences itself,
+ * and SNOPT7 is given the result as if the problem provided its gradient. The variables are perturbed in groups
+ * (Curtis-Powell-Reid method): a greedy colouring of the gradient sparsity, computed once per call to evolve(), puts
+ * in the same group variables which do not affect the same fitness components. The forward scheme then costs one
+ * fitness evaluation per group plus one per gradient, the central scheme two per group and is more accurate. For
+ * banded or block-diagonal sparsities the number of groups is small and independent of the problem dimension.
+ * The evaluations are performed sequentially, or, see set_fd_gradient(const pagmo::bfe &, const std::string &,
+ * double), with a batch fitness evaluator. They are counted as fitness evaluations of the problem. Problems providing
+ * their gradient are not affected.
+ *
+ * The variable \f$ x_j \f$ is perturbed by \f$ h \max(1, |x_j|) \f$, where \f$ h \f$ is the relative step. A
+ * perturbation leaving the bounds is reversed (forward scheme), or replaced by a one-sided difference (central
+ * scheme).
+ *
+ * @param scheme the finite-difference scheme, ``"forward"`` or ``"central"``.
+ * @param step the relative step (zero selects the default, the square root of the machine epsilon for the
+ * forward scheme and its cube root for the central scheme).
+ *
+ * @throws std::invalid_argument if \p scheme is not one of the allowed values, or if \p step is negative
+ * or not finite.
+ */
+void snopt7::set_fd_gradient(const std::string &scheme, double step)
+{
+    if (scheme != "forward" && scheme != "central") {
+        pagmo_throw(std::invalid_argument,
+                    "The finite-difference scheme must be either 'forward' or 'central', while '" + scheme
+                        + "' was detected");
+    }
+    if (!std::isfinite(step) || step < 0.) {
+        pagmo_throw(std::invalid_argument,
+                    "The finite-difference step must be finite and non-negative, while a value of "
+                        + std::to_string(step) + " was detected");
+    }
+    m_fd = true;
+    m_fd_bfe = boost::none;
+    m_fd_central = scheme == "central";
+    m_fd_step = step > 0. ? step : detail::fd_default_step(m_fd_central);
+}
+/// Set the finite-difference gradient computed by the plugin, in parallel.
+/**
+ * As set_fd_gradient(const std::string &, double), but all the perturbed decision vectors needed by a gradient are
+ * evaluated with a single call to the batch fitness evaluator \p b (e.g., a pagmo::thread_bfe or a
+ * pagmo::member_bfe), so that they can be evaluated in parallel.
+ *
+ * @param b the batch fitness evaluator.
+ * @param scheme the finite-difference scheme, ``"forward"`` or ``"central"``.
+ * @param step the relative step.
+ *
+ * @throws std::invalid_argument if \p scheme is not one of the allowed values, or if \p step is negative
+ * or not finite.
+ */
+void snopt7::set_fd_gradient(const pagmo::bfe &b, const std::string &scheme, double step)
+{
+    set_fd_gradient(scheme, step);
+    m_fd_bfe = b;
+}
+/// Unset the finite-difference gradient computed by the plugin.
+/**
+ * After a call to this method, the gradient of the problems not providing it is computed by SNOPT7 (the default).
+ */
+void snopt7::unset_fd_gradient()
+{
+    m_fd = false;
+    m_fd_bfe = boost::none;
+}
+/// Check if the finite-difference gradient is computed by the plugin.
+/**
+ * @return ``true`` if the finite-difference gradient was set via set_fd_gradient().
+ */
+bool snopt7::has_fd_gradient() const
+{
+    return m_fd;
+}
+/// Get the finite-difference scheme.
+/**
+ * @return the scheme set via set_fd_gradient(), ``"forward"`` or ``"central"``.
+ */
+std::string snopt7::get_fd_scheme() const
+{
+    return m_fd_central ? "central" : "forward";
+}
+/// Get the finite-difference step.
+/**
+ * @return the relative step used by the finite differences (zero if set_fd_gradient() was never called).
+ */
+double snopt7::get_fd_step() const
+{
+    return m_fd_step;
+}
+
+/// Set the policy of the in-memory log.
+/**
+ * By default, all the log lines of a run (see set_verbosity()) are kept in memory and returned by get_log(), so that
+ * the log of a long run may take a large amount of memory. This method bounds the in-memory log: the ``"ring"``
+ * policy keeps the last \p capacity lines, the ``"decimate"`` policy keeps at most \p capacity lines evenly spread
+ * over the run (once the buffer is full, every other line is dropped and only half of the following lines are
+ * recorded), and the ``"unbounded"`` policy (the default) keeps all the lines.
+ *
+ * The log lines are printed, streamed to the log file (see set_log_file()) and recorded by a background thread,
+ * so that the solver callbacks only push a fixed-size record into a lock-free queue.
+ *
+ * @param policy the policy of the in-memory log, ``"unbounded"``, ``"ring"`` or ``"decimate"``.
+ * @param capacity the maximum number of lines kept in memory (ignored by the ``"unbounded"`` policy).
+ *
+ * @throws std::invalid_argument if \p policy is not one of the allowed values, or if \p capacity is zero for the
+ * ``"ring"`` and ``"decimate"`` policies.
+ */
+void snopt7::set_log_buffer(const std::string &policy, unsigned capacity)
+{
+    m_log_settings.set_buffer(policy, capacity);
+}
+/// Get the policy of the in-memory log.
+/**
+ * @return the policy and the capacity of the in-memory log (see set_log_buffer()).
+ */
+std::pair<std::string, unsigned> snopt7::get_log_buffer() const
+{
+    return {m_log_settings.m_buffer, m_log_settings.m_capacity};
+}
+/// Set the log file.
+/**
+ * If \p file is not empty, the log lines of each run (see set_verbosity()) are also appended to \p file by a
+ * background thread, together with their timestamp (the seconds elapsed since the start of the run). In the
+ * ``"csv"`` format, each line contains the comma-separated values of the number of objective evaluations, the
+ * objective value, the number of violated constraints, the constraints violation norm, the feasibility flag and the
+ * timestamp, and a header line is written to new files. In the ``"binary"`` format, each line is a record of 41
+ * bytes, in the native byte order: the number of objective evaluations (uint64), the objective value (double), the
+ * number of violated constraints (uint64), the constraints violation norm (double), the feasibility flag (uint8) and
+ * the timestamp (double).
+ *
+ * An error writing the log file does not interrupt the run: the log lines are still kept in memory, and the error
+ * is reported by get_extra_info() (and printed to screen).
+ *
+ * @param file the path of the log file (empty to disable it).
+ * @param format the format of the log file, ``"csv"`` or ``"binary"``.
+ *
+ * @throws std::invalid_argument if \p format is not one of the allowed values.
+ */
+void snopt7::set_log_file(const std::string &file, const std::string &format)
+{
+    m_log_settings.set_file(file, format);
+}
+/// Get the log file.
+/**
+ * @return the path of the log file (empty if disabled) and its format (see set_log_file()).
+ */
+std::pair<std::string, std::string> snopt7::get_log_file() const
+{
+    return {m_log_settings.m_file, m_log_settings.m_format};
+}
+
+/// Activate the collection of statistics.
+/**
+ * If active, each call to evolve() records the time spent in its phases (fetching the snopt7_c library, snInit,
+ * option setting, problem setup, snOptA and the user callbacks), the number of callbacks, the evaluation cache
+ * hits and misses and the estimated bytes of the snOptA arrays. The statistics of the last call to
+ * evolve() are returned by get_stats() and reported by get_extra_info(). The collection is off by default.
+ *
+ * @param flag ``true`` to collect the statistics, ``false`` otherwise.
+ */
+void snopt7::set_collect_stats(bool flag)
+{
+    m_collect_stats = flag;
+}
+/// Get the activation flag of the collection of statistics.
+/**
+ * @return ``true`` if the statistics are collected by evolve().
+ */
+bool snopt7::get_collect_stats() const
+{
+    return m_collect_stats;
+}
+/// Get the statistics of the last evolve().
+/**
+ * \verbatim embed:rst:leading-asterisk
+ *
+ * .. note::
+ *
+ *    For SNOPT7, a call to the user function may request the fitness (ppnf::evolve_stats::m_f_calls) and/or its
+ *    gradient (ppnf::evolve_stats::m_df_calls). The other callback counters are zero.
+ *
+ * \endverbatim
+ *
+ * @return the statistics recorded by the last call to evolve() (all zeros if they were not collected).
+ */
+evolve_stats snopt7::get_stats() const
+{
+    return m_results.apply([](const detail::evolve_results<int> &res) { return res.m_stats; });
 }
 
 // This is the evolve which will be version dependent via the template argument (snProblem declaration is)
@@ -512,10 +1657,6 @@ pagmo::population snopt7::evolve_version(pagmo::population &pop) const
 {
     // We store some useful properties
     const auto &prob = pop.get_problem(); // This is a const reference, so using set_seed, for example, will not work
-    auto dim = prob.get_nx();
-    const auto bounds = prob.get_bounds();
-    const auto &lb = bounds.first;
-    const auto &ub = bounds.second;
 
     // PREAMBLE-------------------------------------------------------------------------------------------------
     // We start by checking that the problem is suitable for this particular algorithm.
@@ -534,102 +1675,16 @@ pagmo::population snopt7::evolve_version(pagmo::population &pop) const
     }
     // ---------------------------------------------------------------------------------------------------------
 
-    // ------------------------- SNOPT7 PLUGIN (we attempt loading the snopt7 library at run-time)--------------
-    // We first declare the prototypes of the functions used from the library
-    std::function<void(snProblem *, char *, char *, int)> snInit;
-    std::function<int(snProblem *, char[], int)> setIntParameter;
-    std::function<int(snProblem *, char[], double)> setRealParameter;
-    std::function<void(snProblem *)> deleteSNOPT;
-    std::function<int(snProblem *, int, int, int, double, int, snFunA, int, int *, int *, double *, int, int *, int *,
-                      double *, double *, double *, double *, double *, int *, double *, double *, int *, double *,
-                      int *, int *, double *)>
-        solveA;
-    // We then try to load the library at run time and locate the symbols used.
-    try {
-        // Here we import at runtime the snopt7_c library and protect the whole try block with a mutex
-        std::lock_guard<std::mutex> lock(detail::library_load_mutex);
-        boost::filesystem::path path_to_lib(m_snopt7_c_library);
-        if (!boost::filesystem::is_regular_file(path_to_lib)) {
-            pagmo_throw(std::invalid_argument, "The snopt7_c library path was constructed to be: "
-                                                   + path_to_lib.string() + " and it does not appear to be a file");
-        }
-        boost::dll::shared_library libsnopt7_c(path_to_lib);
-        // We then load the symbols we need for the SNOPT7 plugin
-        snInit = boost::dll::import_symbol<void(snProblem *, char *, char *,
-                                                int)>( // type of the function to import
-            libsnopt7_c,                               // the library
-            "snInit"                                   // name of the function to import
-        );
-
-        setIntParameter = boost::dll::import_symbol<int(snProblem *, char[], int)>( // type of the function to import
-            libsnopt7_c,                                                            // the library
-            "setIntParameter"                                                       // name of the function to import
-        );
-
-        setRealParameter
-            = boost::dll::import_symbol<int(snProblem *, char[], double)>( // type of the function to import
-                libsnopt7_c,                                               // the library
-                "setRealParameter"                                         // name of the function to import
-            );
-
-        deleteSNOPT = boost::dll::import_symbol<void(snProblem *)>( // type of the function to import
-            libsnopt7_c,                                            // the library
-            "deleteSNOPT"                                           // name of the function to import
-        );
-
-        solveA = boost::dll::import_symbol<int(snProblem *, int, int, int, double, int, snFunA, int, int *, int *,
-                                               double *, int, int *, int *, double *, double *, double *, double *,
-                                               double *, int *, double *, double *, int *, double *, int *, int *,
-                                               double *)>( // type of the function to import
-            libsnopt7_c,                                   // the library
-            "solveA"                                       // name of the function to import
-        );
-    } catch (const std::exception &e) {
-        std::string message(
-            R"(
-An error occurred while loading the snopt7_c library at run-time. This is typically caused by one of the following
-reasons:
-
-- The file declared to be the snopt7_c library, i.e. )"
-            + m_snopt7_c_library
-            + R"(, is not a shared library containing the necessary C interface symbols (is the file path really pointing to
-a valid shared library?)
- - The library is found and it does contain the C interface symbols, but it needs linking to some additional libraries that are not found
-at run-time.
-
-We report the exact text of the original exception thrown:
-
- )" + std::string(e.what()));
-        pagmo_throw(std::invalid_argument, message);
-    }
+    // ------------------------- SNOPT7 PLUGIN (we fetch the snopt7 library from the process-wide registry)------
+    // The library is loaded and its symbols resolved only the first time it is requested, later
+    // evolves (from any thread) reuse the same table.
+    evolve_stats stats;
+    detail::phase_timer total_timer(m_collect_stats ? &stats.m_total_time : nullptr);
+    detail::phase_timer load_timer(m_collect_stats ? &stats.m_load_time : nullptr);
+    const auto lib = detail::get_snopt7_lib<snProblem>(m_snopt7_c_library, m_minor_version);
+    load_timer.stop();
     // ------------------------- END SNOPT7 PLUGIN -------------------------------------------------------------
 
-    // We init and set up SNOPT options
-    // We init the SNOPT workspace suppressing the file output. TODO: should we allow the file output?
-    snProblem snopt7_problem;
-    char empty_string[] = "";
-
-    auto problem_name = detail::s_to_C(prob.get_name());
-
-    // Here we call snInit and ensure deleteSNOPT will be called whenever the object spr is destroyed.
-    detail::sn_problem_raii<snProblem> spr(&snopt7_problem, problem_name.data(), empty_string, m_screen_output, snInit,
-                                           deleteSNOPT);
-    // Logic for the handling of constraints tolerances. The logic is as follows:
-    // - if the user provides the "Major feasibility tolerance" option, use that *unconditionally*. Otherwise,
-    // - compute the minimum tolerance min_tol among those returned by  problem.c_tol(). If zero, ignore
-    //   it and use the SNOPT7 default value for "Major feasibility tolerance" (1e-6). Otherwise, use min_tol as
-    //   the value for "Major feasibility tolerance".
-    int res = 0;
-    if (prob.get_nc() && !m_numeric_opts.count("Major feasibility tolerance")) {
-        const auto c_tol = prob.get_c_tol();
-        assert(!c_tol.empty());
-        const double min_tol = *std::min_element(c_tol.begin(), c_tol.end());
-        if (min_tol > 0.) {
-            auto option_name = detail::s_to_C("Major feasibility tolerance");
-            res = setRealParameter(&snopt7_problem, option_name.data(), min_tol);
-            assert(res == 0);
-        }
-    }
     // We prevent to set the "Derivative option" option as pagmo sets it according to the value of
     // prob.has_gradient()
     if (m_integer_opts.count("Derivative option")) {
@@ -637,144 +1692,180 @@ We report the exact text of the original exception thrown:
             std::invalid_argument,
             R"(The option "Derivative option" was set by the user. In pagmo that is not allowed, as its value is automatically set according to the value returned by has_gradient() (true -> 3, false -> 0))");
     }
-    res = 0;
-    // We set all the other user defined options
-    for (const auto &p : m_numeric_opts) {
-        auto option_name = detail::s_to_C(p.first);
-        double option_value(p.second);
-        res = setRealParameter(&snopt7_problem, option_name.data(), option_value);
-        if (res > 0) {
-            pagmo_throw(std::invalid_argument,
-                        "The option '" + p.first + "' was requested by the user to be set to the float value "
-                            + std::to_string(option_value)
-                            + ", but SNOPT7 interface returned an error. Did you mispell the option name?");
-        }
-    }
-    for (const auto &p : m_integer_opts) {
-        auto option_name = detail::s_to_C(p.first);
-        int option_value(p.second);
-        res = setIntParameter(&snopt7_problem, option_name.data(), option_value);
-        if (res > 0) {
-            pagmo_throw(std::invalid_argument,
-                        "The option '" + p.first + "' was requested by the user to be set to the int value "
-                            + std::to_string(option_value)
-                            + ", but SNOPT7 interface returned an error. Did you mispell the option name?");
-        }
-    }
-
-    // ------- We define various inputs to call the snOptA interface
-    int Cold = 0;            // Cold start
     auto nF = prob.get_nf(); // Fitness dimension
     auto n = prob.get_nx();  // Decision vector dimension
 
-    // ------- Setting the bounds. -----------------------------------------------------------------------------
-    pagmo::vector_double xlow(n), xupp(n);
-    pagmo::vector_double Flow(nF), Fupp(nF);
-    // decision vector.
-    for (decltype(dim) i = 0u; i < dim; ++i) {
-        xlow[i] = lb[i];
-        xupp[i] = ub[i];
-    }
-    // fitness vector.
-    Flow[0] = -std::numeric_limits<double>::max(); // obj
-    Fupp[0] = std::numeric_limits<double>::max();
-    for (decltype(prob.get_nec()) i = 0u; i < prob.get_nec(); ++i) { // ec
-        Flow[i + 1] = 0.;
-        Fupp[i + 1] = 0.;
+    // ------- Setting the initial points --------------------------------------------------------------------
+    // We init the starting point using the inherited methods from not_population_based, or, in batch mode,
+    // we select batch_size individuals according to the same selection policy.
+    // The random engine inherited from not_population_based is shared by the concurrent calls to evolve(): it is
+    // used under its lock, also to seed the engine of the probes of this call.
+    std::vector<pagmo::population::size_type> batch_idx;
+    std::vector<detail::snopt7_run> runs;
+    std::mt19937 probe_e;
+    {
+        std::lock_guard<detail::member_mutex> lock(m_e_mutex);
+        if (m_batch_size > 1u) {
+            batch_idx = detail::select_batch(pop, m_select, m_batch_size, m_e);
+            runs.resize(batch_idx.size());
+            for (decltype(batch_idx.size()) i = 0u; i < batch_idx.size(); ++i) {
+                runs[i].m_x0 = pop.get_x()[batch_idx[i]];
+                runs[i].m_f0 = pop.get_f()[batch_idx[i]];
+            }
+        } else {
+            auto sel_xf = select_individual(pop);
+            runs.resize(1u);
+            runs[0].m_x0 = std::move(sel_xf.first);
+            runs[0].m_f0 = std::move(sel_xf.second);
+        }
+        if (m_sparsity_probes || m_linear_probes) {
+            probe_e.seed(static_cast<std::mt19937::result_type>(m_e()));
+        }
     }
-    for (decltype(prob.get_nic()) i = 0u; i < prob.get_nic(); ++i) { // ic
-        Flow[i + 1 + prob.get_nec()] = -std::numeric_limits<double>::max();
-        Fupp[i + 1 + prob.get_nec()] = 0.;
+    for (auto &run : runs) {
+        // Initialize states and multipliers
+        run.m_xstate.assign(n, 0);
+        run.m_xmul.assign(n, 0.);
+        run.m_Fstate.assign(nF, 0);
+        run.m_Fmul.assign(nF, 0.);
+        // If a state was stored by a previous run ending close to x0, we warm start from its states and multipliers.
+        if (m_warm_start) {
+            m_ws_states.apply([&](std::vector<detail::snopt7_warm_start> &states) {
+                const auto it = detail::find_warm_start(states, prob.get_name(), run.m_x0, nF, m_ws_tol);
+                if (it != states.end()) {
+                    run.m_xstate = it->m_xstate;
+                    run.m_xmul = it->m_xmul;
+                    run.m_Fstate = it->m_Fstate;
+                    run.m_Fmul = it->m_Fmul;
+                    run.m_start = 2; // Warm start
+                    // The entry becomes the most recently used one.
+                    std::rotate(it, it + 1, states.end());
+                }
+            });
+        }
     }
 
-    // ------- Setting the initial point ---------------------------------------------------------------------
-    // We init the starting point using the inherited methods from not_population_based
-    auto sel_xf = select_individual(pop);
-    pagmo::vector_double x0(std::move(sel_xf.first)), fit0(std::move(sel_xf.second));
-    // Initialize states, x and multipliers
-    std::vector<int> xstate(n), Fstate(nF);
-    pagmo::vector_double x(n), xmul(n), F(nF), Fmul(nF);
-    for (decltype(x0.size()) i = 0u; i < x0.size(); i++) {
-        xstate[i] = 0;
-        x[i] = x0[i];
-        xmul[i] = 0.;
-    }
-    for (decltype(x0.size()) i = 0u; i < fit0.size(); i++) {
-        Fstate[i] = 0;
-        F[i] = fit0[0];
-        Fmul[i] = 0;
+    // ------- Gradient sparsity detection --------------------------------------------------------------------
+    // If requested, and if the problem does not declare its gradient sparsity, we detect it by probing, or
+    // reuse the one detected for an identical problem by a previous evolve.
+    std::shared_ptr<const detail::probed_sparsity> probed;
+    if (m_sparsity_probes && !prob.has_gradient_sparsity()) {
+        detail::phase_timer probe_timer(m_collect_stats ? &stats.m_setup_time : nullptr);
+        const detail::sparsity_fingerprint fp(prob);
+        // Looks up the pattern of the problem, or stores the one in probed if there is none (returns true if found).
+        auto lookup = [&fp, &probed](std::vector<sparsity_cache_entry> &cache) {
+            const auto it = std::find_if(cache.begin(), cache.end(),
+                                         [&fp](const sparsity_cache_entry &entry) { return entry.first == fp; });
+            if (it != cache.end()) {
+                probed = it->second;
+                // The entry becomes the most recently used one.
+                std::rotate(it, it + 1, cache.end());
+                return true;
+            }
+            if (probed) {
+                if (cache.size() >= sparsity_cache_capacity) {
+                    cache.erase(cache.begin());
+                }
+                cache.emplace_back(fp, probed);
+            }
+            return false;
+        };
+        // The probes are evaluated without holding the lock (a concurrent call may store the same pattern first).
+        if (!m_sparsity_cache.apply(lookup)) {
+            probed = std::make_shared<const detail::probed_sparsity>(
+                detail::probe_gradient_sparsity(prob, m_sparsity_probes, probe_e));
+            m_sparsity_cache.apply(lookup);
+        }
     }
 
-    // ------- Some inits for quantities needed by the snOptA interface
-    int ObjRow = 0;
-    double ObjAdd = 0;
-    int nS, nInf;
-    double sInf;
-    // We use the user workspace (iu variable) to hide a pointer to user_data,
-    // so that it may be accessed in the user-defined function.
-    detail::user_data info;
-    info.m_prob = &prob;
-    info.m_verbosity = m_verbosity;
-    info.m_dv = pagmo::vector_double(dim);
-    snopt7_problem.iu = reinterpret_cast<int *>(&info);
-
-    // -------- Linear Part Of the Problem. As pagmo does not support linear problems we do not use this -------
-    int neA = 0;        // We switch off the linear part of the fitness
-    unsigned lenA = 1u; // Thats the minimum length allowed
-    std::vector<int> iAfun(lenA);
-    std::vector<int> jAvar(lenA);
-    pagmo::vector_double A(lenA);
+    // ------- Linear structure detection -----------------------------------------------------------------------
+    // If requested, and if the problem provides its gradient, the constant entries of the gradient are detected
+    // by probing and passed to SNOPT7 as the linear part of the problem.
+    std::unique_ptr<const detail::linear_structure> linear;
+    if (m_linear_probes && prob.has_gradient()) {
+        detail::phase_timer linear_timer(m_collect_stats ? &stats.m_setup_time : nullptr);
+        linear = std::make_unique<const detail::linear_structure>(
+            detail::detect_linear_structure(prob, probed ? probed->m_pattern : prob.gradient_sparsity(),
+                                            probed ? &probed->m_dense_idx : nullptr, m_linear_probes, probe_e));
+    }
 
-    // -------- Non Linear Part Of the Problem. ----------------------------------------------------------------
-    auto sparsity = prob.gradient_sparsity();
-    int neG = static_cast<int>(sparsity.size());
-    auto lenG = sparsity.size();
-    std::vector<int> iGfun(lenG);
-    std::vector<int> jGvar(lenG);
-    for (decltype(sparsity.size()) i = 0u; i < sparsity.size(); ++i) {
-        iGfun[i] = static_cast<int>(sparsity[i].first);
-        jGvar[i] = static_cast<int>(sparsity[i].second);
+    // ------- Finite-difference gradient -----------------------------------------------------------------------
+    // If the plugin computes the gradient, the variables are grouped once by colouring the gradient sparsity.
+    std::unique_ptr<const detail::fd_colouring> fd_colouring;
+    if (m_fd && !prob.has_gradient()) {
+        detail::phase_timer colouring_timer(m_collect_stats ? &stats.m_setup_time : nullptr);
+        fd_colouring = std::make_unique<const detail::fd_colouring>(detail::colour_gradient_sparsity(
+            probed ? probed->m_pattern : prob.gradient_sparsity(), prob.get_nx(), prob.get_nf()));
     }
-    if (prob.has_gradient()) {
-        res = setIntParameter(&snopt7_problem, &std::string("Derivative option")[0], 3);
-        assert(res == 0);
+
+    // ------- We call the snOptA interface, once per starting point ------------------------------------------
+    const detail::snopt7_settings settings{
+        m_integer_opts, m_numeric_opts, m_screen_output, m_cache_capacity, m_concurrent_gradient, m_collect_stats,
+        probed.get(), linear.get(), m_persistent_session ? &m_sessions.get() : nullptr, fd_colouring.get(),
+        m_fd_bfe ? m_fd_bfe.get_ptr() : nullptr, m_fd_central, m_fd_step, m_log_settings};
+    // NOTE: the runs need the problem by mutable reference, for the batch fitness evaluator of the finite differences.
+    auto &run_prob = pop.get_problem();
+    if (runs.size() == 1u) {
+        detail::snopt7_solve(lib, settings, run_prob, runs[0], m_verbosity);
     } else {
-        res = setIntParameter(&snopt7_problem, &std::string("Derivative option")[0], 0);
-        assert(res == 0);
+        // Each instance has its own snOptA workspace. The instances share the problem if it is thread safe
+        // (constant), otherwise they work on copies (basic) or run sequentially (none).
+        const auto n_threads = detail::batch_threads(prob, runs.size());
+        detail::batch_problems probs(run_prob, n_threads);
+        detail::parallel_for(runs.size(), n_threads, [&](std::size_t i, std::size_t t) {
+            // Only the first instance prints to screen and is logged.
+            detail::snopt7_solve(lib, settings, probs[t], runs[i], i == 0u ? m_verbosity : 0u);
+        });
+        probs.merge_fevals();
     }
+    detail::evolve_results<int> results;
+    results.m_opt_res = runs[0].m_res;
+    results.m_log = std::make_shared<const log_columns>(std::move(runs[0].m_log));
+    results.m_log_error = runs[0].m_log_error;
 
-    // ------- We call the snOptA interface.
-    if (m_verbosity > 0u) {
-        pagmo::print("SNOPT7 plugin for pagmo/pygmo: \n");
-        if (prob.has_gradient_sparsity()) {
-            pagmo::print("The gradient sparsity is provided by the user: ", neG, " components detected.\n");
-        } else {
-            pagmo::print("The gradient sparsity is assumed dense: ", neG, " components detected.\n");
+    // ------- We reinsert the solutions if better -------------------------------------------------------------
+    std::exception_ptr eptr;
+    for (decltype(runs.size()) i = 0u; i < runs.size(); ++i) {
+        auto &run = runs[i];
+        // Store the new individual into the population, but only if it is improved. In batch mode it replaces
+        // the individual it originates from.
+        if (pagmo::compare_fc(run.m_F, run.m_f0, prob.get_nec(), prob.get_c_tol())) {
+            if (batch_idx.empty()) {
+                std::lock_guard<detail::member_mutex> lock(m_e_mutex);
+                replace_individual(pop, run.m_x, run.m_F);
+            } else {
+                pop.set_xf(batch_idx[i], run.m_x, run.m_F);
+            }
         }
-        if (prob.has_gradient()) {
-            pagmo::print("The gradient is provided by the user.\n");
-        } else {
-            pagmo::print("The gradient is computed numerically by SNOPT7.\n");
+        results.m_cache_stats.m_f_hits += run.m_cache_stats.m_f_hits;
+        results.m_cache_stats.m_f_misses += run.m_cache_stats.m_f_misses;
+        results.m_cache_stats.m_g_hits += run.m_cache_stats.m_g_hits;
+        results.m_cache_stats.m_g_misses += run.m_cache_stats.m_g_misses;
+        // ------- Store the final state for later warm starts ---------------------------------------------
+        if (m_warm_start && !run.m_eptr && m_ws_capacity) {
+            m_ws_states.apply([&](std::vector<detail::snopt7_warm_start> &states) {
+                const auto it = detail::find_warm_start(states, prob.get_name(), run.m_x, nF, m_ws_tol);
+                if (it != states.end()) {
+                    states.erase(it);
+                } else if (states.size() >= m_ws_capacity) {
+                    states.erase(states.begin());
+                }
+                states.push_back({prob.get_name(), run.m_x, std::move(run.m_xstate), std::move(run.m_xmul),
+                                  std::move(run.m_Fstate), std::move(run.m_Fmul)});
+            });
         }
+        if (!eptr) {
+            eptr = run.m_eptr;
+        }
+        stats += run.m_stats;
     }
-    m_last_opt_res = solveA(&snopt7_problem, Cold, static_cast<int>(nF), static_cast<int>(n), ObjAdd, ObjRow,
-                            detail::snopt_fitness_wrapper, neA, iAfun.data(), jAvar.data(), A.data(), neG, iGfun.data(),
-                            jGvar.data(), xlow.data(), xupp.data(), Flow.data(), Fupp.data(), x.data(), xstate.data(),
-                            xmul.data(), F.data(), Fstate.data(), Fmul.data(), &nS, &nInf, &sInf);
-
-    if (m_verbosity > 0u) {
-        pagmo::print("\n", detail::results.at(m_last_opt_res), "\n");
-    }
-    // ------- We reinsert the solution if better -----------------------------------------------------------
-    // Store the new individual into the population, but only if it is improved.
-    if (pagmo::compare_fc(F, fit0, prob.get_nec(), prob.get_c_tol())) {
-        replace_individual(pop, x, F);
-    }
-    // ------- Store the log --------------------------------------------------------------------------------
-    m_log = std::move(info.m_log);
+    total_timer.stop();
+    results.m_stats = stats;
+    // The results of this evolve are published together.
+    m_results.set(std::move(results));
     // ------- Handle any exception that might have been thrown during the evolve call. ---------------------
-    if (info.m_eptr) {
-        std::rethrow_exception(info.m_eptr);
+    if (eptr) {
+        std::rethrow_exception(eptr);
     }
     return pop;
 }
@@ -44,14 +44,17 @@ You should have received copies of the GNU General Public License and the
 GNU Lesser General Public License along with the "pagmo plugins nonfree" library.  If not,
 see https://www.gnu.org/licenses/. */
 
-#include <algorithm> // std::min_element, std::sort, std::remove_if
+#include <algorithm> // std::min_element, std::sort, std::remove_if, std::lower_bound, std::fill
 #include <boost/dll/import.hpp>
 #include <boost/dll/shared_library.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/serialization/map.hpp>
-#include <iomanip>
-#include <mutex>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <memory>
 #include <numeric>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/not_population_based.hpp>
@@ -71,6 +74,8 @@ see https://www.gnu.org/licenses/. */
 #include <vector>
 
 #include "../include/pagmo_plugins_nonfree/bogus_libs/worhp_lib/worhp_bogus.h"
+#include <pagmo_plugins_nonfree/detail/batch.hpp>
+#include <pagmo_plugins_nonfree/detail/library_registry.hpp>
 #include <pagmo_plugins_nonfree/worhp.hpp>
 
 // MINGW-specific warnings.
@@ -86,100 +91,131 @@ namespace ppnf
 {
 namespace detail
 {
-// We use this to ensure WorhpFree is called also if exceptions occur.
-struct worhp_raii {
-    worhp_raii(OptVar *o, Workspace *w, Params *p, Control *c,
-               std::function<void(OptVar *, Workspace *, Params *, Control *)> &WorhpInit,
-               std::function<void(OptVar *, Workspace *, Params *, Control *)> &WorhpFree)
-        : m_o(o), m_w(w), m_p(p), m_c(c), m_WorhpFree(WorhpFree)
-    {
-        WorhpInit(m_o, m_w, m_p, m_c);
-    }
-    ~worhp_raii()
-    {
-        m_WorhpFree(m_o, m_w, m_p, m_c);
-    }
-    OptVar *m_o;
-    Workspace *m_w;
-    Params *m_p;
-    Control *m_c;
-    std::function<void(OptVar *, Workspace *, Params *, Control *)> m_WorhpFree;
+// A WORHP instance (its data structures), see worhp_session.
+struct worhp_session_base {
+    worhp_session_base() = default;
+    worhp_session_base(const worhp_session_base &) = delete;
+    worhp_session_base &operator=(const worhp_session_base &) = delete;
+    virtual ~worhp_session_base() = default;
+};
+
+// The idle persistent sessions of a worhp instance.
+struct worhp_session_pool {
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<worhp_session_base>> m_idle;
 };
+
+worhp_session_holder::worhp_session_holder() : m_pool(std::make_shared<worhp_session_pool>()) {}
+
+worhp_session_holder::worhp_session_holder(const worhp_session_holder &) : worhp_session_holder() {}
+
+worhp_session_holder::worhp_session_holder(worhp_session_holder &&) : worhp_session_holder() {}
+
+// NOTE: the target keeps its own sessions, which are only used if they match the library and the structure of the
+// problems of later runs.
+worhp_session_holder &worhp_session_holder::operator=(const worhp_session_holder &)
+{
+    return *this;
+}
+
+worhp_session_holder &worhp_session_holder::operator=(worhp_session_holder &&)
+{
+    return *this;
+}
+
+worhp_session_holder::~worhp_session_holder() = default;
+
+worhp_session_pool &worhp_session_holder::get() const
+{
+    return *m_pool;
+}
+
+void worhp_session_holder::clear() const
+{
+    std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+    m_pool->m_idle.clear();
+}
+
+// The origin of the structure of the hessian of the lagrangian (see worhp::set_hessian_structure()): the hessians
+// (sparsity) of the problem, dense, derived from the gradient sparsity, or diagonal (limited-memory BFGS).
+enum class hessian_structure { problem, dense, gradient, diagonal };
+
+// The sparsity structures of a problem in the WORHP representation (see prepare_sparsity()).
+struct worhp_sparsity {
+    // The requested strategy for the structure of the hessian of the lagrangian (with the fingerprint of the
+    // problem, the key of the sparsity cache) and the structure it resolved to.
+    std::string m_hs_strategy;
+    hessian_structure m_hs_kind;
+    // The objective and constraints parts of the gradient sparsity (row-major, as in pagmo).
+    sparsity_pattern m_fs;
+    sparsity_pattern m_gs;
+    // The order of the entries of m_gs in the column-major WORHP representation of DG.
+    std::vector<vector_double::size_type> m_gs_idx_map;
+    // The position in the pagmo gradient of each entry of DG.val (that is, m_fs.size() + m_gs_idx_map[i]).
+    std::vector<vector_double::size_type> m_dg_gather;
+    // The union of the hessians sparsities (row-major).
+    sparsity_pattern m_merged_hs;
+    // The order of the off-diagonal entries of m_merged_hs in the column-major WORHP representation of HM.
+    std::vector<vector_double::size_type> m_hs_idx_map;
+    // Where each entry of the pagmo hessians is accumulated in HM.val (only if the problem has the hessians).
+    hm_scatter_plan m_hm_plan;
+};
+
+// The in-memory snapshot of the WORHP parameters read from an XML file (see worhp::set_params_caching()).
+struct worhp_params_cache {
+    std::mutex m_mutex;
+    // The library and the file the snapshot was read with, and the state of the file at that time.
+    const void *m_lib_id = nullptr;
+    std::string m_file;
+    bool m_exists = false;
+    std::time_t m_write_time = 0;
+    boost::uintmax_t m_size = 0u;
+    std::shared_ptr<const Params> m_params;
+    // Incremented at each read of the file.
+    unsigned long long m_generation = 0u;
+};
+
 namespace
 {
 // Used to suppress screen output from worhp
 void no_screen_output(int, const char[]) {}
-// Mutex to protect the library loading.
-std::mutex library_load_mutex;
-} // namespace
 
-} // end of namespace detail
+// WORHP prints through one process-wide callback. The plugin sets it once, when the library is loaded, to
+// print_dispatch(), which forwards each message to the printer of the run on the calling thread (silent unless a
+// print_scope says otherwise). Concurrent runs with different output settings thus do not interfere.
+thread_local worhp_print_t current_printer = no_screen_output;
 
-worhp::worhp(bool screen_output, std::string worhp_library)
-    : m_worhp_library(worhp_library), m_integer_opts(), m_numeric_opts(), m_bool_opts(), m_screen_output(screen_output),
-      m_verbosity(0), m_log()
+void print_dispatch(int mode, const char s[])
 {
+    current_printer(mode, s);
 }
 
-/// Evolve population.
-/**
- * This method will select an individual from \p pop, optimise it using the WORHP USI interface, replace an
- * individual in \p pop with the optimised individual, and finally return \p pop. The individual selection and
- * replacement criteria can be set via set_selection(const std::string &), set_selection(population::size_type),
- * set_replacement(const std::string &) and set_replacement(population::size_type). The WORHP solver will then run
- * until one of the stopping criteria is satisfied, and the return status of the WORHP solver will be recorded (it
- * can be fetched with get_last_opt_result()).
- *
- * \verbatim embed:rst:leading-asterisk
- *
- * .. warning::
- *
- *    All options passed to the WORHP interface are determined first by the xml parameter file, or (if not found) by
- *    the default options. Then FGtogether is set to true (for constrained problems) and UserDF, UserDG , UserHM to
- *    the values detected by the pagmo::has_gradient, pagmo::has_hessians methods. TolFeas is then set to be the
- *    minimum of prob.get_c_tol() if not 0. All the other options, contained in the data members m_integer_opts,
- *    m_numeric_opts and m_bool_opts are set after and thus overwrite the above rules.
- *
- * \endverbatim
- *
- * @param pop the population to be optimised.
- *
- * @return the optimised population.
- *
- * @throws std::invalid_argument if a version mismatch is found between the declared library and 1.12
- * @throws std::invalid_argument in the following cases:
- * - the population's problem is multi-objective or stochastic
- * @throws unspecified any exception thrown by the public interface of pagmo::problem or
- * pagmo::not_population_based.
- */
-population worhp::evolve(population pop) const
+// Routes the WORHP messages printed by the calling thread to a printer, for the lifetime of the object.
+class print_scope
 {
-    // We store some useful properties
-    const auto &prob = pop.get_problem(); // This is a const reference, so using set_seed, for example, will not work
-    auto dim = prob.get_nx();
-    const auto bounds = prob.get_bounds();
-    const auto &lb = bounds.first;
-    const auto &ub = bounds.second;
-
-    // PREAMBLE-------------------------------------------------------------------------------------------------
-    // We start by checking that the problem is suitable for this particular algorithm.
-    if (prob.get_nobj() != 1u) {
-        pagmo_throw(std::invalid_argument, "Multiple objectives detected in " + prob.get_name() + " instance. "
-                                               + get_name() + " cannot deal with them");
+public:
+    explicit print_scope(worhp_print_t printer) : m_prev(current_printer)
+    {
+        current_printer = printer;
     }
-    if (prob.is_stochastic()) {
-        pagmo_throw(std::invalid_argument,
-                    "The problem appears to be stochastic " + get_name() + " cannot deal with it");
+    print_scope(const print_scope &) = delete;
+    print_scope &operator=(const print_scope &) = delete;
+    ~print_scope()
+    {
+        current_printer = m_prev;
     }
 
-    if (!pop.size()) {
-        // In case of an empty pop, just return it.
-        return pop;
-    }
-    // ---------------------------------------------------------------------------------------------------------
-    // ------------------------- WORHP PLUGIN (we attempt loading the worhp library at run-time)--------------
-    // We first declare the prototypes of the functions used from the library
+private:
+    worhp_print_t m_prev;
+};
+
+// The WORHP symbols used by the plugin, together with the library version. The table owns the shared
+// library, so the symbols remain valid for as long as the table is alive.
+struct worhp_lib {
+    boost::dll::shared_library m_lib;
     std::function<void(int *, const char[], Params *)> ReadParams;
+    // Optional (empty if the library does not export it).
+    std::function<void(int *, Params *)> InitParams;
     std::function<void(OptVar *, Workspace *, Params *, Control *)> WorhpPreInit;
     std::function<void(OptVar *, Workspace *, Params *, Control *)> WorhpInit;
     std::function<void(OptVar *, Workspace *, Params *, Control *)> WorhpDiag;
@@ -191,101 +227,130 @@ population worhp::evolve(population pop) const
     std::function<void(OptVar *, Workspace *, Params *, Control *, char message[])> StatusMsgString;
     std::function<void(OptVar *, Workspace *, Params *, Control *)> WorhpFree;
     std::function<void(OptVar *, Workspace *, Params *, Control *)> WorhpFidif;
+    // Optional (empty if the library does not export it).
+    std::function<void(OptVar *, Workspace *, Params *, Control *)> WorhpRestart;
     std::function<bool(Params *, const char *, bool)> WorhpSetBoolParam;
     std::function<bool(Params *, const char *, int)> WorhpSetIntParam;
     std::function<bool(Params *, const char *, double)> WorhpSetDoubleParam;
     std::function<void(int *major, int *minor, char patch[PATCH_STRING_LENGTH])> WorhpVersion;
-    std::function<void(worhp_print_t)> SetWorhpPrint;
+    // The printer used by WORHP when its screen output is active.
+    worhp_print_t m_default_print = nullptr;
+    // The library version.
+    int m_major = 0;
+    int m_minor = 0;
+    std::string m_patch;
+};
 
-    boost::filesystem::path library_filename(m_worhp_library);
-    // We then try to load the library at run time and locate the symbols used.
+// Loads the worhp library at run time, locates the symbols used and checks the library version.
+std::shared_ptr<const worhp_lib> load_worhp_lib(const std::string &worhp_library)
+{
+    auto retval = std::make_shared<worhp_lib>();
+    boost::filesystem::path library_filename(worhp_library);
     try {
-        // Here we import at runtime the worhp library and protect the whole try block with a mutex
-        std::lock_guard<std::mutex> lock(detail::library_load_mutex);
         if (!boost::filesystem::is_regular_file(library_filename)) {
             pagmo_throw(std::invalid_argument,
                         "The worhp library file name was constructed to be: " + library_filename.string()
                             + " and it does not appear to be a file");
         }
-        boost::dll::shared_library libworhp(library_filename);
+        retval->m_lib.load(library_filename);
+        auto &libworhp = retval->m_lib;
         // We then load the symbols we need for the WORHP plugin
-        WorhpPreInit = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                      Control *)>( // type of the function to import
-            libworhp,                                              // the library
-            "WorhpPreInit"                                         // name of the function to import
-        );
-        WorhpInit = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                   Control *)>( // type of the function to import
-            libworhp,                                           // the library
-            "WorhpInit"                                         // name of the function to import
-        );
-        WorhpDiag = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                   Control *)>( // type of the function to import
-            libworhp,                                           // the library
-            "WorhpDiag"                                         // name of the function to import
-        );
-        ReadParams = boost::dll::import_symbol<void(int *, const char[], Params *)>( // type of the function to import
-            libworhp,                                                                // the library
-            "ReadParams"                                                             // name of the function to import
+        retval->WorhpPreInit = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                              Control *)>( // type of the function to import
+            libworhp,                                                      // the library
+            "WorhpPreInit"                                                 // name of the function to import
         );
-        SetWorhpPrint = boost::dll::import_symbol<void(worhp_print_t)>( // type of the function to import
+        retval->WorhpInit = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                           Control *)>( // type of the function to import
             libworhp,                                                   // the library
-            "SetWorhpPrint"                                             // name of the function to import
+            "WorhpInit"                                                 // name of the function to import
         );
-        GetUserAction = boost::dll::import_symbol<bool(const Control *, int)>( // type of the function to import
-            libworhp,                                                          // the library
-            "GetUserAction"                                                    // name of the function to import
+        retval->WorhpDiag = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                           Control *)>( // type of the function to import
+            libworhp,                                                   // the library
+            "WorhpDiag"                                                 // name of the function to import
         );
-        DoneUserAction = boost::dll::import_symbol<void(Control *, int)>( // type of the function to import
-            libworhp,                                                     // the library
-            "DoneUserAction"                                              // name of the function to import
+        retval->ReadParams
+            = boost::dll::import_symbol<void(int *, const char[], Params *)>( // type of the function to import
+                libworhp,                                                     // the library
+                "ReadParams"                                                  // name of the function to import
+            );
+        // The print callback of WORHP is set here once, see print_dispatch().
+        boost::dll::import_symbol<void(worhp_print_t)>( // type of the function to import
+            libworhp,                                   // the library
+            "SetWorhpPrint"                             // name of the function to import
+            )(print_dispatch);
+        retval->m_default_print = &libworhp.get<void(int, const char *)>("WorhpDefaultPrintFunction");
+        retval->GetUserAction
+            = boost::dll::import_symbol<bool(const Control *, int)>( // type of the function to import
+                libworhp,                                            // the library
+                "GetUserAction"                                      // name of the function to import
+            );
+        retval->DoneUserAction = boost::dll::import_symbol<void(Control *, int)>( // type of the function to import
+            libworhp,                                                             // the library
+            "DoneUserAction"                                                      // name of the function to import
         );
-        IterationOutput = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                         Control *)>( // type of the function to import
-            libworhp,                                                 // the library
-            "IterationOutput"                                         // name of the function to import
+        retval->IterationOutput = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                                 Control *)>( // type of the function to import
+            libworhp,                                                         // the library
+            "IterationOutput"                                                 // name of the function to import
         );
-        Worhp = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                               Control *)>( // type of the function to import
-            libworhp,                                       // the library
-            "Worhp"                                         // name of the function to import
+        retval->Worhp = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                       Control *)>( // type of the function to import
+            libworhp,                                               // the library
+            "Worhp"                                                 // name of the function to import
         );
-        StatusMsg = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                   Control *)>( // type of the function to import
-            libworhp,                                           // the library
-            "StatusMsg"                                         // name of the function to import
+        retval->StatusMsg = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                           Control *)>( // type of the function to import
+            libworhp,                                                   // the library
+            "StatusMsg"                                                 // name of the function to import
         );
-        StatusMsgString = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *, Control *,
-                                                         char message[])>( // type of the function to import
-            libworhp,                                                      // the library
-            "StatusMsgString"                                              // name of the function to import
+        retval->StatusMsgString = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *, Control *,
+                                                                 char message[])>( // type of the function to import
+            libworhp,                                                              // the library
+            "StatusMsgString"                                                      // name of the function to import
         );
-        WorhpSetBoolParam
+        retval->WorhpSetBoolParam
             = boost::dll::import_symbol<bool(Params *, const char *, bool)>( // type of the function to import
                 libworhp,                                                    // the library
                 "WorhpSetBoolParam"                                          // name of the function to import
             );
-        WorhpSetIntParam
+        retval->WorhpSetIntParam
             = boost::dll::import_symbol<bool(Params *, const char *, int)>( // type of the function to import
                 libworhp,                                                   // the library
                 "WorhpSetIntParam"                                          // name of the function to import
             );
-        WorhpSetDoubleParam
+        retval->WorhpSetDoubleParam
             = boost::dll::import_symbol<bool(Params *, const char *, double)>( // type of the function to import
                 libworhp,                                                      // the library
                 "WorhpSetDoubleParam"                                          // name of the function to import
             );
-        WorhpFree = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                   Control *)>( // type of the function to import
-            libworhp,                                           // the library
-            "WorhpFree"                                         // name of the function to import
+        retval->WorhpFree = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                           Control *)>( // type of the function to import
+            libworhp,                                                   // the library
+            "WorhpFree"                                                 // name of the function to import
         );
-        WorhpFidif = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
-                                                    Control *)>( // type of the function to import
-            libworhp,                                            // the library
-            "WorhpFidif"                                         // name of the function to import
+        retval->WorhpFidif = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                            Control *)>( // type of the function to import
+            libworhp,                                                    // the library
+            "WorhpFidif"                                                 // name of the function to import
         );
-        WorhpVersion
+        // InitParams is optional: without it, the XML lookup cannot be disabled.
+        if (libworhp.has("InitParams")) {
+            retval->InitParams = boost::dll::import_symbol<void(int *, Params *)>( // type of the function to import
+                libworhp,                                                       // the library
+                "InitParams"                                                    // name of the function to import
+            );
+        }
+        // WorhpRestart is optional: without it, the persistent sessions are initialised at each run.
+        if (libworhp.has("WorhpRestart")) {
+            retval->WorhpRestart = boost::dll::import_symbol<void(OptVar *, Workspace *, Params *,
+                                                                  Control *)>( // type of the function to import
+                libworhp,                                                      // the library
+                "WorhpRestart"                                                 // name of the function to import
+            );
+        }
+        retval->WorhpVersion
             = boost::dll::import_symbol<void(int *major, int *minor,
                                              char patch[PATCH_STRING_LENGTH])>( // type of the function to import
                 libworhp,                                                       // the library
@@ -298,7 +363,7 @@ An error occurred while loading the worhp library at run-time. This is typically
 reasons:
 
 - The file declared to be the worhp library, i.e. )"
-            + m_worhp_library
+            + worhp_library
             + R"(, is not found or is found but it is not a shared library containing the necessary symbols 
 (is the file really a valid shared library?)
  - The library is found and it does contain the symbols, but it needs linking to some additional libraries that are not found
@@ -309,424 +374,1237 @@ We report the exact text of the original exception thrown:
  )" + std::string(e.what()));
         pagmo_throw(std::invalid_argument, message);
     }
-    // ------------------------- END WORHP PLUGIN -------------------------------------------------------------
 
     // We check for a version mismatch
     // First we query the library
-    int major, minor;
     char patch[PATCH_STRING_LENGTH];
-    WorhpVersion(&major, &minor, patch);
-    std::string patchstr(patch);
+    retval->WorhpVersion(&retval->m_major, &retval->m_minor, patch);
+    retval->m_patch = std::string(patch);
     // Then we check with the pnf headers
-    if (major != WORHP_MAJOR || minor != WORHP_MINOR) {
-        pagmo_throw(std::invalid_argument, "Your WORHP library (" + library_filename.string()
-                                               + ") version is: " + std::to_string(major) + "." + std::to_string(minor)
+    if (retval->m_major != WORHP_MAJOR || retval->m_minor != WORHP_MINOR) {
+        pagmo_throw(std::invalid_argument, "Your WORHP library (" + library_filename.string() + ") version is: "
+                                               + std::to_string(retval->m_major) + "."
+                                               + std::to_string(retval->m_minor)
                                                + " while pagmo plugins nonfree supports only version: "
                                                + std::to_string(WORHP_MAJOR) + "." + std::to_string(WORHP_MINOR));
     }
+    return retval;
+}
 
-    // All is good, proceed
-    m_log.clear();
-    auto fevals0 = prob.get_fevals();
-
-    // With reference to the worhp User Manual (V1.12)
-    // USI-0:  Call WorhpPreInit to properly initialise the (empty) data structures.
-    OptVar opt;
-    Workspace wsp;
-    Params par;
-    Control cnt;
-    WorhpPreInit(&opt, &wsp, &par, &cnt);
-
-    // USI-1: Read parameters from XML
-    // Note that a file named "param.xml" will be searched in the current directory only if the environment variable
-    // WORHP_PARAM_FILE is not set. Otherwise the WORHP_PARAM_FILE will be used. The number of parameters that are
-    // not getting default values will be stored in n_xml_param
-    int n_xml_param;
-    if (m_verbosity) { // pagmo log is active
-        ReadParams(&n_xml_param, const_cast<char *>("param.xml"), &par);
-        SetWorhpPrint(detail::no_screen_output);
-    } else {
-        if (!m_screen_output) { // pagmo log is active
-            SetWorhpPrint(detail::no_screen_output);
+// Stable counting sort of the indices idx according to key(i), with keys in [0, n_keys). This runs in
+// O(idx.size() + n_keys).
+template <typename Key>
+std::vector<vector_double::size_type> counting_sort(const std::vector<vector_double::size_type> &idx,
+                                                    vector_double::size_type n_keys, const Key &key)
+{
+    std::vector<vector_double::size_type> start(n_keys + 1u, 0u);
+    for (const auto i : idx) {
+        ++start[key(i) + 1u];
+    }
+    std::partial_sum(start.begin(), start.end(), start.begin());
+    std::vector<vector_double::size_type> retval(idx.size());
+    for (const auto i : idx) {
+        retval[start[key(i)]++] = i;
+    }
+    return retval;
+}
+
+// Resolves the strategy for the structure of the hessian of the lagrangian of a problem (see
+// worhp::set_hessian_structure()). pagmo_gs is the gradient sparsity of the problem.
+hessian_structure resolve_hessian_structure(const problem &prob, const std::string &strategy,
+                                            const sparsity_pattern &pagmo_gs)
+{
+    using size_type = vector_double::size_type;
+    // The hessians provided by the problem always need their own structure.
+    if (prob.has_hessians()) {
+        return hessian_structure::problem;
+    }
+    if (strategy == "dense") {
+        return hessian_structure::dense;
+    } else if (strategy == "gradient") {
+        return hessian_structure::gradient;
+    } else if (strategy == "diagonal") {
+        return hessian_structure::diagonal;
+    }
+    // "auto".
+    if (prob.has_hessians_sparsity()) {
+        return hessian_structure::problem;
+    }
+    // The dense structure (the lower triangular part) is kept for small problems.
+    constexpr size_type dense_limit = 1u << 20;
+    const auto nx = prob.get_nx();
+    if (nx * (nx + 1u) / 2u <= dense_limit) {
+        return hessian_structure::dense;
+    }
+    // The structure derived from the gradient sparsity is used if its size (bounded by the sum over the rows of the
+    // gradient of the squared number of entries) is within a small multiple of the size of the gradient sparsity.
+    constexpr size_type gradient_factor = 16u;
+    const auto limit = gradient_factor * (pagmo_gs.size() + nx);
+    size_type bound = 0u;
+    for (size_type i = 0u; i < pagmo_gs.size() && bound <= limit;) {
+        size_type k = 0u;
+        for (const auto row = pagmo_gs[i].first; i < pagmo_gs.size() && pagmo_gs[i].first == row; ++i) {
+            ++k;
         }
-        ReadParams(&n_xml_param, const_cast<char *>("param.xml"), &par);
+        bound += k * (k + 1u) / 2u;
     }
+    return bound <= limit ? hessian_structure::gradient : hessian_structure::diagonal;
+}
 
-    // USI-2: Specify problem dimensions
-    opt.n = static_cast<int>(dim);
-    opt.m = static_cast<int>(prob.get_nc()); // number of constraints
-    auto n_eq = prob.get_nec();
-    // Get the sparsity pattern of the gradient
-    auto pagmo_gs = prob.gradient_sparsity();
-    // Determine where the gradients of the constraints start in the fitness gradient.
+// Prepares the sparsity structures of a problem in the WORHP representation, in time linear in the number of
+// entries of the sparsity patterns (plus the number of variables). strategy is the requested strategy for the
+// structure of the hessian of the lagrangian.
+worhp_sparsity prepare_sparsity(const problem &prob, const std::string &strategy)
+{
+    using size_type = vector_double::size_type;
+    const auto nx = prob.get_nx();
+    worhp_sparsity retval;
+    // Split the gradient sparsity into f and g parts (the gradients of the constraints start at row 1).
+    const auto pagmo_gs = prob.gradient_sparsity();
     const auto it = std::lower_bound(pagmo_gs.begin(), pagmo_gs.end(), sparsity_pattern::value_type(1u, 0u));
-    // Split the sparsity into f and g parts
-    sparsity_pattern fs(pagmo_gs.begin(), it);
-    sparsity_pattern gs(it, pagmo_gs.end());
-    // Create the corresponding index map between pagmo and worhp sparse representation of the gradient
-    std::vector<vector_double::size_type> gs_idx_map(gs.size());
-    std::iota(gs_idx_map.begin(), gs_idx_map.end(), 0);
-    std::sort(gs_idx_map.begin(), gs_idx_map.end(),
-              [&gs](const std::vector<vector_double::size_type>::size_type &idx1,
-                    const std::vector<vector_double::size_type>::size_type &idx2) -> bool {
-                  return (gs[idx1].second < gs[idx2].second
-                          || (!(gs[idx2].second < gs[idx1].second) && gs[idx1].first < gs[idx2].first));
-              });
+    retval.m_fs.assign(pagmo_gs.begin(), it);
+    retval.m_gs.assign(it, pagmo_gs.end());
+    // Column-major order of m_gs, by two stable counting sorts (by row, then by column).
+    const auto &gs = retval.m_gs;
+    std::vector<size_type> gs_idx(gs.size());
+    std::iota(gs_idx.begin(), gs_idx.end(), size_type(0));
+    gs_idx = counting_sort(gs_idx, prob.get_nf(), [&gs](size_type i) { return gs[i].first; });
+    retval.m_gs_idx_map = counting_sort(gs_idx, nx, [&gs](size_type i) { return gs[i].second; });
+    retval.m_dg_gather.resize(gs.size());
+    for (size_type i = 0u; i < gs.size(); ++i) {
+        retval.m_dg_gather[i] = retval.m_fs.size() + retval.m_gs_idx_map[i];
+    }
 
     // NOTE: Worhp requires a single sparsity pattern for the hessian of the lagrangian (that is,
     // the pattern must be valid for objfun and all constraints), but we provide a separate sparsity pattern for
-    // objfun and every constraint. We will thus need to merge our sparsity patterns in a single sparsity
-    // pattern.
-    sparsity_pattern merged_hs;
-    // Store the original hessians sparsity only if it is user-provided.
-    auto hs = prob.hessians_sparsity();
-    if (prob.has_hessians_sparsity()) {
-        for (const auto &sp : hs) {
-            // NOTE: we need to create a separate copy each time as std::set_union() requires distinct ranges.
-            const auto old_merged_hs(merged_hs);
-            merged_hs.clear();
-            std::set_union(old_merged_hs.begin(), old_merged_hs.end(), sp.begin(), sp.end(),
-                           std::back_inserter(merged_hs));
+    // objfun and every constraint. We thus merge our sparsity patterns in a single sparsity pattern. If the
+    // hessians are not provided, the structure is chosen by the requested strategy: the hessians sparsity of the
+    // problem, a dense pattern, the pattern derived from the gradient sparsity (the hessian of each fitness component
+    // can only be non-zero between the variables the component depends upon), or the diagonal alone.
+    retval.m_hs_strategy = strategy;
+    retval.m_hs_kind = resolve_hessian_structure(prob, strategy, pagmo_gs);
+    auto &merged_hs = retval.m_merged_hs;
+    std::vector<sparsity_pattern> hs;
+    // For each entry of the hessians (concatenated), its position in merged_hs.
+    std::vector<size_type> merged_pos;
+    if (retval.m_hs_kind == hessian_structure::problem || retval.m_hs_kind == hessian_structure::gradient) {
+        sparsity_pattern all_hs;
+        if (retval.m_hs_kind == hessian_structure::problem) {
+            hs = prob.hessians_sparsity();
+            for (const auto &sp : hs) {
+                all_hs.insert(all_hs.end(), sp.begin(), sp.end());
+            }
+        } else {
+            // The lower triangular pairs of the variables of each row of the (row-major) gradient sparsity.
+            for (size_type i = 0u, j = 0u; i < pagmo_gs.size(); i = j) {
+                for (j = i; j < pagmo_gs.size() && pagmo_gs[j].first == pagmo_gs[i].first; ++j) {
+                    for (auto k = i; k <= j; ++k) {
+                        all_hs.emplace_back(pagmo_gs[j].second, pagmo_gs[k].second);
+                    }
+                }
+            }
         }
+        // Row-major order of all the entries, by two stable counting sorts (by column, then by row), then
+        // the duplicates are merged.
+        std::vector<size_type> order(all_hs.size());
+        std::iota(order.begin(), order.end(), size_type(0));
+        order = counting_sort(order, nx, [&all_hs](size_type i) { return all_hs[i].second; });
+        order = counting_sort(order, nx, [&all_hs](size_type i) { return all_hs[i].first; });
+        merged_pos.resize(all_hs.size());
+        for (const auto i : order) {
+            if (merged_hs.empty() || merged_hs.back() != all_hs[i]) {
+                merged_hs.push_back(all_hs[i]);
+            }
+            merged_pos[i] = merged_hs.size() - 1u;
+        }
+    } else if (retval.m_hs_kind == hessian_structure::dense) {
+        merged_hs = pagmo::detail::dense_hessian(nx);
     } else {
-        // If the hessians sparsity is not user-provided, dense patterns are assumed.
-        merged_hs = pagmo::detail::dense_hessian(prob.get_nx());
+        merged_hs.reserve(nx);
+        for (size_type i = 0u; i < nx; ++i) {
+            merged_hs.emplace_back(i, i);
+        }
     }
-    // -------------------------------------------------------------------------------------------------------------------------
+
     /*
      * In WORHP the HM sparsity requires lower triangular entries first,
      * then all the diagonal elements (also the zeros) (cani maledetti^2)
      */
-    // Create the corresponding index map between pagmo and worhp sparse representation of the lower triangular part
-    // of the hessian of the lagrangian
-    std::vector<vector_double::size_type> hs_idx_map(merged_hs.size());
-    std::iota(hs_idx_map.begin(), hs_idx_map.end(), 0);
-    // Sort the resulting hessian of the lagrangian sparsity according to worhp twisted choice.
-    // Lexicographic from right to left, i.e. ((1,0),(2,0),(0,1), )
-    std::sort(hs_idx_map.begin(), hs_idx_map.end(),
-              [&merged_hs](const vector_double::size_type &idx1, const vector_double::size_type &idx2) -> bool {
-                  return (merged_hs[idx1].second < merged_hs[idx2].second
-                          || (!(merged_hs[idx2].second < merged_hs[idx1].second)
-                              && merged_hs[idx1].first < merged_hs[idx2].first));
-              });
-
-    // We remove the diagonal entries from the hessian sparsity as merged from pagmo (if present)
-    auto it2 = std::remove_if(hs_idx_map.begin(), hs_idx_map.end(),
-                              [&merged_hs](std::vector<vector_double::size_type>::size_type &idx) -> bool {
-                                  return (merged_hs[idx].first == merged_hs[idx].second);
-                              });
-    hs_idx_map.erase(it2, hs_idx_map.end());
-
-    wsp.DF.nnz = static_cast<int>(fs.size());
-    wsp.DG.nnz = static_cast<int>(gs.size());
-    wsp.HM.nnz = static_cast<int>(hs_idx_map.size() + dim); // lower triangular sparse + full diagonal
-
-    // USI-3 (and 8): Allocate solver memory (and deallocate upon destruction of wr)
-    detail::worhp_raii wr(&opt, &wsp, &par, &cnt, WorhpInit, WorhpFree);
-
-    // This flag informs Worhp that f and g should not be evaluated seperately. pagmo fitness always computes both
-    // so that if only the objfun is needed also the constraints are computed. This flag signals to worhp that this
-    // is the case. Since the flag makes sense only for constrained problems, we set it only if necessary (worhp
-    // would otherwise print a warning)
-    if (prob.get_nc() > 0) {
-        par.FGtogether = true;
-    }
-
-    // We deal with the gradient
-    if (prob.has_gradient()) {
-        WorhpSetBoolParam(&par, "UserDF", true);
-        WorhpSetBoolParam(&par, "UserDG", true);
-    } else {
-        WorhpSetBoolParam(&par, "UserDF", false);
-        WorhpSetBoolParam(&par, "UserDG", false);
+    // Column-major order of the strict lower triangular part of merged_hs (Lexicographic from right to left,
+    // i.e. ((1,0),(2,0),(0,1), )).
+    std::vector<size_type> off_diagonal;
+    for (size_type i = 0u; i < merged_hs.size(); ++i) {
+        if (merged_hs[i].first != merged_hs[i].second) {
+            off_diagonal.push_back(i);
+        }
     }
+    retval.m_hs_idx_map
+        = counting_sort(off_diagonal, nx, [&merged_hs](size_type i) { return merged_hs[i].second; });
+    const auto &hs_idx_map = retval.m_hs_idx_map;
+
+    // We now compute, once and for all, where each entry of each pagmo hessian must be accumulated in the
+    // WORHP representation (HM.val), so that UserHM does not need to look up the sparsity patterns.
     if (prob.has_hessians()) {
-        WorhpSetBoolParam(&par, "UserHM", true);
-    } else {
-        WorhpSetBoolParam(&par, "UserHM", false);
+        auto &plan = retval.m_hm_plan;
+        // Position in HM.val of each (off-diagonal) entry of merged_hs.
+        std::vector<size_type> merged_slot(merged_hs.size());
+        for (size_type i = 0u; i < hs_idx_map.size(); ++i) {
+            merged_slot[hs_idx_map[i]] = i;
+        }
+        plan.m_offset.reserve(hs.size() + 1u);
+        plan.m_offset.push_back(0u);
+        size_type k = 0u;
+        for (const auto &sp : hs) {
+            for (const auto &ij : sp) {
+                // Diagonal entries go after the lower triangular part.
+                plan.m_slot.push_back(ij.first == ij.second ? hs_idx_map.size() + ij.first
+                                                            : merged_slot[merged_pos[k]]);
+                ++k;
+            }
+            plan.m_offset.push_back(plan.m_slot.size());
+        }
     }
+    return retval;
+}
 
-    // Logic for the handling of constraints tolerances. The logic is as follows:
-    // - if the user provides the "TolFeas" option, use that *unconditionally*. Otherwise,
-    // - compute the minimum tolerance min_tol among those returned by  problem.c_tol(). If zero, ignore
-    //   it and use the WORHP default value for "TolFeas" (1e-6). Otherwise, use min_tol as
-    //   the value for "TolFeas" and min_tol/2 for AcceptTolFeas
-    if (prob.get_nc() && !m_numeric_opts.count("TolFeas")) {
-        const auto c_tol = prob.get_c_tol();
-        assert(!c_tol.empty());
-        const double min_tol = *std::min_element(c_tol.begin(), c_tol.end());
-        if (min_tol > 0.) {
-            auto res = WorhpSetDoubleParam(&par, "TolFeas", min_tol);
-            res = WorhpSetDoubleParam(&par, "AcceptTolFeas", min_tol / 2);
-            assert(res == true);
-        }
+// The name of the parameter file passed to ReadParams (an empty file name selects the WORHP default).
+std::string params_file_name(const std::string &file)
+{
+    return file.empty() ? std::string("param.xml") : file;
+}
+
+// Whether the parameter file changed since the snapshot of the cache was taken. Without a file name, the file
+// actually read by ReadParams is WORHP_PARAM_FILE, if the environment variable is set, or param.xml.
+bool params_file_changed(worhp_params_cache &cache, const std::string &file, bool &exists, std::time_t &write_time,
+                         boost::uintmax_t &size)
+{
+    const char *env = file.empty() ? std::getenv("WORHP_PARAM_FILE") : nullptr;
+    const boost::filesystem::path path(env ? std::string(env) : params_file_name(file));
+    boost::system::error_code ec;
+    exists = boost::filesystem::is_regular_file(path, ec);
+    write_time = exists ? boost::filesystem::last_write_time(path, ec) : std::time_t(0);
+    size = exists ? boost::filesystem::file_size(path, ec) : boost::uintmax_t(0);
+    return exists != cache.m_exists || write_time != cache.m_write_time || size != cache.m_size;
+}
+
+// Returns the parameters snapshot of the cache, together with its generation. The file is read again if it
+// changed, or if the snapshot was taken with another library or file.
+std::pair<std::shared_ptr<const Params>, unsigned long long>
+get_params_snapshot(worhp_params_cache &cache, const std::shared_ptr<const worhp_lib> &lib, const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(cache.m_mutex);
+    bool exists;
+    std::time_t write_time;
+    boost::uintmax_t size;
+    const auto changed = params_file_changed(cache, file, exists, write_time, size);
+    if (changed || !cache.m_params || cache.m_lib_id != lib.get() || cache.m_file != file) {
+        auto params = std::make_shared<Params>();
+        int n_xml_param;
+        lib->ReadParams(&n_xml_param, params_file_name(file).c_str(), params.get());
+        cache.m_params = std::move(params);
+        cache.m_lib_id = lib.get();
+        cache.m_file = file;
+        cache.m_exists = exists;
+        cache.m_write_time = write_time;
+        cache.m_size = size;
+        ++cache.m_generation;
     }
+    return {cache.m_params, cache.m_generation};
+}
 
-    // We now set the user defined options
-    // floats
-    for (const auto &p : m_numeric_opts) {
-        auto success = WorhpSetDoubleParam(&par, p.first.c_str(), p.second);
-        if (!success) {
-            pagmo_throw(std::invalid_argument,
-                        "The option '" + p.first + "' was requested by the user to be set to the float value "
-                            + std::to_string(p.second)
-                            + ", but WORHP interface returned an error. Did you mispell the option name?");
+// The structure of a problem as seen by WORHP: the dimensions, the sparsity patterns and the data determining the
+// parameters set by the plugin. A WORHP instance initialised for a structure can be restarted for another run
+// on the same structure, without allocating the data structures and filling the sparsity patterns again.
+struct worhp_structure {
+    vector_double::size_type m_n;
+    vector_double::size_type m_m;
+    // The sparsity structures.
+    std::shared_ptr<const worhp_sparsity> m_sparsity;
+    bool m_has_gradient;
+    bool m_has_hessians;
+    // The source of the parameters: 0 for the WORHP defaults, 1 for the XML file read at each run, otherwise
+    // 1 + the generation of the in-memory snapshot.
+    unsigned long long m_params_source;
+    // The minimum constraint tolerance and the options requested by the user.
+    double m_min_tol;
+    std::map<std::string, int> m_integer_opts;
+    std::map<std::string, double> m_numeric_opts;
+    std::map<std::string, bool> m_bool_opts;
+};
+
+bool operator==(const worhp_structure &a, const worhp_structure &b)
+{
+    return a.m_n == b.m_n && a.m_m == b.m_m && a.m_params_source == b.m_params_source
+           && a.m_has_gradient == b.m_has_gradient
+           && a.m_has_hessians == b.m_has_hessians && a.m_min_tol == b.m_min_tol
+           && (a.m_sparsity == b.m_sparsity
+               || (a.m_sparsity->m_fs == b.m_sparsity->m_fs && a.m_sparsity->m_gs == b.m_sparsity->m_gs
+                   && a.m_sparsity->m_hs_kind == b.m_sparsity->m_hs_kind
+                   && a.m_sparsity->m_merged_hs == b.m_sparsity->m_merged_hs))
+           && a.m_integer_opts == b.m_integer_opts
+           && a.m_numeric_opts == b.m_numeric_opts && a.m_bool_opts == b.m_bool_opts;
+}
+
+// A WORHP instance. Once initialised (WorhpInit) for a structure, it is freed (WorhpFree) on destruction.
+struct worhp_session final : worhp_session_base {
+    explicit worhp_session(std::shared_ptr<const worhp_lib> lib) : m_lib(std::move(lib)) {}
+    ~worhp_session()
+    {
+        if (m_initialised) {
+            m_lib->WorhpFree(&m_opt, &m_wsp, &m_par, &m_cnt);
         }
     }
-    // int
-    for (const auto &p : m_integer_opts) {
-        auto success = WorhpSetIntParam(&par, p.first.c_str(), p.second);
-        if (!success) {
-            pagmo_throw(std::invalid_argument,
-                        "The option '" + p.first + "' was requested by the user to be set to the integer value "
-                            + std::to_string(p.second)
-                            + ", but WORHP interface returned an error. Did you mispell the option name?");
+    // NOTE: the library is kept alive for as long as the instance exists.
+    std::shared_ptr<const worhp_lib> m_lib;
+    OptVar m_opt;
+    Workspace m_wsp;
+    Params m_par;
+    Control m_cnt;
+    // The structure the instance was initialised for (null if not initialised).
+    std::shared_ptr<const worhp_structure> m_structure;
+    bool m_initialised = false;
+    // Set when a run completes: only then can the instance be restarted.
+    bool m_completed = false;
+};
+
+// Exclusive use of a WORHP instance for the duration of a run. If a pool is given and the library exports
+// WorhpRestart, an idle instance initialised for the same structure is taken from the pool (or a new one is
+// created), and given back to it on destruction if its run completed. Otherwise the instance is used for one
+// run only.
+class worhp_session_lease
+{
+public:
+    worhp_session_lease() = default;
+    worhp_session_lease(const worhp_session_lease &) = delete;
+    worhp_session_lease &operator=(const worhp_session_lease &) = delete;
+    ~worhp_session_lease()
+    {
+        if (m_pool && m_session && m_session->m_completed) {
+            try {
+                std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+                m_pool->m_idle.push_back(std::move(m_session));
+            } catch (...) {
+                // The instance could not be given back: it is simply freed.
+            }
         }
     }
-    // bool
-    for (const auto &p : m_bool_opts) {
-        auto success = WorhpSetBoolParam(&par, p.first.c_str(), p.second);
-        if (!success) {
-            pagmo_throw(std::invalid_argument,
-                        "The option '" + p.first + "' was requested by the user to be set to the bool value "
-                            + std::to_string(p.second)
-                            + ", but WORHP interface returned an error. Did you mispell the option name?");
+    void acquire(worhp_session_pool *pool, const std::shared_ptr<const worhp_lib> &lib,
+                 const std::shared_ptr<const worhp_structure> &structure)
+    {
+        m_pool = lib->WorhpRestart ? pool : nullptr;
+        if (m_pool) {
+            std::lock_guard<std::mutex> lock(m_pool->m_mutex);
+            auto &idle = m_pool->m_idle;
+            const auto it = std::find_if(idle.begin(), idle.end(), [&](const auto &s) {
+                const auto &session = static_cast<const worhp_session &>(*s);
+                return session.m_lib == lib
+                       && (session.m_structure == structure || *session.m_structure == *structure);
+            });
+            if (it != idle.end()) {
+                m_session.reset(static_cast<worhp_session *>(it->release()));
+                idle.erase(it);
+                // NOTE: the matching structure is shared, so that later matches are cheaper.
+                m_session->m_structure = structure;
+                m_session->m_completed = false;
+            }
+        }
+        if (!m_session) {
+            m_session = std::make_unique<worhp_session>(lib);
         }
     }
-
-    // USI-5: Set initial values and deal with gradients / hessians
-    // We define the initial value for the chromosome
-    // We init the starting point using the inherited methods from not_population_based
-    auto sel_xf = select_individual(pop);
-    vector_double x0(std::move(sel_xf.first)), f0(std::move(sel_xf.second)); // TODO: is f0 useful to worhp?
-    for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(opt.n); ++i) {
-        opt.X[i] = x0[i];
+    // Whether the instance has been initialised by a previous run (and can thus be restarted).
+    bool reused() const
+    {
+        return m_session->m_initialised;
     }
-    opt.F = wsp.ScaleObj * f0[0];
-    for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(opt.m); ++i) {
-        opt.G[i] = f0[i + 1];
+    worhp_session *operator->() const
+    {
+        return m_session.get();
     }
 
-    // USI-6: Set the constraint bounds
-    // Box bounds
-    for (vector_double::size_type i = 0; i < static_cast<vector_double::size_type>(opt.n); ++i) {
-        opt.Lambda[i] = 0;
-        opt.XL[i] = lb[i];
-        opt.XU[i] = ub[i];
+private:
+    worhp_session_pool *m_pool = nullptr;
+    std::unique_ptr<worhp_session> m_session;
+};
+
+// The state of one WORHP run during evolve(): its WORHP instance, its starting point and its outcome.
+struct worhp_run {
+    worhp_session_lease m_session;
+    vector_double m_x0;
+    vector_double m_f0;
+    vector_double m_x;
+    vector_double m_f;
+    std::string m_res;
+    log_columns m_log;
+    // The error raised writing the log file (empty if none).
+    std::string m_log_error;
+    eval_cache_stats m_cache_stats;
+    evolve_stats m_stats;
+    // The stored state the run is warm started from (if m_warm), replaced by its final state (if m_ws_final).
+    bool m_warm = false;
+    bool m_ws_final = false;
+    worhp_warm_start m_ws;
+};
+
+// Looks for a stored warm start state matching the decision vector x (i.e. with the same problem name and sizes,
+// and with a decision vector within tol from x in the infinity norm). Returns states.end() if none is found.
+std::vector<worhp_warm_start>::iterator find_warm_start(std::vector<worhp_warm_start> &states,
+                                                        const std::string &prob_name, const vector_double &x,
+                                                        vector_double::size_type nc, double tol)
+{
+    return std::find_if(states.begin(), states.end(), [&](const worhp_warm_start &ws) {
+        if (ws.m_prob_name != prob_name || ws.m_x.size() != x.size() || ws.m_mu.size() != nc) {
+            return false;
+        }
+        for (decltype(x.size()) i = 0u; i < x.size(); ++i) {
+            if (!(std::abs(ws.m_x[i] - x[i]) <= tol)) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+// The registry of the loaded worhp libraries, keyed by path.
+library_registry<std::string, worhp_lib> &worhp_registry()
+{
+    static library_registry<std::string, worhp_lib> registry;
+    return registry;
+}
+
+std::shared_ptr<const worhp_lib> get_worhp_lib(const std::string &worhp_library)
+{
+    return worhp_registry().get(worhp_library, [&worhp_library]() { return load_worhp_lib(worhp_library); });
+}
+
+// The results of a worhp instance which was never evolved.
+evolve_results<std::string> no_results()
+{
+    evolve_results<std::string> retval;
+    retval.m_opt_res
+        = "\tThere still is no last optimisation result as WORHP evolve was never successfully called yet.";
+    return retval;
+}
+} // namespace
+
+} // end of namespace detail
+
+worhp::worhp(bool screen_output, std::string worhp_library)
+    : m_worhp_library(worhp_library), m_results(detail::no_results()), m_integer_opts(), m_numeric_opts(),
+      m_bool_opts(), m_screen_output(screen_output), m_verbosity(0),
+      m_params_cache(std::make_shared<detail::worhp_params_cache>())
+{
+}
+
+/// Evolve population.
+/**
+ * This method will select an individual from \p pop, optimise it using the WORHP USI interface, replace an
+ * individual in \p pop with the optimised individual, and finally return \p pop. The individual selection and
+ * replacement criteria can be set via set_selection(const std::string &), set_selection(population::size_type),
+ * set_replacement(const std::string &) and set_replacement(population::size_type). The WORHP solver will then run
+ * until one of the stopping criteria is satisfied, and the return status of the WORHP solver will be recorded (it
+ * can be fetched with get_last_opt_result()).
+ *
+ * The sparsity structures of the problem in the WORHP representation are prepared once, and reused by later calls
+ * on problems with the same UDP type and name, dimensions, bounds and availability of the derivatives and of their
+ * sparsities (such problems are assumed to share the same sparsity patterns).
+ *
+ * \verbatim embed:rst:leading-asterisk
+ *
+ * .. warning::
+ *
+ *    All options passed to the WORHP interface are determined first by the xml parameter file, or (if not found) by
+ *    the default options. Then FGtogether is set to true (for constrained problems) and UserDF, UserDG , UserHM to
+ *    the values detected by the pagmo::has_gradient, pagmo::has_hessians methods. TolFeas is then set to be the
+ *    minimum of prob.get_c_tol() if not 0. All the other options, contained in the data members m_integer_opts,
+ *    m_numeric_opts and m_bool_opts are set after and thus overwrite the above rules.
+ *
+ * \endverbatim
+ *
+ * @param pop the population to be optimised.
+ *
+ * @return the optimised population.
+ *
+ * @throws std::invalid_argument if a version mismatch is found between the declared library and 1.12
+ * @throws std::invalid_argument in the following cases:
+ * - the population's problem is multi-objective or stochastic
+ * @throws unspecified any exception thrown by the public interface of pagmo::problem or
+ * pagmo::not_population_based.
+ */
+population worhp::evolve(population pop) const
+{
+    // We store some useful properties
+    const auto &prob = pop.get_problem(); // This is a const reference, so using set_seed, for example, will not work
+    auto dim = prob.get_nx();
+    const auto bounds = prob.get_bounds();
+    const auto &lb = bounds.first;
+    const auto &ub = bounds.second;
+
+    // PREAMBLE-------------------------------------------------------------------------------------------------
+    // We start by checking that the problem is suitable for this particular algorithm.
+    if (prob.get_nobj() != 1u) {
+        pagmo_throw(std::invalid_argument, "Multiple objectives detected in " + prob.get_name() + " instance. "
+                                               + get_name() + " cannot deal with them");
     }
-    // Equality constraints
-    for (decltype(n_eq) i = 0u; i < n_eq; ++i) {
-        opt.Mu[i] = 0;
-        opt.GL[i] = 0;
-        opt.GU[i] = 0;
+    if (prob.is_stochastic()) {
+        pagmo_throw(std::invalid_argument,
+                    "The problem appears to be stochastic " + get_name() + " cannot deal with it");
     }
-    // Inequality constraints
-    for (auto i = n_eq; i < static_cast<decltype(n_eq)>(opt.m); ++i) {
-        opt.Mu[i] = 0;
-        opt.GL[i] = -par.Infty;
-        opt.GU[i] = 0;
+
+    if (!pop.size()) {
+        // In case of an empty pop, just return it.
+        return pop;
     }
+    // ---------------------------------------------------------------------------------------------------------
+    // ------------------------- WORHP PLUGIN (we fetch the worhp library from the process-wide registry)--------
+    // The library is loaded, its symbols resolved and its version checked only the first time it is
+    // requested, later evolves (from any thread) reuse the same table.
+    evolve_stats stats;
+    detail::phase_timer total_timer(m_collect_stats ? &stats.m_total_time : nullptr);
+    detail::phase_timer load_timer(m_collect_stats ? &stats.m_load_time : nullptr);
+    const auto lib = detail::get_worhp_lib(m_worhp_library);
+    load_timer.stop();
+    const auto &ReadParams = lib->ReadParams;
+    const auto &WorhpPreInit = lib->WorhpPreInit;
+    const auto &WorhpInit = lib->WorhpInit;
+    const auto &GetUserAction = lib->GetUserAction;
+    const auto &DoneUserAction = lib->DoneUserAction;
+    const auto &IterationOutput = lib->IterationOutput;
+    const auto &Worhp = lib->Worhp;
+    const auto &StatusMsg = lib->StatusMsg;
+    const auto &StatusMsgString = lib->StatusMsgString;
+    const auto &WorhpFidif = lib->WorhpFidif;
+    const auto &WorhpSetBoolParam = lib->WorhpSetBoolParam;
+    const auto &WorhpSetIntParam = lib->WorhpSetIntParam;
+    const auto &WorhpSetDoubleParam = lib->WorhpSetDoubleParam;
+    // ------------------------- END WORHP PLUGIN -------------------------------------------------------------
 
-    /*
-     * Specify matrix structures in CS format, using Fortran indexing,
-     * i.e. 1...N instead of 0...N-1, to describe the matrix structure.
-     * Only if the declared size is not dense.
-     */
-    // -------------------------------------------------------------------------------------------------------------------------
-    // Assign sparsity structure to DF
-    if (wsp.DF.NeedStructure) {
-        for (decltype(fs.size()) i = 0; i < fs.size(); ++i) {
-            // NOTE: the +1 is because of fortran notation is required by WORHP (maledetti).
-            wsp.DF.row[i] = static_cast<int>(fs[i].second + 1);
-        }
+    if (!m_xml_params && !lib->InitParams) {
+        pagmo_throw(std::invalid_argument, "The XML parameter file lookup was disabled, but the WORHP library ("
+                                               + m_worhp_library + ") does not export InitParams");
     }
-    // -------------------------------------------------------------------------------------------------------------------------
-    // Assign sparsity structure to DG if not dense.
-    if (wsp.DG.NeedStructure) {
-        for (decltype(gs_idx_map.size()) i = 0u; i < gs_idx_map.size(); ++i) {
-            // NOTE: no need for +1 here as in pagmo 0 is the objfun already stripped from here.
-            wsp.DG.row[i] = static_cast<int>(gs[gs_idx_map[i]].first);
-            // NOTE: the +1 is because of fortran notation is required by WORHP (maledetti).
-            wsp.DG.col[i] = static_cast<int>(gs[gs_idx_map[i]].second + 1);
-        }
+
+    // All is good, proceed
+    // The messages printed by WORHP on this thread (and on the threads of the runs) go to screen only if WORHP's
+    // screen output is active. Those of the parameters' reading are also shown if the pagmo log is active.
+    const auto solver_printer = m_screen_output ? lib->m_default_print : detail::no_screen_output;
+    const auto params_printer = (m_screen_output || m_verbosity) ? lib->m_default_print : detail::no_screen_output;
+    const detail::print_scope print_scope(solver_printer);
+
+    // The parameters read from the XML file are taken from the in-memory snapshot, if active. This is read
+    // only if the file changed.
+    detail::phase_timer params_timer(m_collect_stats ? &stats.m_options_time : nullptr);
+    std::pair<std::shared_ptr<const Params>, unsigned long long> params_snapshot;
+    if (m_xml_params && m_params_caching) {
+        const detail::print_scope params_print_scope(params_printer);
+        params_snapshot = detail::get_params_snapshot(*m_params_cache, lib, m_params_file);
     }
-    // -------------------------------------------------------------------------------------------------------------------------
-    // Assign sparsity structure to HM if not dense. (this requires to perform the same operations as above,
-    // but directly on the merged_hs not on the iota)
-    if (wsp.HM.NeedStructure) {
-        // Strict lower triangle
-        for (decltype(hs_idx_map.size()) i = 0u; i < hs_idx_map.size(); ++i) {
-            // NOTE: the +1 is because fortran notation is required by WORHP (maledetti).
-            wsp.HM.row[i] = static_cast<int>(merged_hs[hs_idx_map[i]].first + 1);
-            // NOTE: the +1 is because fortran notation is required by WORHP (maledetti).
-            wsp.HM.col[i] = static_cast<int>(merged_hs[hs_idx_map[i]].second + 1);
+    params_timer.stop();
+    // USI-1: Read parameters from XML, from the snapshot, or set the WORHP defaults if the XML lookup is disabled.
+    // Note that a file named "param.xml" will be searched in the current directory only if the environment variable
+    // WORHP_PARAM_FILE is not set. Otherwise the WORHP_PARAM_FILE will be used. The number of parameters that are
+    // not getting default values will be stored in n_xml_param
+    const auto params_file = detail::params_file_name(m_params_file);
+    auto read_params = [&](Params &par) {
+        int n_xml_param;
+        if (params_snapshot.first) {
+            par = *params_snapshot.first;
+        } else if (m_xml_params) {
+            ReadParams(&n_xml_param, params_file.c_str(), &par);
+        } else {
+            lib->InitParams(&n_xml_param, &par);
         }
+    };
 
-        // Diagonal
-        for (decltype(dim) i = 0; i < dim; ++i) {
-            wsp.HM.row[hs_idx_map.size() + i] = static_cast<int>(i + 1);
-            wsp.HM.col[hs_idx_map.size() + i] = static_cast<int>(i + 1);
+    // The analysis of the sparsity patterns is shared by all the runs, and reused by later evolves on problems
+    // with the same fingerprint.
+    detail::phase_timer sparsity_timer(m_collect_stats ? &stats.m_setup_time : nullptr);
+    auto n_eq = prob.get_nec();
+    std::shared_ptr<const detail::worhp_sparsity> sparsity;
+    {
+        const detail::sparsity_fingerprint fp(prob);
+        // Looks up the structures of the problem, or stores those in sparsity if there are none (returns true if
+        // found).
+        auto lookup = [this, &fp, &sparsity](std::vector<sparsity_cache_entry> &cache) {
+            const auto it = std::find_if(cache.begin(), cache.end(), [this, &fp](const sparsity_cache_entry &entry) {
+                return entry.first == fp && entry.second->m_hs_strategy == m_hessian_structure;
+            });
+            if (it != cache.end()) {
+                sparsity = it->second;
+                // The entry becomes the most recently used one.
+                std::rotate(it, it + 1, cache.end());
+                return true;
+            }
+            if (sparsity) {
+                if (cache.size() >= sparsity_cache_capacity) {
+                    cache.erase(cache.begin());
+                }
+                cache.emplace_back(fp, sparsity);
+            }
+            return false;
+        };
+        // The structures are prepared without holding the lock (a concurrent call may store them first).
+        if (!m_sparsity_cache.apply(lookup)) {
+            sparsity
+                = std::make_shared<const detail::worhp_sparsity>(detail::prepare_sparsity(prob, m_hessian_structure));
+            m_sparsity_cache.apply(lookup);
         }
     }
-    // -------------------------------------------------------------------------------------------------------------------------
+    const auto &fs = sparsity->m_fs;
+    const auto &gs = sparsity->m_gs;
+    const auto &gs_idx_map = sparsity->m_gs_idx_map;
+    const auto &merged_hs = sparsity->m_merged_hs;
+    const auto &hs_idx_map = sparsity->m_hs_idx_map;
+    const auto &hm_plan = sparsity->m_hm_plan;
+    const auto &dg_gather = sparsity->m_dg_gather;
+    // The number of entries of the fitness gradient.
+    const auto n_grad = fs.size() + gs.size();
+    // The gradient is computed by finite differences in the plugin if the problem does not provide it and this
+    // was requested. WORHP then sees the problem as one providing its gradient, whose entries are computed in the
+    // pagmo order (that of fs followed by that of gs). The variables are grouped once by colouring the pattern.
+    const bool plugin_fd = m_fd && !prob.has_gradient();
+    const bool has_gradient = prob.has_gradient() || plugin_fd;
+    sparsity_pattern fd_pattern;
+    detail::fd_colouring fd_colouring;
+    if (plugin_fd) {
+        fd_pattern.reserve(n_grad);
+        fd_pattern.insert(fd_pattern.end(), fs.begin(), fs.end());
+        fd_pattern.insert(fd_pattern.end(), gs.begin(), gs.end());
+        fd_colouring = detail::colour_gradient_sparsity(fd_pattern, dim, prob.get_nf());
+    }
 
-    if (m_verbosity) {
-        print("WORHP version is (library): ", major, ".", minor, ".", patchstr, "\n");
-        print("WORHP version is (plugin headers): ", WORHP_VERSION, "\n");
-        print("\nWORHP plugin for pagmo/pygmo: \n");
-        if (prob.has_gradient_sparsity()) {
-            print("\tThe gradient sparsity is provided by the user: ", pagmo_gs.size(), " components detected.\n");
+    // The structure of the problem, shared with the WORHP instances initialised for it.
+    auto structure = std::make_shared<detail::worhp_structure>();
+    structure->m_sparsity = sparsity;
+    structure->m_n = dim;
+    structure->m_m = prob.get_nc();
+    structure->m_params_source = m_xml_params ? (params_snapshot.first ? 1u + params_snapshot.second : 1u) : 0u;
+    structure->m_has_gradient = has_gradient;
+    structure->m_has_hessians = prob.has_hessians();
+    structure->m_min_tol = 0.;
+    if (prob.get_nc()) {
+        const auto c_tol = prob.get_c_tol();
+        structure->m_min_tol = *std::min_element(c_tol.begin(), c_tol.end());
+    }
+    structure->m_integer_opts = m_integer_opts;
+    structure->m_numeric_opts = m_numeric_opts;
+    structure->m_bool_opts = m_bool_opts;
+    sparsity_timer.stop();
+
+    // ------- Setting the initial points --------------------------------------------------------------------
+    // We init the starting point using the inherited methods from not_population_based, or, in batch mode,
+    // we select batch_size individuals according to the same selection policy.
+    // The random engine inherited from not_population_based is shared by the concurrent calls to evolve(), and
+    // is used under its lock.
+    std::vector<population::size_type> batch_idx;
+    std::vector<vector_double> x0s, f0s;
+    {
+        std::lock_guard<detail::member_mutex> lock(m_e_mutex);
+        if (m_batch_size > 1u) {
+            batch_idx = detail::select_batch(pop, m_select, m_batch_size, m_e);
+            for (auto idx : batch_idx) {
+                x0s.push_back(pop.get_x()[idx]);
+                f0s.push_back(pop.get_f()[idx]);
+            }
         } else {
-            print("\tThe gradient sparsity is assumed dense: ", pagmo_gs.size(), " components detected.\n");
+            auto sel_xf = select_individual(pop);
+            x0s.push_back(std::move(sel_xf.first));
+            f0s.push_back(std::move(sel_xf.second));
         }
-        if (prob.has_gradient()) {
-            print("\tThe gradient is provided by the user.\n");
-        } else {
-            print("\tThe gradient is computed numerically by WORHP.\n");
+    }
+    std::vector<detail::worhp_run> runs(x0s.size());
+    for (decltype(runs.size()) i = 0u; i < runs.size(); ++i) {
+        auto &run = runs[i];
+        run.m_x0 = std::move(x0s[i]);
+        run.m_f0 = std::move(f0s[i]);
+        // If a state was stored by a previous run ending close to x0, we warm start from its multipliers.
+        if (m_warm_start) {
+            m_ws_states.apply([&](std::vector<detail::worhp_warm_start> &states) {
+                const auto it = detail::find_warm_start(states, prob.get_name(), run.m_x0, prob.get_nc(), m_ws_tol);
+                if (it != states.end()) {
+                    run.m_ws = *it;
+                    run.m_warm = true;
+                    // The entry becomes the most recently used one.
+                    std::rotate(it, it + 1, states.end());
+                }
+            });
+        }
+        // In the persistent session mode, the WORHP instance may have been initialised for the same structure by a
+        // previous run: in that case there is nothing to do here.
+        auto &session = run.m_session;
+        session.acquire(m_persistent_session ? &m_sessions.get() : nullptr, lib, structure);
+        if (session.reused()) {
+            continue;
         }
-        print("\tThe hessian of the lagrangian sparsity has: ", merged_hs.size(), " components.\n");
+        // With reference to the worhp User Manual (V1.12)
+        // USI-0:  Call WorhpPreInit to properly initialise the (empty) data structures.
+        auto &opt = session->m_opt;
+        auto &wsp = session->m_wsp;
+        auto &par = session->m_par;
+        auto &cnt = session->m_cnt;
+        detail::phase_timer init_timer(m_collect_stats ? &run.m_stats.m_init_time : nullptr);
+        WorhpPreInit(&opt, &wsp, &par, &cnt);
+        init_timer.stop();
+
+        // USI-1: Read parameters (see read_params above)
+        detail::phase_timer options_timer(m_collect_stats ? &run.m_stats.m_options_time : nullptr);
+        {
+            const detail::print_scope params_print_scope(params_printer);
+            read_params(par);
+        }
+    }
 
-        if (prob.has_hessians()) {
-            print("\tThe hessians are provided by the user.\n");
-        } else {
-            print("\tThe hessian of the lagrangian is computed numerically by WORHP.\n");
+    // With reference to the worhp User Manual (V1.12), this performs USI-2 to USI-8 on a run whose data structures
+    // have been initialised (USI-0 and USI-1 above). Only the logged run prints to screen.
+    auto solve = [&](problem &run_prob, detail::worhp_run &run, bool logged) {
+        auto &session = run.m_session;
+        auto &opt = session->m_opt;
+        auto &wsp = session->m_wsp;
+        auto &par = session->m_par;
+        auto &cnt = session->m_cnt;
+        // The runs are solved on several threads in batch mode: the printer is set on each.
+        const detail::print_scope run_print_scope(logged ? solver_printer : detail::no_screen_output);
+        // Whether the instance is restarted, keeping the data structures, parameters and sparsity structures of
+        // a previous run on the same structure.
+        const bool restart = session.reused();
+        // The statistics of the run, if collected.
+        evolve_stats *run_stats = m_collect_stats ? &run.m_stats : nullptr;
+
+        detail::phase_timer init_timer(run_stats ? &run_stats->m_init_time : nullptr);
+        // NOTE: a restarted instance keeps its data structures: WorhpRestart is called below, once the new starting
+        // point, bounds and multipliers are set.
+        if (!restart) {
+            // USI-2: Specify problem dimensions
+            opt.n = static_cast<int>(dim);
+            opt.m = static_cast<int>(prob.get_nc()); // number of constraints
+            wsp.DF.nnz = static_cast<int>(fs.size());
+            wsp.DG.nnz = static_cast<int>(gs.size());
+            wsp.HM.nnz = static_cast<int>(hs_idx_map.size() + dim); // lower triangular sparse + full diagonal
+
+            // USI-3 (and 8): Allocate solver memory (deallocated upon destruction of the instance)
+            WorhpInit(&opt, &wsp, &par, &cnt);
+            session->m_initialised = true;
+            session->m_structure = structure;
         }
-        print("\nThe following parameters have been set by pagmo to values other than their xml provided ones (or "
-              "their default ones): \n");
-        print("\tpar.FGtogether: ", par.FGtogether, "\n");
-        print("\tpar.UserDF: ", par.UserDF, "\n");
-        print("\tpar.UserDG: ", par.UserDG, "\n");
-        print("\tpar.UserHM: ", par.UserHM, "\n");
-        print("\tpar.TolFeas: ", par.UserHM, "\n");
-        print("\tpar.AcceptTolFeas: ", par.UserHM, "\n");
-        // floats
-        for (const auto &p : m_numeric_opts) {
-            print("\tpar.", p.first, ": ", p.second, "\n");
+        init_timer.stop();
+
+        detail::phase_timer options_timer(run_stats ? &run_stats->m_options_time : nullptr);
+        if (!restart) {
+            // This flag informs Worhp that f and g should not be evaluated seperately. pagmo fitness always computes
+            // both so that if only the objfun is needed also the constraints are computed. This flag signals to worhp
+            // that this is the case. Since the flag makes sense only for constrained problems, we set it only if
+            // necessary (worhp would otherwise print a warning)
+            if (prob.get_nc() > 0) {
+                par.FGtogether = true;
+            }
+
+            // We deal with the gradient
+            if (has_gradient) {
+                WorhpSetBoolParam(&par, "UserDF", true);
+                WorhpSetBoolParam(&par, "UserDG", true);
+            } else {
+                WorhpSetBoolParam(&par, "UserDF", false);
+                WorhpSetBoolParam(&par, "UserDG", false);
+            }
+            if (prob.has_hessians()) {
+                WorhpSetBoolParam(&par, "UserHM", true);
+            } else {
+                WorhpSetBoolParam(&par, "UserHM", false);
+                // The BFGS method must match the structure passed to WORHP: with the structure derived from the
+                // gradient sparsity (made of the overlapping dense blocks of the variables each fitness component
+                // depends upon) block BFGS with intersecting blocks is used, with the diagonal structure
+                // limited-memory BFGS. The user options, set below, take precedence.
+                if (sparsity->m_hs_kind == detail::hessian_structure::gradient) {
+                    WorhpSetIntParam(&par, "BFGSmethod", 2);
+                } else if (sparsity->m_hs_kind == detail::hessian_structure::diagonal) {
+                    WorhpSetIntParam(&par, "BFGSmethod", 100);
+                }
+            }
+
+            // Logic for the handling of constraints tolerances. The logic is as follows:
+            // - if the user provides the "TolFeas" option, use that *unconditionally*. Otherwise,
+            // - compute the minimum tolerance min_tol among those returned by  problem.c_tol(). If zero, ignore
+            //   it and use the WORHP default value for "TolFeas" (1e-6). Otherwise, use min_tol as
+            //   the value for "TolFeas" and min_tol/2 for AcceptTolFeas
+            if (prob.get_nc() && !m_numeric_opts.count("TolFeas")) {
+                const auto c_tol = prob.get_c_tol();
+                assert(!c_tol.empty());
+                const double min_tol = *std::min_element(c_tol.begin(), c_tol.end());
+                if (min_tol > 0.) {
+                    auto res = WorhpSetDoubleParam(&par, "TolFeas", min_tol);
+                    res = WorhpSetDoubleParam(&par, "AcceptTolFeas", min_tol / 2);
+                    assert(res == true);
+                }
+            }
+
+            // We now set the user defined options
+            // floats
+            for (const auto &p : m_numeric_opts) {
+                auto success = WorhpSetDoubleParam(&par, p.first.c_str(), p.second);
+                if (!success) {
+                    pagmo_throw(std::invalid_argument,
+                                "The option '" + p.first + "' was requested by the user to be set to the float value "
+                                    + std::to_string(p.second)
+                                    + ", but WORHP interface returned an error. Did you mispell the option name?");
+                }
+            }
+            // int
+            for (const auto &p : m_integer_opts) {
+                auto success = WorhpSetIntParam(&par, p.first.c_str(), p.second);
+                if (!success) {
+                    pagmo_throw(std::invalid_argument,
+                                "The option '" + p.first
+                                    + "' was requested by the user to be set to the integer value "
+                                    + std::to_string(p.second)
+                                    + ", but WORHP interface returned an error. Did you mispell the option name?");
+                }
+            }
+            // bool
+            for (const auto &p : m_bool_opts) {
+                auto success = WorhpSetBoolParam(&par, p.first.c_str(), p.second);
+                if (!success) {
+                    pagmo_throw(std::invalid_argument,
+                                "The option '" + p.first + "' was requested by the user to be set to the bool value "
+                                    + std::to_string(p.second)
+                                    + ", but WORHP interface returned an error. Did you mispell the option name?");
+                }
+            }
         }
-        // int
-        for (const auto &p : m_integer_opts) {
-            print("\tpar.", p.first, ": ", p.second, "\n");
+        options_timer.stop();
+
+        // USI-5: Set initial values and deal with gradients / hessians
+        detail::phase_timer setup_timer(run_stats ? &run_stats->m_setup_time : nullptr);
+        // We define the initial value for the chromosome
+        // The starting point has been selected by the caller
+        const auto &x0 = run.m_x0;
+        const auto &f0 = run.m_f0; // TODO: is f0 useful to worhp?
+        for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(opt.n); ++i) {
+            opt.X[i] = x0[i];
         }
-        // bool
-        for (const auto &p : m_bool_opts) {
-            print("\tpar.", p.first, ": ", p.second, "\n");
+        // On warm start, the scaling of the objective and the penalties of the merit function are those at the end
+        // of the stored run (the penalties only if WORHP allocated the same number of them).
+        if (run.m_warm) {
+            wsp.ScaleObj = run.m_ws.m_scale_obj;
+            if (wsp.penalty && wsp.dim_penalty == run.m_ws.m_penalty.size()) {
+                std::copy(run.m_ws.m_penalty.begin(), run.m_ws.m_penalty.end(), wsp.penalty);
+            }
         }
-
-        print("\n", std::setw(10), "objevals:", std::setw(15), "objval:", std::setw(15), "violated:", std::setw(15),
-              "viol. norm:", '\n');
-    }
-
-    // -------------------------------------------------------------------------------------------------------------------------
-    // USI-7: Run the solver
-    /*
-     * WORHP Reverse Communication loop.
-     * In every iteration poll GetUserAction for the requested action, i.e. one
-     * of {callWorhp, iterOutput, evalF, evalG, evalDF, evalDG, evalHM, fidif}.
-     *
-     * Make sure to reset the requested user action afterwards by calling
-     * DoneUserAction, except for 'callWorhp' and 'fidif'.
-     */
-    while (cnt.status < TerminateSuccess && cnt.status > TerminateError) {
-        /*
-         * WORHP's main routine.
-         * Do not manually reset callWorhp, this is only done by the FD routines.
-         */
-        if (GetUserAction(&cnt, callWorhp)) {
-            Worhp(&opt, &wsp, &par, &cnt);
-            // No DoneUserAction!
+        opt.F = wsp.ScaleObj * f0[0];
+        for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(opt.m); ++i) {
+            opt.G[i] = f0[i + 1];
         }
 
-        /*
-         * Show iteration output.
-         * The call to IterationOutput() may be replaced by user-defined code.
-         */
-        if (GetUserAction(&cnt, iterOutput)) {
-            IterationOutput(&opt, &wsp, &par, &cnt);
-            DoneUserAction(&cnt, iterOutput);
+        // USI-6: Set the constraint bounds (and the initial multipliers, zero unless warm starting)
+        // Box bounds
+        for (vector_double::size_type i = 0; i < static_cast<vector_double::size_type>(opt.n); ++i) {
+            opt.Lambda[i] = run.m_warm ? run.m_ws.m_lambda[i] : 0.;
+            opt.XL[i] = lb[i];
+            opt.XU[i] = ub[i];
         }
-
-        /*
-         * Evaluate the objective function.
-         * The call to UserF may be replaced by user-defined code.
-         */
-        if (GetUserAction(&cnt, evalF)) {
-            UserF(&opt, &wsp, &par, &cnt, pop, fevals0);
-            DoneUserAction(&cnt, evalF);
+        // Equality constraints
+        for (decltype(n_eq) i = 0u; i < n_eq; ++i) {
+            opt.Mu[i] = run.m_warm ? run.m_ws.m_mu[i] : 0.;
+            opt.GL[i] = 0;
+            opt.GU[i] = 0;
         }
-
-        /*
-         * Evaluate the constraints.
-         * The call to UserG may be replaced by user-defined code.
-         */
-        if (GetUserAction(&cnt, evalG)) {
-            UserG(&opt, &wsp, &par, &cnt, pop);
-            DoneUserAction(&cnt, evalG);
+        // Inequality constraints
+        for (auto i = n_eq; i < static_cast<decltype(n_eq)>(opt.m); ++i) {
+            opt.Mu[i] = run.m_warm ? run.m_ws.m_mu[i] : 0.;
+            opt.GL[i] = -par.Infty;
+            opt.GU[i] = 0;
         }
+        setup_timer.stop();
 
-        /*
-         * Evaluate the gradient of the objective function.
-         * The call to UserDF may be replaced by user-defined code.
-         */
-        if (GetUserAction(&cnt, evalDF)) {
-            UserDF(&opt, &wsp, &par, &cnt, pop);
-            DoneUserAction(&cnt, evalDF);
+        if (restart) {
+            // USI-3 (restart): reinitialise the instance from the starting point, bounds and multipliers set above.
+            const detail::phase_timer restart_timer(run_stats ? &run_stats->m_init_time : nullptr);
+            session->m_lib->WorhpRestart(&opt, &wsp, &par, &cnt);
         }
+        detail::phase_timer structure_timer(run_stats ? &run_stats->m_setup_time : nullptr);
 
         /*
-         * Evaluate the Hessian matrix of the Lagrange function (L = f + mu*g)
-         * The call to UserHM may be replaced by user-defined code.
+         * Specify matrix structures in CS format, using Fortran indexing,
+         * i.e. 1...N instead of 0...N-1, to describe the matrix structure.
+         * Only if the declared size is not dense, and not on restart (the structures are those of the previous run).
          */
-        if (GetUserAction(&cnt, evalHM)) {
-            UserHM(&opt, &wsp, &par, &cnt, pop, hs, merged_hs, hs_idx_map);
-            DoneUserAction(&cnt, evalHM);
+        // -------------------------------------------------------------------------------------------------------------
+        // Assign sparsity structure to DF
+        if (!restart && wsp.DF.NeedStructure) {
+            for (decltype(fs.size()) i = 0; i < fs.size(); ++i) {
+                // NOTE: the +1 is because of fortran notation is required by WORHP (maledetti).
+                wsp.DF.row[i] = static_cast<int>(fs[i].second + 1);
+            }
+        }
+        // -------------------------------------------------------------------------------------------------------------
+        // Assign sparsity structure to DG if not dense.
+        if (!restart && wsp.DG.NeedStructure) {
+            for (decltype(gs_idx_map.size()) i = 0u; i < gs_idx_map.size(); ++i) {
+                // NOTE: no need for +1 here as in pagmo 0 is the objfun already stripped from here.
+                wsp.DG.row[i] = static_cast<int>(gs[gs_idx_map[i]].first);
+                // NOTE: the +1 is because of fortran notation is required by WORHP (maledetti).
+                wsp.DG.col[i] = static_cast<int>(gs[gs_idx_map[i]].second + 1);
+            }
+        }
+        // -------------------------------------------------------------------------------------------------------------
+        // Assign sparsity structure to HM if not dense. (this requires to perform the same operations as above,
+        // but directly on the merged_hs not on the iota)
+        if (!restart && wsp.HM.NeedStructure) {
+            // Strict lower triangle
+            for (decltype(hs_idx_map.size()) i = 0u; i < hs_idx_map.size(); ++i) {
+                // NOTE: the +1 is because fortran notation is required by WORHP (maledetti).
+                wsp.HM.row[i] = static_cast<int>(merged_hs[hs_idx_map[i]].first + 1);
+                // NOTE: the +1 is because fortran notation is required by WORHP (maledetti).
+                wsp.HM.col[i] = static_cast<int>(merged_hs[hs_idx_map[i]].second + 1);
+            }
+
+            // Diagonal
+            for (decltype(dim) i = 0; i < dim; ++i) {
+                wsp.HM.row[hs_idx_map.size() + i] = static_cast<int>(i + 1);
+                wsp.HM.col[hs_idx_map.size() + i] = static_cast<int>(i + 1);
+            }
+        }
+        // -------------------------------------------------------------------------------------------------------------
+        structure_timer.stop();
+
+        if (logged && m_verbosity) {
+            print("WORHP version is (library): ", lib->m_major, ".", lib->m_minor, ".", lib->m_patch, "\n");
+            print("WORHP version is (plugin headers): ", WORHP_VERSION, "\n");
+            print("\nWORHP plugin for pagmo/pygmo: \n");
+            if (prob.has_gradient_sparsity()) {
+                print("\tThe gradient sparsity is provided by the user: ", n_grad, " components detected.\n");
+            } else {
+                print("\tThe gradient sparsity is assumed dense: ", n_grad, " components detected.\n");
+            }
+            if (prob.has_gradient()) {
+                print("\tThe gradient is provided by the user.\n");
+            } else if (plugin_fd) {
+                print("\tThe gradient is computed by ", m_fd_central ? "central" : "forward",
+                      " finite differences in the plugin: ", fd_colouring.m_n_colours, " colours detected.\n");
+            } else {
+                print("\tThe gradient is computed numerically by WORHP.\n");
+            }
+            print("\tThe hessian of the lagrangian sparsity has: ", merged_hs.size(), " components");
+            if (sparsity->m_hs_kind == detail::hessian_structure::dense) {
+                print(" (dense)");
+            } else if (sparsity->m_hs_kind == detail::hessian_structure::gradient) {
+                print(" (derived from the gradient sparsity, block BFGS)");
+            } else if (sparsity->m_hs_kind == detail::hessian_structure::diagonal) {
+                print(" (diagonal, limited-memory BFGS)");
+            }
+            print(".\n");
+            if (run.m_warm) {
+                print("\tWarm start from the multipliers of a previous run.\n");
+            }
+
+            if (prob.has_hessians()) {
+                print("\tThe hessians are provided by the user.\n");
+            } else {
+                print("\tThe hessian of the lagrangian is computed numerically by WORHP.\n");
+            }
+            print("\nThe following parameters have been set by pagmo to values other than their xml provided ones (or "
+                  "their default ones): \n");
+            print("\tpar.FGtogether: ", par.FGtogether, "\n");
+            print("\tpar.UserDF: ", par.UserDF, "\n");
+            print("\tpar.UserDG: ", par.UserDG, "\n");
+            print("\tpar.UserHM: ", par.UserHM, "\n");
+            print("\tpar.TolFeas: ", par.UserHM, "\n");
+            print("\tpar.AcceptTolFeas: ", par.UserHM, "\n");
+            if (!prob.has_hessians() && !m_integer_opts.count("BFGSmethod")
+                && (sparsity->m_hs_kind == detail::hessian_structure::gradient
+                    || sparsity->m_hs_kind == detail::hessian_structure::diagonal)) {
+                print("\tpar.BFGSmethod: ", par.BFGSmethod, "\n");
+            }
+            // floats
+            for (const auto &p : m_numeric_opts) {
+                print("\tpar.", p.first, ": ", p.second, "\n");
+            }
+            // int
+            for (const auto &p : m_integer_opts) {
+                print("\tpar.", p.first, ": ", p.second, "\n");
+            }
+            // bool
+            for (const auto &p : m_bool_opts) {
+                print("\tpar.", p.first, ": ", p.second, "\n");
+            }
         }
 
-        /*
-         * Evaluate the Jacobian of the constraints.
-         * The call to UserDG may be replaced by user-defined code.
-         */
-        if (GetUserAction(&cnt, evalDG)) {
-            UserDG(&opt, &wsp, &par, &cnt, pop, gs_idx_map);
-            DoneUserAction(&cnt, evalDG);
+        // WORHP requests the fitness (gradient) in separate calls for the objective and the constraints, and often
+        // revisits recent points: all evaluations go through a small LRU cache.
+        detail::inplace_evaluator eval(run_prob);
+        std::unique_ptr<detail::fd_gradient> fd;
+        if (plugin_fd) {
+            fd = std::make_unique<detail::fd_gradient>(run_prob, m_fd_bfe ? m_fd_bfe.get_ptr() : nullptr, fd_pattern,
+                                                       fd_colouring, m_fd_central, m_fd_step);
+            eval.set_fd_gradient(fd.get());
+        }
+        // If requested and the problem allows it, the gradient is evaluated speculatively, concurrently with the
+        // fitness, as soon as WORHP requests the objective at a new point.
+        const bool concurrent
+            = m_concurrent_gradient && run_prob.get_thread_safety() == pagmo::thread_safety::constant;
+        detail::eval_cache cache(eval, dim, prob.get_nf(), has_gradient ? n_grad : 0u, m_cache_capacity, concurrent);
+        // The buffers used by the callbacks live for the whole run: after the first iterations, the reverse
+        // communication loop does not allocate (the hessians of pagmo problems are always returned by value).
+        const auto c_tol = prob.get_c_tol();
+        const bool has_hessians = prob.has_hessians();
+        vector_double hm_x(dim);
+        // The log lines of the logged run are printed, streamed and recorded by a background thread. The lines are
+        // numbered by the fitness evaluations of the run (cached requests are not counted).
+        std::unique_ptr<detail::async_log_sink> log_sink;
+        unsigned long f_count = 0u;
+        if (logged && m_verbosity) {
+            log_sink = std::make_unique<detail::async_log_sink>(m_log_settings, true);
         }
 
+        // -------------------------------------------------------------------------------------------------------------
+        // USI-7: Run the solver
         /*
-         * Use finite differences with RC to determine derivatives
-         * Do not reset fidif, this is done by the FD routine.
+         * WORHP Reverse Communication loop.
+         * In every iteration poll GetUserAction for the requested action, i.e. one
+         * of {callWorhp, iterOutput, evalF, evalG, evalDF, evalDG, evalHM, fidif}.
+         *
+         * Make sure to reset the requested user action afterwards by calling
+         * DoneUserAction, except for 'callWorhp' and 'fidif'.
+         *
+         * The time spent in the loop, minus the time spent in the callbacks, is the time spent by the solver.
          */
-        if (GetUserAction(&cnt, fidif)) {
-            WorhpFidif(&opt, &wsp, &par, &cnt);
-            // No DoneUserAction!
+        double loop_time = 0.;
+        detail::phase_timer loop_timer(run_stats ? &loop_time : nullptr);
+        // Accounts a callback to the statistics of the run, returns the timer of the callback.
+        auto callback_timer = [run_stats](unsigned long long evolve_stats::*counter) {
+            if (run_stats) {
+                ++(run_stats->*counter);
+            }
+            return run_stats ? &run_stats->m_callback_time : nullptr;
+        };
+        while (cnt.status < TerminateSuccess && cnt.status > TerminateError) {
+            /*
+             * WORHP's main routine.
+             * Do not manually reset callWorhp, this is only done by the FD routines.
+             */
+            if (GetUserAction(&cnt, callWorhp)) {
+                Worhp(&opt, &wsp, &par, &cnt);
+                // No DoneUserAction!
+            }
+
+            /*
+             * Show iteration output.
+             * The call to IterationOutput() may be replaced by user-defined code.
+             */
+            if (GetUserAction(&cnt, iterOutput)) {
+                IterationOutput(&opt, &wsp, &par, &cnt);
+                DoneUserAction(&cnt, iterOutput);
+            }
+
+            /*
+             * Evaluate the objective function.
+             * The call to UserF may be replaced by user-defined code.
+             */
+            if (GetUserAction(&cnt, evalF)) {
+                const detail::phase_timer timer(callback_timer(&evolve_stats::m_f_calls));
+                UserF(&opt, &wsp, &par, &cnt, run_prob, cache, c_tol, log_sink.get(), f_count);
+                DoneUserAction(&cnt, evalF);
+            }
+
+            /*
+             * Evaluate the constraints.
+             * The call to UserG may be replaced by user-defined code.
+             */
+            if (GetUserAction(&cnt, evalG)) {
+                const detail::phase_timer timer(callback_timer(&evolve_stats::m_g_calls));
+                UserG(&opt, &wsp, &par, &cnt, run_prob, cache);
+                DoneUserAction(&cnt, evalG);
+            }
+
+            /*
+             * Evaluate the gradient of the objective function.
+             * The call to UserDF may be replaced by user-defined code.
+             */
+            if (GetUserAction(&cnt, evalDF)) {
+                const detail::phase_timer timer(callback_timer(&evolve_stats::m_df_calls));
+                UserDF(&opt, &wsp, &par, &cnt, run_prob, cache);
+                DoneUserAction(&cnt, evalDF);
+            }
+
+            /*
+             * Evaluate the Hessian matrix of the Lagrange function (L = f + mu*g)
+             * The call to UserHM may be replaced by user-defined code.
+             */
+            if (GetUserAction(&cnt, evalHM)) {
+                // NOTE: WORHP only requests the hessians if UserHM is true, that is, if the problem provides them.
+                if (has_hessians) {
+                    const detail::phase_timer timer(callback_timer(&evolve_stats::m_hm_calls));
+                    UserHM(&opt, &wsp, &par, &cnt, run_prob, hm_plan, hm_x);
+                }
+                DoneUserAction(&cnt, evalHM);
+            }
+
+            /*
+             * Evaluate the Jacobian of the constraints.
+             * The call to UserDG may be replaced by user-defined code.
+             */
+            if (GetUserAction(&cnt, evalDG)) {
+                const detail::phase_timer timer(callback_timer(&evolve_stats::m_dg_calls));
+                UserDG(&opt, &wsp, &par, &cnt, run_prob, cache, dg_gather);
+                DoneUserAction(&cnt, evalDG);
+            }
+
+            /*
+             * Use finite differences with RC to determine derivatives
+             * Do not reset fidif, this is done by the FD routine.
+             */
+            if (GetUserAction(&cnt, fidif)) {
+                callback_timer(&evolve_stats::m_fidif_calls);
+                WorhpFidif(&opt, &wsp, &par, &cnt);
+                // No DoneUserAction!
+            }
+        }
+        loop_timer.stop();
+        if (log_sink) {
+            run.m_log = log_sink->finish();
+            run.m_log_error = log_sink->get_error();
+        }
+        // ------- We store the outcome of the run -------------------------------------------------------------
+        run.m_x.assign(opt.X, opt.X + dim);
+        // The final state is stored for later warm starts only if WORHP terminated successfully.
+        if (m_warm_start && cnt.status >= TerminateSuccess) {
+            run.m_ws.m_prob_name = prob.get_name();
+            run.m_ws.m_x = run.m_x;
+            run.m_ws.m_lambda.assign(opt.Lambda, opt.Lambda + opt.n);
+            run.m_ws.m_mu.assign(opt.Mu, opt.Mu + opt.m);
+            run.m_ws.m_scale_obj = wsp.ScaleObj;
+            if (wsp.penalty) {
+                run.m_ws.m_penalty.assign(wsp.penalty, wsp.penalty + wsp.dim_penalty);
+            } else {
+                run.m_ws.m_penalty.clear();
+            }
+            run.m_ws_final = true;
+        }
+        run.m_f = cache.fitness(run.m_x);
+        run.m_cache_stats = cache.get_stats();
+        if (run_stats) {
+            run_stats->m_solver_time += loop_time - run_stats->m_callback_time;
+            run_stats->m_cache_hits += run.m_cache_stats.m_f_hits + run.m_cache_stats.m_g_hits;
+            run_stats->m_cache_misses += run.m_cache_stats.m_f_misses + run.m_cache_stats.m_g_misses;
+            // The arrays allocated by WorhpInit (OptVar and the DF, DG and HM structures, not on restart) and the
+            // entries of the evaluation cache.
+            const auto n = static_cast<unsigned long long>(opt.n), m = static_cast<unsigned long long>(opt.m);
+            const auto df = static_cast<unsigned long long>(wsp.DF.nnz);
+            const auto dg = static_cast<unsigned long long>(wsp.DG.nnz);
+            const auto hm = static_cast<unsigned long long>(wsp.HM.nnz);
+            if (!restart) {
+                run_stats->m_bytes_estimated
+                    += (4u * n + 4u * m + df + dg + hm) * sizeof(double) + (df + 2u * dg + 2u * hm) * sizeof(int);
+            }
+            run_stats->m_bytes_estimated
+                += m_cache_capacity * (n + 1u + m + (has_gradient ? n_grad : 0u)) * sizeof(double);
         }
-    }
-    // ------- We reinsert the solution if better -----------------------------------------------------------
-    // Store the new individual into the population, but only if it is improved.
-    vector_double x_final(dim, 0);
-    vector_double f_final(prob.get_nf(), 0);
-    for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(opt.n); ++i) {
-        x_final[i] = opt.X[i];
-    }
 
-    f_final = prob.fitness(x_final);
+        // We retrieve the text of the optimization result
+        char cstr[1024];
+        StatusMsgString(&opt, &wsp, &par, &cnt, cstr);
+
+        run.m_res = std::string(cstr);
+        // The run completed: the instance can be restarted by a later run.
+        session->m_completed = true;
+
+        // And print it to screen if requested
+        if (logged) {
+            if (m_verbosity) {
+                print(run.m_res, "\n");
+                if (!run.m_log_error.empty()) {
+                    print(run.m_log_error, "\n");
+                }
+            } else if (m_screen_output) {
+                StatusMsg(&opt, &wsp, &par, &cnt);
+            }
+        }
+    };
 
-    if (compare_fc(f_final, f0, prob.get_nec(), prob.get_c_tol())) {
-        replace_individual(pop, x_final, f_final);
+    // ------- We call WORHP, once per starting point ---------------------------------------------------------------
+    // NOTE: the runs need the problem by mutable reference, for the batch fitness evaluator of the finite differences.
+    auto &run_prob = pop.get_problem();
+    if (runs.size() == 1u) {
+        solve(run_prob, runs[0], true);
+    } else {
+        // The instances share the problem if it is thread safe (constant), otherwise they work on copies (basic)
+        // or run sequentially (none).
+        const auto n_threads = detail::batch_threads(prob, runs.size());
+        detail::batch_problems probs(run_prob, n_threads);
+        detail::parallel_for(runs.size(), n_threads,
+                             [&](std::size_t i, std::size_t t) { solve(probs[t], runs[i], i == 0u); });
+        probs.merge_fevals();
     }
+    detail::evolve_results<std::string> results;
+    results.m_opt_res = runs[0].m_res;
+    results.m_log = std::make_shared<const log_columns>(std::move(runs[0].m_log));
+    results.m_log_error = runs[0].m_log_error;
+
+    // ------- We reinsert the solutions if better -------------------------------------------------------------
+    for (decltype(runs.size()) i = 0u; i < runs.size(); ++i) {
+        auto &run = runs[i];
+        // Store the new individual into the population, but only if it is improved. In batch mode it replaces
+        // the individual it originates from.
+        if (compare_fc(run.m_f, run.m_f0, prob.get_nec(), prob.get_c_tol())) {
+            if (batch_idx.empty()) {
+                std::lock_guard<detail::member_mutex> lock(m_e_mutex);
+                replace_individual(pop, run.m_x, run.m_f);
+            } else {
+                pop.set_xf(batch_idx[i], run.m_x, run.m_f);
+            }
+        }
+        results.m_cache_stats.m_f_hits += run.m_cache_stats.m_f_hits;
+        results.m_cache_stats.m_f_misses += run.m_cache_stats.m_f_misses;
+        results.m_cache_stats.m_g_hits += run.m_cache_stats.m_g_hits;
+        results.m_cache_stats.m_g_misses += run.m_cache_stats.m_g_misses;
+        // ------- Store the final state for later warm starts ---------------------------------------------
+        if (run.m_ws_final && m_ws_capacity) {
+            m_ws_states.apply([&](std::vector<detail::worhp_warm_start> &states) {
+                const auto it = detail::find_warm_start(states, prob.get_name(), run.m_x, prob.get_nc(), m_ws_tol);
+                if (it != states.end()) {
+                    states.erase(it);
+                } else if (states.size() >= m_ws_capacity) {
+                    states.erase(states.begin());
+                }
+                states.push_back(std::move(run.m_ws));
+            });
+        }
+        stats += run.m_stats;
+    }
+    total_timer.stop();
+    results.m_stats = stats;
+    // The results of this evolve are published together.
+    m_results.set(std::move(results));
 
-    // We retrieve the text of the optimization result
-    char cstr[1024];
-    StatusMsgString(&opt, &wsp, &par, &cnt, cstr);
-
-    m_last_opt_res = std::string(cstr);
+    return pop;
+}
 
-    // And print it to screen if requested
-    if (m_verbosity) {
-        print(m_last_opt_res, "\n");
-    } else if (m_screen_output) {
-        StatusMsg(&opt, &wsp, &par, &cnt);
-    }
+/// Preload the worhp library.
+/**
+ * The worhp library is loaded at run-time, its symbols resolved and its version checked, the first time it is
+ * needed. The loaded library is then kept in a process-wide registry (keyed by library path) and shared by all
+ * subsequent calls to evolve() of all ppnf::worhp instances, from any thread. This method forces the loading to
+ * happen immediately (e.g., at program start-up) rather than during the first call to evolve().
+ * Calling it on an already loaded library has no effect.
+ *
+ * @throws std::invalid_argument if the library cannot be loaded, does not contain the expected symbols or
+ * if a version mismatch is found between the declared library and the supported one.
+ */
+void worhp::preload() const
+{
+    detail::get_worhp_lib(m_worhp_library);
+}
 
-    return pop;
+/// Unload the worhp library.
+/**
+ * This method removes the worhp library used by \p this from the process-wide registry (see preload()).
+ * Evolves that are already running keep their own reference to the library, which is effectively
+ * unloaded when the last of them ends. The next call to evolve() or preload() will load the library again.
+ *
+ * @return ``true`` if the library was in the registry, ``false`` otherwise.
+ */
+bool worhp::unload() const
+{
+    return detail::worhp_registry().erase(m_worhp_library);
 }
 
 /// Set verbosity.
@@ -790,11 +1668,30 @@ void worhp::set_verbosity(unsigned n)
  * See worhp::log_type for a description of the optimisation log. Logging is turned on/off via
  * set_verbosity().
  *
- * @return a const reference to the log.
+ * \verbatim embed:rst:leading-asterisk
+ * .. versionchanged:: 0.28
+ *
+ *    The log is returned by value, rather than by const reference (see :ref:`changelog`).
+ *
+ * \endverbatim
+ *
+ * @return a copy of the log, built from the columnar log of the last run (see get_log_columns()).
+ */
+worhp::log_type worhp::get_log() const
+{
+    return get_log_columns()->lines();
+}
+/// Get the columnar optimisation log.
+/**
+ * The log of the last call to evolve(), with the same content as get_log(), stored as one contiguous array per
+ * field (see ppnf::log_columns). The columns can be accessed without copies, and are not modified by further calls
+ * to evolve(), which store a new log.
+ *
+ * @return a pointer sharing the ownership of the columnar log.
  */
-const worhp::log_type &worhp::get_log() const
+std::shared_ptr<const log_columns> worhp::get_log_columns() const
 {
-    return m_log;
+    return m_results.apply([](const detail::evolve_results<std::string> &res) { return res.m_log; });
 }
 /// Gets the verbosity level
 /**
@@ -821,6 +1718,7 @@ std::string worhp::get_name() const
  */
 std::string worhp::get_extra_info() const
 {
+    const auto results = m_results.get();
     std::ostringstream ss;
     stream(ss, "\tWorhp library filename: ", m_worhp_library);
     if (!m_screen_output) {
@@ -849,11 +1747,78 @@ std::string worhp::get_extra_info() const
     if (m_bool_opts.size()) {
         stream(ss, "\n\\tBoolean options: ", pagmo::detail::to_string(m_bool_opts));
     }
+    stream(ss, "\n\tEvaluation cache capacity: ", m_cache_capacity);
+    const auto &cache_stats = results.m_cache_stats;
+    stream(ss, "\n\tEvaluation cache (last evolve), fitness hits/misses: ", cache_stats.m_f_hits, "/",
+           cache_stats.m_f_misses, ", gradient hits/misses: ", cache_stats.m_g_hits, "/", cache_stats.m_g_misses);
+    if (m_concurrent_gradient) {
+        stream(ss, "\n\tConcurrent gradient: active");
+    }
+    if (m_batch_size > 1u) {
+        stream(ss, "\n\tBatch size: ", m_batch_size);
+    }
+    if (m_warm_start) {
+        stream(ss, "\n\tWarm start: active (tolerance ", m_ws_tol, ", ", m_ws_states.get().size(), "/", m_ws_capacity,
+               " stored states)");
+    }
+    if (!m_xml_params) {
+        stream(ss, "\n\tParameters: WORHP defaults (XML lookup disabled)");
+    } else if (m_params_caching || !m_params_file.empty()) {
+        stream(ss, "\n\tParameters: XML file ", m_params_file.empty() ? std::string("default") : m_params_file,
+               m_params_caching ? " (cached)" : "");
+    }
+    if (m_persistent_session) {
+        stream(ss, "\n\tPersistent session: active");
+    }
+    if (m_hessian_structure != "auto") {
+        stream(ss, "\n\tHessian structure: ", m_hessian_structure);
+    }
+    if (m_log_settings.m_buffer != "unbounded") {
+        stream(ss, "\n\tLog buffer: ", m_log_settings.m_buffer, " (capacity ", m_log_settings.m_capacity, ")");
+    }
+    if (!m_log_settings.m_file.empty()) {
+        stream(ss, "\n\tLog file: ", m_log_settings.m_file, " (", m_log_settings.m_format, ")");
+    }
+    if (!results.m_log_error.empty()) {
+        stream(ss, "\n\tLog error (last evolve): ", results.m_log_error);
+    }
+    if (m_fd) {
+        stream(ss, "\n\tFinite-difference gradient: ", get_fd_scheme(), " (step ", m_fd_step, ", ",
+               m_fd_bfe ? m_fd_bfe->get_name() : std::string("sequential"), ")");
+    }
+    if (m_collect_stats) {
+        ss << "\n\tStatistics (last evolve):\n" << results.m_stats;
+    }
     stream(ss, "\n");
-    stream(ss, "\nLast optimisation result: \n", m_last_opt_res);
+    stream(ss, "\nLast optimisation result: \n", results.m_opt_res);
     stream(ss, "\n");
     return ss.str();
 }
+/// Thread safety level.
+/**
+ * One of the optional methods of any user-defined algorithm (UDA). The state of a call to evolve() is private to
+ * the call, while the state shared by the calls (the random engine of the selection and replacement policies, the
+ * warm start states and the prepared sparsity structures) is accessed under a lock. The results of an evolve()
+ * (see, e.g., get_log() and get_stats()) are published together once it is complete, so that evolve() and the
+ * getters can be called concurrently on the same instance. The messages printed by WORHP are routed to the run
+ * printing them, so that concurrent calls with different output settings do not interfere.
+ *
+ * @return pagmo::thread_safety::constant, or pagmo::thread_safety::basic if a log file is set (concurrent calls
+ * would write to the same file) or if the finite-difference gradient uses a batch fitness evaluator which cannot
+ * be called concurrently, or pagmo::thread_safety::none if that batch fitness evaluator provides no thread safety
+ * guarantee (e.g., a Python one).
+ */
+pagmo::thread_safety worhp::get_thread_safety() const
+{
+    if (m_fd_bfe && m_fd_bfe->get_thread_safety() == pagmo::thread_safety::none) {
+        return pagmo::thread_safety::none;
+    }
+    if (!m_log_settings.m_file.empty()
+        || (m_fd_bfe && m_fd_bfe->get_thread_safety() != pagmo::thread_safety::constant)) {
+        return pagmo::thread_safety::basic;
+    }
+    return pagmo::thread_safety::constant;
+}
 
 /// Set integer option.
 /**
@@ -986,150 +1951,572 @@ void worhp::reset_bool_options()
  */
 std::string worhp::get_last_opt_result() const
 {
-    return m_last_opt_res;
+    return m_results.apply([](const detail::evolve_results<std::string> &res) { return res.m_opt_res; });
+}
+
+/// Set the warm start mode.
+/**
+ * When the warm start mode is active, the final multipliers of the box constraints (``Lambda``) and of the
+ * constraints (``Mu``) computed by WORHP, together with the scaling of the objective and the penalties of the merit
+ * function, are stored after each call to evolve() ending successfully, keyed by the final decision vector. When the
+ * individual selected by a later call to evolve() is close enough to one of the stored decision vectors (i.e., their
+ * difference is not larger than \p tol in the infinity norm), WORHP starts from the stored multipliers, scaling and
+ * penalties instead of from zero multipliers. This is typically useful when the same individual, or a slightly
+ * perturbed one, is repeatedly optimised (e.g., after migration).
+ *
+ * At most \p capacity states are stored, the least recently used ones being discarded first.
+ * The stored states are part of the serialized representation of \p this.
+ *
+ * @param flag ``true`` activates the warm start mode, ``false`` deactivates it (the stored states are kept, see
+ * clear_warm_start()).
+ * @param tol the matching tolerance on the decision vector.
+ * @param capacity the maximum number of stored states.
+ *
+ * @throws std::invalid_argument if \p tol is negative or NaN.
+ */
+void worhp::set_warm_start(bool flag, double tol, unsigned capacity)
+{
+    if (!(tol >= 0.)) {
+        pagmo_throw(std::invalid_argument,
+                    "The warm start tolerance must be non negative, while a value of " + std::to_string(tol)
+                        + " was detected");
+    }
+    m_warm_start = flag;
+    m_ws_tol = tol;
+    m_ws_capacity = capacity;
+    m_ws_states.apply([capacity](std::vector<detail::worhp_warm_start> &states) {
+        if (states.size() > capacity) {
+            states.erase(states.begin(), states.begin() + static_cast<std::ptrdiff_t>(states.size() - capacity));
+        }
+    });
+}
+/// Get the warm start mode.
+/**
+ * @return ``true`` if the warm start mode is active, ``false`` otherwise.
+ */
+bool worhp::get_warm_start() const
+{
+    return m_warm_start;
+}
+/// Clear the stored warm start states.
+void worhp::clear_warm_start()
+{
+    m_ws_states.set({});
+}
+
+/// Set the capacity of the evaluation cache.
+/**
+ * During evolve(), the fitness and gradient evaluations are stored in a least recently used cache
+ * holding at most \p capacity decision vectors, as WORHP requests the objective and the constraints (and their
+ * gradients) in separate calls and often revisits recent points. The number of cache hits and misses
+ * of the last call to evolve() is reported by get_extra_info(). A capacity of zero disables the cache.
+ *
+ * @param capacity the maximum number of decision vectors stored in the cache (default is 8).
+ */
+void worhp::set_cache_capacity(unsigned capacity)
+{
+    m_cache_capacity = capacity;
+}
+
+/// Get the capacity of the evaluation cache.
+/**
+ * @return the maximum number of decision vectors stored in the evaluation cache.
+ */
+unsigned worhp::get_cache_capacity() const
+{
+    return m_cache_capacity;
+}
+
+/// Set the speculative evaluation of the gradient.
+/**
+ * WORHP requests the objective, the constraints and their gradients in separate calls, so that the fitness and the
+ * gradient at a point are by default evaluated one after the other. If this mode is active and the problem is thread
+ * safe (pagmo::thread_safety::constant), the gradient is instead evaluated speculatively by a helper thread (one per
+ * WORHP instance) as soon as WORHP requests the objective at a new point, concurrently with the fitness, and stored
+ * in the evaluation cache (see set_cache_capacity()), which then holds at least one decision vector. This pays off
+ * for problems whose fitness and gradient are computed independently (e.g., an adjoint gradient), at the price of
+ * the gradients evaluated at points (e.g., in the line search) where WORHP does not request them. The mode is off by
+ * default, and has no effect on problems which are not thread safe, do not provide the gradient or whose UDP
+ * evaluates fitness and gradient in one pass (see ppnf::register_inplace_udp()).
+ *
+ * @param flag ``true`` to evaluate the gradient speculatively, ``false`` otherwise.
+ */
+void worhp::set_concurrent_gradient(bool flag)
+{
+    m_concurrent_gradient = flag;
+}
+
+/// Get the activation flag of the speculative evaluation of the gradient.
+/**
+ * @return ``true`` if the gradient is evaluated speculatively (see set_concurrent_gradient()).
+ */
+bool worhp::get_concurrent_gradient() const
+{
+    return m_concurrent_gradient;
+}
+
+/// Set the batch size.
+/**
+ * By default, evolve() optimises the single individual selected by the selection policy, and reinserts the result
+ * according to the replacement policy (see pagmo::not_population_based). With a batch size \p k larger than one,
+ * evolve() selects instead \p k individuals with the same policy (the \p k best, the \p k worst, \p k random
+ * individuals or, if the selection policy is an index, the \p k individuals starting from that index), and
+ * optimises them concurrently, each with its own WORHP data structures. Each improved individual then replaces the
+ * one it originates from, and the replacement policy is not used.
+ *
+ * The concurrency respects the thread safety level of the problem: the WORHP instances share the problem if
+ * it is pagmo::thread_safety::constant, work on their own copy of it if it is pagmo::thread_safety::basic and
+ * run sequentially if it is pagmo::thread_safety::none. Only the first of the selected individuals is
+ * logged and printed to screen, and the result returned by get_last_opt_result() refers to it.
+ *
+ * @param k the number of individuals optimised by each call to evolve().
+ *
+ * @throws std::invalid_argument if \p k is zero.
+ */
+void worhp::set_batch_size(unsigned k)
+{
+    if (k == 0u) {
+        pagmo_throw(std::invalid_argument, "The batch size must be at least one");
+    }
+    m_batch_size = k;
+}
+
+/// Get the batch size.
+/**
+ * @return the number of individuals optimised by each call to evolve().
+ */
+unsigned worhp::get_batch_size() const
+{
+    return m_batch_size;
+}
+
+/// Activate the collection of statistics.
+/**
+ * If active, each call to evolve() records the time spent in its phases (fetching the worhp library, the
+ * initialisation of the WORHP data structures, option setting, problem setup, the WORHP reverse communication loop
+ * and the user callbacks), the number of requests of each kind (F, G, DF, DG, HM and finite differences), the
+ * evaluation cache hits and misses and the estimated bytes of the WORHP arrays. The statistics of the last call to
+ * evolve() are returned by get_stats() and reported by get_extra_info(). The collection is off by default.
+ *
+ * @param flag ``true`` to collect the statistics, ``false`` otherwise.
+ */
+void worhp::set_collect_stats(bool flag)
+{
+    m_collect_stats = flag;
+}
+
+/// Get the activation flag of the collection of statistics.
+/**
+ * @return ``true`` if the statistics are collected by evolve().
+ */
+bool worhp::get_collect_stats() const
+{
+    return m_collect_stats;
+}
+
+/// Get the statistics of the last evolve().
+/**
+ * @return the statistics recorded by the last call to evolve() (all zeros if they were not collected).
+ */
+evolve_stats worhp::get_stats() const
+{
+    return m_results.apply([](const detail::evolve_results<std::string> &res) { return res.m_stats; });
+}
+
+/// Set the parameter file caching.
+/**
+ * By default, each call to evolve() reads the WORHP parameters from the XML parameter file (see load_params()).
+ * With the caching active, the file is read once into an in-memory snapshot, which is used by later calls to
+ * evolve() as long as the modification time and the size of the file do not change (the file is then read
+ * again). The snapshot is shared by the copies of the algorithm object.
+ *
+ * @param flag ``true`` to activate the parameter file caching, ``false`` to deactivate it.
+ */
+void worhp::set_params_caching(bool flag)
+{
+    m_params_caching = flag;
+}
+
+/// Get the parameter file caching.
+/**
+ * @return ``true`` if the parameter file caching is active.
+ */
+bool worhp::get_params_caching() const
+{
+    return m_params_caching;
+}
+
+/// Load the parameter file.
+/**
+ * Reads the WORHP parameters from the XML file \p file into the in-memory snapshot and activates the parameter file
+ * caching (see set_params_caching()), so that later calls to evolve() use the snapshot. The file is also used by
+ * evolve() when the caching is later deactivated. With an empty \p file, the WORHP default is used:
+ * the file named by the environment variable ``WORHP_PARAM_FILE``, if set, otherwise ``param.xml`` in the current
+ * directory.
+ *
+ * @param file the XML parameter file.
+ *
+ * @throws std::invalid_argument if \p file is not empty and it is not a file.
+ * @throws unspecified any exception thrown by the loading of the WORHP library.
+ */
+void worhp::load_params(const std::string &file)
+{
+    if (!file.empty() && !boost::filesystem::is_regular_file(boost::filesystem::path(file))) {
+        pagmo_throw(std::invalid_argument, "The WORHP parameter file " + file + " does not appear to be a file");
+    }
+    const auto lib = detail::get_worhp_lib(m_worhp_library);
+    detail::get_params_snapshot(*m_params_cache, lib, file);
+    m_params_file = file;
+    m_params_caching = true;
+}
+
+/// Get the parameter file.
+/**
+ * @return the XML parameter file set by load_params() (empty for the WORHP default).
+ */
+const std::string &worhp::get_params_file() const
+{
+    return m_params_file;
+}
+
+/// Set the XML parameter file lookup.
+/**
+ * When deactivated, evolve() does not look up (nor read) the XML parameter file: the parameters take the WORHP
+ * default values (set by InitParams), except those set by pagmo and the options set by the user (see
+ * set_integer_option(), set_numeric_option() and set_bool_option()).
+ *
+ * @param flag ``true`` (the default) to activate the XML parameter file lookup, ``false`` to deactivate it.
+ */
+void worhp::set_xml_params(bool flag)
+{
+    m_xml_params = flag;
+}
+
+/// Get the XML parameter file lookup.
+/**
+ * @return ``true`` if the XML parameter file lookup is active.
+ */
+bool worhp::get_xml_params() const
+{
+    return m_xml_params;
+}
+
+/// Set the persistent session mode.
+/**
+ * By default, each call to evolve() initialises the WORHP data structures (WorhpPreInit, ReadParams, WorhpInit),
+ * sets the parameters, fills the sparsity structures and frees everything (WorhpFree) at the end. With the persistent
+ * session mode active, the initialised WORHP instances are kept by the algorithm: a later call to evolve() on a problem
+ * with the same dimensions, sparsity patterns, constraint tolerances and options only restarts an instance
+ * (WorhpRestart), resetting its iterate and control state, while anything else triggers a full initialisation.
+ *
+ * Each instance is used by one run at a time: concurrent calls to evolve() (or the runs of a batch, see
+ * set_batch_size()) each take their own instance. The instances belong to the algorithm object: copies (as well as
+ * moved-to and deserialised objects) start without instances, and deactivating the mode frees them. If the WORHP
+ * library does not export WorhpRestart, the mode has no effect.
+ *
+ * @param flag ``true`` to activate the persistent session mode, ``false`` to deactivate it.
+ */
+void worhp::set_persistent_session(bool flag)
+{
+    m_persistent_session = flag;
+    if (!flag) {
+        m_sessions.clear();
+    }
+}
+
+/// Get the persistent session mode.
+/**
+ * @return ``true`` if the persistent session mode is active.
+ */
+bool worhp::get_persistent_session() const
+{
+    return m_persistent_session;
+}
+
+/// Set the finite-difference gradient computed by the plugin.
+/**
+ * When a problem does not provide its gradient, WORHP approximates it by finite differences, perturbing one variable
+ * per fitness evaluation. After a call to this method, the plugin computes instead the finite differences itself,
+ * and WORHP is given the result as if the problem provided its gradient (UserDF and UserDG are set to ``true``, while
+ * the hessians are still computed by WORHP if the problem does not provide them). The variables are perturbed in
+ * groups (Curtis-Powell-Reid method): a greedy colouring of the gradient sparsity, computed once per call to evolve(),
+ * puts in the same group variables which do not affect the same fitness components. The forward scheme then costs one
+ * fitness evaluation per group plus one per gradient, the central scheme two per group and is more accurate. For
+ * banded or block-diagonal sparsities the number of groups is small and independent of the problem dimension.
+ * The evaluations are performed sequentially, or, see set_fd_gradient(const pagmo::bfe &, const std::string &,
+ * double), with a batch fitness evaluator. They are counted as fitness evaluations of the problem. Problems providing
+ * their gradient are not affected.
+ *
+ * The variable \f$ x_j \f$ is perturbed by \f$ h \max(1, |x_j|) \f$, where \f$ h \f$ is the relative step. A
+ * perturbation leaving the bounds is reversed (forward scheme), or replaced by a one-sided difference (central
+ * scheme).
+ *
+ * @param scheme the finite-difference scheme, ``"forward"`` or ``"central"``.
+ * @param step the relative step (zero selects the default, the square root of the machine epsilon for the
+ * forward scheme and its cube root for the central scheme).
+ *
+ * @throws std::invalid_argument if \p scheme is not one of the allowed values, or if \p step is negative
+ * or not finite.
+ */
+void worhp::set_fd_gradient(const std::string &scheme, double step)
+{
+    if (scheme != "forward" && scheme != "central") {
+        pagmo_throw(std::invalid_argument,
+                    "The finite-difference scheme must be either 'forward' or 'central', while '" + scheme
+                        + "' was detected");
+    }
+    if (!std::isfinite(step) || step < 0.) {
+        pagmo_throw(std::invalid_argument,
+                    "The finite-difference step must be finite and non-negative, while a value of "
+                        + std::to_string(step) + " was detected");
+    }
+    m_fd = true;
+    m_fd_bfe = boost::none;
+    m_fd_central = scheme == "central";
+    m_fd_step = step > 0. ? step : detail::fd_default_step(m_fd_central);
+}
+
+/// Set the finite-difference gradient computed by the plugin, in parallel.
+/**
+ * As set_fd_gradient(const std::string &, double), but all the perturbed decision vectors needed by a gradient are
+ * evaluated with a single call to the batch fitness evaluator \p b (e.g., a pagmo::thread_bfe or a
+ * pagmo::member_bfe), so that they can be evaluated in parallel.
+ *
+ * @param b the batch fitness evaluator.
+ * @param scheme the finite-difference scheme, ``"forward"`` or ``"central"``.
+ * @param step the relative step.
+ *
+ * @throws std::invalid_argument if \p scheme is not one of the allowed values, or if \p step is negative
+ * or not finite.
+ */
+void worhp::set_fd_gradient(const bfe &b, const std::string &scheme, double step)
+{
+    set_fd_gradient(scheme, step);
+    m_fd_bfe = b;
+}
+
+/// Unset the finite-difference gradient computed by the plugin.
+/**
+ * After a call to this method, the gradient of the problems not providing it is computed by WORHP (the default).
+ */
+void worhp::unset_fd_gradient()
+{
+    m_fd = false;
+    m_fd_bfe = boost::none;
+}
+
+/// Check if the finite-difference gradient is computed by the plugin.
+/**
+ * @return ``true`` if the finite-difference gradient was set via set_fd_gradient().
+ */
+bool worhp::has_fd_gradient() const
+{
+    return m_fd;
+}
+
+/// Get the finite-difference scheme.
+/**
+ * @return the scheme set via set_fd_gradient(), ``"forward"`` or ``"central"``.
+ */
+std::string worhp::get_fd_scheme() const
+{
+    return m_fd_central ? "central" : "forward";
+}
+
+/// Get the finite-difference step.
+/**
+ * @return the relative step used by the finite differences (zero if set_fd_gradient() was never called).
+ */
+double worhp::get_fd_step() const
+{
+    return m_fd_step;
+}
+
+/// Set the strategy for the structure of the hessian of the lagrangian.
+/**
+ * When a problem does not provide its hessians, WORHP approximates the hessian of the lagrangian by BFGS updates on
+ * the structure passed by the plugin, whose size determines the memory used by WORHP. This method selects the
+ * structure:
+ * - ``"dense"``: the lower triangular part of the hessian, that is \f$ n_x (n_x + 1) / 2 \f$ entries,
+ * - ``"gradient"``: the structure derived from the gradient sparsity, as the hessian of each fitness component can
+ *   only be non-zero between the variables the component depends upon, WORHP then using block BFGS with
+ *   intersecting blocks (the ``BFGSmethod`` integer option is set to 2, unless set by the user),
+ * - ``"diagonal"``: the diagonal alone, WORHP then using limited-memory BFGS (the ``BFGSmethod`` integer option is
+ *   set to 100, unless set by the user),
+ * - ``"auto"`` (the default): the hessians sparsity of the problem, if provided, otherwise the dense structure for
+ *   small problems (up to about 1.4k variables), otherwise the structure derived from the gradient sparsity if its
+ *   size is at most 16 times that of the gradient sparsity (plus \f$ n_x \f$), otherwise the diagonal structure.
+ *   The memory used by large problems is thus proportional to the size of the gradient sparsity.
+ *
+ * The hessians provided by a problem always use the structure given by its hessians sparsity.
+ *
+ * @param strategy the strategy, ``"auto"``, ``"dense"``, ``"gradient"`` or ``"diagonal"``.
+ *
+ * @throws std::invalid_argument if \p strategy is not one of the allowed values.
+ */
+void worhp::set_hessian_structure(const std::string &strategy)
+{
+    if (strategy != "auto" && strategy != "dense" && strategy != "gradient" && strategy != "diagonal") {
+        pagmo_throw(std::invalid_argument,
+                    "The hessian structure strategy must be one of 'auto', 'dense', 'gradient' or 'diagonal', while '"
+                        + strategy + "' was detected");
+    }
+    m_hessian_structure = strategy;
+}
+
+/// Get the strategy for the structure of the hessian of the lagrangian.
+/**
+ * @return the strategy set via set_hessian_structure().
+ */
+const std::string &worhp::get_hessian_structure() const
+{
+    return m_hessian_structure;
+}
+
+/// Set the policy of the in-memory log.
+/**
+ * By default, all the log lines of a run (see set_verbosity()) are kept in memory and returned by get_log(), so that
+ * the log of a long run may take a large amount of memory. This method bounds the in-memory log: the ``"ring"``
+ * policy keeps the last \p capacity lines, the ``"decimate"`` policy keeps at most \p capacity lines evenly spread
+ * over the run (once the buffer is full, every other line is dropped and only half of the following lines are
+ * recorded), and the ``"unbounded"`` policy (the default) keeps all the lines.
+ *
+ * The log lines are printed, streamed to the log file (see set_log_file()) and recorded by a background thread,
+ * so that the solver callbacks only push a fixed-size record into a lock-free queue.
+ *
+ * @param policy the policy of the in-memory log, ``"unbounded"``, ``"ring"`` or ``"decimate"``.
+ * @param capacity the maximum number of lines kept in memory (ignored by the ``"unbounded"`` policy).
+ *
+ * @throws std::invalid_argument if \p policy is not one of the allowed values, or if \p capacity is zero for the
+ * ``"ring"`` and ``"decimate"`` policies.
+ */
+void worhp::set_log_buffer(const std::string &policy, unsigned capacity)
+{
+    m_log_settings.set_buffer(policy, capacity);
+}
+
+/// Get the policy of the in-memory log.
+/**
+ * @return the policy and the capacity of the in-memory log (see set_log_buffer()).
+ */
+std::pair<std::string, unsigned> worhp::get_log_buffer() const
+{
+    return {m_log_settings.m_buffer, m_log_settings.m_capacity};
+}
+
+/// Set the log file.
+/**
+ * If \p file is not empty, the log lines of each run (see set_verbosity()) are also appended to \p file by a
+ * background thread, together with their timestamp (the seconds elapsed since the start of the run). In the
+ * ``"csv"`` format, each line contains the comma-separated values of the number of objective evaluations, the
+ * objective value, the number of violated constraints, the constraints violation norm, the feasibility flag and the
+ * timestamp, and a header line is written to new files. In the ``"binary"`` format, each line is a record of 41
+ * bytes, in the native byte order: the number of objective evaluations (uint64), the objective value (double), the
+ * number of violated constraints (uint64), the constraints violation norm (double), the feasibility flag (uint8) and
+ * the timestamp (double).
+ *
+ * An error writing the log file does not interrupt the run: the log lines are still kept in memory, and the error
+ * is reported by get_extra_info() (and printed to screen).
+ *
+ * @param file the path of the log file (empty to disable it).
+ * @param format the format of the log file, ``"csv"`` or ``"binary"``.
+ *
+ * @throws std::invalid_argument if \p format is not one of the allowed values.
+ */
+void worhp::set_log_file(const std::string &file, const std::string &format)
+{
+    m_log_settings.set_file(file, format);
+}
+
+/// Get the log file.
+/**
+ * @return the path of the log file (empty if disabled) and its format (see set_log_file()).
+ */
+std::pair<std::string, std::string> worhp::get_log_file() const
+{
+    return {m_log_settings.m_file, m_log_settings.m_format};
 }
 
 // Log update and print to screen
-void worhp::update_log(const problem &prob, const vector_double &fit, long long unsigned fevals0) const
+void worhp::update_log(const problem &prob, const vector_double &fit, const vector_double &c_tol,
+                       detail::async_log_sink *sink, unsigned long f_count) const
 {
-    unsigned fevals = static_cast<unsigned>(prob.get_fevals() - fevals0);
-    if (m_verbosity && !(fevals % m_verbosity)) {
+    if (sink && !(f_count % m_verbosity)) {
         // Constraints bits.
-        const auto ctol = prob.get_c_tol();
         const auto c1eq
-            = pagmo::detail::test_eq_constraints(fit.data() + 1, fit.data() + 1 + prob.get_nec(), ctol.data());
-        const auto c1ineq = pagmo::detail::test_ineq_constraints(fit.data() + 1 + prob.get_nec(),
-                                                                 fit.data() + fit.size(), ctol.data() + prob.get_nec());
+            = pagmo::detail::test_eq_constraints(fit.data() + 1, fit.data() + 1 + prob.get_nec(), c_tol.data());
+        const auto c1ineq = pagmo::detail::test_ineq_constraints(
+            fit.data() + 1 + prob.get_nec(), fit.data() + fit.size(), c_tol.data() + prob.get_nec());
         // This will be the total number of violated constraints.
         const auto nv = prob.get_nc() - c1eq.first - c1ineq.first;
         // This will be the norm of the violation.
         const auto l = c1eq.second + c1ineq.second;
-        // Test feasibility.
-        const auto feas = prob.feasibility_f(fit);
-
-        if (!(fevals / m_verbosity % 50u)) {
-            // Every 50 lines print the column names.
-            print("\n", std::setw(10), "objevals:", std::setw(15), "objval:", std::setw(15), "violated:", std::setw(15),
-                  "viol. norm:", '\n');
-        }
-        // Print to screen the log line.
-        print(std::setw(10), fevals, std::setw(15), fit[0], std::setw(15), nv, std::setw(15), l, feas ? "" : " i",
-              '\n');
-        // Record the log.
-        m_log.emplace_back(fevals, fit[0], nv, l, feas);
+        // The sink prints, streams and records the log line (the point is feasible if no constraint is violated).
+        sink->push(f_count, fit[0], nv, l, nv == 0u);
     }
 }
 
 // Objective function
-void worhp::UserF(OptVar *opt, Workspace *wsp, Params *, Control *, const population &pop,
-                  long long unsigned fevals0) const
+void worhp::UserF(OptVar *opt, Workspace *wsp, Params *, Control *, const problem &prob,
+                  detail::eval_cache &cache, const vector_double &c_tol, detail::async_log_sink *sink,
+                  unsigned long &f_count) const
 {
-    double *X = opt->X; // Abbreviate notation
-    const auto &prob = pop.get_problem();
-    auto dim = prob.get_nx();
-    vector_double x(X, X + dim);
-    auto fit = fitness_with_cache(x, prob);
-    update_log(prob, fit, fevals0);
+    // WORHP usually requests the gradient at the same point next: both are evaluated in one pass if the UDP
+    // implements the combined method, or the gradient is started on the helper thread in concurrent mode.
+    cache.prefetch(opt->X, prob.get_nx());
+    const auto misses = cache.get_stats().m_f_misses;
+    const auto &fit = cache.fitness(opt->X, prob.get_nx());
+    // Only a new fitness evaluation updates the counter (and possibly the log): a cached one was already logged.
+    if (cache.get_stats().m_f_misses != misses) {
+        ++f_count;
+        update_log(prob, fit, c_tol, sink, f_count);
+    }
     opt->F = wsp->ScaleObj * fit[0];
 }
 // Constraints
-void worhp::UserG(OptVar *opt, Workspace *, Params *, Control *, const population &pop) const
+void worhp::UserG(OptVar *opt, Workspace *, Params *, Control *, const problem &prob,
+                  detail::eval_cache &cache) const
 {
-    double *X = opt->X; // Abbreviate notation
-    const auto &prob = pop.get_problem();
-    auto dim = prob.get_nx();
-    vector_double x(X, X + dim);
-    auto fit = fitness_with_cache(x, prob);
-    for (decltype(prob.get_nc()) i = 0; i < prob.get_nc(); ++i) {
-        opt->G[i] = fit[i + 1];
-    }
+    const auto &fit = cache.fitness(opt->X, prob.get_nx());
+    std::copy(fit.begin() + 1, fit.end(), opt->G);
 }
 // Gradient for the objective function
-void worhp::UserDF(OptVar *opt, Workspace *wsp, Params *, Control *, const population &pop) const
+void worhp::UserDF(OptVar *opt, Workspace *wsp, Params *, Control *, const problem &prob,
+                   detail::eval_cache &cache) const
 {
-    const auto &prob = pop.get_problem();
-    auto dim = prob.get_nx();
-    vector_double x(opt->X, opt->X + dim);
-    auto g = gradient_with_cache(x, prob);
-    for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(wsp->DF.nnz); ++i) {
-        wsp->DF.val[i] = g[i];
-    }
+    const auto &g = cache.gradient(opt->X, prob.get_nx());
+    std::copy(g.begin(), g.begin() + wsp->DF.nnz, wsp->DF.val);
 }
 
 // Gradient for the constraints
-void worhp::UserDG(OptVar *opt, Workspace *wsp, Params *, Control *, const population &pop,
-                   const std::vector<vector_double::size_type> &gs_idx_map) const
+void worhp::UserDG(OptVar *opt, Workspace *wsp, Params *, Control *, const problem &prob,
+                   detail::eval_cache &cache, const std::vector<vector_double::size_type> &dg_gather) const
 {
-    const auto &prob = pop.get_problem();
-    auto dim = prob.get_nx();
-    vector_double x(opt->X, opt->X + dim);
-    auto g = gradient_with_cache(x, prob);
-    for (vector_double::size_type i = 0u; i < static_cast<vector_double::size_type>(wsp->DG.nnz); ++i) {
-        wsp->DG.val[i] = g[static_cast<vector_double::size_type>(wsp->DF.nnz) + gs_idx_map[i]];
+    const auto &g = cache.gradient(opt->X, prob.get_nx());
+    for (decltype(dg_gather.size()) i = 0u; i < dg_gather.size(); ++i) {
+        wsp->DG.val[i] = g[dg_gather[i]];
     }
 }
 
 // The Hessian of the Lagrangian L = f + mu * g
-void worhp::UserHM(OptVar *opt, Workspace *wsp, Params *, Control *, const population &pop,
-                   const std::vector<sparsity_pattern> &pagmo_hsp, const sparsity_pattern &pagmo_merged_hsp,
-                   const std::vector<vector_double::size_type> &hs_idx_map) const
+void worhp::UserHM(OptVar *opt, Workspace *wsp, Params *, Control *, const problem &prob,
+                   const detail::hm_scatter_plan &plan, vector_double &x) const
 {
-    const auto &prob = pop.get_problem();
-    auto dim = prob.get_nx();
-    vector_double x(opt->X, opt->X + dim);
-    auto pagmo_h = prob.hessians(x);
-    // Compute the hessian of the lagrangian. Logic: first we assemble the Hessian of the Lagrangian
-    // as represented by an unordered map (i,j) - > valij. We do so looping on the pagmo hessians
-    // and inserting the various contributions where they belong. Later we transform this representation
-    // into the worhp representation.
-    std::unordered_map<std::pair<vector_double::size_type, vector_double::size_type>, double, pair_hash> pagmo_merged_h;
-    // First we deal with the objective
-    for (decltype(pagmo_hsp[0].size()) j = 0u; j < pagmo_hsp[0].size(); ++j) {
-        // These will all be insertions in the map as all keys will not be there.
-        pagmo_merged_h[pagmo_hsp[0][j]] = pagmo_h[0][j] * wsp->ScaleObj;
-    }
-    // Then with the constraints
-    for (decltype(pagmo_hsp.size()) i = 1u; i < pagmo_hsp.size(); ++i) {
-        for (decltype(pagmo_hsp[i].size()) j = 0u; j < pagmo_hsp[i].size(); ++j) {
-            // If the key is there, great! Otherwise a 0 will be created and pagmo_h[i][j] * opt->Mu[i-1] summed
-            // over.
-            pagmo_merged_h[pagmo_hsp[i][j]] = pagmo_merged_h[pagmo_hsp[i][j]] + pagmo_h[i][j] * opt->Mu[i - 1];
+    std::copy(opt->X, opt->X + prob.get_nx(), x.begin());
+    const auto pagmo_h = prob.hessians(x);
+    // The hessian of the lagrangian is assembled directly in the WORHP representation: each entry
+    // of the pagmo hessians, weighted by ScaleObj (objective) or by the multiplier (constraints),
+    // is accumulated into its precomputed slot.
+    std::fill(wsp->HM.val, wsp->HM.val + wsp->HM.nnz, 0.);
+    for (decltype(pagmo_h.size()) i = 0u; i < pagmo_h.size(); ++i) {
+        const double w = (i == 0u) ? wsp->ScaleObj : opt->Mu[i - 1u];
+        const auto *slot = plan.m_slot.data() + plan.m_offset[i];
+        const auto n = plan.m_offset[i + 1u] - plan.m_offset[i];
+        const auto *h = pagmo_h[i].data();
+        for (decltype(plan.m_offset.size()) j = 0u; j < n; ++j) {
+            wsp->HM.val[slot[j]] += w * h[j];
         }
     }
-    // At this point the hessian of the lagrangian is assembled in pagmo_merged_h
-    // but we still need to translate it into the WORHP format.
-    // lower triangular
-    for (decltype(hs_idx_map.size()) i = 0u; i < hs_idx_map.size(); ++i) {
-        wsp->HM.val[i] = pagmo_merged_h[pagmo_merged_hsp[hs_idx_map[i]]];
-    }
-    // diagonal
-    for (decltype(dim) i = 0u; i < dim; ++i) {
-        wsp->HM.val[hs_idx_map.size() + i] = pagmo_merged_h[{i, i}];
-    }
-}
-
-// We cache the last call to fitness as it will be repeated by worhp
-vector_double worhp::fitness_with_cache(const vector_double &x, const problem &prob) const
-{
-    if (x == m_f_cache.first) {
-        return m_f_cache.second;
-    } else {
-        vector_double fit = prob.fitness(x);
-        m_f_cache = std::pair<vector_double, vector_double>{x, fit};
-        return fit;
-    }
-}
-
-// We cache the last call to gradient as it will be repeated by worhp
-vector_double worhp::gradient_with_cache(const vector_double &x, const problem &prob) const
-{
-    if (x == m_g_cache.first) {
-        return m_g_cache.second;
-    } else {
-        vector_double grad = prob.gradient(x);
-        m_g_cache = std::pair<vector_double, vector_double>{x, grad};
-        return grad;
-    }
 }
 
 } // namespace ppnf
@@ -5,6 +5,8 @@
 #include <boost/lexical_cast.hpp>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/null_algorithm.hpp>
+#include <pagmo/batch_evaluators/thread_bfe.hpp>
+#include <pagmo/bfe.hpp>
 #include <pagmo/io.hpp>
 #include <pagmo/population.hpp>
 #include <pagmo/problem.hpp>
@@ -13,11 +15,22 @@
 #include <pagmo/problems/hock_schittkowski_71.hpp>
 #include <pagmo/problems/inventory.hpp>
 #include <pagmo/problems/zdt.hpp>
+#include <pagmo/threading.hpp>
 #include <pagmo/types.hpp>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <random>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 
+#include <pagmo_plugins_nonfree/inplace.hpp>
 #include <pagmo_plugins_nonfree/snopt7.hpp>
 
 #ifdef _MSC_VER
@@ -90,6 +103,61 @@ struct analytic_udp {
     }
 };
 
+// The same UDP, also exposing the in-place methods.
+struct inplace_udp : analytic_udp {
+    static unsigned f_counter;
+    static unsigned g_counter;
+    void fitness_inplace(const vector_double &x, double *f) const
+    {
+        ++f_counter;
+        f[0] = x[0] * x[0] + x[1] * x[1];
+    }
+    void gradient_inplace(const vector_double &x, double *g) const
+    {
+        ++g_counter;
+        g[0] = 2. * x[0];
+        g[1] = 2. * x[1];
+    }
+};
+unsigned inplace_udp::f_counter = 0u;
+unsigned inplace_udp::g_counter = 0u;
+
+// An implicitly sparse UDP, not declaring its gradient sparsity: the i-th constraint depends on x_i and x_i+1.
+template <bool Gradient>
+struct chain_udp {
+    vector_double fitness(const vector_double &x) const
+    {
+        vector_double retval(5u);
+        retval[0] = x[0] * x[0];
+        for (vector_double::size_type i = 0u; i < 4u; ++i) {
+            retval[i + 1u] = x[i] * x[i + 1u] - 1.;
+        }
+        return retval;
+    }
+    vector_double gradient(const vector_double &x) const
+    {
+        vector_double retval(25u, 0.);
+        retval[0] = 2. * x[0];
+        for (vector_double::size_type i = 0u; i < 4u; ++i) {
+            retval[(i + 1u) * 5u + i] = x[i + 1u];
+            retval[(i + 1u) * 5u + i + 1u] = x[i];
+        }
+        return retval;
+    }
+    bool has_gradient() const
+    {
+        return Gradient;
+    }
+    vector_double::size_type get_nic() const
+    {
+        return 4u;
+    }
+    std::pair<vector_double, vector_double> get_bounds() const
+    {
+        return {vector_double(5u, 1.), vector_double(5u, 2.)};
+    }
+};
+
 BOOST_AUTO_TEST_CASE(construction)
 {
     // We test construction of the snopt7 uda
@@ -176,6 +244,515 @@ BOOST_AUTO_TEST_CASE(evolve)
     population pop{throwing_udp{}, 1u};
     BOOST_CHECK_THROW(uda.evolve(pop), std::invalid_argument);
 }
+BOOST_AUTO_TEST_CASE(library_registry)
+{
+    // Preloading a non existing library throws, and nothing is left in the registry.
+    BOOST_CHECK_THROW(snopt7(false, "IDONOTEXIST").preload(), std::invalid_argument);
+    BOOST_CHECK(!snopt7(false, "IDONOTEXIST").unload());
+    // Preloading a valid library.
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK_NO_THROW(uda.preload());
+    BOOST_CHECK_NO_THROW(uda.preload());
+    BOOST_CHECK_NO_THROW(uda.evolve(population{hock_schittkowski_71{}, 1u}));
+    // The library is shared by all the instances with the same path and minor version.
+    BOOST_CHECK_NO_THROW((snopt7{false, SNOPT7C_LIB}.evolve(population{hock_schittkowski_71{}, 1u})));
+    BOOST_CHECK(uda.unload());
+    BOOST_CHECK(!uda.unload());
+    // After unloading, the library is loaded again on demand.
+    BOOST_CHECK_NO_THROW(uda.evolve(population{hock_schittkowski_71{}, 1u}));
+    BOOST_CHECK(uda.unload());
+    // The 7.7 API has its own entry.
+    snopt7 uda77{false, SNOPT7C_LIB, 7u};
+    BOOST_CHECK_NO_THROW(uda77.preload());
+    BOOST_CHECK(!uda.unload());
+    BOOST_CHECK(uda77.unload());
+}
+
+BOOST_AUTO_TEST_CASE(warm_start)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(!uda.get_warm_start());
+    BOOST_CHECK_THROW(uda.set_warm_start(true, -1.), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_warm_start(true, std::numeric_limits<double>::quiet_NaN()), std::invalid_argument);
+    uda.set_warm_start(true, 1e-8, 2u);
+    BOOST_CHECK(uda.get_warm_start());
+    BOOST_CHECK(uda.get_extra_info().find("0/2 stored states") != std::string::npos);
+    // The bogus snopt7_c does not move the decision vector, so evolving twice the same
+    // population reuses the stored state.
+    population pop{cec2006{7u}, 10u, 23u};
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("1/2 stored states") != std::string::npos);
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("1/2 stored states") != std::string::npos);
+    // A different problem produces a new entry, and the capacity is respected.
+    population pop2{cec2006{8u}, 10u, 23u};
+    uda.evolve(pop2);
+    BOOST_CHECK(uda.get_extra_info().find("2/2 stored states") != std::string::npos);
+    population pop3{cec2006{9u}, 10u, 23u};
+    uda.evolve(pop3);
+    BOOST_CHECK(uda.get_extra_info().find("2/2 stored states") != std::string::npos);
+    // The states survive a copy and can be cleared.
+    auto uda_copy = uda;
+    BOOST_CHECK(uda_copy.get_extra_info().find("2/2 stored states") != std::string::npos);
+    uda.clear_warm_start();
+    BOOST_CHECK(uda.get_extra_info().find("0/2 stored states") != std::string::npos);
+    // Reducing the capacity drops the least recently used states.
+    uda_copy.set_warm_start(true, 0., 1u);
+    BOOST_CHECK(uda_copy.get_extra_info().find("1/1 stored states") != std::string::npos);
+    // Deactivating the warm start does not store anything.
+    uda.set_warm_start(false);
+    uda.evolve(pop);
+    uda.set_warm_start(true);
+    BOOST_CHECK(uda.get_extra_info().find("0/16 stored states") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(inplace_evaluation)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    uda.set_verbosity(1u);
+    // Before the registration the pagmo::problem interface is used.
+    population pop{inplace_udp{}, 1u, 32u};
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(inplace_udp::f_counter, 0u);
+    BOOST_CHECK_EQUAL(inplace_udp::g_counter, 0u);
+    register_inplace_udp<inplace_udp>();
+    const auto fevals0 = pop.get_problem().get_fevals();
+    const auto log0 = uda.get_log();
+    pop = uda.evolve(pop);
+    // The bogus snopt7_c calls the callback 100 times, asking both fitness and gradient.
+    BOOST_CHECK_EQUAL(inplace_udp::f_counter, 100u);
+    BOOST_CHECK_EQUAL(inplace_udp::g_counter, 100u);
+    // The fevals are counted also for in-place calls.
+    BOOST_CHECK_EQUAL(pop.get_problem().get_fevals(), fevals0 + 100u);
+    // The log is produced in the same way.
+    BOOST_CHECK_EQUAL(uda.get_log().size(), log0.size());
+    for (const auto &line : uda.get_log()) {
+        BOOST_CHECK(std::get<4>(line));
+        BOOST_CHECK_EQUAL(std::get<2>(line), 0u);
+    }
+    // Other UDPs are not affected.
+    population pop2{analytic_udp{}, 1u, 32u};
+    uda.evolve(pop2);
+    BOOST_CHECK_EQUAL(inplace_udp::f_counter, 100u);
+}
+
+BOOST_AUTO_TEST_CASE(evaluation_cache)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK_EQUAL(uda.get_cache_capacity(), 0u);
+    population pop{analytic_udp{}, 1u, 32u};
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("fitness hits/misses: 0/100, gradient hits/misses: 0/100")
+                != std::string::npos);
+    // The bogus snopt7_c never revisits its random points: the cache only misses, and the number
+    // of evaluations is unchanged.
+    uda.set_cache_capacity(4u);
+    BOOST_CHECK_EQUAL(uda.get_cache_capacity(), 4u);
+    const auto fevals0 = pop.get_problem().get_fevals();
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, 100u);
+    BOOST_CHECK(uda.get_extra_info().find("Evaluation cache capacity: 4") != std::string::npos);
+    BOOST_CHECK(uda.get_extra_info().find("fitness hits/misses: 0/100, gradient hits/misses: 0/100")
+                != std::string::npos);
+}
+
+// A thread safe UDP counting the gradients evaluated by a thread other than the one calling evolve().
+struct concurrent_udp : analytic_udp {
+    vector_double gradient(const vector_double &x) const
+    {
+        if (std::this_thread::get_id() != caller) {
+            ++helper_gradients;
+        }
+        return analytic_udp::gradient(x);
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::constant;
+    }
+    static std::thread::id caller;
+    static std::atomic<unsigned> helper_gradients;
+};
+std::thread::id concurrent_udp::caller;
+std::atomic<unsigned> concurrent_udp::helper_gradients{0u};
+
+// The same UDP, not thread safe.
+struct basic_udp : concurrent_udp {
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::basic;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_gradient)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(!uda.get_concurrent_gradient());
+    concurrent_udp::caller = std::this_thread::get_id();
+    concurrent_udp::helper_gradients = 0u;
+    population pop{concurrent_udp{}, 1u, 32u};
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(concurrent_udp::helper_gradients.load(), 0u);
+    // The bogus snopt7_c requests fitness and gradient together 100 times: all the gradients are evaluated
+    // by the helper thread, once each (also with the cache disabled).
+    uda.set_concurrent_gradient(true);
+    BOOST_CHECK(uda.get_concurrent_gradient());
+    BOOST_CHECK(uda.get_extra_info().find("Concurrent gradient: active") != std::string::npos);
+    for (auto capacity : {0u, 4u}) {
+        uda.set_cache_capacity(capacity);
+        concurrent_udp::helper_gradients = 0u;
+        const auto gevals0 = pop.get_problem().get_gevals();
+        pop = uda.evolve(pop);
+        BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 100u);
+        BOOST_CHECK_EQUAL(concurrent_udp::helper_gradients.load(), 100u);
+        BOOST_CHECK(uda.get_extra_info().find("gradient hits/misses: 0/100") != std::string::npos);
+    }
+    // Problems which are not thread safe are evaluated sequentially.
+    concurrent_udp::helper_gradients = 0u;
+    population pop2{basic_udp{}, 1u, 32u};
+    pop2 = uda.evolve(pop2);
+    BOOST_CHECK_EQUAL(concurrent_udp::helper_gradients.load(), 0u);
+}
+
+// A UDP computing fitness and gradient in one pass.
+struct combined_udp : analytic_udp {
+    static unsigned fg_counter;
+    void fitness_and_gradient_inplace(const vector_double &x, double *f, double *g) const
+    {
+        ++fg_counter;
+        f[0] = x[0] * x[0] + x[1] * x[1];
+        g[0] = 2. * x[0];
+        g[1] = 2. * x[1];
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::constant;
+    }
+};
+unsigned combined_udp::fg_counter = 0u;
+
+BOOST_AUTO_TEST_CASE(combined_evaluation)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    uda.set_verbosity(1u);
+    register_inplace_udp<combined_udp>();
+    population pop{combined_udp{}, 1u, 32u};
+    // The bogus snopt7_c requests fitness and gradient together 100 times: both are evaluated in one pass (also
+    // with the cache disabled, and in place of the concurrent evaluation).
+    for (auto concurrent : {false, true}) {
+        uda.set_concurrent_gradient(concurrent);
+        for (auto capacity : {0u, 4u}) {
+            uda.set_cache_capacity(capacity);
+            combined_udp::fg_counter = 0u;
+            const auto fevals0 = pop.get_problem().get_fevals();
+            const auto gevals0 = pop.get_problem().get_gevals();
+            pop = uda.evolve(pop);
+            BOOST_CHECK_EQUAL(combined_udp::fg_counter, 100u);
+            BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, 100u);
+            BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 0u);
+            BOOST_CHECK(uda.get_extra_info().find("fitness hits/misses: 0/100, gradient hits/misses: 0/100")
+                        != std::string::npos);
+            for (const auto &line : uda.get_log()) {
+                BOOST_CHECK(std::get<4>(line));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(batch_mode)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK_EQUAL(uda.get_batch_size(), 1u);
+    BOOST_CHECK_THROW(uda.set_batch_size(0u), std::invalid_argument);
+    uda.set_batch_size(3u);
+    BOOST_CHECK_EQUAL(uda.get_batch_size(), 3u);
+    BOOST_CHECK(uda.get_extra_info().find("Batch size: 3") != std::string::npos);
+    // The individuals starting from index 1 are optimised, the others are left untouched.
+    uda.set_selection(1u);
+    population pop{analytic_udp{}, 5u, 32u};
+    const auto x_before = pop.get_x();
+    const auto fevals0 = pop.get_problem().get_fevals();
+    pop = uda.evolve(pop);
+    // Each of the three runs of the bogus snopt7_c makes 100 evaluations.
+    BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, 300u);
+    BOOST_CHECK(pop.get_x()[0] == x_before[0]);
+    BOOST_CHECK(pop.get_x()[4] == x_before[4]);
+    BOOST_CHECK(uda.get_extra_info().find("fitness hits/misses: 0/300") != std::string::npos);
+    // The batch is truncated at the end of the population, and the index must be valid.
+    uda.set_selection(4u);
+    pop = uda.evolve(pop);
+    uda.set_selection(5u);
+    BOOST_CHECK_THROW(uda.evolve(pop), std::invalid_argument);
+    // A batch larger than the population optimises all the individuals.
+    uda.set_batch_size(10u);
+    uda.set_selection("random");
+    pop = uda.evolve(pop);
+}
+
+BOOST_AUTO_TEST_CASE(statistics)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(!uda.get_collect_stats());
+    population pop{analytic_udp{}, 1u, 32u};
+    pop = uda.evolve(pop);
+    // Not collected by default.
+    BOOST_CHECK_EQUAL(uda.get_stats().m_f_calls, 0u);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_total_time, 0.);
+    BOOST_CHECK(uda.get_extra_info().find("Statistics") == std::string::npos);
+    uda.set_collect_stats(true);
+    BOOST_CHECK(uda.get_collect_stats());
+    pop = uda.evolve(pop);
+    const auto &stats = uda.get_stats();
+    // The bogus snopt7_c asks 100 times for both the fitness and the gradient.
+    BOOST_CHECK_EQUAL(stats.m_f_calls, 100u);
+    BOOST_CHECK_EQUAL(stats.m_df_calls, 100u);
+    BOOST_CHECK_EQUAL(stats.m_g_calls + stats.m_dg_calls + stats.m_hm_calls + stats.m_fidif_calls, 0u);
+    BOOST_CHECK_EQUAL(stats.m_cache_misses, 200u);
+    BOOST_CHECK(stats.m_total_time > 0.);
+    BOOST_CHECK(stats.m_callback_time > 0.);
+    BOOST_CHECK(stats.m_total_time >= stats.m_callback_time);
+    BOOST_CHECK(stats.m_bytes_estimated > 0u);
+    BOOST_CHECK(uda.get_extra_info().find("Callbacks, F: 100, G: 0, DF: 100") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(sparsity_detection)
+{
+    const sparsity_pattern expected
+        = {{0, 0}, {1, 0}, {1, 1}, {2, 1}, {2, 2}, {3, 2}, {3, 3}, {4, 3}, {4, 4}};
+    std::mt19937 e(42u);
+    // From the gradient.
+    auto probed = ppnf::detail::probe_gradient_sparsity(problem{chain_udp<true>{}}, 3u, e);
+    BOOST_CHECK(probed.m_pattern == expected);
+    BOOST_CHECK((probed.m_dense_idx == std::vector<vector_double::size_type>{0, 5, 6, 11, 12, 17, 18, 23, 24}));
+    // From the fitness.
+    problem p{chain_udp<false>{}};
+    probed = ppnf::detail::probe_gradient_sparsity(p, 3u, e);
+    BOOST_CHECK(probed.m_pattern == expected);
+    BOOST_CHECK_EQUAL(p.get_fevals(), 3u * 6u);
+
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK_EQUAL(uda.get_sparsity_detection(), 0u);
+    uda.set_sparsity_detection(3u);
+    BOOST_CHECK_EQUAL(uda.get_sparsity_detection(), 3u);
+    BOOST_CHECK(uda.get_extra_info().find("Sparsity detection: 3 probes") != std::string::npos);
+    population pop{chain_udp<true>{}, 1u, 32u};
+    auto gevals0 = pop.get_problem().get_gevals();
+    pop = uda.evolve(pop);
+    // The bogus snopt7_c asks for 100 gradients, the detection for 3.
+    BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 103u);
+    // The detected pattern is reused.
+    gevals0 = pop.get_problem().get_gevals();
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 100u);
+    // Problems declaring their sparsity are not probed.
+    population pop2{analytic_udp{}, 1u, 32u};
+    gevals0 = pop2.get_problem().get_gevals();
+    pop2 = uda.evolve(pop2);
+    BOOST_CHECK_EQUAL(pop2.get_problem().get_gevals() - gevals0, 100u);
+}
+
+// A UDP with a linear part: a linear term in the objective, a linear equality constraint and a bilinear
+// inequality constraint. It does not declare its (dense) gradient sparsity.
+struct linear_udp {
+    vector_double fitness(const vector_double &x) const
+    {
+        return {x[0] * x[0] + 3. * x[1], 2. * x[0] - x[1] + 5., x[0] * x[1] - 1.};
+    }
+    vector_double gradient(const vector_double &x) const
+    {
+        return {2. * x[0], 3., 2., -1., x[1], x[0]};
+    }
+    bool has_gradient() const
+    {
+        return true;
+    }
+    vector_double::size_type get_nec() const
+    {
+        return 1u;
+    }
+    vector_double::size_type get_nic() const
+    {
+        return 1u;
+    }
+    std::pair<vector_double, vector_double> get_bounds() const
+    {
+        return {{-5., -5.}, {5., 5.}};
+    }
+};
+
+BOOST_AUTO_TEST_CASE(linear_detection)
+{
+    // The detected structure.
+    std::mt19937 e(42u);
+    const auto lin = ppnf::detail::detect_linear_structure(problem{linear_udp{}}, pagmo::detail::dense_gradient(3u, 2u),
+                                                           nullptr, 3u, e);
+    BOOST_CHECK((lin.m_iAfun == std::vector<int>{0, 1, 1}));
+    BOOST_CHECK((lin.m_jAvar == std::vector<int>{1, 0, 1}));
+    BOOST_CHECK((lin.m_A == vector_double{3., 2., -1.}));
+    BOOST_CHECK((lin.m_pattern == sparsity_pattern{{0u, 0u}, {2u, 0u}, {2u, 1u}}));
+    BOOST_CHECK((lin.m_gradient_idx == std::vector<vector_double::size_type>{0u, 4u, 5u}));
+    BOOST_CHECK((lin.m_linear_row == std::vector<char>{0, 1, 0}));
+    BOOST_CHECK(std::abs(lin.m_constant[1] - 5.) < 1e-12);
+    BOOST_CHECK_EQUAL(lin.m_constant[0], 0.);
+    // The detection in evolve().
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK_EQUAL(uda.get_linear_detection(), 0u);
+    BOOST_CHECK_THROW(uda.set_linear_detection(1u), std::invalid_argument);
+    uda.set_linear_detection(3u);
+    BOOST_CHECK_EQUAL(uda.get_linear_detection(), 3u);
+    BOOST_CHECK(uda.get_extra_info().find("Linear structure detection: 3 probes") != std::string::npos);
+    population pop{linear_udp{}, 1u};
+    auto fevals0 = pop.get_problem().get_fevals();
+    auto gevals0 = pop.get_problem().get_gevals();
+    // The detection costs one fitness and 3 gradient evaluations, and the final fitness is evaluated in full.
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, 102u);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 103u);
+    BOOST_CHECK(pop.get_problem().feasibility_f(pop.get_f()[0]) == pop.get_problem().feasibility_x(pop.get_x()[0]));
+    // Also with the sparsity detection, and in batch mode.
+    uda.set_sparsity_detection(2u);
+    uda.set_batch_size(2u);
+    population pop2{linear_udp{}, 2u};
+    BOOST_CHECK_NO_THROW(pop2 = uda.evolve(pop2));
+    // The detection is skipped for problems not providing the gradient.
+    uda.set_batch_size(1u);
+    uda.set_sparsity_detection(0u);
+    population pop3{cec2006{1}, 1u};
+    fevals0 = pop3.get_problem().get_fevals();
+    pop3 = uda.evolve(pop3);
+    BOOST_CHECK_EQUAL(pop3.get_problem().get_fevals() - fevals0, 100u);
+}
+
+BOOST_AUTO_TEST_CASE(persistent_session)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(!uda.get_persistent_session());
+    uda.set_persistent_session(true);
+    BOOST_CHECK(uda.get_persistent_session());
+    BOOST_CHECK(uda.get_extra_info().find("Persistent session: active") != std::string::npos);
+    // Repeated runs on the same and on different problems.
+    population pop{hock_schittkowski_71{}, 1u};
+    for (auto i = 0; i < 3; ++i) {
+        pop = uda.evolve(pop);
+        BOOST_CHECK_EQUAL(uda.get_log().size(), 100u);
+    }
+    BOOST_CHECK_NO_THROW(uda.evolve(population{cec2006{1}, 1u}));
+    // Changing and removing options between runs.
+    uda.set_numeric_option("Major optimality tolerance", 1e-8);
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    uda.set_numeric_option("Major optimality tolerance", 1e-9);
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    uda.reset_numeric_options();
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    // Invalid options are still detected, and the session remains usable.
+    uda.set_integer_option("invalid_integer_option", 32);
+    BOOST_CHECK_THROW(uda.evolve(pop), std::invalid_argument);
+    uda.reset_integer_options();
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    // Concurrent runs of a batch, each with its own session.
+    uda.set_batch_size(4u);
+    population pop2{hock_schittkowski_71{}, 8u};
+    for (auto i = 0; i < 2; ++i) {
+        BOOST_CHECK_NO_THROW(pop2 = uda.evolve(pop2));
+    }
+    // Copies keep the mode, not the sessions.
+    auto uda_copy{uda};
+    BOOST_CHECK(uda_copy.get_persistent_session());
+    BOOST_CHECK_NO_THROW(uda_copy.evolve(pop2));
+    uda.set_persistent_session(false);
+    BOOST_CHECK(!uda.get_persistent_session());
+    BOOST_CHECK_NO_THROW(uda.evolve(pop2));
+}
+
+BOOST_AUTO_TEST_CASE(plugin_fd_gradient)
+{
+    // The colouring of the chain pattern needs two colours, that of a dense pattern one per variable.
+    const sparsity_pattern chain = {{0, 0}, {1, 0}, {1, 1}, {2, 1}, {2, 2}, {3, 2}, {3, 3}, {4, 3}, {4, 4}};
+    const auto dense = pagmo::detail::dense_gradient(5u, 5u);
+    const auto chain_colouring = ppnf::detail::colour_gradient_sparsity(chain, 5u, 5u);
+    BOOST_CHECK_EQUAL(chain_colouring.m_n_colours, 2u);
+    for (const auto &p : chain) {
+        for (const auto &q : chain) {
+            if (p.first == q.first && p.second != q.second) {
+                BOOST_CHECK(chain_colouring.m_colour[p.second] != chain_colouring.m_colour[q.second]);
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(ppnf::detail::colour_gradient_sparsity(dense, 5u, 5u).m_n_colours, 5u);
+    // Variables not appearing in the pattern are not coloured.
+    const auto partial = ppnf::detail::colour_gradient_sparsity({{0, 1}, {1, 3}}, 5u, 2u);
+    BOOST_CHECK_EQUAL(partial.m_n_colours, 1u);
+    BOOST_CHECK_EQUAL(partial.m_colour[0], ppnf::detail::fd_colouring::none);
+    // The engine against the analytic gradient, at a point where x_4 sits on its upper bound, with and without
+    // the batch fitness evaluator.
+    const problem exact{chain_udp<true>{}};
+    problem p{chain_udp<false>{}};
+    const vector_double x{1.2, 1.5, 1.7, 1.1, 2.};
+    const auto g_exact = exact.gradient(x);
+    const bfe b{thread_bfe{}};
+    for (const auto central : {false, true}) {
+        for (const auto *pattern : {&dense, &chain}) {
+            const auto colouring = ppnf::detail::colour_gradient_sparsity(*pattern, 5u, 5u);
+            for (const auto *eval : {&b, static_cast<const bfe *>(nullptr)}) {
+                ppnf::detail::fd_gradient fd(p, eval, *pattern, colouring, central, 0.);
+                BOOST_CHECK_EQUAL(fd.n_points(), central ? 2u * colouring.m_n_colours : colouring.m_n_colours + 1u);
+                const auto fevals0 = p.get_fevals();
+                vector_double g(pattern->size());
+                fd.gradient(x, g.data());
+                BOOST_CHECK_EQUAL(p.get_fevals() - fevals0, fd.n_points());
+                for (decltype(g.size()) k = 0u; k < g.size(); ++k) {
+                    const auto i = (*pattern)[k].first, j = (*pattern)[k].second;
+                    BOOST_CHECK(std::abs(g[k] - g_exact[i * 5u + j]) < 1e-6);
+                }
+            }
+        }
+    }
+
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(!uda.has_fd_gradient());
+    BOOST_CHECK_THROW(uda.set_fd_gradient(bfe{thread_bfe{}}, "backward"), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_fd_gradient(bfe{thread_bfe{}}, "forward", -1.), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_fd_gradient(bfe{thread_bfe{}}, "forward", std::numeric_limits<double>::quiet_NaN()),
+                      std::invalid_argument);
+    BOOST_CHECK(!uda.has_fd_gradient());
+    uda.set_fd_gradient(bfe{thread_bfe{}}, "central", 1e-5);
+    BOOST_CHECK(uda.has_fd_gradient());
+    BOOST_CHECK_EQUAL(uda.get_fd_scheme(), "central");
+    BOOST_CHECK_EQUAL(uda.get_fd_step(), 1e-5);
+    BOOST_CHECK(uda.get_extra_info().find("Finite-difference gradient: central") != std::string::npos);
+    uda.set_fd_gradient(bfe{thread_bfe{}});
+    BOOST_CHECK_EQUAL(uda.get_fd_scheme(), "forward");
+    BOOST_CHECK(uda.get_fd_step() > 0.);
+    // The bogus snopt7_c asks for 100 fitnesses and gradients: each gradient costs 6 fitness evaluations.
+    population pop{chain_udp<false>{}, 1u, 32u};
+    auto fevals0 = pop.get_problem().get_fevals();
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, 700u);
+    // Problems providing their gradient are not affected.
+    population pop2{chain_udp<true>{}, 1u, 32u};
+    fevals0 = pop2.get_problem().get_fevals();
+    const auto gevals0 = pop2.get_problem().get_gevals();
+    pop2 = uda.evolve(pop2);
+    BOOST_CHECK_EQUAL(pop2.get_problem().get_fevals() - fevals0, 100u);
+    BOOST_CHECK_EQUAL(pop2.get_problem().get_gevals() - gevals0, 100u);
+    // With the detected sparsity, each gradient costs 3 fitness evaluations, plus 6 for the detection.
+    uda.set_fd_gradient();
+    BOOST_CHECK(uda.get_extra_info().find("(step ") != std::string::npos);
+    BOOST_CHECK(uda.get_extra_info().find(", sequential)") != std::string::npos);
+    uda.set_sparsity_detection(1u);
+    population pop3{chain_udp<false>{}, 1u, 32u};
+    fevals0 = pop3.get_problem().get_fevals();
+    pop3 = uda.evolve(pop3);
+    BOOST_CHECK_EQUAL(pop3.get_problem().get_fevals() - fevals0, 406u);
+    // Also in batch mode.
+    uda.set_fd_gradient(bfe{thread_bfe{}}, "central");
+    uda.set_batch_size(2u);
+    population pop4{chain_udp<false>{}, 2u, 32u};
+    BOOST_CHECK_NO_THROW(uda.evolve(pop4));
+    uda.unset_fd_gradient();
+    BOOST_CHECK(!uda.has_fd_gradient());
+    BOOST_CHECK(uda.get_extra_info().find("Finite-difference gradient") == std::string::npos);
+}
+
 BOOST_AUTO_TEST_CASE(streams_and_log)
 {
     snopt7 uda{false, SNOPT7C_LIB};
@@ -184,12 +761,102 @@ BOOST_AUTO_TEST_CASE(streams_and_log)
     pop = uda.evolve(pop);
     BOOST_CHECK_EQUAL(uda.get_log().size(), 100);
     BOOST_CHECK(pop.get_problem().get_fevals() - 1 == uda.get_log().size());
+    // The columnar log has the same content, and is not modified by further calls to evolve().
+    // NOTE: get_log() returns a copy, which is taken once.
+    const auto log = uda.get_log();
+    const auto cols = uda.get_log_columns();
+    BOOST_CHECK_EQUAL(cols->size(), 100u);
+    for (decltype(cols->size()) i = 0u; i < cols->size(); ++i) {
+        const auto &line = log[i];
+        BOOST_CHECK_EQUAL(cols->fevals()[i], std::get<0>(line));
+        BOOST_CHECK_EQUAL(cols->objval()[i], std::get<1>(line));
+        BOOST_CHECK_EQUAL(cols->violated()[i], std::get<2>(line));
+        BOOST_CHECK_EQUAL(cols->viol_norm()[i], std::get<3>(line));
+        BOOST_CHECK_EQUAL(cols->feasible()[i] != 0u, std::get<4>(line));
+    }
+    uda.set_verbosity(50u);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_log().size(), 2u);
+    BOOST_CHECK_EQUAL(uda.get_log_columns()->size(), 2u);
+    BOOST_CHECK_EQUAL(cols->size(), 100u);
     uda.set_verbosity(23u);
     BOOST_CHECK(uda.get_verbosity() == 23u);
     BOOST_CHECK(uda.get_name().find("SNOPT7") != std::string::npos);
     BOOST_CHECK(uda.get_extra_info().find("Name of the snopt7_c library") != std::string::npos);
 }
 
+BOOST_AUTO_TEST_CASE(log_buffer_and_file)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(uda.get_log_buffer() == std::make_pair(std::string("unbounded"), 0u));
+    BOOST_CHECK_THROW(uda.set_log_buffer("circular", 10u), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_log_buffer("ring"), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_log_file("log.txt", "json"), std::invalid_argument);
+    population pop{cec2006{1}, 1u};
+    uda.set_verbosity(1u);
+    // The ring buffer keeps the last lines.
+    uda.set_log_buffer("ring", 10u);
+    BOOST_CHECK(uda.get_extra_info().find("Log buffer: ring (capacity 10)") != std::string::npos);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_log().size(), 10u);
+    BOOST_CHECK_EQUAL(std::get<0>(uda.get_log().front()), 91u);
+    BOOST_CHECK_EQUAL(std::get<0>(uda.get_log().back()), 100u);
+    // The decimated buffer keeps the first line and spreads the others over the run.
+    uda.set_log_buffer("decimate", 10u);
+    pop = uda.evolve(pop);
+    const auto decimated = uda.get_log();
+    BOOST_CHECK(decimated.size() <= 10u);
+    BOOST_CHECK(decimated.size() > 1u);
+    BOOST_CHECK_EQUAL(std::get<0>(decimated.front()), 1u);
+    for (decltype(decimated.size()) i = 1u; i < decimated.size(); ++i) {
+        BOOST_CHECK(std::get<0>(decimated[i]) > std::get<0>(decimated[i - 1u]));
+    }
+    // The lines are appended to the csv file, the header is written once.
+    uda.set_log_buffer("unbounded");
+    const std::string file = "ppnf_snopt7_test_log.csv";
+    std::remove(file.c_str());
+    uda.set_log_file(file);
+    BOOST_CHECK(uda.get_log_file() == std::make_pair(file, std::string("csv")));
+    BOOST_CHECK(uda.get_extra_info().find("Log file: " + file + " (csv)") != std::string::npos);
+    pop = uda.evolve(pop);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_log().size(), 100u);
+    {
+        std::ifstream csv(file);
+        std::string line;
+        std::getline(csv, line);
+        BOOST_CHECK_EQUAL(line, "fevals,objval,violated,viol_norm,feasible,time");
+        unsigned n_lines = 0u;
+        while (std::getline(csv, line)) {
+            ++n_lines;
+        }
+        BOOST_CHECK_EQUAL(n_lines, 200u);
+    }
+    std::remove(file.c_str());
+    // The binary records have a fixed size.
+    const std::string bin_file = "ppnf_snopt7_test_log.bin";
+    std::remove(bin_file.c_str());
+    uda.set_log_file(bin_file, "binary");
+    pop = uda.evolve(pop);
+    {
+        std::ifstream bin(bin_file, std::ios::binary | std::ios::ate);
+        BOOST_CHECK_EQUAL(static_cast<long long>(bin.tellg()), 100ll * 41ll);
+    }
+    std::remove(bin_file.c_str());
+#if defined(__linux__)
+    // An error writing the log file does not interrupt the run, and is reported.
+    uda.set_log_file("/dev/full");
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    BOOST_CHECK_EQUAL(uda.get_log().size(), 100u);
+    BOOST_CHECK(uda.get_extra_info().find("Log error (last evolve): Could not write to the log file /dev/full")
+                != std::string::npos);
+#endif
+    uda.set_log_file("");
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("Log error") == std::string::npos);
+    BOOST_CHECK(uda.get_extra_info().find("Log file") == std::string::npos);
+}
+
 BOOST_AUTO_TEST_CASE(fevals_gevals_with_algorithm_wrapper)
 {
     algorithm algo{snopt7{false, SNOPT7C_LIB}};
@@ -208,6 +875,85 @@ BOOST_AUTO_TEST_CASE(fevals_gevals_with_algorithm_wrapper)
     BOOST_CHECK(evolved.get_problem().get_gevals() > gevals0);
 }
 
+// A batch fitness evaluator with no thread safety guarantee (as the Python ones).
+struct unsafe_bfe {
+    vector_double operator()(problem &p, const vector_double &dvs) const
+    {
+        return bfe{}(p, dvs);
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::none;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_evolve)
+{
+    snopt7 uda{false, SNOPT7C_LIB};
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::constant);
+    // A log file, or a batch evaluator which is not thread safe, is not shared safely by concurrent evolves.
+    uda.set_log_file("snopt7_concurrent.log");
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::basic);
+    uda.set_log_file("");
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::constant);
+    // A batch evaluator with no thread safety guarantee makes the algorithm not thread safe.
+    uda.set_fd_gradient(bfe{unsafe_bfe{}});
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::none);
+    uda.unset_fd_gradient();
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::constant);
+    uda.set_verbosity(1u);
+    uda.set_collect_stats(true);
+    uda.set_warm_start(true, 0., 4u);
+    uda.set_sparsity_detection(3u);
+    uda.set_selection("random");
+    uda.set_replacement("random");
+    // A single instance is evolved from several threads, which also read its results: each thread must see
+    // the results of a complete evolve (the bogus snopt7_c makes 100 evaluations).
+    std::atomic<unsigned> failures(0u);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0u; i < 8u; ++i) {
+        threads.emplace_back([&uda, &failures, i]() {
+            try {
+                for (unsigned j = 0u; j < 5u; ++j) {
+                    population pop{cec2006{7u + (i + j) % 3u}, 10u, 10u * i + j};
+                    pop = uda.evolve(pop);
+                    if (uda.get_log_columns()->size() != 100u || uda.get_log().size() != 100u
+                        || uda.get_stats().m_f_calls != 100u
+                        || uda.get_extra_info().find("Statistics") == std::string::npos) {
+                        ++failures;
+                    }
+                }
+            } catch (...) {
+                ++failures;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    BOOST_CHECK_EQUAL(failures.load(), 0u);
+    BOOST_CHECK(uda.get_extra_info().find("4/4 stored states") != std::string::npos);
+    // The same holds in batch mode, and for copies made while the original is evolved.
+    uda.set_batch_size(3u);
+    threads.clear();
+    for (unsigned i = 0u; i < 4u; ++i) {
+        threads.emplace_back([&uda, &failures, i]() {
+            try {
+                auto uda_copy = uda;
+                population pop{hock_schittkowski_71{}, 5u, i};
+                pop = uda.evolve(pop);
+                pop = uda_copy.evolve(pop);
+            } catch (...) {
+                ++failures;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    BOOST_CHECK_EQUAL(failures.load(), 0u);
+}
+
 BOOST_AUTO_TEST_CASE(serialization_test)
 {
     // Make one evolution
@@ -217,6 +963,11 @@ BOOST_AUTO_TEST_CASE(serialization_test)
     algo.set_verbosity(1u);
     algo.extract<snopt7>()->set_integer_option("some_int", 4);
     algo.extract<snopt7>()->set_numeric_option("some_float", 2.2);
+    algo.extract<snopt7>()->set_warm_start(true, 1e-3, 4u);
+    algo.extract<snopt7>()->set_collect_stats(true);
+    algo.extract<snopt7>()->set_fd_gradient(bfe{thread_bfe{}}, "central");
+    algo.extract<snopt7>()->set_log_buffer("ring", 50u);
+    algo.extract<snopt7>()->set_concurrent_gradient(true);
     pop = algo.evolve(pop);
 
     // Store the string representation of p.
@@ -237,3 +988,52 @@ BOOST_AUTO_TEST_CASE(serialization_test)
     auto after_text = boost::lexical_cast<std::string>(algo);
     BOOST_CHECK_EQUAL(before_text, after_text);
 }
+
+// The layout of the archives of snopt7 before the class version 1.
+struct legacy_snopt7 : not_population_based {
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, boost::serialization::base_object<not_population_based>(*this), m_library,
+                               m_minor_version, m_integer_opts, m_numeric_opts, m_last_opt_res, m_screen_output,
+                               m_verbosity, m_log);
+    }
+    template <typename Archive>
+    void load(Archive &ar) = delete;
+    template <typename Archive>
+    void save(Archive &ar) const = delete;
+    std::string m_library = SNOPT7C_LIB;
+    unsigned m_minor_version = 7u;
+    std::map<std::string, int> m_integer_opts{{"some_int", 4}};
+    std::map<std::string, double> m_numeric_opts{{"some_float", 2.2}};
+    int m_last_opt_res = 1;
+    bool m_screen_output = false;
+    unsigned m_verbosity = 2u;
+    snopt7::log_type m_log{snopt7::log_line_type{2u, 1.5, 1u, 0.25, false},
+                           snopt7::log_line_type{4u, 1., 0u, 0., true}};
+};
+
+BOOST_AUTO_TEST_CASE(legacy_serialization)
+{
+    // The archives written before the class version 1 can still be loaded.
+    const legacy_snopt7 legacy;
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << legacy;
+    }
+    snopt7 uda;
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> uda;
+    }
+    BOOST_CHECK(uda.get_log() == legacy.m_log);
+    BOOST_CHECK_EQUAL(uda.get_last_opt_result(), 1);
+    BOOST_CHECK_EQUAL(uda.get_verbosity(), 2u);
+    BOOST_CHECK(uda.get_integer_options() == legacy.m_integer_opts);
+    BOOST_CHECK(uda.get_numeric_options() == legacy.m_numeric_opts);
+    BOOST_CHECK(uda.get_extra_info().find(SNOPT7C_LIB) != std::string::npos);
+    // The settings the archive does not contain keep their default values.
+    BOOST_CHECK(!uda.get_warm_start());
+    BOOST_CHECK_EQUAL(uda.get_batch_size(), 1u);
+}
@@ -2,8 +2,16 @@
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 #include <boost/lexical_cast.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <pagmo/algorithm.hpp>
 #include <pagmo/algorithms/null_algorithm.hpp>
+#include <pagmo/batch_evaluators/thread_bfe.hpp>
+#include <pagmo/bfe.hpp>
 #include <pagmo/io.hpp>
 #include <pagmo/population.hpp>
 #include <pagmo/problem.hpp>
@@ -15,11 +23,19 @@
 #include <pagmo/problems/rastrigin.hpp>
 #include <pagmo/problems/rosenbrock.hpp>
 #include <pagmo/problems/zdt.hpp>
+#include <pagmo/threading.hpp>
 #include <pagmo/types.hpp>
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include <pagmo_plugins_nonfree/inplace.hpp>
 #include <pagmo_plugins_nonfree/worhp.hpp>
 
 #ifdef _MSC_VER
@@ -142,6 +158,25 @@ BOOST_AUTO_TEST_CASE(evolve)
     BOOST_CHECK_NO_THROW((uda2.evolve(population{ackley{10}, 0u})));
 }
 
+BOOST_AUTO_TEST_CASE(library_registry)
+{
+    // Preloading a non existing library throws, and nothing is left in the registry.
+    BOOST_CHECK_THROW(worhp(false, "IDONOTEXIST").preload(), std::invalid_argument);
+    BOOST_CHECK(!worhp(false, "IDONOTEXIST").unload());
+    // Preloading a valid library.
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK_NO_THROW(uda.preload());
+    BOOST_CHECK_NO_THROW(uda.preload());
+    BOOST_CHECK_NO_THROW(uda.evolve(population{worhp_test_problem{}, 1u}));
+    // The library is shared by all the instances with the same path.
+    BOOST_CHECK_NO_THROW((worhp{false, WORHP_LIB}.evolve(population{worhp_test_problem{}, 1u})));
+    BOOST_CHECK(uda.unload());
+    BOOST_CHECK(!uda.unload());
+    // After unloading, the library is loaded again on demand.
+    BOOST_CHECK_NO_THROW(uda.evolve(population{worhp_test_problem{}, 1u}));
+    BOOST_CHECK(uda.unload());
+}
+
 BOOST_AUTO_TEST_CASE(verbosity)
 {
     // We test the verbosity mechanism when the original worhp screen output is deactivated
@@ -152,6 +187,17 @@ BOOST_AUTO_TEST_CASE(verbosity)
         BOOST_CHECK_EQUAL(uda.get_verbosity(), 1u);
         uda.evolve(population{p, 1u});
         BOOST_CHECK(uda.get_log().size() > 0);
+        // The columnar log has the same content.
+        const auto cols = uda.get_log_columns();
+        BOOST_CHECK_EQUAL(cols->size(), uda.get_log().size());
+        BOOST_CHECK_EQUAL(cols->fevals().back(), std::get<0>(uda.get_log().back()));
+        BOOST_CHECK_EQUAL(cols->objval().back(), std::get<1>(uda.get_log().back()));
+        // A new log is stored by each call to evolve().
+        uda.set_verbosity(0u);
+        uda.evolve(population{p, 1u});
+        BOOST_CHECK(uda.get_log().empty());
+        BOOST_CHECK(uda.get_log_columns()->empty());
+        BOOST_CHECK(!cols->empty());
     }
     // We test the verbosity mechanism when the original worhp screen output is active
     {
@@ -225,6 +271,820 @@ BOOST_AUTO_TEST_CASE(extrainfo_and_others)
     BOOST_CHECK(uda.get_name().find("WORHP") != std::string::npos);
 }
 
+BOOST_AUTO_TEST_CASE(warm_start)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(!uda.get_warm_start());
+    BOOST_CHECK_THROW(uda.set_warm_start(true, -1.), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_warm_start(true, std::numeric_limits<double>::quiet_NaN()), std::invalid_argument);
+    // The bogus WORHP moves the decision vector at random within the bounds: with a tolerance larger than the
+    // bounds, the stored state matches any individual and is replaced by the final state of the new run.
+    uda.set_warm_start(true, 100., 2u);
+    BOOST_CHECK(uda.get_warm_start());
+    BOOST_CHECK(uda.get_extra_info().find("0/2 stored states") != std::string::npos);
+    population pop{worhp_test_problem{}, 1u, 23u};
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("1/2 stored states") != std::string::npos);
+    uda.set_persistent_session(true);
+    pop = uda.evolve(pop);
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("1/2 stored states") != std::string::npos);
+    // With a zero tolerance, the final states of new runs produce new entries, and the capacity is respected.
+    uda.set_warm_start(true, 0., 2u);
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("2/2 stored states") != std::string::npos);
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_extra_info().find("2/2 stored states") != std::string::npos);
+    // The states survive a copy and can be cleared.
+    auto uda_copy = uda;
+    BOOST_CHECK(uda_copy.get_extra_info().find("2/2 stored states") != std::string::npos);
+    uda.clear_warm_start();
+    BOOST_CHECK(uda.get_extra_info().find("0/2 stored states") != std::string::npos);
+    // Reducing the capacity drops the least recently used states.
+    uda_copy.set_warm_start(true, 0., 1u);
+    BOOST_CHECK(uda_copy.get_extra_info().find("1/1 stored states") != std::string::npos);
+    // Deactivating the warm start does not store anything.
+    uda.set_warm_start(false);
+    uda.evolve(pop);
+    uda.set_warm_start(true);
+    BOOST_CHECK(uda.get_extra_info().find("0/16 stored states") != std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(evaluation_cache)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK_EQUAL(uda.get_cache_capacity(), 8u);
+    // The bogus worhp requests, at each iteration, objective and constraints (and their gradients) at the
+    // same point: with the cache active, each point is evaluated once.
+    population pop{worhp_test_problem{}, 1u};
+    auto fevals0 = pop.get_problem().get_fevals();
+    pop = uda.evolve(pop);
+    const auto fevals_cached = pop.get_problem().get_fevals() - fevals0;
+    BOOST_CHECK(uda.get_extra_info().find("Evaluation cache capacity: 8") != std::string::npos);
+    BOOST_CHECK(uda.get_extra_info().find("fitness hits/misses: 0/") == std::string::npos);
+    BOOST_CHECK(uda.get_extra_info().find("gradient hits/misses: 0/") == std::string::npos);
+    // Disabling the cache, every request is evaluated.
+    uda.set_cache_capacity(0u);
+    BOOST_CHECK_EQUAL(uda.get_cache_capacity(), 0u);
+    fevals0 = pop.get_problem().get_fevals();
+    pop = uda.evolve(pop);
+    BOOST_CHECK(pop.get_problem().get_fevals() - fevals0 > fevals_cached);
+    BOOST_CHECK(uda.get_extra_info().find("fitness hits/misses: 0/") != std::string::npos);
+}
+
+// A thread safe UDP counting the gradients evaluated by a thread other than the one calling evolve().
+struct concurrent_udp : worhp_test_problem {
+    vector_double gradient(const vector_double &x) const
+    {
+        if (std::this_thread::get_id() != caller) {
+            ++helper_gradients;
+        }
+        return worhp_test_problem::gradient(x);
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::constant;
+    }
+    static std::thread::id caller;
+    static std::atomic<unsigned> helper_gradients;
+};
+std::thread::id concurrent_udp::caller;
+std::atomic<unsigned> concurrent_udp::helper_gradients{0u};
+
+// The same UDP, not thread safe.
+struct basic_udp : concurrent_udp {
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::basic;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_gradient)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(!uda.get_concurrent_gradient());
+    concurrent_udp::caller = std::this_thread::get_id();
+    concurrent_udp::helper_gradients = 0u;
+    population pop{concurrent_udp{}, 1u};
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(concurrent_udp::helper_gradients.load(), 0u);
+    // At each iteration, the bogus worhp requests the gradients at the point where it requested the objective:
+    // all the gradients are evaluated speculatively by the helper thread, once each (also with the cache disabled).
+    uda.set_concurrent_gradient(true);
+    BOOST_CHECK(uda.get_concurrent_gradient());
+    BOOST_CHECK(uda.get_extra_info().find("Concurrent gradient: active") != std::string::npos);
+    for (auto capacity : {0u, 8u}) {
+        uda.set_cache_capacity(capacity);
+        concurrent_udp::helper_gradients = 0u;
+        const auto gevals0 = pop.get_problem().get_gevals();
+        pop = uda.evolve(pop);
+        BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 10u);
+        BOOST_CHECK_EQUAL(concurrent_udp::helper_gradients.load(), 10u);
+    }
+    // Problems which are not thread safe are evaluated sequentially.
+    concurrent_udp::helper_gradients = 0u;
+    population pop2{basic_udp{}, 1u};
+    pop2 = uda.evolve(pop2);
+    BOOST_CHECK_EQUAL(concurrent_udp::helper_gradients.load(), 0u);
+}
+
+// The test problem, computing fitness and gradient in one pass.
+struct combined_udp : worhp_test_problem {
+    static unsigned fg_counter;
+    void fitness_and_gradient_inplace(const vector_double &x, double *f, double *g) const
+    {
+        ++fg_counter;
+        const auto fit = fitness(x);
+        const auto grad = gradient(x);
+        std::copy(fit.begin(), fit.end(), f);
+        std::copy(grad.begin(), grad.end(), g);
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::constant;
+    }
+};
+unsigned combined_udp::fg_counter = 0u;
+
+BOOST_AUTO_TEST_CASE(combined_evaluation)
+{
+    worhp uda{false, WORHP_LIB};
+    register_inplace_udp<combined_udp>();
+    population pop{combined_udp{}, 1u};
+    // At each iteration, the bogus worhp requests the objective, the constraints and their gradients at the same
+    // point: all of them are evaluated in one pass (also with the cache disabled, and in place of the concurrent
+    // evaluation), and the gradient of the problem is never called.
+    for (auto concurrent : {false, true}) {
+        uda.set_concurrent_gradient(concurrent);
+        for (auto capacity : {0u, 8u}) {
+            uda.set_cache_capacity(capacity);
+            combined_udp::fg_counter = 0u;
+            const auto fevals0 = pop.get_problem().get_fevals();
+            const auto gevals0 = pop.get_problem().get_gevals();
+            pop = uda.evolve(pop);
+            BOOST_CHECK_EQUAL(combined_udp::fg_counter, 10u);
+            BOOST_CHECK_EQUAL(pop.get_problem().get_gevals() - gevals0, 0u);
+            BOOST_CHECK(pop.get_problem().get_fevals() - fevals0 >= 10u);
+            BOOST_CHECK(uda.get_extra_info().find("gradient hits/misses: 10/10") != std::string::npos);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(batch_mode)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK_EQUAL(uda.get_batch_size(), 1u);
+    BOOST_CHECK_THROW(uda.set_batch_size(0u), std::invalid_argument);
+    uda.set_batch_size(3u);
+    BOOST_CHECK_EQUAL(uda.get_batch_size(), 3u);
+    BOOST_CHECK(uda.get_extra_info().find("Batch size: 3") != std::string::npos);
+    // The individuals starting from index 1 are optimised, the others are left untouched.
+    uda.set_selection(1u);
+    uda.set_verbosity(1u);
+    population pop{worhp_test_problem{}, 5u, 23u};
+    const auto x_before = pop.get_x();
+    pop = uda.evolve(pop);
+    BOOST_CHECK(pop.get_x()[0] == x_before[0]);
+    BOOST_CHECK(pop.get_x()[4] == x_before[4]);
+    // Only the first run is logged.
+    BOOST_CHECK(uda.get_log().size() > 0u);
+    uda.set_selection(5u);
+    BOOST_CHECK_THROW(uda.evolve(pop), std::invalid_argument);
+}
+
+// The test problem, not thread safe, recording the instances it is evaluated on.
+struct recording_udp : worhp_test_problem {
+    vector_double fitness(const vector_double &x) const
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            instances.insert(this);
+            ++n_calls;
+        }
+        return worhp_test_problem::fitness(x);
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::basic;
+    }
+    static std::mutex mutex;
+    static std::set<const recording_udp *> instances;
+    static unsigned long long n_calls;
+};
+std::mutex recording_udp::mutex;
+std::set<const recording_udp *> recording_udp::instances;
+unsigned long long recording_udp::n_calls = 0u;
+
+BOOST_AUTO_TEST_CASE(batch_problem_copies)
+{
+    worhp uda{false, WORHP_LIB};
+    const auto hw_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (auto batch_size : {2u, 8u}) {
+        uda.set_batch_size(batch_size);
+        population pop{recording_udp{}, 8u, 23u};
+        recording_udp::instances.clear();
+        recording_udp::n_calls = 0u;
+        const auto fevals0 = pop.get_problem().get_fevals();
+        pop = uda.evolve(pop);
+        // The problem is copied once per thread, the threads being at most one per instance.
+        BOOST_CHECK(recording_udp::instances.size() <= std::min(hw_threads, batch_size));
+        // The evaluations made on the copies are reported back to the problem.
+        BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, recording_udp::n_calls);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(log_counter)
+{
+    // The log lines are numbered by the fitness evaluations of the logged run only, even if the runs of the batch
+    // share the (thread safe) problem and the problem was evaluated before.
+    worhp uda{false, WORHP_LIB};
+    uda.set_batch_size(4u);
+    uda.set_verbosity(1u);
+    population pop{concurrent_udp{}, 4u, 23u};
+    pop = uda.evolve(pop);
+    const auto log = uda.get_log();
+    BOOST_CHECK(log.size() > 0u);
+    for (decltype(log.size()) i = 0u; i < log.size(); ++i) {
+        BOOST_CHECK_EQUAL(std::get<0>(log[i]), i + 1u);
+    }
+    // With verbosity n, every n-th evaluation is logged, once.
+    uda.set_batch_size(1u);
+    uda.set_verbosity(2u);
+    pop = uda.evolve(pop);
+    const auto log2 = uda.get_log();
+    BOOST_CHECK(log2.size() > 0u);
+    for (decltype(log2.size()) i = 0u; i < log2.size(); ++i) {
+        BOOST_CHECK_EQUAL(std::get<0>(log2[i]), 2u * (i + 1u));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(statistics)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(!uda.get_collect_stats());
+    population pop{worhp_test_problem{}, 1u};
+    pop = uda.evolve(pop);
+    // Not collected by default.
+    BOOST_CHECK_EQUAL(uda.get_stats().m_f_calls, 0u);
+    BOOST_CHECK(uda.get_extra_info().find("Statistics") == std::string::npos);
+    uda.set_collect_stats(true);
+    BOOST_CHECK(uda.get_collect_stats());
+    pop = uda.evolve(pop);
+    const auto &stats = uda.get_stats();
+    // The bogus worhp requests every user action at each iteration.
+    BOOST_CHECK(stats.m_f_calls > 0u);
+    BOOST_CHECK_EQUAL(stats.m_f_calls, stats.m_g_calls);
+    BOOST_CHECK_EQUAL(stats.m_f_calls, stats.m_df_calls);
+    BOOST_CHECK_EQUAL(stats.m_f_calls, stats.m_dg_calls);
+    BOOST_CHECK_EQUAL(stats.m_f_calls, stats.m_hm_calls);
+    BOOST_CHECK_EQUAL(stats.m_f_calls, stats.m_fidif_calls);
+    BOOST_CHECK(stats.m_cache_hits > 0u);
+    BOOST_CHECK(stats.m_total_time > 0.);
+    BOOST_CHECK(stats.m_total_time >= stats.m_callback_time);
+    BOOST_CHECK(stats.m_bytes_estimated > 0u);
+    BOOST_CHECK(uda.get_extra_info().find("Statistics (last evolve)") != std::string::npos);
+}
+
+// Counts the queries of its sparsity patterns.
+struct counting_sparsity_udp : worhp_test_problem {
+    sparsity_pattern gradient_sparsity() const
+    {
+        ++n_queries;
+        return worhp_test_problem::gradient_sparsity();
+    }
+    std::vector<sparsity_pattern> hessians_sparsity() const
+    {
+        ++n_queries;
+        return worhp_test_problem::hessians_sparsity();
+    }
+    static unsigned n_queries;
+};
+
+unsigned counting_sparsity_udp::n_queries = 0u;
+
+BOOST_AUTO_TEST_CASE(sparsity_preparation)
+{
+    worhp uda{false, WORHP_LIB};
+    population pop{counting_sparsity_udp{}, 1u};
+    counting_sparsity_udp::n_queries = 0u;
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(counting_sparsity_udp::n_queries, 2u);
+    // The prepared structures are reused, also by the copies of the algorithm.
+    pop = uda.evolve(pop);
+    auto uda_copy{uda};
+    pop = uda_copy.evolve(pop);
+    BOOST_CHECK_EQUAL(counting_sparsity_udp::n_queries, 2u);
+    // Other problems are prepared, and the structures of the first one are still cached.
+    BOOST_CHECK_NO_THROW(uda.evolve(population{hock_schittkowski_71{}, 1u}));
+    BOOST_CHECK_NO_THROW(uda.evolve(population{luksan_vlcek1{10}, 1u}));
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(counting_sparsity_udp::n_queries, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(parameter_file)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(uda.get_xml_params());
+    BOOST_CHECK(!uda.get_params_caching());
+    BOOST_CHECK(uda.get_params_file().empty());
+    population pop{worhp_test_problem{}, 1u};
+    // The XML lookup can be disabled.
+    uda.set_xml_params(false);
+    BOOST_CHECK(!uda.get_xml_params());
+    BOOST_CHECK(uda.get_extra_info().find("XML lookup disabled") != std::string::npos);
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    uda.set_xml_params(true);
+    // The default file is read once.
+    uda.set_params_caching(true);
+    BOOST_CHECK(uda.get_params_caching());
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    // Explicit loading.
+    BOOST_CHECK_THROW(uda.load_params("IDONOTEXIST.xml"), std::invalid_argument);
+    const std::string file = "ppnf_worhp_test_params.xml";
+    {
+        std::ofstream xml(file);
+        xml << "<WorhpData/>\n";
+    }
+    uda.set_params_caching(false);
+    uda.load_params(file);
+    BOOST_CHECK(uda.get_params_caching());
+    BOOST_CHECK_EQUAL(uda.get_params_file(), file);
+    BOOST_CHECK(uda.get_extra_info().find("(cached)") != std::string::npos);
+    // A change of the file is detected, and the persistent sessions are initialised again.
+    uda.set_persistent_session(true);
+    uda.set_collect_stats(true);
+    pop = uda.evolve(pop);
+    const auto full_bytes = uda.get_stats().m_bytes_estimated;
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_stats().m_bytes_estimated < full_bytes);
+    {
+        std::ofstream xml(file);
+        xml << "<WorhpData>\n</WorhpData>\n";
+    }
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, full_bytes);
+    std::remove(file.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(persistent_session)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(!uda.get_persistent_session());
+    uda.set_persistent_session(true);
+    BOOST_CHECK(uda.get_persistent_session());
+    BOOST_CHECK(uda.get_extra_info().find("Persistent session: active") != std::string::npos);
+    uda.set_collect_stats(true);
+    population pop{worhp_test_problem{}, 1u};
+    // The first run initialises the instance, the later ones restart it without allocating the WORHP arrays.
+    pop = uda.evolve(pop);
+    const auto full_bytes = uda.get_stats().m_bytes_estimated;
+    pop = uda.evolve(pop);
+    const auto restart_bytes = uda.get_stats().m_bytes_estimated;
+    BOOST_CHECK(restart_bytes < full_bytes);
+    BOOST_CHECK(uda.get_log().size() > 0u);
+    // Changing the options or the problem requires a full initialisation.
+    uda.set_numeric_option("TolOpti", 1e-8);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, full_bytes);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, restart_bytes);
+    BOOST_CHECK_NO_THROW(uda.evolve(population{hock_schittkowski_71{}, 1u}));
+    BOOST_CHECK(uda.get_stats().m_bytes_estimated > restart_bytes);
+    uda.reset_numeric_options();
+    // Failed runs do not leave instances behind.
+    uda.set_integer_option("invalid_integer_option", 1);
+    BOOST_CHECK_THROW(uda.evolve(pop), std::invalid_argument);
+    uda.reset_integer_options();
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, restart_bytes);
+    // Concurrent runs of a batch, each with its own instance.
+    uda.set_batch_size(3u);
+    population pop2{worhp_test_problem{}, 5u, 23u};
+    pop2 = uda.evolve(pop2);
+    pop2 = uda.evolve(pop2);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, 3u * restart_bytes);
+    // Copies and moved-to objects start cold, and then keep their own instances.
+    auto uda_copy{uda};
+    BOOST_CHECK(uda_copy.get_persistent_session());
+    uda_copy.set_batch_size(1u);
+    pop = uda_copy.evolve(pop);
+    BOOST_CHECK_EQUAL(uda_copy.get_stats().m_bytes_estimated, full_bytes);
+    pop = uda_copy.evolve(pop);
+    BOOST_CHECK_EQUAL(uda_copy.get_stats().m_bytes_estimated, restart_bytes);
+    auto uda_moved{std::move(uda_copy)};
+    pop = uda_moved.evolve(pop);
+    BOOST_CHECK_EQUAL(uda_moved.get_stats().m_bytes_estimated, full_bytes);
+    const algorithm algo{uda_moved};
+    algorithm algo_copy{algo};
+    pop = algo_copy.evolve(pop);
+    BOOST_CHECK_EQUAL(algo_copy.extract<worhp>()->get_stats().m_bytes_estimated, full_bytes);
+    pop = algo_copy.evolve(pop);
+    BOOST_CHECK_EQUAL(algo_copy.extract<worhp>()->get_stats().m_bytes_estimated, restart_bytes);
+    // The original still has its instances.
+    uda.set_batch_size(1u);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, restart_bytes);
+    uda.set_persistent_session(false);
+    uda.set_batch_size(1u);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, full_bytes);
+    pop = uda.evolve(pop);
+    BOOST_CHECK_EQUAL(uda.get_stats().m_bytes_estimated, full_bytes);
+}
+
+// A problem with configurable bounds, recording the points it is evaluated at.
+struct bounded_udp {
+    vector_double fitness(const vector_double &x) const
+    {
+        points.push_back(x);
+        return {x[0] * x[0] + x[1] * x[1]};
+    }
+    std::pair<vector_double, vector_double> get_bounds() const
+    {
+        return {m_lb, m_ub};
+    }
+    vector_double m_lb, m_ub;
+    static std::vector<vector_double> points;
+};
+std::vector<vector_double> bounded_udp::points;
+
+BOOST_AUTO_TEST_CASE(persistent_session_restart)
+{
+    // A restarted instance starts from the new starting point, within the new bounds.
+    worhp uda{false, WORHP_LIB};
+    uda.set_persistent_session(true);
+    uda.set_collect_stats(true);
+    population pop1{bounded_udp{{-1., -1.}, {1., 1.}}, 1u, 23u};
+    uda.evolve(pop1);
+    const auto full_bytes = uda.get_stats().m_bytes_estimated;
+    population pop2{bounded_udp{{2., 3.}, {4., 5.}}, 1u, 23u};
+    bounded_udp::points.clear();
+    uda.evolve(pop2);
+    BOOST_CHECK(uda.get_stats().m_bytes_estimated < full_bytes);
+    BOOST_REQUIRE(!bounded_udp::points.empty());
+    BOOST_CHECK(bounded_udp::points.front() == pop2.get_x()[0]);
+    for (const auto &x : bounded_udp::points) {
+        BOOST_CHECK(x[0] >= 2. && x[0] <= 4. && x[1] >= 3. && x[1] <= 5.);
+    }
+}
+
+// The test problem, without its gradient.
+struct no_gradient_udp : worhp_test_problem {
+    bool has_gradient() const
+    {
+        return false;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(plugin_fd_gradient)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(!uda.has_fd_gradient());
+    BOOST_CHECK_THROW(uda.set_fd_gradient(bfe{thread_bfe{}}, "backward"), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_fd_gradient(bfe{thread_bfe{}}, "central", -1e-6), std::invalid_argument);
+    uda.set_fd_gradient(bfe{thread_bfe{}}, "central");
+    BOOST_CHECK(uda.has_fd_gradient());
+    BOOST_CHECK_EQUAL(uda.get_fd_scheme(), "central");
+    BOOST_CHECK(uda.get_fd_step() > 0.);
+    BOOST_CHECK(uda.get_extra_info().find("Finite-difference gradient: central") != std::string::npos);
+    uda.set_fd_gradient(bfe{thread_bfe{}}, "forward", 1e-7);
+    BOOST_CHECK_EQUAL(uda.get_fd_step(), 1e-7);
+    // With the cache disabled, each iteration of the bogus worhp evaluates the fitness twice (F and G) and the
+    // gradient twice (DF and DG). The 4 variables of the test problem need 3 colours, so that each gradient costs
+    // 4 fitness evaluations. The final point is evaluated once.
+    uda.set_cache_capacity(0u);
+    uda.set_collect_stats(true);
+    population pop{no_gradient_udp{}, 1u};
+    const auto fevals0 = pop.get_problem().get_fevals();
+    pop = uda.evolve(pop);
+    BOOST_CHECK(uda.get_stats().m_df_calls > 0u);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_fevals() - fevals0, uda.get_stats().m_f_calls * 10u + 1u);
+    BOOST_CHECK_EQUAL(pop.get_problem().get_gevals(), 0u);
+    // Sequential evaluations.
+    uda.set_fd_gradient("central");
+    BOOST_CHECK(uda.get_extra_info().find(", sequential)") != std::string::npos);
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    // Also in batch mode and with a persistent session.
+    uda.set_cache_capacity(8u);
+    uda.set_batch_size(2u);
+    uda.set_persistent_session(true);
+    population pop2{no_gradient_udp{}, 2u};
+    for (auto i = 0; i < 2; ++i) {
+        BOOST_CHECK_NO_THROW(pop2 = uda.evolve(pop2));
+    }
+    uda.unset_fd_gradient();
+    BOOST_CHECK(!uda.has_fd_gradient());
+    BOOST_CHECK(uda.get_extra_info().find("Finite-difference gradient") == std::string::npos);
+}
+
+// A chained problem without hessians: the i-th constraint depends on the variables i and i + 1, the objective on
+// the first variable only or, if dense_obj is true, on all of them.
+struct chained_udp {
+    vector_double fitness(const vector_double &x) const
+    {
+        vector_double retval(m_n);
+        for (vector_double::size_type j = 0u; j < (m_dense_obj ? m_n : 1u); ++j) {
+            retval[0] += x[j] * x[j];
+        }
+        for (vector_double::size_type i = 0u; i + 1u < m_n; ++i) {
+            retval[i + 1u] = x[i] * x[i + 1u] - 1.;
+        }
+        return retval;
+    }
+    std::pair<vector_double, vector_double> get_bounds() const
+    {
+        return {vector_double(m_n, -2.), vector_double(m_n, 2.)};
+    }
+    vector_double::size_type get_nic() const
+    {
+        return m_n - 1u;
+    }
+    sparsity_pattern gradient_sparsity() const
+    {
+        sparsity_pattern retval;
+        for (vector_double::size_type j = 0u; j < (m_dense_obj ? m_n : 1u); ++j) {
+            retval.emplace_back(0u, j);
+        }
+        for (vector_double::size_type i = 0u; i + 1u < m_n; ++i) {
+            retval.emplace_back(i + 1u, i);
+            retval.emplace_back(i + 1u, i + 1u);
+        }
+        return retval;
+    }
+    vector_double gradient(const vector_double &x) const
+    {
+        vector_double retval;
+        for (vector_double::size_type j = 0u; j < (m_dense_obj ? m_n : 1u); ++j) {
+            retval.push_back(2. * x[j]);
+        }
+        for (vector_double::size_type i = 0u; i + 1u < m_n; ++i) {
+            retval.push_back(x[i + 1u]);
+            retval.push_back(x[i]);
+        }
+        return retval;
+    }
+    vector_double::size_type m_n = 1500u;
+    bool m_dense_obj = false;
+};
+
+BOOST_AUTO_TEST_CASE(hessian_structure)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK_EQUAL(uda.get_hessian_structure(), "auto");
+    BOOST_CHECK_THROW(uda.set_hessian_structure("sparse"), std::invalid_argument);
+    BOOST_CHECK(uda.get_extra_info().find("Hessian structure") == std::string::npos);
+    uda.set_collect_stats(true);
+    // The memory allocated by WorhpInit depends on the size of the structure of the hessian of the lagrangian.
+    auto bytes = [&uda](population &pop, const std::string &strategy) {
+        uda.set_hessian_structure(strategy);
+        pop = uda.evolve(pop);
+        return uda.get_stats().m_bytes_estimated;
+    };
+    const auto n = 1500ull;
+    population pop{chained_udp{}, 1u};
+    const auto dense = bytes(pop, "dense");
+    BOOST_CHECK(dense > n * (n + 1u) / 2u * sizeof(double));
+    BOOST_CHECK(uda.get_extra_info().find("Hessian structure: dense") != std::string::npos);
+    const auto gradient = bytes(pop, "gradient");
+    const auto diagonal = bytes(pop, "diagonal");
+    BOOST_CHECK(gradient < dense / 10u);
+    BOOST_CHECK(diagonal < gradient);
+    // The large banded problem gets the structure derived from the gradient sparsity.
+    BOOST_CHECK_EQUAL(bytes(pop, "auto"), gradient);
+    // With a dense objective, the structure derived from the gradient sparsity would be dense: the diagonal
+    // structure is chosen.
+    population pop2{chained_udp{n, true}, 1u};
+    BOOST_CHECK_EQUAL(bytes(pop2, "auto"), bytes(pop2, "diagonal"));
+    // Small problems keep the dense structure.
+    population pop3{chained_udp{10u, true}, 1u};
+    BOOST_CHECK_EQUAL(bytes(pop3, "auto"), bytes(pop3, "dense"));
+    // The structure of the problems providing the hessians is not affected.
+    population pop4{worhp_test_problem{}, 1u};
+    BOOST_CHECK_EQUAL(bytes(pop4, "diagonal"), bytes(pop4, "auto"));
+}
+
+BOOST_AUTO_TEST_CASE(hessian_structure_bfgs_method)
+{
+    worhp uda{false, WORHP_LIB};
+    uda.set_verbosity(1u);
+    population pop{chained_udp{10u}, 1u};
+    // The BFGS method used by a run is reported in the verbose header.
+    auto header = [&uda, &pop](const std::string &strategy) {
+        uda.set_hessian_structure(strategy);
+        std::ostringstream oss;
+        auto old_buf = std::cout.rdbuf(oss.rdbuf());
+        try {
+            pop = uda.evolve(pop);
+        } catch (...) {
+            std::cout.rdbuf(old_buf);
+            throw;
+        }
+        std::cout.rdbuf(old_buf);
+        return oss.str();
+    };
+    BOOST_CHECK(header("dense").find("par.BFGSmethod") == std::string::npos);
+    BOOST_CHECK(header("gradient").find("par.BFGSmethod: 2\n") != std::string::npos);
+    BOOST_CHECK(header("diagonal").find("par.BFGSmethod: 100\n") != std::string::npos);
+    // The user options take precedence.
+    uda.set_integer_option("BFGSmethod", 1);
+    const auto gradient = header("gradient");
+    BOOST_CHECK(gradient.find("par.BFGSmethod: 1\n") != std::string::npos);
+    BOOST_CHECK(gradient.find("par.BFGSmethod: 2\n") == std::string::npos);
+    const auto diagonal = header("diagonal");
+    BOOST_CHECK(diagonal.find("par.BFGSmethod: 1\n") != std::string::npos);
+    BOOST_CHECK(diagonal.find("par.BFGSmethod: 100\n") == std::string::npos);
+    // The structure of the problems providing the hessians is not affected.
+    uda.reset_integer_options();
+    population pop2{worhp_test_problem{}, 1u};
+    uda.set_hessian_structure("gradient");
+    std::ostringstream oss;
+    auto old_buf = std::cout.rdbuf(oss.rdbuf());
+    pop2 = uda.evolve(pop2);
+    std::cout.rdbuf(old_buf);
+    BOOST_CHECK(oss.str().find("par.BFGSmethod") == std::string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(log_buffer_and_file)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(uda.get_log_buffer() == std::make_pair(std::string("unbounded"), 0u));
+    BOOST_CHECK_THROW(uda.set_log_buffer("circular", 10u), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_log_buffer("decimate", 0u), std::invalid_argument);
+    BOOST_CHECK_THROW(uda.set_log_file("log.txt", "json"), std::invalid_argument);
+    population pop{worhp_test_problem{}, 1u};
+    uda.set_verbosity(1u);
+    pop = uda.evolve(pop);
+    const auto full_log = uda.get_log();
+    BOOST_CHECK(full_log.size() > 3u);
+    // The ring buffer keeps the last lines.
+    uda.set_log_buffer("ring", 3u);
+    BOOST_CHECK(uda.get_extra_info().find("Log buffer: ring (capacity 3)") != std::string::npos);
+    pop = uda.evolve(population{worhp_test_problem{}, 1u});
+    BOOST_CHECK_EQUAL(uda.get_log().size(), 3u);
+    BOOST_CHECK_EQUAL(std::get<0>(uda.get_log().back()), std::get<0>(full_log.back()));
+    // The decimated buffer keeps the first line.
+    uda.set_log_buffer("decimate", 3u);
+    pop = uda.evolve(population{worhp_test_problem{}, 1u});
+    BOOST_CHECK(uda.get_log().size() <= 3u);
+    BOOST_CHECK_EQUAL(std::get<0>(uda.get_log().front()), std::get<0>(full_log.front()));
+    // The lines are streamed to the csv file, after the header.
+    uda.set_log_buffer("unbounded");
+    const std::string file = "ppnf_worhp_test_log.csv";
+    std::remove(file.c_str());
+    uda.set_log_file(file);
+    BOOST_CHECK(uda.get_extra_info().find("Log file: " + file + " (csv)") != std::string::npos);
+    pop = uda.evolve(population{worhp_test_problem{}, 1u});
+    {
+        std::ifstream csv(file);
+        std::string line;
+        std::getline(csv, line);
+        BOOST_CHECK_EQUAL(line, "fevals,objval,violated,viol_norm,feasible,time");
+        decltype(full_log.size()) n_lines = 0u;
+        while (std::getline(csv, line)) {
+            ++n_lines;
+        }
+        BOOST_CHECK_EQUAL(n_lines, uda.get_log().size());
+    }
+    std::remove(file.c_str());
+    // The binary records have a fixed size.
+    uda.set_log_file(file, "binary");
+    BOOST_CHECK(uda.get_log_file() == std::make_pair(file, std::string("binary")));
+    pop = uda.evolve(population{worhp_test_problem{}, 1u});
+    {
+        std::ifstream bin(file, std::ios::binary | std::ios::ate);
+        BOOST_CHECK_EQUAL(static_cast<unsigned long long>(bin.tellg()), uda.get_log().size() * 41u);
+    }
+    std::remove(file.c_str());
+#if defined(__linux__)
+    // An error writing the log file does not interrupt the run, and is reported.
+    uda.set_log_file("/dev/full");
+    BOOST_CHECK_NO_THROW(pop = uda.evolve(pop));
+    BOOST_CHECK(uda.get_log().size() > 0u);
+    BOOST_CHECK(uda.get_extra_info().find("Log error (last evolve): Could not write to the log file /dev/full")
+                != std::string::npos);
+#endif
+}
+
+// A batch fitness evaluator with no thread safety guarantee (as the Python ones).
+struct unsafe_bfe {
+    vector_double operator()(problem &p, const vector_double &dvs) const
+    {
+        return bfe{}(p, dvs);
+    }
+    thread_safety get_thread_safety() const
+    {
+        return thread_safety::none;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(concurrent_evolve)
+{
+    worhp uda{false, WORHP_LIB};
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::constant);
+    // A log file is not shared safely by concurrent evolves.
+    uda.set_log_file("worhp_concurrent.log");
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::basic);
+    uda.set_log_file("");
+    // A batch evaluator with no thread safety guarantee makes the algorithm not thread safe.
+    uda.set_fd_gradient(bfe{unsafe_bfe{}});
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::none);
+    uda.unset_fd_gradient();
+    BOOST_CHECK(uda.get_thread_safety() == thread_safety::constant);
+    uda.set_verbosity(1u);
+    uda.set_collect_stats(true);
+    uda.set_params_caching(true);
+    uda.set_persistent_session(true);
+    uda.set_selection("random");
+    uda.set_replacement("random");
+    // A single instance is evolved from several threads, which also read its results: each thread must see
+    // the results of a complete evolve.
+    std::atomic<unsigned> failures(0u);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0u; i < 8u; ++i) {
+        threads.emplace_back([&uda, &failures, i]() {
+            try {
+                for (unsigned j = 0u; j < 5u; ++j) {
+                    population pop{worhp_test_problem{}, 5u, 10u * i + j};
+                    pop = uda.evolve(pop);
+                    const auto log = uda.get_log_columns();
+                    if (log->empty() || uda.get_stats().m_f_calls == 0u
+                        || uda.get_last_opt_result().find("All went great") == std::string::npos) {
+                        ++failures;
+                    }
+                }
+            } catch (...) {
+                ++failures;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    BOOST_CHECK_EQUAL(failures.load(), 0u);
+    // The same holds in batch mode, and for copies made while the original is evolved.
+    uda.set_batch_size(3u);
+    threads.clear();
+    for (unsigned i = 0u; i < 4u; ++i) {
+        threads.emplace_back([&uda, &failures, i]() {
+            try {
+                auto uda_copy = uda;
+                population pop{worhp_test_problem{}, 5u, i};
+                pop = uda.evolve(pop);
+                pop = uda_copy.evolve(pop);
+            } catch (...) {
+                ++failures;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    BOOST_CHECK_EQUAL(failures.load(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(concurrent_output)
+{
+    // Instances with different output settings are evolved concurrently: the messages printed by WORHP are routed
+    // per run, and the log of each run only holds its own lines.
+    std::vector<worhp> udas{worhp{true, WORHP_LIB}, worhp{false, WORHP_LIB}, worhp{false, WORHP_LIB},
+                            worhp{false, WORHP_LIB}};
+    udas[2].set_verbosity(1u);
+    udas[3].set_verbosity(3u);
+    for (auto &uda : udas) {
+        BOOST_CHECK(uda.get_thread_safety() == thread_safety::constant);
+    }
+    std::atomic<unsigned> failures(0u);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0u; i < 8u; ++i) {
+        threads.emplace_back([&udas, &failures, i]() {
+            const auto &uda = udas[i % 4u];
+            try {
+                for (unsigned j = 0u; j < 5u; ++j) {
+                    population pop{worhp_test_problem{}, 1u, 10u * i + j};
+                    pop = uda.evolve(pop);
+                    const auto log = uda.get_log();
+                    const auto verb = uda.get_verbosity();
+                    if (verb == 0u) {
+                        failures += !log.empty();
+                    } else {
+                        failures += log.empty();
+                        for (decltype(log.size()) k = 0u; k < log.size(); ++k) {
+                            failures += std::get<0>(log[k]) != verb * (k + 1u);
+                        }
+                    }
+                }
+            } catch (...) {
+                ++failures;
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    BOOST_CHECK_EQUAL(failures.load(), 0u);
+}
+
 BOOST_AUTO_TEST_CASE(serialization_test)
 {
     // Make one evolution
@@ -235,6 +1095,11 @@ BOOST_AUTO_TEST_CASE(serialization_test)
     algo.extract<worhp>()->set_integer_option("some_int", 4);
     algo.extract<worhp>()->set_numeric_option("some_float", 2.2);
     algo.extract<worhp>()->set_bool_option("some_bool", false);
+    algo.extract<worhp>()->set_collect_stats(true);
+    algo.extract<worhp>()->set_fd_gradient(bfe{thread_bfe{}});
+    algo.extract<worhp>()->set_log_buffer("decimate", 20u);
+    algo.extract<worhp>()->set_warm_start(true, 0., 4u);
+    algo.extract<worhp>()->set_concurrent_gradient(true);
     pop = algo.evolve(pop);
 
     // Store the string representation of p.
@@ -254,4 +1119,54 @@ BOOST_AUTO_TEST_CASE(serialization_test)
     }
     auto after_text = boost::lexical_cast<std::string>(algo);
     BOOST_CHECK_EQUAL(before_text, after_text);
-}
\ No newline at end of file
+    // The log is serialized together with the other results of the last evolve.
+    BOOST_CHECK(before_log == algo.extract<worhp>()->get_log());
+}
+// The layout of the archives of worhp before the class version 1.
+struct legacy_worhp : not_population_based {
+    template <typename Archive>
+    void serialize(Archive &ar, unsigned)
+    {
+        pagmo::detail::archive(ar, boost::serialization::base_object<not_population_based>(*this), m_library,
+                               m_last_opt_res, m_integer_opts, m_numeric_opts, m_bool_opts, m_screen_output,
+                               m_verbosity, m_f_cache, m_g_cache);
+    }
+    template <typename Archive>
+    void load(Archive &ar) = delete;
+    template <typename Archive>
+    void save(Archive &ar) const = delete;
+    std::string m_library = WORHP_LIB;
+    std::string m_last_opt_res = "All went great!!!! What a glamorous Success!!\n";
+    std::map<std::string, int> m_integer_opts{{"MaxIter", 20}};
+    std::map<std::string, double> m_numeric_opts{{"TolFeas", 1e-5}};
+    std::map<std::string, bool> m_bool_opts{{"UserHMstructure", true}};
+    bool m_screen_output = false;
+    unsigned m_verbosity = 2u;
+    std::pair<vector_double, vector_double> m_f_cache{{1., 2.}, {3.}};
+    std::pair<vector_double, vector_double> m_g_cache{{1., 2.}, {4., 5.}};
+};
+
+BOOST_AUTO_TEST_CASE(legacy_serialization)
+{
+    // The archives written before the class version 1 can still be loaded.
+    const legacy_worhp legacy;
+    std::stringstream ss;
+    {
+        boost::archive::binary_oarchive oarchive(ss);
+        oarchive << legacy;
+    }
+    worhp uda;
+    {
+        boost::archive::binary_iarchive iarchive(ss);
+        iarchive >> uda;
+    }
+    BOOST_CHECK_EQUAL(uda.get_last_opt_result(), legacy.m_last_opt_res);
+    BOOST_CHECK_EQUAL(uda.get_verbosity(), 2u);
+    BOOST_CHECK(uda.get_integer_options() == legacy.m_integer_opts);
+    BOOST_CHECK(uda.get_numeric_options() == legacy.m_numeric_opts);
+    BOOST_CHECK(uda.get_bool_options() == legacy.m_bool_opts);
+    BOOST_CHECK(uda.get_log().empty());
+    // The settings the archive does not contain keep their default values.
+    BOOST_CHECK_EQUAL(uda.get_cache_capacity(), 8u);
+    BOOST_CHECK_EQUAL(uda.get_batch_size(), 1u);
+}